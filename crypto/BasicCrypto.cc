@@ -7,6 +7,7 @@
 #include <climits>
 
 #include <crypto/BasicCrypto.hh>
+#include <crypto/aesni.hh>
 #include <util/ctr.hh>
 #include <util/util.hh>
 #include <util/cryptdb_log.hh>
@@ -122,17 +123,6 @@ get_AES_dec_key(const string &key)
 }
 
 
-template<typename SIZE_T>
-static SIZE_T
-getBlocks(unsigned int unit, SIZE_T len) {
-    SIZE_T blocks = len / unit;
-    if (len > blocks * unit) {
-        blocks++;
-    }
-    return blocks;
-}
-
-
 vector<unsigned char>
 getXorVector(size_t len, const AES_KEY * key, uint64_t salt)
 {
@@ -178,85 +168,62 @@ decrypt_AES(const string &ctext, const AES_KEY * key, uint64_t salt)
     return ss.str();
 }
 
-static vector<unsigned char>
-getIVec(string salt)
+static void
+getIVec(const string &salt, uint8_t *const ivec)
 {
-    vector<unsigned char> ivec(AES_BLOCK_BYTES);
-
-    memcpy(&ivec[0], salt.data(), min(salt.length(), (size_t) AES_BLOCK_BYTES));
-
-    return ivec;
+    memset(ivec, 0, AES_BLOCK_BYTES);
+    memcpy(ivec, salt.data(), min(salt.length(), (size_t) AES_BLOCK_BYTES));
 }
 
-static vector<unsigned char>
-pad(vector<unsigned char> data, unsigned int unit)
+// copies ptext into out, padded (if requested) to a whole number of
+// blocks; the last byte of the padding holds the padding length
+static void
+padInto(const string &ptext, bool dopad, string *const out)
 {
-    // pad does not work for padding unit more than 256 bytes
-    throw_c(unit < 256);
-
-    size_t blocks = getBlocks(unit, data.size());
-    size_t multipleLen = blocks * unit;
-    size_t padding;
-    if (multipleLen == data.size()) {
-        padding = unit;
-    } else {
-        padding = multipleLen - data.size();
-    }
-    throw_c(padding > 0 && padding <= AES_BLOCK_BYTES);
-    size_t paddedLen = data.size() + padding;
-    throw_c((paddedLen > 0) && ((paddedLen % AES_BLOCK_BYTES) == 0));
+    unsigned long paddedLen;
+    throw_c(rounded_len(ptext.size(), AES_BLOCK_BYTES, dopad, &paddedLen));
+    throw_c(dopad || paddedLen == ptext.size());
 
-    // cerr << "length of padding " << padding << " length of padded data " << paddedLen << "\n";
-
-    vector<unsigned char> res(paddedLen, 0);
-    res[paddedLen-1] = (unsigned char)padding;
-    memcpy(&res[0], &data[0], data.size());
-    return res;
+    out->assign(paddedLen, 0);
+    memcpy(&(*out)[0], ptext.data(), ptext.size());
+    if (dopad) {
+        (*out)[paddedLen-1] = (char) (paddedLen - ptext.size());
+    }
 }
 
-static vector<unsigned char>
-unpad(vector<unsigned char> data)
+static void
+unpadInPlace(string *const data)
 {
-    const size_t len = data.size();
+    const size_t len = data->size();
     throw_c((len > 0) && ((len % AES_BLOCK_BYTES) == 0));
-    const size_t pad_count = static_cast<int>(data[len-1]);
-    //cerr << "padding to remove " << (int)data[len-1] << "\n";
-    const size_t actualLen = len - pad_count;
-    //cerr << " len is " << len << " and data[len-1] " << (int)data[len-1] << "\n";
+    const size_t pad_count = static_cast<unsigned char>((*data)[len-1]);
     // Padding will never be larger than a block.
     if (false == ((pad_count > 0) && (pad_count <= AES_BLOCK_BYTES))) {
         throw CryptoError("AES padding is wrong size!");
     }
-    // Tells us when we have a bad length.
-    throw_c(pad_count <= len);
-    vector<unsigned char> res(actualLen);
-    memcpy(&res[0], &data[0], actualLen);
-    return res;
+    data->resize(len - pad_count);
 }
 
+static uint8_t *
+bufOf(string &s)
+{
+    return (uint8_t *) &s[0];
+}
 
 string
 encrypt_AES_CBC(const string &ptext, const AES_KEY * enckey, string salt, bool dopad)
 {
     //TODO: separately for numbers to avoid need for padding
 
-    throw_c(dopad || ((ptext.size() % AES_BLOCK_BYTES) == 0));
+    string ctext;
+    padInto(ptext, dopad, &ctext);
 
-    vector<unsigned char> ptext_buf;
-    if (dopad) {
-        ptext_buf = pad(vector<unsigned char>(ptext.begin(), ptext.end()), AES_BLOCK_BYTES);
-        // cerr << "padded data is " << stringToByteInts(string((char *) &ptext_buf[0], ptext_buf.size())) << "\n";
-    } else {
-        ptext_buf = vector<unsigned char>(ptext.begin(), ptext.end());
-    }
-    auto ctext_buf = vector<unsigned char>(ptext_buf.size());
-    auto ivec = getIVec(salt);
-
-    AES_cbc_encrypt(&ptext_buf[0], &ctext_buf[0], ptext_buf.size(), enckey, &ivec[0], AES_ENCRYPT);
-
-    // cerr << "encrypted data is " << stringToByteInts(string((char *) &ctext_buf[0], ctext_buf.size())) << '\n';
+    uint8_t ivec[AES_BLOCK_BYTES];
+    getIVec(salt, ivec);
+    aes_cbc_encrypt_blocks(bufOf(ctext), bufOf(ctext), ctext.size(), enckey,
+                           ivec);
 
-    return string((char *) &ctext_buf[0], ctext_buf.size());
+    return ctext;
 }
 
 string
@@ -264,60 +231,111 @@ decrypt_AES_CBC(const string &ctext, const AES_KEY * deckey, string salt, bool d
 {
     throw_c((ctext.size() > 0) && ((ctext.size() % AES_BLOCK_BYTES) == 0));
 
-    vector<unsigned char> ptext_buf(ctext.size());
-    auto ivec = getIVec(salt);
-
-    AES_cbc_encrypt((const unsigned char *) ctext.data(), &ptext_buf[0], ctext.size(), deckey, &ivec[0], AES_DECRYPT);
-
+    string ptext(ctext);
+    uint8_t ivec[AES_BLOCK_BYTES];
+    getIVec(salt, ivec);
+    aes_cbc_decrypt_blocks(bufOf(ptext), bufOf(ptext), ptext.size(), deckey,
+                           ivec);
 
     if (dounpad) {
-        auto res = unpad(ptext_buf);
-        // cerr << "unpadded dec data is " << stringToByteInts(string((char * ) &res[0], res.size())) << "\n";
-        return string((char *)&res[0], res.size());
-    } else {
-        return string((char *)&ptext_buf[0], ptext_buf.size());
+        unpadInPlace(&ptext);
     }
+    return ptext;
 }
 
-//TODO: have some helpers that only manipulate unsigned char * and convert in string at the end
-
-static string
-reverse(const string & vec)
+/*
+ * CTR mode for RND without padding: the ciphertext is exactly as long as
+ * the plaintext.  The salt fills the high half of the counter block and
+ * the block index the low half, so rows never share keystream.
+ */
+string
+encrypt_AES_CTR(const string &ptext, const AES_KEY * enckey, string salt)
 {
-    size_t len = vec.length();
-    size_t noBlocks = len /AES_BLOCK_BYTES;
-
-    throw_c(len == noBlocks * AES_BLOCK_BYTES);
-    string rev;
-    rev.resize(len);
+    throw_c(salt.size() <= AES_BLOCK_BYTES / 2);
 
-    for (unsigned int i = 0; i < noBlocks; i++) {
-        memcpy(&rev[i * AES_BLOCK_BYTES],
-               &vec[(noBlocks-i-1)*AES_BLOCK_BYTES], AES_BLOCK_BYTES);
+    string ctext(ptext);
+    if (ctext.empty()) {
+        return ctext;
     }
 
-    return rev;
+    uint8_t ivec[AES_BLOCK_BYTES];
+    getIVec(salt, ivec);
+    aes_ctr_xor(bufOf(ctext), bufOf(ctext), ctext.size(), enckey, ivec);
+
+    return ctext;
+}
+
+string
+decrypt_AES_CTR(const string &ctext, const AES_KEY * enckey, string salt)
+{
+    return encrypt_AES_CTR(ctext, enckey, salt);
+}
+
+static void
+reverseBlocks(string *const vec)
+{
+    const size_t noBlocks = vec->size() / AES_BLOCK_BYTES;
+    throw_c(vec->size() == noBlocks * AES_BLOCK_BYTES);
+
+    uint8_t *const buf = bufOf(*vec);
+    uint8_t tmp[AES_BLOCK_BYTES];
+    for (size_t i = 0; i < noBlocks / 2; i++) {
+        uint8_t *const lo = buf + i * AES_BLOCK_BYTES;
+        uint8_t *const hi = buf + (noBlocks-i-1) * AES_BLOCK_BYTES;
+        memcpy(tmp, lo, AES_BLOCK_BYTES);
+        memcpy(lo, hi, AES_BLOCK_BYTES);
+        memcpy(hi, tmp, AES_BLOCK_BYTES);
+    }
 }
 
+/*
+ * CMC is CBC, reverse the blocks, CBC again (both with the IV "0").  Both
+ * passes run in place over the output string; on the decrypt side they are
+ * CBC decryptions, so aes_cbc_decrypt_blocks keeps several blocks in flight.
+ */
+
 //DID WE DECIDE ON ONE OR TWO KEYS?!
 string
 encrypt_AES_CMC(const string &ptext, const AES_KEY * enckey, bool dopad)
 {
-    string firstenc = encrypt_AES_CBC(ptext, enckey, "0", dopad);
+    string ctext;
+    padInto(ptext, dopad, &ctext);
+
+    uint8_t ivec[AES_BLOCK_BYTES];
+    getIVec("0", ivec);
+    aes_cbc_encrypt_blocks(bufOf(ctext), bufOf(ctext), ctext.size(), enckey,
+                           ivec);
 
-    string rev = reverse(firstenc);
+    reverseBlocks(&ctext);
 
-    return encrypt_AES_CBC(rev, enckey, "0", false);
+    getIVec("0", ivec);
+    aes_cbc_encrypt_blocks(bufOf(ctext), bufOf(ctext), ctext.size(), enckey,
+                           ivec);
+
+    return ctext;
 }
 
 string
 decrypt_AES_CMC(const string &ctext, const AES_KEY * deckey, bool dopad)
 {
-    string firstdec = decrypt_AES_CBC(ctext, deckey, "0", false);
+    throw_c((ctext.size() > 0) && ((ctext.size() % AES_BLOCK_BYTES) == 0));
+
+    string ptext(ctext);
+    uint8_t ivec[AES_BLOCK_BYTES];
+    getIVec("0", ivec);
+    aes_cbc_decrypt_blocks(bufOf(ptext), bufOf(ptext), ptext.size(), deckey,
+                           ivec);
 
-    string reversed = reverse(firstdec);
+    reverseBlocks(&ptext);
 
-    return decrypt_AES_CBC(reversed, deckey, "0", dopad);
+    getIVec("0", ivec);
+    aes_cbc_decrypt_blocks(bufOf(ptext), bufOf(ptext), ptext.size(), deckey,
+                           ivec);
+
+    if (dopad) {
+        unpadInPlace(&ptext);
+    }
+    return ptext;
 }
 
 
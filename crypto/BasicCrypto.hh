@@ -56,6 +56,13 @@ encrypt_AES_CBC(const std::string &ptext, const AES_KEY * enckey, std::string sa
 std::string
 decrypt_AES_CBC(const std::string &ctext, const AES_KEY * deckey, std::string salt, bool pad = true);
 
+// both take the encryption key; the output is as long as the input
+std::string
+encrypt_AES_CTR(const std::string &ptext, const AES_KEY * enckey, std::string salt);
+
+std::string
+decrypt_AES_CTR(const std::string &ctext, const AES_KEY * enckey, std::string salt);
+
 //only works for padding unit < 255 bytes
 //std::vector<unsigned char> pad(std::vector<unsigned char> data, unsigned int unit);
 //std::vector<unsigned char> unpad(std::vector<unsigned char> data);
@@ -0,0 +1,287 @@
+#include <string.h>
+
+#include <crypto/aesni.hh>
+#include <util/errstream.hh>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+#define AESNI_SUPPORTED 1
+#define AESNI_TARGET __attribute__((target("aes,ssse3")))
+#endif
+
+/*
+ * OpenSSL's decryption schedule is the "equivalent inverse cipher" one
+ * (reversed, InvMixColumns applied), which is exactly what aesdec expects.
+ * How the round keys are stored depends on how OpenSSL was built: the C
+ * code keeps host-order words built from big-endian bytes, the x86_64
+ * assembly keeps plain bytes.  hw_self_test() figures out which one we
+ * have by comparing against AES_cbc_encrypt.
+ */
+
+#ifdef AESNI_SUPPORTED
+
+static bool schedule_bswap = false;
+
+static inline AESNI_TARGET void
+load_schedule(const AES_KEY *key, __m128i *rk)
+{
+    const __m128i shuf = schedule_bswap
+        ? _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3)
+        : _mm_set_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    for (int i = 0; i <= key->rounds; i++) {
+        rk[i] = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *) &key->rd_key[4*i]), shuf);
+    }
+}
+
+static AESNI_TARGET void
+hw_cbc_encrypt(const uint8_t *in, uint8_t *out, size_t len,
+               const AES_KEY *key, uint8_t *ivec)
+{
+    __m128i rk[AES_MAXNR + 1];
+    load_schedule(key, rk);
+    const int nr = key->rounds;
+
+    // CBC encryption is inherently serial; only the rounds are faster
+    __m128i fb = _mm_loadu_si128((const __m128i *) ivec);
+    for (size_t off = 0; off < len; off += AES_BLOCK_SIZE) {
+        __m128i b = _mm_loadu_si128((const __m128i *) (in + off));
+        b = _mm_xor_si128(_mm_xor_si128(b, fb), rk[0]);
+        for (int r = 1; r < nr; r++)
+            b = _mm_aesenc_si128(b, rk[r]);
+        fb = _mm_aesenclast_si128(b, rk[nr]);
+        _mm_storeu_si128((__m128i *) (out + off), fb);
+    }
+    _mm_storeu_si128((__m128i *) ivec, fb);
+}
+
+// decrypt N independent blocks at once so the aesdec latencies overlap
+template<size_t N>
+static inline AESNI_TARGET void
+hw_cbc_decrypt_n(const uint8_t *in, uint8_t *out, const __m128i *rk,
+                 int nr, __m128i *prev)
+{
+    __m128i c[N], b[N];
+    for (size_t j = 0; j < N; j++) {
+        c[j] = _mm_loadu_si128((const __m128i *) (in + j*AES_BLOCK_SIZE));
+        b[j] = _mm_xor_si128(c[j], rk[0]);
+    }
+    for (int r = 1; r < nr; r++)
+        for (size_t j = 0; j < N; j++)
+            b[j] = _mm_aesdec_si128(b[j], rk[r]);
+    for (size_t j = 0; j < N; j++)
+        b[j] = _mm_aesdeclast_si128(b[j], rk[nr]);
+
+    // all of the ciphertext is in registers, so in == out is fine
+    _mm_storeu_si128((__m128i *) out, _mm_xor_si128(b[0], *prev));
+    for (size_t j = 1; j < N; j++)
+        _mm_storeu_si128((__m128i *) (out + j*AES_BLOCK_SIZE),
+                         _mm_xor_si128(b[j], c[j-1]));
+    *prev = c[N-1];
+}
+
+static AESNI_TARGET void
+hw_cbc_decrypt(const uint8_t *in, uint8_t *out, size_t len,
+               const AES_KEY *key, uint8_t *ivec)
+{
+    __m128i rk[AES_MAXNR + 1];
+    load_schedule(key, rk);
+    const int nr = key->rounds;
+
+    __m128i prev = _mm_loadu_si128((const __m128i *) ivec);
+    size_t off = 0;
+    for (; off + 8*AES_BLOCK_SIZE <= len; off += 8*AES_BLOCK_SIZE)
+        hw_cbc_decrypt_n<8>(in + off, out + off, rk, nr, &prev);
+    for (; off + 4*AES_BLOCK_SIZE <= len; off += 4*AES_BLOCK_SIZE)
+        hw_cbc_decrypt_n<4>(in + off, out + off, rk, nr, &prev);
+    for (; off < len; off += AES_BLOCK_SIZE)
+        hw_cbc_decrypt_n<1>(in + off, out + off, rk, nr, &prev);
+    _mm_storeu_si128((__m128i *) ivec, prev);
+}
+
+static bool
+hw_matches_openssl()
+{
+    static const uint8_t key[16] = {
+        0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+        0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+    uint8_t ptext[2*AES_BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(ptext); i++)
+        ptext[i] = (uint8_t) (i * 37 + 11);
+
+    AES_KEY enc, dec;
+    AES_set_encrypt_key(key, 128, &enc);
+    AES_set_decrypt_key(key, 128, &dec);
+
+    uint8_t sw[sizeof(ptext)], hw[sizeof(ptext)];
+    uint8_t sw_iv[AES_BLOCK_SIZE] = {0}, hw_iv[AES_BLOCK_SIZE] = {0};
+    AES_cbc_encrypt(ptext, sw, sizeof(ptext), &enc, sw_iv, AES_ENCRYPT);
+    hw_cbc_encrypt(ptext, hw, sizeof(ptext), &enc, hw_iv);
+    if (memcmp(sw, hw, sizeof(sw)) || memcmp(sw_iv, hw_iv, sizeof(sw_iv)))
+        return false;
+
+    memset(hw_iv, 0, sizeof(hw_iv));
+    hw_cbc_decrypt(sw, hw, sizeof(sw), &dec, hw_iv);
+    return 0 == memcmp(ptext, hw, sizeof(ptext));
+}
+
+static bool
+hw_self_test()
+{
+    if (!__builtin_cpu_supports("aes") || !__builtin_cpu_supports("ssse3"))
+        return false;
+
+    for (bool bswap : {false, true}) {
+        schedule_bswap = bswap;
+        if (hw_matches_openssl())
+            return true;
+    }
+    return false;
+}
+
+#endif /* AESNI_SUPPORTED */
+
+// counter blocks are ivec with its low 64 bits, big-endian, incremented
+static inline void
+ctr_block(const uint8_t *ivec, uint64_t i, uint8_t *block)
+{
+    memcpy(block, ivec, AES_BLOCK_SIZE);
+    uint64_t lo = 0;
+    for (int j = 8; j < AES_BLOCK_SIZE; j++)
+        lo = (lo << 8) | block[j];
+    lo += i;
+    for (int j = AES_BLOCK_SIZE - 1; j >= 8; j--, lo >>= 8)
+        block[j] = (uint8_t) lo;
+}
+
+#ifdef AESNI_SUPPORTED
+
+template<size_t N>
+static inline AESNI_TARGET void
+hw_ctr_xor_n(const uint8_t *in, uint8_t *out, size_t len, const __m128i *rk,
+             int nr, const uint8_t *ivec, uint64_t first)
+{
+    __m128i b[N];
+    for (size_t j = 0; j < N; j++) {
+        uint8_t block[AES_BLOCK_SIZE];
+        ctr_block(ivec, first + j, block);
+        b[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *) block),
+                             rk[0]);
+    }
+    for (int r = 1; r < nr; r++)
+        for (size_t j = 0; j < N; j++)
+            b[j] = _mm_aesenc_si128(b[j], rk[r]);
+    for (size_t j = 0; j < N; j++)
+        b[j] = _mm_aesenclast_si128(b[j], rk[nr]);
+
+    for (size_t j = 0; j < N; j++) {
+        const size_t off = j * AES_BLOCK_SIZE;
+        if (off + AES_BLOCK_SIZE <= len) {
+            const __m128i x =
+                _mm_loadu_si128((const __m128i *) (in + off));
+            _mm_storeu_si128((__m128i *) (out + off), _mm_xor_si128(x, b[j]));
+        } else {
+            uint8_t ks[AES_BLOCK_SIZE];
+            _mm_storeu_si128((__m128i *) ks, b[j]);
+            for (size_t k = off; k < len; k++)
+                out[k] = in[k] ^ ks[k - off];
+        }
+    }
+}
+
+static AESNI_TARGET void
+hw_ctr_xor(const uint8_t *in, uint8_t *out, size_t len, const AES_KEY *key,
+           const uint8_t *ivec)
+{
+    __m128i rk[AES_MAXNR + 1];
+    load_schedule(key, rk);
+    const int nr = key->rounds;
+
+    size_t off = 0;
+    uint64_t i = 0;
+    for (; off + 4*AES_BLOCK_SIZE <= len; off += 4*AES_BLOCK_SIZE, i += 4)
+        hw_ctr_xor_n<4>(in + off, out + off, 4*AES_BLOCK_SIZE, rk, nr,
+                        ivec, i);
+    for (; off < len; off += AES_BLOCK_SIZE, i++)
+        hw_ctr_xor_n<1>(in + off, out + off, len - off, rk, nr, ivec, i);
+}
+
+#endif /* AESNI_SUPPORTED */
+
+bool
+aes_hw_available()
+{
+#ifdef AESNI_SUPPORTED
+    static const bool available = hw_self_test();
+    return available;
+#else
+    return false;
+#endif
+}
+
+static bool &
+hw_flag()
+{
+    static bool on = aes_hw_available();
+    return on;
+}
+
+bool
+aes_hw_enabled()
+{
+    return hw_flag();
+}
+
+void
+aes_hw_enable(bool on)
+{
+    hw_flag() = on && aes_hw_available();
+}
+
+void
+aes_cbc_encrypt_blocks(const uint8_t *in, uint8_t *out, size_t len,
+                       const AES_KEY *enckey, uint8_t *ivec)
+{
+    throw_c(len % AES_BLOCK_SIZE == 0);
+#ifdef AESNI_SUPPORTED
+    if (hw_flag()) {
+        hw_cbc_encrypt(in, out, len, enckey, ivec);
+        return;
+    }
+#endif
+    AES_cbc_encrypt(in, out, len, enckey, ivec, AES_ENCRYPT);
+}
+
+void
+aes_cbc_decrypt_blocks(const uint8_t *in, uint8_t *out, size_t len,
+                       const AES_KEY *deckey, uint8_t *ivec)
+{
+    throw_c(len % AES_BLOCK_SIZE == 0);
+#ifdef AESNI_SUPPORTED
+    if (hw_flag()) {
+        hw_cbc_decrypt(in, out, len, deckey, ivec);
+        return;
+    }
+#endif
+    AES_cbc_encrypt(in, out, len, deckey, ivec, AES_DECRYPT);
+}
+
+void
+aes_ctr_xor(const uint8_t *in, uint8_t *out, size_t len,
+            const AES_KEY *enckey, const uint8_t *ivec)
+{
+#ifdef AESNI_SUPPORTED
+    if (hw_flag()) {
+        hw_ctr_xor(in, out, len, enckey, ivec);
+        return;
+    }
+#endif
+    uint8_t block[AES_BLOCK_SIZE], ks[AES_BLOCK_SIZE];
+    for (size_t off = 0; off < len; off += AES_BLOCK_SIZE) {
+        ctr_block(ivec, off / AES_BLOCK_SIZE, block);
+        AES_encrypt(block, ks, enckey);
+        for (size_t k = off; k < len && k < off + AES_BLOCK_SIZE; k++)
+            out[k] = in[k] ^ ks[k - off];
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+/*
+ * aesni.hh
+ *
+ *  Multi-block AES-CBC and AES-CTR over caller-owned buffers.  When the CPU has the
+ *  AES-NI instructions the blocks go through the hardware rounds (and CBC
+ *  decryption keeps several blocks in flight); otherwise we fall back to
+ *  OpenSSL's AES_cbc_encrypt.  Both paths use the same AES_KEY schedules
+ *  (from get_AES_enc_key/get_AES_dec_key), so the output is identical.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/aes.h>
+
+// true if the CPU supports AES-NI and it agrees with OpenSSL's key layout
+bool aes_hw_available();
+
+// whether the kernels below currently use the hardware path; disabling
+// it is only meant for benchmarks and for checking the two paths agree
+bool aes_hw_enabled();
+void aes_hw_enable(bool on);
+
+/*
+ * len must be a multiple of AES_BLOCK_SIZE; in and out may alias.  ivec
+ * is updated to the last ciphertext block, as AES_cbc_encrypt does.
+ */
+void aes_cbc_encrypt_blocks(const uint8_t *in, uint8_t *out, size_t len,
+                            const AES_KEY *enckey, uint8_t *ivec);
+void aes_cbc_decrypt_blocks(const uint8_t *in, uint8_t *out, size_t len,
+                            const AES_KEY *deckey, uint8_t *ivec);
+
+/*
+ * XORs len bytes (any length) with the AES-CTR keystream; the counter
+ * blocks are ivec with its low 64 bits, read big-endian, incremented by
+ * the block index.  The same call encrypts and decrypts.
+ */
+void aes_ctr_xor(const uint8_t *in, uint8_t *out, size_t len,
+                 const AES_KEY *enckey, const uint8_t *ivec);
@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include <crypto/blowfish.hh>
+
+/*
+ * Same rounds as OpenSSL's BF_encrypt/BF_decrypt, working straight off the
+ * BF_KEY tables.  Blocks are read and written big-endian, like
+ * BF_ecb_encrypt does, so the output matches block_encrypt/block_decrypt.
+ */
+
+static inline void
+load_block(uint64_t v, uint32_t *const l, uint32_t *const r)
+{
+    uint8_t b[8];
+    memcpy(b, &v, sizeof(b));
+    *l = (uint32_t) b[0] << 24 | (uint32_t) b[1] << 16 |
+         (uint32_t) b[2] << 8 | b[3];
+    *r = (uint32_t) b[4] << 24 | (uint32_t) b[5] << 16 |
+         (uint32_t) b[6] << 8 | b[7];
+}
+
+static inline uint64_t
+store_block(uint32_t l, uint32_t r)
+{
+    const uint8_t b[8] = {
+        (uint8_t) (l >> 24), (uint8_t) (l >> 16), (uint8_t) (l >> 8),
+        (uint8_t) l,
+        (uint8_t) (r >> 24), (uint8_t) (r >> 16), (uint8_t) (r >> 8),
+        (uint8_t) r };
+    uint64_t v;
+    memcpy(&v, b, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+bf_f(const BF_LONG *const S, uint32_t x)
+{
+    return ((S[x >> 24] + S[0x100 + ((x >> 16) & 0xff)])
+            ^ S[0x200 + ((x >> 8) & 0xff)]) + S[0x300 + (x & 0xff)];
+}
+
+template<size_t N>
+static inline void
+encrypt_n(const BF_KEY &k, const uint64_t *in, uint64_t *out,
+          const uint64_t *iv)
+{
+    const BF_LONG *const P = k.P;
+    const BF_LONG *const S = k.S;
+
+    uint32_t l[N], r[N];
+    for (size_t j = 0; j < N; j++) {
+        load_block(iv ? in[j] ^ iv[j] : in[j], &l[j], &r[j]);
+        l[j] ^= P[0];
+    }
+    for (int i = 1; i <= BF_ROUNDS; i += 2) {
+        for (size_t j = 0; j < N; j++)
+            r[j] ^= P[i] ^ bf_f(S, l[j]);
+        for (size_t j = 0; j < N; j++)
+            l[j] ^= P[i+1] ^ bf_f(S, r[j]);
+    }
+    for (size_t j = 0; j < N; j++)
+        out[j] = store_block(r[j] ^ P[BF_ROUNDS+1], l[j]);
+}
+
+template<size_t N>
+static inline void
+decrypt_n(const BF_KEY &k, const uint64_t *in, uint64_t *out,
+          const uint64_t *iv)
+{
+    const BF_LONG *const P = k.P;
+    const BF_LONG *const S = k.S;
+
+    uint32_t l[N], r[N];
+    for (size_t j = 0; j < N; j++) {
+        load_block(in[j], &l[j], &r[j]);
+        l[j] ^= P[BF_ROUNDS+1];
+    }
+    for (int i = BF_ROUNDS; i >= 1; i -= 2) {
+        for (size_t j = 0; j < N; j++)
+            r[j] ^= P[i] ^ bf_f(S, l[j]);
+        for (size_t j = 0; j < N; j++)
+            l[j] ^= P[i-1] ^ bf_f(S, r[j]);
+    }
+    // read all of iv before writing, in case it aliases out
+    uint64_t x[N];
+    for (size_t j = 0; j < N; j++)
+        x[j] = iv ? iv[j] : 0;
+    for (size_t j = 0; j < N; j++)
+        out[j] = store_block(r[j] ^ P[0], l[j]) ^ x[j];
+}
+
+void
+blowfish::encrypt_batch(const uint64_t *in, uint64_t *out, size_t n,
+                        const uint64_t *iv) const
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        encrypt_n<4>(k, in + i, out + i, iv ? iv + i : NULL);
+    for (; i < n; i++)
+        encrypt_n<1>(k, in + i, out + i, iv ? iv + i : NULL);
+}
+
+void
+blowfish::decrypt_batch(const uint64_t *in, uint64_t *out, size_t n,
+                        const uint64_t *iv) const
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        decrypt_n<4>(k, in + i, out + i, iv ? iv + i : NULL);
+    for (; i < n; i++)
+        decrypt_n<1>(k, in + i, out + i, iv ? iv + i : NULL);
+}
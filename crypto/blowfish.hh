@@ -1,6 +1,8 @@
 #pragma once
 
+#include <string>
 #include <vector>
+#include <stddef.h>
 #include <stdint.h>
 #include <openssl/blowfish.h>
 
@@ -30,6 +32,19 @@ class blowfish {
         return pt;
     }
 
+    /*
+     * Batched ECB over n 64-bit blocks, with the per-block IV fused in:
+     * encrypt_batch computes out[i] = E(in[i] ^ iv[i]) and decrypt_batch
+     * out[i] = D(in[i]) ^ iv[i] (no xor if iv is NULL).  Results match
+     * encrypt()/decrypt() one value at a time, but several independent
+     * blocks go through the rounds together to hide the S-box lookup
+     * latency.  in, out and iv may alias.
+     */
+    void encrypt_batch(const uint64_t *in, uint64_t *out, size_t n,
+                       const uint64_t *iv = NULL) const;
+    void decrypt_batch(const uint64_t *in, uint64_t *out, size_t n,
+                       const uint64_t *iv = NULL) const;
+
     static const size_t blocksize = 8;
 
  private:
@@ -0,0 +1,143 @@
+#include <crypto/fpe.hh>
+#include <crypto/BasicCrypto.hh>
+
+static std::vector<uint8_t>
+skip32_key(const std::string &key)
+{
+    throw_c(key.size() >= 10);
+    return std::vector<uint8_t>(key.begin(), key.begin() + 10);
+}
+
+// values go to and from FFX big-endian, in the minimum number of bytes
+static void
+to_bytes(uint64_t v, uint nbits, uint8_t *const p)
+{
+    for (uint i = 0; i < nbits / 8; i++)
+        p[i] = (uint8_t) (v >> (nbits - 8 * (i + 1)));
+}
+
+static uint64_t
+from_bytes(const uint8_t *const p, uint nbits)
+{
+    uint64_t v = 0;
+    for (uint i = 0; i < nbits / 8; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static std::vector<uint8_t>
+tweak_bytes(uint64_t tweak)
+{
+    std::vector<uint8_t> t(sizeof(tweak));
+    to_bytes(tweak, 64, &t[0]);
+    return t;
+}
+
+static uint64_t
+mask(uint nbits)
+{
+    return (1ULL << nbits) - 1;
+}
+
+fpe_int::fpe_int(const std::string &key, uint nbits)
+    : nbits(nbits), aes(key), s32(skip32_key(key)),
+      det(&aes, nbits, std::vector<uint8_t>())
+{
+    throw_c(nbits >= 8 && nbits <= 32 && nbits % 8 == 0,
+            "fpe_int supports 8, 16, 24 and 32 bit values");
+}
+
+uint64_t
+fpe_int::encrypt(uint64_t pt) const
+{
+    uint8_t in[4], out[4];
+    to_bytes(pt & mask(nbits), nbits, in);
+    if (32 == nbits)
+        s32.block_encrypt(in, out);
+    else
+        det.encrypt(in, out);
+    return from_bytes(out, nbits);
+}
+
+uint64_t
+fpe_int::decrypt(uint64_t ct) const
+{
+    uint8_t in[4], out[4];
+    to_bytes(ct & mask(nbits), nbits, in);
+    if (32 == nbits)
+        s32.block_decrypt(in, out);
+    else
+        det.decrypt(in, out);
+    return from_bytes(out, nbits);
+}
+
+uint64_t
+fpe_int::encrypt(uint64_t pt, uint64_t tweak) const
+{
+    const ffx2<AES> f(&aes, nbits, tweak_bytes(tweak));
+    uint8_t in[4], out[4];
+    to_bytes(pt & mask(nbits), nbits, in);
+    f.encrypt(in, out);
+    return from_bytes(out, nbits);
+}
+
+uint64_t
+fpe_int::decrypt(uint64_t ct, uint64_t tweak) const
+{
+    const ffx2<AES> f(&aes, nbits, tweak_bytes(tweak));
+    uint8_t in[4], out[4];
+    to_bytes(ct & mask(nbits), nbits, in);
+    f.decrypt(in, out);
+    return from_bytes(out, nbits);
+}
+
+static std::string
+half(const std::string &key, uint i)
+{
+    throw_c(key.size() == fpe_str::key_bytes);
+    return key.substr(i * fpe_str::key_bytes / 2, fpe_str::key_bytes / 2);
+}
+
+fpe_str::fpe_str(const std::string &key)
+    : aes(half(key, 0)), enckey(get_AES_enc_key(half(key, 1))),
+      deckey(get_AES_dec_key(half(key, 1)))
+{}
+
+std::string
+fpe_str::encrypt(const std::string &ptext) const
+{
+    if (ptext.size() > max_short)
+        return encrypt_AES_CMC(ptext, enckey.get(), true);
+
+    std::string ctext(ptext.size(), 0);
+    if (!ptext.empty()) {
+        const ffx2<AES> f(&aes, ptext.size() * 8, std::vector<uint8_t>());
+        f.encrypt((const uint8_t *) ptext.data(), (uint8_t *) &ctext[0]);
+    }
+    return ctext;
+}
+
+std::string
+fpe_str::decrypt(const std::string &ctext) const
+{
+    if (ctext.size() > max_short)
+        return decrypt_AES_CMC(ctext, deckey.get(), true);
+
+    std::string ptext(ctext.size(), 0);
+    if (!ctext.empty()) {
+        const ffx2<AES> f(&aes, ctext.size() * 8, std::vector<uint8_t>());
+        f.decrypt((const uint8_t *) ctext.data(), (uint8_t *) &ptext[0]);
+    }
+    return ptext;
+}
+
+size_t
+fpe_str::ciphertext_length(size_t len)
+{
+    if (len <= max_short)
+        return len;
+
+    unsigned long out;
+    throw_c(rounded_len(len, AES_BLOCK_SIZE, true, &out));
+    return out;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+/*
+ * fpe.hh
+ *
+ *  Format-preserving encryption of small integers: an n-bit value
+ *  (n a multiple of 8, at most 32) encrypts to an n-bit value, so an
+ *  encrypted INT column can stay an INT instead of growing to a BIGINT.
+ *  The deterministic mode uses skip32 for 32-bit values and FFX for the
+ *  other widths; the tweaked mode (for RND, with the row's IV as tweak)
+ *  is always FFX.
+ *
+ *  fpe_str is the string counterpart for DET: strings of up to 16 bytes
+ *  are enciphered with FFX over all of their bits, so the ciphertext is
+ *  exactly as long as the plaintext; longer strings use padded CMC, whose
+ *  output is never shorter than 32 bytes, so decryption can tell the two
+ *  apart by length alone.
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <openssl/aes.h>
+#include <sys/types.h>
+
+#include <crypto/aes.hh>
+#include <crypto/ffx.hh>
+#include <crypto/skip32.hh>
+
+class fpe_int {
+ public:
+    fpe_int(const std::string &key, uint nbits);
+
+    uint64_t encrypt(uint64_t pt) const;
+    uint64_t decrypt(uint64_t ct) const;
+
+    uint64_t encrypt(uint64_t pt, uint64_t tweak) const;
+    uint64_t decrypt(uint64_t ct, uint64_t tweak) const;
+
+    uint bits() const {return nbits;}
+
+    static const size_t key_bytes = 16;
+
+ private:
+    fpe_int(const fpe_int &);
+
+    const uint nbits;
+    const AES aes;
+    const skip32 s32;
+    const ffx2<AES> det;
+};
+
+class fpe_str {
+ public:
+    fpe_str(const std::string &key);
+
+    std::string encrypt(const std::string &ptext) const;
+    std::string decrypt(const std::string &ctext) const;
+
+    // longest ciphertext for plaintexts of at most len bytes
+    static size_t ciphertext_length(size_t len);
+
+    // the first half keys FFX, the second half CMC
+    static const size_t key_bytes = 32;
+    static const size_t max_short = 16;
+
+ private:
+    fpe_str(const fpe_str &);
+
+    const AES aes;
+    const std::unique_ptr<const AES_KEY> enckey;
+    const std::unique_ptr<const AES_KEY> deckey;
+};
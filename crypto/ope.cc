@@ -45,12 +45,23 @@ OPE::lazy_sample(const ZZ &d_lo, const ZZ &d_hi,
     ZZ rgap = nrange/2;
     ZZ dgap;
 
-    auto ci = dgap_cache.find(r_lo + rgap);
-    if (ci == dgap_cache.end()) {
+    bool cached;
+    {
+        std::lock_guard<std::mutex> guard(*cache_lock);
+        auto ci = dgap_cache.find(r_lo + rgap);
+        cached = ci != dgap_cache.end();
+        if (cached)
+            dgap = ci->second;
+    }
+
+    /*
+     * Sampled outside the lock; the PRNG was reset above, so threads that
+     * miss the same gap at once agree on it.
+     */
+    if (!cached) {
         dgap = domain_gap(ndomain, nrange, nrange / 2, prng);
+        std::lock_guard<std::mutex> guard(*cache_lock);
         dgap_cache[r_lo + rgap] = dgap;
-    } else {
-        dgap = ci->second;
     }
 
     if (go_low(d_lo + dgap, r_lo + rgap))
@@ -2,6 +2,8 @@
 
 #include <string>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <crypto/prng.hh>
 #include <crypto/aes.hh>
 #include <crypto/sha.hh>
@@ -19,7 +21,8 @@ class ope_domain_range {
 class OPE {
  public:
     OPE(const std::string &keyarg, size_t plainbits, size_t cipherbits)
-    : key(keyarg), pbits(plainbits), cbits(cipherbits), aesk(aeskey(key)) {}
+    : key(keyarg), pbits(plainbits), cbits(cipherbits), aesk(aeskey(key)),
+      cache_lock(std::make_shared<std::mutex>()) {}
 
     NTL::ZZ encrypt(const NTL::ZZ &ptext);
     NTL::ZZ decrypt(const NTL::ZZ &ctext);
@@ -36,6 +39,8 @@ class OPE {
 
     AES aesk;
     std::map<NTL::ZZ, NTL::ZZ> dgap_cache;
+    // encryptions may run on several threads at once; copies share it
+    std::shared_ptr<std::mutex> cache_lock;
 
     template<class CB>
     ope_domain_range search(CB go_low);
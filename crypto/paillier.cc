@@ -1,5 +1,10 @@
 #include <crypto/paillier.hh>
+#include <algorithm>
+#include <mutex>
 #include <sstream>
+#include <thread>
+
+#include <gmp.h>
 
 using namespace std;
 using namespace NTL;
@@ -8,6 +13,10 @@ using namespace NTL;
  * Public-key operations
  */
 
+// the queue of randomness and NTL's generator, for INSERTs encrypted on
+// several threads; the exponentiations run outside it
+static mutex rand_lock;
+
 Paillier::Paillier() : nbits(0) {
 }
 
@@ -21,14 +30,22 @@ Paillier::Paillier(const vector<ZZ> &pk)
 void
 Paillier::rand_gen(size_t niter, size_t nmax)
 {
-    if (rqueue.size() >= nmax)
-        niter = 0;
-    else
-        niter = min(niter, nmax - rqueue.size());
+    {
+        lock_guard<mutex> guard(rand_lock);
+        if (rqueue.size() >= nmax)
+            niter = 0;
+        else
+            niter = min(niter, nmax - rqueue.size());
+    }
 
     for (uint i = 0; i < niter; i++) {
-        ZZ r = RandomLen_ZZ(nbits) % n;
+        ZZ r;
+        {
+            lock_guard<mutex> guard(rand_lock);
+            r = RandomLen_ZZ(nbits) % n;
+        }
         ZZ rn = PowerMod(g, n*r, n2);
+        lock_guard<mutex> guard(rand_lock);
         rqueue.push_back(rn);
     }
 }
@@ -36,14 +53,23 @@ Paillier::rand_gen(size_t niter, size_t nmax)
 ZZ
 Paillier::encrypt(const ZZ &plaintext)
 {
-    auto i = rqueue.begin();
-    if (i != rqueue.end()) {
-        ZZ rn = *i;
-        rqueue.pop_front();
+    ZZ rn, r;
+    bool queued;
+    {
+        lock_guard<mutex> guard(rand_lock);
+        auto i = rqueue.begin();
+        queued = i != rqueue.end();
+        if (queued) {
+            rn = *i;
+            rqueue.pop_front();
+        } else {
+            r = RandomLen_ZZ(nbits) % n;
+        }
+    }
 
+    if (queued) {
         return (PowerMod(g, plaintext, n2) * rn) % n2;
     } else {
-        ZZ r = RandomLen_ZZ(nbits) % n;
         return PowerMod(g, plaintext + n*r, n2);
     }
 }
@@ -83,6 +109,105 @@ LCM(const ZZ &a, const ZZ &b)
     return (a * b) / GCD(a, b);
 }
 
+/*
+ * decrypt_batch works on GMP integers: mpz_powm_sec is a fixed-window
+ * exponentiation (the exponent is the same for every ciphertext), and
+ * the CRT recombination m = mp + p * ((mq - mp) * p^-1 mod q) only needs
+ * one precomputed inverse.
+ */
+static void
+mpz_from_ZZ(mpz_t out, const ZZ &x)
+{
+    const long len = NumBytes(x);
+    vector<uint8_t> bytes(len);
+    BytesFromZZ(bytes.data(), x, len);
+    mpz_init(out);
+    mpz_import(out, len, -1, 1, 0, 0, bytes.data());
+}
+
+struct Paillier_priv::batch_consts {
+    // one CRT half: m_p = L(c^e mod p^2) * h mod p
+    struct half {
+        mpz_t p, p2, e, pinv, h;
+        unsigned long bits;
+
+        half(const ZZ &p_, const ZZ &p2_, const ZZ &e_, const ZZ &pinv_,
+             const ZZ &h_)
+            : bits(NumBits(p_))
+        {
+            mpz_from_ZZ(p, p_);
+            mpz_from_ZZ(p2, p2_);
+            mpz_from_ZZ(e, e_);
+            mpz_from_ZZ(pinv, pinv_);
+            mpz_from_ZZ(h, h_);
+        }
+        ~half() {
+            mpz_clears(p, p2, e, pinv, h, NULL);
+        }
+
+        // out = m mod p; tmp is scratch
+        void decrypt(mpz_t out, const mpz_t c, mpz_t tmp) const {
+            mpz_mod(tmp, c, p2);
+            mpz_powm_sec(out, tmp, e, p2);
+            mpz_sub_ui(out, out, 1);
+            mpz_mul(out, out, pinv);
+            mpz_fdiv_r_2exp(out, out, bits);
+            mpz_mod(out, out, p);
+            mpz_mul(out, out, h);
+            mpz_mod(out, out, p);
+        }
+    };
+
+    const half hp, hq;
+    mpz_t p_inv_q;
+
+    batch_consts(const Paillier_priv &sk)
+        : hp(sk.p, sk.p2, sk.fast ? sk.a : sk.p - 1, sk.pinv, sk.hp),
+          hq(sk.q, sk.q2, sk.fast ? sk.a : sk.q - 1, sk.qinv, sk.hq)
+    {
+        mpz_from_ZZ(p_inv_q, InvMod(sk.p % sk.q, sk.q));
+    }
+    ~batch_consts() {
+        mpz_clear(p_inv_q);
+    }
+
+    // false if the plaintext needs more than 64 bits
+    bool decrypt(const raw_ciphertext &in, uint64_t *const out,
+                 mpz_t c, mpz_t mp, mpz_t mq, mpz_t tmp) const
+    {
+        mpz_import(c, in.second, -1, 1, 0, 0, in.first);
+        hp.decrypt(mp, c, tmp);
+        hq.decrypt(mq, c, tmp);
+
+        mpz_sub(mq, mq, mp);
+        mpz_mul(mq, mq, p_inv_q);
+        mpz_mod(mq, mq, hq.p);
+        mpz_mul(mq, mq, hp.p);
+        mpz_add(mp, mp, mq);
+
+        if (mpz_sizeinbase(mp, 2) > 64) {
+            return false;
+        }
+        uint64_t v = 0;
+        mpz_export(&v, NULL, -1, sizeof(v), 0, 0, mp);
+        *out = v;
+        return true;
+    }
+
+    bool decrypt_range(const raw_ciphertext *in, uint64_t *out,
+                       size_t n) const
+    {
+        mpz_t c, mp, mq, tmp;
+        mpz_inits(c, mp, mq, tmp, NULL);
+        bool ok = true;
+        for (size_t i = 0; i < n && ok; i++) {
+            ok = decrypt(in[i], &out[i], c, mp, mq, tmp);
+        }
+        mpz_clears(c, mp, mq, tmp, NULL);
+        return ok;
+    }
+};
+
 Paillier_priv::Paillier_priv(const vector<ZZ> &sk)
     : Paillier({sk[0]*sk[1], sk[2]}), p(sk[0]), q(sk[1]), a(sk[3]),
       fast(a != 0),
@@ -94,7 +219,8 @@ Paillier_priv::Paillier_priv(const vector<ZZ> &sk)
       hp(InvMod(Lfast(PowerMod(g % p2, fast ? a : (p-1), p2),
                       pinv, two_p, p), p)),
       hq(InvMod(Lfast(PowerMod(g % q2, fast ? a : (q-1), q2),
-                      qinv, two_q, q), q))
+                      qinv, two_q, q), q)),
+      batch(new batch_consts(*this))
 {
     throw_c(sk.size() == 4);
 }
@@ -158,3 +284,39 @@ Paillier_priv::decrypt(const ZZ &ciphertext) const
 
     return m;
 }
+
+bool
+Paillier_priv::decrypt_batch(const vector<raw_ciphertext> &ciphertexts,
+                             uint64_t *const plaintexts, uint nthreads) const
+{
+    throw_c(batch != nullptr);
+
+    // below this a thread costs more than the exponentiations it saves
+    static const size_t min_per_thread = 16;
+
+    const size_t n = ciphertexts.size();
+    if (0 == nthreads) {
+        nthreads = max(1u, thread::hardware_concurrency());
+    }
+    nthreads = max((size_t) 1, min((size_t) nthreads, n / min_per_thread));
+    if (1 == nthreads) {
+        return batch->decrypt_range(ciphertexts.data(), plaintexts, n);
+    }
+
+    vector<thread> workers;
+    vector<char> ok(nthreads, false);
+    const size_t chunk = (n + nthreads - 1) / nthreads;
+    for (uint t = 0; t < nthreads; t++) {
+        const size_t begin = min(n, t * chunk);
+        const size_t count = min(n, begin + chunk) - begin;
+        workers.push_back(thread([=, &ciphertexts, &ok] () {
+            ok[t] = batch->decrypt_range(ciphertexts.data() + begin,
+                                         plaintexts + begin, count);
+        }));
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+
+    return find(ok.begin(), ok.end(), false) == ok.end();
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <list>
+#include <memory>
+#include <utility>
 #include <vector>
 #include <NTL/ZZ.h>
 #include <crypto/prng.hh>
@@ -113,6 +115,18 @@ class Paillier_priv : public Paillier {
 
     NTL::ZZ decrypt(const NTL::ZZ &ciphertext) const;
 
+    /*
+     * Decrypts many ciphertexts, given as the little-endian bytes they are
+     * stored as (StringFromZZ), straight into 64-bit plaintexts.  The CRT
+     * constants are converted once, both halves use GMP's fixed-window
+     * exponentiation, and the work is split over nthreads threads (0 for
+     * one per core).  Returns false if a plaintext needs more than 64
+     * bits; decrypt() gives the exact answer for those.
+     */
+    typedef std::pair<const uint8_t *, size_t> raw_ciphertext;
+    bool decrypt_batch(const std::vector<raw_ciphertext> &ciphertexts,
+                       uint64_t *const plaintexts, uint nthreads = 0) const;
+
     static std::vector<NTL::ZZ> keygen(PRNG*, uint nbits = 1024, uint abits = 256);
 
     template<class PackT>
@@ -146,4 +160,8 @@ class Paillier_priv : public Paillier {
     const NTL::ZZ two_p, two_q;
     const NTL::ZZ pinv, qinv;
     const NTL::ZZ hp, hq;
+
+    /* GMP copies of the above for decrypt_batch */
+    struct batch_consts;
+    const std::shared_ptr<const batch_consts> batch;
 };
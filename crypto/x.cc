@@ -22,6 +22,8 @@
 #include <crypto/mont.hh>
 #include <crypto/gfe.hh>
 #include <util/timer.hh>
+#include <util/cryptdb_log.hh>
+#include <util/zz.hh>
 #include <NTL/ZZ.h>
 #include <NTL/RR.h>
 
@@ -169,6 +171,36 @@ test_paillier()
     cout << "paillier add: "
          << ((double) sumperf.lap()) / 1000 << " usec" << endl;
 
+    std::vector<uint64_t> vals(1000);
+    std::vector<std::string> raw(vals.size());
+    std::vector<Paillier_priv::raw_ciphertext> cts(vals.size());
+    for (size_t i = 0; i < vals.size(); i++) {
+        vals[i] = u.rand<uint64_t>();
+        const ZZ c = p.encrypt(to_ZZ(vals[i]));
+        raw[i].resize(NumBytes(c));
+        BytesFromZZ((uint8_t *) &raw[i][0], c, raw[i].size());
+        cts[i] = make_pair((const uint8_t *) raw[i].data(), raw[i].size());
+    }
+    timer decperf;
+    for (size_t i = 0; i < vals.size(); i++) {
+        const ZZ c = ZZFromBytes((const uint8_t *) raw[i].data(),
+                                 raw[i].size());
+        throw_c(pp.decrypt(c) == to_ZZ(vals[i]));
+    }
+    double serial = decperf.lap();
+    std::vector<uint64_t> dec(vals.size());
+    throw_c(pp.decrypt_batch(cts, dec.data()));
+    double batched = decperf.lap();
+    throw_c(dec == vals);
+    cout << "paillier decrypt: " << serial / vals.size() << " usec, batched "
+         << batched / vals.size() << " usec" << endl;
+
+    const ZZ big = p.encrypt(to_ZZ(1) << 64);
+    raw[0].resize(NumBytes(big));
+    BytesFromZZ((uint8_t *) &raw[0][0], big, raw[0].size());
+    cts[0] = make_pair((const uint8_t *) raw[0].data(), raw[0].size());
+    throw_c(!pp.decrypt_batch(cts, dec.data(), 1));
+
     for (int i = 0; i < 10; i++) {
         blockrng<AES> br(u.rand_string(16));
         auto v = u.rand_string(AES::blocksize);
@@ -597,6 +629,69 @@ test_gfe(size_t q)
     cout << "test_gfe size " << sizeof(T) << " q " << q << " ok\n";
 }
 
+static string
+hex_of(const string &s, uint *const formatted)
+{
+    ++*formatted;
+    ostringstream ss;
+    for (auto &x: s)
+        ss << hex << setw(2) << setfill('0') << (uint) (uint8_t) x;
+    return ss.str();
+}
+
+// a disabled LOG(encl) on every value must neither format nor evaluate
+// its arguments: the timings should match and nothing be formatted
+static void
+test_log_disabled()
+{
+    urandom u;
+    AES aes(u.rand_string(16));
+    OPE o("hello world", 32, 64);
+    const bool was_enabled = cryptdb_logger::enabled(log_group::log_encl);
+    cryptdb_logger::disable(log_group::log_encl);
+
+    enum { nblocks = 1000000, nope = 1000 };
+    string pt = u.rand_string(AES::blocksize);
+    string ct(pt.size(), 0);
+    uint formatted = 0;
+
+    timer t;
+    for (uint i = 0; i < nblocks; i++) {
+        aes.block_encrypt(&pt[0], &ct[0]);
+        pt[0] = ct[0];
+    }
+    uint64_t plain = t.lap();
+    for (uint i = 0; i < nblocks; i++) {
+        aes.block_encrypt(&pt[0], &ct[0]);
+        LOG(encl) << "AES " << hex_of(pt, &formatted)
+                  << " ---> " << hex_of(ct, &formatted);
+        pt[0] = ct[0];
+    }
+    uint64_t logged = t.lap();
+    cout << "--- disabled LOG, aes-128 block: " << plain * 1000 / nblocks
+         << " nsec without, " << logged * 1000 / nblocks << " nsec with"
+         << endl;
+
+    for (uint i = 0; i < nope; i++)
+        o.encrypt(to_ZZ(i));
+    t.lap();
+    for (uint i = 0; i < nope; i++)
+        o.encrypt(to_ZZ(i));
+    plain = t.lap();
+    for (uint i = 0; i < nope; i++) {
+        ZZ c = o.encrypt(to_ZZ(i));
+        LOG(encl) << "OPE " << i << " ---> " << c
+                  << hex_of(StringFromZZ(c), &formatted);
+    }
+    logged = t.lap();
+    cout << "--- disabled LOG, 32-bit ope: " << plain / nope
+         << " usec without, " << logged / nope << " usec with" << endl;
+
+    throw_c(0 == formatted);
+    if (was_enabled)
+        cryptdb_logger::enable(log_group::log_encl);
+}
+
 int
 main(int ac, char **av)
 {
@@ -655,4 +750,6 @@ main(int ac, char **av)
     for (int pbits = 32; pbits <= 128; pbits += 32)
         for (int cbits = pbits; cbits <= pbits + 128; cbits += 32)
             test_ope(pbits, cbits);
+
+    test_log_disabled();
 }
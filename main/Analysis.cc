@@ -4,6 +4,7 @@
 #include <main/metadata_tables.hh>
 #include <main/macro_util.hh>
 #include <main/stored_procedures.hh>
+#include <util/latency.hh>
 #include <util/util.hh>
 
 // FIXME: Wrong interfaces.
@@ -377,7 +378,10 @@ SharedProxyState::SharedProxyState(ConnectionInfo ci,
                                                    // list.
       conn(new Connect(ci.server, ci.user, ci.passwd, ci.port)),
       default_sec_rating(default_sec_rating),
-      cache(std::move(SchemaCache()))
+      cache(std::move(SchemaCache())),
+      scheduler(new AdjustmentScheduler(ci.server, ci.user, ci.passwd,
+                                        ci.port)),
+      embedded_pool(new EmbeddedPool(embed_dir))
 {
     // make sure the server was not started in SQL_SAFE_UPDATES mode
     // > it might not even be possible to start the server in this mode;
@@ -409,6 +413,32 @@ SharedProxyState::SharedProxyState(ConnectionInfo ci,
     loadUDFs(conn);
 
     assert(loadStoredProcedures(conn));
+
+    embedded_pool->release(std::move(init_e_conn), false);
+}
+
+SharedProxyState::SharedProxyState(const std::string &embed_dir,
+                                   const std::string &master_key,
+                                   SECURITY_RATING default_sec_rating)
+    : masterKey(std::unique_ptr<AES_KEY>(getKey(master_key))),
+      embed_dir(embed_dir),
+      mysql_dummy(SharedProxyState::db_init(embed_dir)),
+      conn(nullptr),
+      default_sec_rating(default_sec_rating),
+      cache(std::move(SchemaCache())),
+      scheduler(new AdjustmentScheduler()),
+      embedded_pool(new EmbeddedPool(embed_dir))
+{
+    std::unique_ptr<Connect>
+        init_e_conn(Connect::getEmbedded(embed_dir));
+    assert(init_e_conn);
+
+    const std::string prefix =
+        getenv("CRYPTDB_NAME") ? getenv("CRYPTDB_NAME")
+                               : "generic_prefix_";
+    assert(MetaData::initialize(conn, init_e_conn, prefix));
+
+    embedded_pool->release(std::move(init_e_conn), false);
 }
 
 SharedProxyState::~SharedProxyState()
@@ -423,7 +453,51 @@ SharedProxyState::db_init(const std::string &embed_dir)
     return 1;
 }
 
-ProxyState::~ProxyState() {}
+std::unique_ptr<Connect>
+EmbeddedPool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (false == idle.empty()) {
+            std::unique_ptr<Connect> e_conn(std::move(idle.back()));
+            idle.pop_back();
+            return e_conn;
+        }
+    }
+
+    std::unique_ptr<Connect> e_conn(Connect::getEmbedded(embed_dir));
+    TEST_TextMessageError(nullptr != e_conn,
+                          "failed to open an embedded connection");
+    ++opened;
+    return e_conn;
+}
+
+void
+EmbeddedPool::release(std::unique_ptr<Connect> e_conn, bool failed)
+{
+    assert(e_conn);
+
+    // the executors wrap their writes to the embedded database in
+    // transactions that a failure can leave open
+    if (failed && false == e_conn->execute("ROLLBACK")) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.push_back(std::move(e_conn));
+}
+
+size_t
+EmbeddedPool::idleCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return idle.size();
+}
+
+ProxyState::~ProxyState()
+{
+    this->releaseQuery(true);
+}
 
 SECURITY_RATING
 ProxyState::defaultSecurityRating() const
@@ -446,6 +520,11 @@ ProxyState::getConn() const
 const std::unique_ptr<Connect> &
 ProxyState::getEConn() const
 {
+    if (!e_conn) {
+        e_conn = shared.getEmbeddedPool().acquire();
+        this->pushEmbeddedTHD();
+    }
+
     return e_conn;
 }
 
@@ -464,6 +543,12 @@ embeddedTHDCleanup(THD *thd)
 
 void
 ProxyState::safeCreateEmbeddedTHD()
+{
+    this->pushEmbeddedTHD();
+}
+
+void
+ProxyState::pushEmbeddedTHD() const
 {
     THD *thd = static_cast<THD *>(create_embedded_thd(0));
     assert(thd);
@@ -473,6 +558,63 @@ ProxyState::safeCreateEmbeddedTHD()
     return;
 }
 
+void
+ProxyState::releaseQuery(bool failed)
+{
+    // the ROLLBACK goes through Connect::execute which wants a THD of
+    // its own, so the connection goes back before the THDs go
+    if (e_conn) {
+        shared.getEmbeddedPool().release(std::move(e_conn), failed);
+    }
+    thds.clear();
+}
+
+void
+ProxyState::endQuery(bool failed)
+{
+    this->releaseQuery(failed);
+    // the next query still wants a current THD
+    this->safeCreateEmbeddedTHD();
+}
+
+static uint64_t
+usedMemBytes(const USED_MEM *block)
+{
+    uint64_t bytes = 0;
+    for (; block; block = block->next) {
+        bytes += block->size;
+    }
+
+    return bytes;
+}
+
+ConnectionMemory
+ProxyState::memory(bool count_items) const
+{
+    ConnectionMemory out;
+    out.thds = thds.size();
+    out.embedded = nullptr != e_conn;
+    for (const auto &it : thds) {
+        const THD *const thd = it.get();
+        if (nullptr == thd) {
+            continue;
+        }
+        const MEM_ROOT *const root = thd->mem_root;
+        if (root) {
+            out.mem_root_bytes +=
+                usedMemBytes(root->free) + usedMemBytes(root->used);
+        }
+        if (count_items) {
+            for (const Item *item = thd->free_list; item;
+                 item = item->next) {
+                ++out.items;
+            }
+        }
+    }
+
+    return out;
+}
+
 void ProxyState::dumpTHDs()
 {
     for (auto &it : thds) {
@@ -593,7 +735,8 @@ bool ReplaceDelta::apply(const std::unique_ptr<Connect> &e_conn,
 
     const unsigned int child_id = meta.getDatabaseID();
 
-    const std::string child_serial = meta.serialize(parent_meta);
+    const std::string child_serial =
+        this->serial.empty() ? meta.serialize(parent_meta) : this->serial;
     const std::string esc_child_serial =
         escapeString(e_conn, child_serial);
     const std::string serial_key = key.getSerial();
@@ -951,6 +1094,7 @@ RewritePlanWithAnalysis::RewritePlanWithAnalysis(const EncSet &es_out,
 std::string
 lexToQuery(const LEX &lex)
 {
+    const LatencyScope latency(latency_stage::stage_print);
     std::ostringstream o;
     o << const_cast<LEX &>(lex);
     return o.str();
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <util/onions.hh>
 #include <util/cryptdb_log.hh>
 #include <main/schema.hh>
 #include <main/rewrite_ds.hh>
+#include <main/adjust_scheduler.hh>
 #include <parser/embedmysql.hh>
 #include <parser/stringify.hh>
 
@@ -52,6 +55,18 @@ public:
     const SECLEVEL tolevel;
 };
 
+// the query needs an onion that is not populated yet
+class OnionMaterializeExcept {
+public:
+    OnionMaterializeExcept(const TableMeta &tm, const FieldMeta &fm,
+                           onion o)
+        : tm(tm), fm(fm), o(o) {}
+
+    const TableMeta &tm;
+    const FieldMeta &fm;
+    const onion o;
+};
+
 // TODO: Maybe we want a database name argument/member.
 typedef class ConnectionInfo {
 public:
@@ -68,11 +83,53 @@ public:
 
 class ProxyState;
 
+// Embedded connections shared by the ProxyStates.  A ProxyState leases one
+// for a query and gives it back once the query is done, so there are as
+// many as there are queries in flight rather than one per client.
+class EmbeddedPool {
+public:
+    explicit EmbeddedPool(const std::string &embed_dir)
+        : embed_dir(embed_dir), opened(0) {}
+
+    std::unique_ptr<Connect> acquire();
+    // @failed: the query may have left a transaction open
+    void release(std::unique_ptr<Connect> e_conn, bool failed);
+    size_t idleCount() const;
+    uint64_t openedCount() const {return opened.load();}
+
+private:
+    EmbeddedPool(const EmbeddedPool &);
+    EmbeddedPool &operator=(const EmbeddedPool &);
+
+    const std::string embed_dir;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Connect> > idle;
+    std::atomic<uint64_t> opened;
+};
+
+// what a client connection holds on to; see ProxyState::memory()
+struct ConnectionMemory {
+    ConnectionMemory()
+        : thds(0), mem_root_bytes(0), items(0), embedded(false) {}
+
+    uint64_t thds;
+    // of the mem_roots of the THDs, where the Items are
+    uint64_t mem_root_bytes;
+    uint64_t items;
+    // holds an embedded connection
+    bool embedded;
+};
+
 // state maintained at the proxy
 typedef struct SharedProxyState {
     SharedProxyState(ConnectionInfo ci, const std::string &embed_dir,
                      const std::string &master_key,
                      SECURITY_RATING default_sec_rating);
+    // No server: getConn() is NULL and the caller answers the queries of
+    // the executors itself, as the replay benchmark does.
+    SharedProxyState(const std::string &embed_dir,
+                     const std::string &master_key,
+                     SECURITY_RATING default_sec_rating);
     ~SharedProxyState();
     SECURITY_RATING defaultSecurityRating() const
     {
@@ -84,6 +141,7 @@ typedef struct SharedProxyState {
         return masterKey;
     }
     const std::unique_ptr<Connect> &getConn() const {return conn;}
+    EmbeddedPool &getEmbeddedPool() const {return *embedded_pool;}
     static int db_init(const std::string &embed_dir);
 
     friend class ProxyState;
@@ -95,29 +153,43 @@ private:
     const std::unique_ptr<Connect> conn;
     const SECURITY_RATING default_sec_rating;
     const SchemaCache cache;
+    const std::unique_ptr<AdjustmentScheduler> scheduler;
+    const std::unique_ptr<EmbeddedPool> embedded_pool;
 } SharedProxyState;
 
 class ProxyState {
 public:
-    ProxyState(SharedProxyState &shared)
-        : shared(shared),
-          e_conn(Connect::getEmbedded(shared.embed_dir)) {}
+    ProxyState(SharedProxyState &shared) : shared(shared) {}
     ~ProxyState();
 
     SECURITY_RATING defaultSecurityRating() const;
     const std::unique_ptr<AES_KEY> &getMasterKey() const;
     const std::unique_ptr<Connect> &getConn() const;
+    // leases an embedded connection from the pool if it holds none
     const std::unique_ptr<Connect> &getEConn() const;
     void safeCreateEmbeddedTHD();
     void dumpTHDs();
+    // The query is done: its THDs go, and the Items on them with them, and
+    // the embedded connection goes back to the pool.  Callers that never
+    // say so keep both until the ProxyState goes.
+    void endQuery(bool failed);
+    // walking the THDs' Items takes as long as there are Items
+    ConnectionMemory memory(bool count_items) const;
     const SchemaCache &getSchemaCache() const {return shared.cache;}
     std::shared_ptr<const SchemaInfo> getSchemaInfo() const
         {return shared.cache.getSchema(this->getConn(), this->getEConn());}
+    AdjustmentScheduler &getAdjustmentScheduler() const
+        {return *shared.scheduler;}
 
 private:
     const SharedProxyState &shared;
-    const std::unique_ptr<Connect> e_conn;
-    std::vector<std::unique_ptr<THD, void (*)(THD *)> > thds;
+    mutable std::unique_ptr<Connect> e_conn;
+    // leasing an embedded connection can open one, which leaves the
+    // current THD to that connection
+    mutable std::vector<std::unique_ptr<THD, void (*)(THD *)> > thds;
+
+    void pushEmbeddedTHD() const;
+    void releaseQuery(bool failed);
 };
 
 extern __thread ProxyState *thread_ps;
@@ -189,9 +261,16 @@ class ReplaceDelta : public DerivedKeyDelta {
 public:
     ReplaceDelta(const DBMeta &meta, const DBMeta &parent_meta)
         : DerivedKeyDelta(meta, parent_meta) {}
+    // stores @serial instead of what @meta serializes to now
+    ReplaceDelta(const DBMeta &meta, const DBMeta &parent_meta,
+                 const std::string &serial)
+        : DerivedKeyDelta(meta, parent_meta), serial(serial) {}
 
     bool apply(const std::unique_ptr<Connect> &e_conn,
                TableType table_type);
+
+private:
+    const std::string serial;
 };
 
 class DeleteDelta : public DerivedKeyDelta {
@@ -13,6 +13,8 @@
 #include <memory>
 
 #include <util/cryptdb_log.hh>
+#include <util/latency.hh>
+#include <util/trace.hh>
 #include <main/Connect.hh>
 #include <main/macro_util.hh>
 #include <main/Analysis.hh>
@@ -22,7 +24,7 @@ __thread ProxyState *thread_ps = NULL;
 
 Connect::Connect(const std::string &server, const std::string &user,
                  const std::string &passwd, uint port)
-    : conn(nullptr), close_on_destroy(true)
+    : conn(nullptr), close_on_destroy(true), embedded(false)
 {
     do_connect(server, user, passwd, port);
 }
@@ -91,7 +93,7 @@ Connect *Connect::getEmbedded(const std::string &embed_db)
         thrower() << "mysql_real_connect: " << mysql_error(m);
     }
 
-    return new Connect(m);
+    return new Connect(m, true);
 }
 
 // @multiple_resultsets causes us to ignore query results.
@@ -107,6 +109,8 @@ Connect::execute(const std::string &query, std::unique_ptr<DBResult> *res,
         *res = nullptr;
         return true;
     }
+    TraceScope trace_scope(this->embedded ? "embedded" : "remote",
+                           "execute");
     bool success = true;
     if (mysql_query(conn, query.c_str())) {
         LOG(warn) << "mysql_query: " << mysql_error(conn);
@@ -238,6 +242,7 @@ getItem(char *const content, enum_field_types type, uint len)
 ResType
 DBResult::unpack()
 {
+    const LatencyScope latency(latency_stage::stage_unpack);
     // 'n' will be NULL when the mysql statement doesn't return a resultset
     // > ie INSERT
     if (nullptr == n) {
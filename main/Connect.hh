@@ -33,6 +33,8 @@ class DBResult {
     static DBResult *store(MYSQL *const mysql);
 
     bool getSuccess() const {return success;}
+    uint64_t getAffectedRows() const {return affected_rows;}
+    uint64_t getInsertId() const {return insert_id;}
 
  private:
     const bool success;
@@ -45,7 +47,8 @@ class Connect {
     Connect(const std::string &server, const std::string &user,
             const std::string &passwd, uint port = 0);
 
-    Connect(MYSQL *const _conn) : conn(_conn), close_on_destroy(true) { }
+    Connect(MYSQL *const _conn, bool embedded=false)
+        : conn(_conn), close_on_destroy(true), embedded(embedded) { }
 
     //returns Connect for the embedded server
     static Connect *getEmbedded(const std::string &embed_dir);
@@ -73,6 +76,8 @@ class Connect {
                     const std::string &passwd, uint port);
 
     bool close_on_destroy;
+    // names the category of the trace spans of execute()
+    const bool embedded;
 };
 
 bool strictMode(Connect *const c);
@@ -7,6 +7,7 @@
 #include <crypto/BasicCrypto.hh>
 #include <crypto/SWPSearch.hh>
 #include <crypto/arc4.hh>
+#include <crypto/fpe.hh>
 #include <util/util.hh>
 #include <util/cryptdb_log.hh>
 #include <util/zz.hh>
@@ -405,6 +406,465 @@ CryptedInteger::serialize() const
 }
 
 
+/*********************** compact ciphertexts *******************************/
+
+/*
+ * CRYPTDB_CIPHER_FORMAT=compact selects the smallest ciphertexts we have
+ * for new fields: RND_str_ctr (no padding), DET_str_lp (length preserving
+ * up to 16 bytes), OPE_int with one extra byte instead of twice the
+ * plaintext size, and the format preserving integer layers below.  Like
+ * CRYPTDB_INT_FORMAT, it only affects fields created while it is set;
+ * existing tables are migrated by dumping them through the proxy and
+ * loading the dump back through a proxy that has the variable set.
+ * tools/size/cryptdbsize reports the bytes per table before and after.
+ */
+static bool
+compactCiphertexts()
+{
+    static const bool compact = [] () {
+        const char *const format = getenv("CRYPTDB_CIPHER_FORMAT");
+        return format && equalsIgnoreCase("COMPACT", format);
+    }();
+    return compact;
+}
+
+/*********************** format preserving integers ************************/
+
+/*
+ * The blowfish layers widen every integer onion to a BIGINT.  With
+ * CRYPTDB_INT_FORMAT=preserving (or CRYPTDB_CIPHER_FORMAT=compact) in the
+ * environment, new TINYINT, SMALLINT, MEDIUMINT and INT columns get the
+ * *_int_fp layers instead, which encrypt into an UNSIGNED column of the
+ * same width.  That includes the RND layer of an oOPE onion whenever the
+ * OPE ciphertexts fit in 32 bits.
+ *
+ * Tables created before keep their layers, as the choice is recorded in
+ * the layer names.  DETJOIN_int_fp only joins with DETJOIN_int_fp
+ * columns of the same width.
+ */
+static bool
+formatPreservingIntegers()
+{
+    static const bool preserving = [] () {
+        const char *const format = getenv("CRYPTDB_INT_FORMAT");
+        return compactCiphertexts()
+            || (format && equalsIgnoreCase("PRESERVING", format));
+    }();
+    return preserving;
+}
+
+// 0 if the type can not be encrypted in place
+static uint
+formatPreservingBits(enum enum_field_types type)
+{
+    switch (type) {
+        case MYSQL_TYPE_TINY:   return 8;
+        case MYSQL_TYPE_SHORT:  return 16;
+        case MYSQL_TYPE_INT24:  return 24;
+        case MYSQL_TYPE_LONG:   return 32;
+        default:                return 0;
+    }
+}
+
+static bool
+useFormatPreserving(const Create_field &cf)
+{
+    return formatPreservingIntegers()
+        && 0 != formatPreservingBits(cf.sql_type);
+}
+
+class FP_abstract_integer : public EncLayer {
+public:
+    FP_abstract_integer(const Create_field &cf, const std::string &seed_key)
+        : EncLayer(),
+          cinteger(cf, prng_expand(seed_key, fpe_int::key_bytes)),
+          fpe(cinteger.getKey(),
+              formatPreservingBits(cinteger.getFieldType())) {}
+    FP_abstract_integer(unsigned int id, const CryptedInteger &cinteger)
+        : EncLayer(id), cinteger(cinteger),
+          fpe(cinteger.getKey(),
+              formatPreservingBits(cinteger.getFieldType())) {}
+
+    std::string doSerialize() const {return cinteger.serialize();}
+    template <typename Type>
+        static std::unique_ptr<Type>
+        deserialize(unsigned int id, const std::string &serial)
+    {
+        const CryptedInteger &cint = CryptedInteger::deserialize(serial);
+        return std::unique_ptr<Type>(new Type(id, cint));
+    }
+
+    Create_field *newCreateField(const Create_field &cf,
+                                 const std::string &anonname = "")
+        const;
+
+protected:
+    uint64_t plainValue(const Item &ptext) const;
+    Item *plainItem(uint64_t p) const;
+    Item *cipherItem(uint64_t c) const;
+    Item *bitsItem() const;
+
+    // the range is that of the input field, so only the lowest layer
+    // of an onion sees a signed range
+    const CryptedInteger cinteger;
+    const fpe_int fpe;
+};
+
+Create_field *
+FP_abstract_integer::newCreateField(const Create_field &cf,
+                                    const std::string &anonname) const
+{
+    Create_field *const f0 =
+        integerCreateFieldHelper(cf, cinteger.getFieldType(), anonname);
+    f0->flags |= UNSIGNED_FLAG;
+    return f0;
+}
+
+uint64_t
+FP_abstract_integer::plainValue(const Item &ptext) const
+{
+    const uint64_t value = RiboldMYSQL::val_uint(ptext);
+    const std::pair<int64_t, uint64_t> range =
+        cinteger.getInclusiveRange();
+    const bool in_range =
+        range.first < 0
+            ? static_cast<int64_t>(value) >= range.first
+              && static_cast<int64_t>(value)
+                 <= static_cast<int64_t>(range.second)
+            : value >= static_cast<uint64_t>(range.first)
+              && value <= range.second;
+    TEST_Text(in_range, "can't handle out of range value!");
+
+    return value;
+}
+
+Item *
+FP_abstract_integer::plainItem(uint64_t p) const
+{
+    if (cinteger.getInclusiveRange().first < 0) {
+        const uint shift = 64 - fpe.bits();
+        const longlong s = static_cast<int64_t>(p << shift) >> shift;
+        return new (current_thd->mem_root) Item_int(s);
+    }
+
+    return new (current_thd->mem_root) Item_int(static_cast<ulonglong>(p));
+}
+
+Item *
+FP_abstract_integer::cipherItem(uint64_t c) const
+{
+    return new (current_thd->mem_root) Item_int(static_cast<ulonglong>(c));
+}
+
+Item *
+FP_abstract_integer::bitsItem() const
+{
+    Item *const bits = new (current_thd->mem_root)
+        Item_int(static_cast<ulonglong>(fpe.bits()));
+    bits->name = NULL;
+    return bits;
+}
+
+static udf_func u_decRNDIntFP = {
+    LEXSTRING("cryptdb_decrypt_int_fp_sem"),
+    INT_RESULT,
+    UDFTYPE_FUNCTION,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    0L,
+};
+
+class RND_int_fp : public FP_abstract_integer {
+public:
+    RND_int_fp(const Create_field &cf, const std::string &seed_key)
+        : FP_abstract_integer(cf, seed_key) {}
+    RND_int_fp(unsigned int id, const CryptedInteger &cinteger)
+        : FP_abstract_integer(id, cinteger) {}
+
+    SECLEVEL level() const {return SECLEVEL::RND;}
+    std::string name() const {return "RND_int_fp";}
+
+    Item *encrypt(const Item &ptext, uint64_t IV) const
+    {
+        const uint64_t p = plainValue(ptext);
+        const uint64_t c = fpe.encrypt(p, IV);
+        LOG(encl) << "RND_int_fp encrypt " << p << " IV " << IV
+                  << " --> " << c;
+        return cipherItem(c);
+    }
+
+    Item *decrypt(const Item &ctext, uint64_t IV) const
+    {
+        const uint64_t c = static_cast<const Item_int &>(ctext).value;
+        const uint64_t p = fpe.decrypt(c, IV);
+        LOG(encl) << "RND_int_fp decrypt " << c << " IV " << IV
+                  << " --> " << p;
+        return plainItem(p);
+    }
+
+    Item *decryptUDF(Item *const col, Item *const ivcol) const
+    {
+        List<Item> l;
+        l.push_back(col);
+        l.push_back(get_key_item(cinteger.getKey()));
+        l.push_back(ivcol);
+        l.push_back(bitsItem());
+
+        Item *const udfdec =
+            new (current_thd->mem_root) Item_func_udf_int(&u_decRNDIntFP, l);
+        udfdec->name = NULL;
+
+        Item *const udf =
+            new (current_thd->mem_root) Item_func_unsigned(udfdec);
+        udf->name = NULL;
+
+        return udf;
+    }
+};
+
+static udf_func u_decDETIntFP = {
+    LEXSTRING("cryptdb_decrypt_int_fp_det"),
+    INT_RESULT,
+    UDFTYPE_FUNCTION,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    0L,
+};
+
+class DET_int_fp : public FP_abstract_integer {
+public:
+    DET_int_fp(const Create_field &cf, const std::string &seed_key)
+        : FP_abstract_integer(cf, seed_key) {}
+    DET_int_fp(unsigned int id, const CryptedInteger &cinteger)
+        : FP_abstract_integer(id, cinteger) {}
+
+    virtual SECLEVEL level() const {return SECLEVEL::DET;}
+    virtual std::string name() const {return "DET_int_fp";}
+
+    Item *encrypt(const Item &ptext, uint64_t IV) const
+    {
+        const uint64_t p = plainValue(ptext);
+        const uint64_t c = fpe.encrypt(p);
+        LOG(encl) << name() << " enc " << p << "--->" << c;
+        return cipherItem(c);
+    }
+
+    Item *decrypt(const Item &ctext, uint64_t IV) const
+    {
+        const uint64_t c = static_cast<const Item_int &>(ctext).value;
+        const uint64_t p = fpe.decrypt(c);
+        LOG(encl) << name() << " dec " << c << "--->" << p;
+        return plainItem(p);
+    }
+
+    Item *decryptUDF(Item *const col, Item *const ivcol = NULL) const
+    {
+        List<Item> l;
+        l.push_back(col);
+        l.push_back(get_key_item(cinteger.getKey()));
+        l.push_back(bitsItem());
+
+        Item *const udfdec =
+            new (current_thd->mem_root) Item_func_udf_int(&u_decDETIntFP, l);
+        udfdec->name = NULL;
+
+        Item *const udf =
+            new (current_thd->mem_root) Item_func_unsigned(udfdec);
+        udf->name = NULL;
+
+        return udf;
+    }
+};
+
+class DETJOIN_int_fp : public DET_int_fp {
+public:
+    DETJOIN_int_fp(const Create_field &cf, const std::string &seed_key)
+        : DET_int_fp(cf, seed_key) {}
+    DETJOIN_int_fp(unsigned int id, const CryptedInteger &cinteger)
+        : DET_int_fp(id, cinteger) {}
+
+    SECLEVEL level() const {return SECLEVEL::DETJOIN;}
+    std::string name() const {return "DETJOIN_int_fp";}
+};
+
+
+/*********************** compact strings ***********************************/
+
+// the ciphertext columns have the type AES would give them, but
+// only as many bytes as the compact ciphertexts need
+static Create_field *
+compactStringCreateField(const Create_field &cf, unsigned long length,
+                         const std::string &anonname)
+{
+    const auto typelen = AESTypeAndLength(cf, false);
+    return arrayCreateFieldHelper(cf, length, typelen.first, anonname,
+                                  &my_charset_bin);
+}
+
+static Item *
+binaryStringItem(const std::string &s)
+{
+    return new (current_thd->mem_root) Item_string(make_thd_string(s),
+                                                   s.length(),
+                                                   &my_charset_bin);
+}
+
+static udf_func u_decRNDStringCTR = {
+    LEXSTRING("cryptdb_decrypt_text_ctr"),
+    STRING_RESULT,
+    UDFTYPE_FUNCTION,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    0L,
+};
+
+// RND_str without the padding: AES-CTR keyed by the row's IV
+class RND_str_ctr : public EncLayer {
+public:
+    RND_str_ctr(const Create_field &cf, const std::string &seed_key)
+        : EncLayer(), rawkey(prng_expand(seed_key, key_bytes)),
+          enckey(get_AES_enc_key(rawkey)) {}
+    RND_str_ctr(unsigned int id, const std::string &serial)
+        : EncLayer(id), rawkey(serial), enckey(get_AES_enc_key(rawkey)) {}
+
+    std::string doSerialize() const {return rawkey;}
+
+    SECLEVEL level() const {return SECLEVEL::RND;}
+    std::string name() const {return "RND_str_ctr";}
+    Create_field *newCreateField(const Create_field &cf,
+                                 const std::string &anonname = "") const
+    {
+        return compactStringCreateField(cf, cf.length, anonname);
+    }
+
+    Item *encrypt(const Item &ptext, uint64_t IV) const
+    {
+        const std::string enc =
+            encrypt_AES_CTR(ItemToString(ptext), enckey.get(),
+                            BytesFromInt(IV, SALT_LEN_BYTES));
+        LOG(encl) << "RND_str_ctr encrypt IV " << IV << " ---> len of enc "
+                  << enc.length();
+        return binaryStringItem(enc);
+    }
+
+    Item *decrypt(const Item &ctext, uint64_t IV) const
+    {
+        const std::string dec =
+            decrypt_AES_CTR(ItemToString(ctext), enckey.get(),
+                            BytesFromInt(IV, SALT_LEN_BYTES));
+        LOG(encl) << "RND_str_ctr decrypt IV " << IV << " ---> len of dec "
+                  << dec.length();
+        return binaryStringItem(dec);
+    }
+
+    Item *decryptUDF(Item *const col, Item *const ivcol) const
+    {
+        List<Item> l;
+        l.push_back(col);
+        l.push_back(get_key_item(rawkey));
+        l.push_back(ivcol);
+
+        return new (current_thd->mem_root)
+            Item_func_udf_str(&u_decRNDStringCTR, l);
+    }
+
+private:
+    const std::string rawkey;
+    static const int key_bytes = 16;
+    const std::unique_ptr<const AES_KEY> enckey;
+};
+
+static udf_func u_decDETStringLP = {
+    LEXSTRING("cryptdb_decrypt_text_lp"),
+    STRING_RESULT,
+    UDFTYPE_FUNCTION,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    0L,
+};
+
+// DET_str that keeps short strings at their length; see fpe_str
+class DET_str_lp : public EncLayer {
+public:
+    DET_str_lp(const Create_field &cf, const std::string &seed_key)
+        : EncLayer(), rawkey(prng_expand(seed_key, fpe_str::key_bytes)),
+          fpe(rawkey) {}
+    DET_str_lp(unsigned int id, const std::string &serial)
+        : EncLayer(id), rawkey(serial), fpe(rawkey) {}
+
+    std::string doSerialize() const {return rawkey;}
+
+    virtual SECLEVEL level() const {return SECLEVEL::DET;}
+    virtual std::string name() const {return "DET_str_lp";}
+    Create_field *newCreateField(const Create_field &cf,
+                                 const std::string &anonname = "") const
+    {
+        return compactStringCreateField(cf,
+                                        fpe_str::ciphertext_length(cf.length),
+                                        anonname);
+    }
+
+    Item *encrypt(const Item &ptext, uint64_t IV) const
+    {
+        const std::string enc = fpe.encrypt(ItemToString(ptext));
+        LOG(encl) << name() << " encrypt ---> len of enc " << enc.length();
+        return binaryStringItem(enc);
+    }
+
+    Item *decrypt(const Item &ctext, uint64_t IV) const
+    {
+        const std::string dec = fpe.decrypt(ItemToString(ctext));
+        LOG(encl) << name() << " decrypt ---> len of dec " << dec.length();
+        return binaryStringItem(dec);
+    }
+
+    Item *decryptUDF(Item *const col, Item *const ivcol = NULL) const
+    {
+        List<Item> l;
+        l.push_back(col);
+        l.push_back(get_key_item(rawkey));
+
+        return new (current_thd->mem_root)
+            Item_func_udf_str(&u_decDETStringLP, l);
+    }
+
+private:
+    const std::string rawkey;
+    const fpe_str fpe;
+};
+
+class DETJOIN_str_lp : public DET_str_lp {
+public:
+    DETJOIN_str_lp(const Create_field &cf, const std::string &seed_key)
+        : DET_str_lp(cf, seed_key) {}
+    DETJOIN_str_lp(unsigned int id, const std::string &serial)
+        : DET_str_lp(id, serial) {}
+
+    SECLEVEL level() const {return SECLEVEL::DETJOIN;}
+    std::string name() const {return "DETJOIN_str_lp";}
+};
+
+
 /*********************** RND ************************************************/
 
 class RND_int : public EncLayer {
@@ -425,6 +885,8 @@ public:
 
     Item *encrypt(const Item &ptext, uint64_t IV) const;
     Item *decrypt(const Item &ctext, uint64_t IV) const;
+    bool decryptBatch(uint64_t *const vals, const uint64_t *const IVs,
+                      size_t n) const;
     Item * decryptUDF(Item * const col, Item * const ivcol) const;
 
 private:
@@ -470,7 +932,12 @@ std::unique_ptr<EncLayer>
 RNDFactory::create(const Create_field &cf, const std::string &key)
 {
     if (isMySQLTypeNumeric(cf)) {
+        if (useFormatPreserving(cf)) {
+            return std::unique_ptr<EncLayer>(new RND_int_fp(cf, key));
+        }
         return std::unique_ptr<EncLayer>(new RND_int(cf, key));
+    } else if (compactCiphertexts()) {
+        return std::unique_ptr<EncLayer>(new RND_str_ctr(cf, key));
     } else {
         return std::unique_ptr<EncLayer>(new RND_str(cf, key));
     }
@@ -481,6 +948,11 @@ RNDFactory::deserialize(unsigned int id, const SerialLayer &sl)
 {
     if (sl.name == "RND_int") {
         return RND_int::deserialize(id, sl.layer_info);
+    } else if (sl.name == "RND_int_fp") {
+        return FP_abstract_integer::deserialize<RND_int_fp>(id,
+                                                        sl.layer_info);
+    } else if (sl.name == "RND_str_ctr") {
+        return std::unique_ptr<EncLayer>(new RND_str_ctr(id, sl.layer_info));
     } else {
         return std::unique_ptr<EncLayer>(new RND_str(id, sl.layer_info));
     }
@@ -546,6 +1018,16 @@ RND_int::decrypt(const Item &ctext, uint64_t IV) const
                Item_int(static_cast<ulonglong>(p));
 }
 
+bool
+RND_int::decryptBatch(uint64_t *const vals, const uint64_t *const IVs,
+                      size_t n) const
+{
+    bf.decrypt_batch(vals, vals, n, IVs);
+    LOG(encl) << "RND_int decrypt batch of " << n;
+
+    return true;
+}
+
 static udf_func u_decRNDInt = {
     LEXSTRING("cryptdb_decrypt_int_sem"),
     INT_RESULT,
@@ -690,6 +1172,8 @@ public:
     // FIXME: final
     Item *encrypt(const Item &ptext, uint64_t IV) const;
     Item *decrypt(const Item &ctext, uint64_t IV) const;
+    bool decryptBatch(uint64_t *const vals, const uint64_t *const IVs,
+                      size_t n) const;
     Item *decryptUDF(Item *const col, Item *const ivcol = NULL) const;
 
 protected:
@@ -808,9 +1292,13 @@ DETFactory::create(const Create_field &cf, const std::string &key)
         if (cf.sql_type == MYSQL_TYPE_DECIMAL
             || cf.sql_type == MYSQL_TYPE_NEWDECIMAL) {
             FAIL_TextMessageError("decimal support is broken");
+        } else if (useFormatPreserving(cf)) {
+            return std::unique_ptr<EncLayer>(new DET_int_fp(cf, key));
         } else {
             return std::unique_ptr<EncLayer>(new DET_int(cf, key));
         }
+    } else if (compactCiphertexts()) {
+        return std::unique_ptr<EncLayer>(new DET_str_lp(cf, key));
     } else {
         return std::unique_ptr<EncLayer>(new DET_str(cf, key));
     }
@@ -822,10 +1310,15 @@ DETFactory::deserialize(unsigned int id, const SerialLayer &sl)
     if ("DET_int" == sl.name) {
         return DET_abstract_integer::deserialize<DET_int>(id,
                                                        sl.layer_info);
+    } else if ("DET_int_fp" == sl.name) {
+        return FP_abstract_integer::deserialize<DET_int_fp>(id,
+                                                        sl.layer_info);
     } else if ("DET_dec" == sl.name) {
         FAIL_TextMessageError("decimal support broken");
     } else if ("DET_str" == sl.name) {
         return std::unique_ptr<EncLayer>(new DET_str(id, sl.layer_info));
+    } else if ("DET_str_lp" == sl.name) {
+        return std::unique_ptr<EncLayer>(new DET_str_lp(id, sl.layer_info));
     } else {
         FAIL_TextMessageError("Unknown type for DET deserialization!");
     }
@@ -878,6 +1371,17 @@ DET_abstract_integer::decrypt(const Item &ctext, uint64_t IV) const
     return new (current_thd->mem_root) Item_int(retdec);
 }
 
+bool
+DET_abstract_integer::decryptBatch(uint64_t *const vals,
+                                   const uint64_t *const IVs,
+                                   size_t n) const
+{
+    getBlowfish_().decrypt_batch(vals, vals, n);
+    LOG(encl) << "DET_int dec batch of " << n;
+
+    return true;
+}
+
 Item *
 DET_abstract_integer::decryptUDF(Item *const col, Item *const ivcol)
     const
@@ -1114,9 +1618,13 @@ DETJOINFactory::create(const Create_field &cf,
         if (cf.sql_type == MYSQL_TYPE_DECIMAL
             || cf.sql_type == MYSQL_TYPE_NEWDECIMAL) {
             FAIL_TextMessageError("decimal support is broken");
+        } else if (useFormatPreserving(cf)) {
+            return std::unique_ptr<EncLayer>(new DETJOIN_int_fp(cf, key));
         } else {
             return std::unique_ptr<EncLayer>(new DETJOIN_int(cf, key));
         }
+    } else if (compactCiphertexts()) {
+        return std::unique_ptr<EncLayer>(new DETJOIN_str_lp(cf, key));
     } else {
         return std::unique_ptr<EncLayer>(new DETJOIN_str(cf, key));
     }
@@ -1128,11 +1636,17 @@ DETJOINFactory::deserialize(unsigned int id, const SerialLayer &sl)
     if ("DETJOIN_int" == sl.name) {
         return DET_abstract_integer::deserialize<DETJOIN_int>(id,
                                                     sl.layer_info);
+    } else if ("DETJOIN_int_fp" == sl.name) {
+        return FP_abstract_integer::deserialize<DETJOIN_int_fp>(id,
+                                                        sl.layer_info);
     } else if ("DETJOIN_dec" == sl.name) {
         FAIL_TextMessageError("decimal support broken");
     } else if ("DETJOIN_str" == sl.name) {
         return std::unique_ptr<EncLayer>(new DETJOIN_str(id,
                                                          sl.layer_info));
+    } else if ("DETJOIN_str_lp" == sl.name) {
+        return std::unique_ptr<EncLayer>(new DETJOIN_str_lp(id,
+                                                            sl.layer_info));
     } else {
         FAIL_TextMessageError("DETJOINFactory does not recognize type!");
     }
@@ -1311,8 +1825,17 @@ toMultiple(size_t n, size_t multiple)
  * OPE_int::opeHelper(...), opePlainSize(...) and opeCiphSize(...) must all
  * play nice as OPE_int::opeHelper(...) assumes the doubling of field size
  * when it decides if a VARCHAR field is necessary, but this actual doubling
- * doesn't occur until opeCiphSize(...).
+ * doesn't occur until opeCiphSize(...).  Compact ciphertexts get a single
+ * extra byte instead of the doubling.
  */
+static size_t
+opePlainBytes(uint64_t inclusive_upper)
+{
+    return toMultiple(log2(inclusive_upper), BITS_PER_BYTE) / BITS_PER_BYTE;
+}
+
+static const size_t compact_ope_extra_bytes = 1;
+
 CryptedInteger
 OPE_int::opeHelper(const Create_field &f, const std::string &key)
 {
@@ -1325,9 +1848,15 @@ OPE_int::opeHelper(const Create_field &f, const std::string &key)
                               plain_inclusive_range);
     }
 
+    const uint64_t compact_bits =
+        (opePlainBytes(plain_inclusive_range.second)
+         + compact_ope_extra_bytes) * BITS_PER_BYTE;
+    const uint64_t compact_max = (1ULL << compact_bits) - 1;
     const auto crypto_inclusive_range =
-        std::make_pair(0, plain_inclusive_range.second
-                          * (2 + plain_inclusive_range.second));
+        compactCiphertexts()
+            ? std::make_pair(0, compact_max)
+            : std::make_pair(0, plain_inclusive_range.second
+                                * (2 + plain_inclusive_range.second));
     // FIXME: pass Create_field object so we can account for signage
     const std::pair<bool, enum enum_field_types> field_type =
         getTypeForRange(crypto_inclusive_range);
@@ -1341,9 +1870,7 @@ OPE_int::opeHelper(const Create_field &f, const std::string &key)
 static size_t
 opePlainSize(const CryptedInteger &cinteger)
 {
-    return toMultiple(log2(cinteger.getInclusiveRange().second),
-                           BITS_PER_BYTE)
-           / BITS_PER_BYTE;
+    return opePlainBytes(cinteger.getInclusiveRange().second);
 }
 
 // we need twice as many bytes for the cipher; this means that we
@@ -1351,6 +1878,9 @@ opePlainSize(const CryptedInteger &cinteger)
 static size_t
 opeCiphSize(const CryptedInteger &cinteger)
 {
+    if (compactCiphertexts()) {
+        return opePlainSize(cinteger) + compact_ope_extra_bytes;
+    }
     return 2 * opePlainSize(cinteger);
 }
 
@@ -1561,10 +2091,14 @@ HOMFactory::deserialize(unsigned int id, const SerialLayer &serial)
     return std::unique_ptr<EncLayer>(new HOM(id, serial.layer_info));
 }
 
+// negative values are n - |value|
 static ZZ
-ItemIntToZZ(const Item &ptext)
+ItemIntToZZ(const Item &ptext, const ZZ &n)
 {
     const ulonglong val = RiboldMYSQL::val_uint(ptext);
+    if (false == ptext.unsigned_flag && static_cast<longlong>(val) < 0) {
+        return n - ZZFromUint64(0 - val);
+    }
     return ZZFromUint64(val);
 }
 
@@ -1696,12 +2230,19 @@ HOM::newCreateField(const Create_field &cf,
 void
 HOM::unwait() const
 {
-    const std::unique_ptr<streamrng<arc4>>
-        prng(new streamrng<arc4>(seed_key));
-    sk = new Paillier_priv(Paillier_priv::keygen(prng.get(), nbits));
-    waiting = false;
+    std::call_once(keygen, [this] () {
+        const std::unique_ptr<streamrng<arc4>>
+            prng(new streamrng<arc4>(seed_key));
+        sk = new Paillier_priv(Paillier_priv::keygen(prng.get(), nbits));
+        waiting = false;
+    });
 }
 
+/*
+ * Plaintexts are signed: -m is n - m, so that a counter decremented past
+ * zero, or summed with negative values, decrypts to what MySQL would
+ * have.  Sums of 64 bit integers never get near n / 2.
+ */
 Item *
 HOM::encrypt(const Item &ptext, uint64_t IV) const
 {
@@ -1709,7 +2250,7 @@ HOM::encrypt(const Item &ptext, uint64_t IV) const
         this->unwait();
     }
 
-    const ZZ enc = sk->encrypt(ItemIntToZZ(ptext));
+    const ZZ enc = sk->encrypt(ItemIntToZZ(ptext, sk->pubkey()[0]));
     return ZZToItemStr(enc);
 }
 
@@ -1723,11 +2264,36 @@ HOM::decrypt(const Item &ctext, uint64_t IV) const
     const ZZ enc = ItemStrToZZ(ctext);
     const ZZ dec = sk->decrypt(enc);
     LOG(encl) << "HOM ciph " << enc << "---->" << dec;
+    const ZZ n = sk->pubkey()[0];
+    if (dec > n / 2) {
+        const ZZ neg = n - dec;
+        TEST_Text(NumBits(neg) <= 63 || power2_ZZ(63) == neg,
+                  "Summation produced an integer smaller than -2^63");
+        return new (current_thd->mem_root)
+            Item_int(static_cast<longlong>(0 - uint64FromZZ(neg)));
+    }
     TEST_Text(NumBytes(dec) <= 8,
               "Summation produced an integer larger than 64 bits");
     return ZZToItemInt(dec);
 }
 
+// GROUP BY results carry one ciphertext per group; decrypt_batch spreads
+// them over the cores
+bool
+HOM::decryptBatchBytes(const std::vector<std::pair<const uint8_t *, size_t> >
+                           &ctexts,
+                       uint64_t *const vals) const
+{
+    if (true == waiting) {
+        this->unwait();
+    }
+
+    const bool ok = sk->decrypt_batch(ctexts, vals);
+    LOG(encl) << "HOM decrypt batch of " << ctexts.size()
+              << (ok ? "" : " needs the slow path");
+    return ok;
+}
+
 static udf_func u_sum_a = {
     LEXSTRING("cryptdb_agg"),
     STRING_RESULT,
@@ -1784,6 +2350,18 @@ HOM::sumUDF(Item *const i1, Item *const i2) const
     return new (current_thd->mem_root) Item_func_udf_str(&u_sum_f, l);
 }
 
+Item *
+HOM::negate(const Item &ctext) const
+{
+    if (true == waiting) {
+        this->unwait();
+    }
+
+    // Enc(m)^-1 decrypts to n - m, ie -m
+    const ZZ inv = InvMod(ItemStrToZZ(ctext), sk->hompubkey());
+    return ZZToItemStr(inv);
+}
+
 HOM::~HOM() {
     delete sk;
 }
@@ -2004,6 +2582,10 @@ const std::vector<udf_func*> udf_list = {
     &u_decRNDString,
     &u_decDETInt,
     &u_decDETStr,
+    &u_decRNDIntFP,
+    &u_decDETIntFP,
+    &u_decRNDStringCTR,
+    &u_decDETStringLP,
     &u_sum_f,
     &u_sum_a,
     &u_search,
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 
 #include <util/util.hh>
 #include <crypto/prng.hh>
@@ -46,11 +48,14 @@ serial_pack(SECLEVEL l, const std::string &name,
            TypeText<SECLEVEL>::toText(l) + " " + name + " " + layer_info;
 }
 
+// where layer_counters.cc counts a layer
+struct LayerSlot;
+
 class EncLayer : public LeafDBMeta {
 public:
     virtual ~EncLayer() {}
-    EncLayer() : LeafDBMeta() {}
-    EncLayer(unsigned int id) : LeafDBMeta(id) {}
+    EncLayer() : LeafDBMeta(), counter_slot(nullptr) {}
+    EncLayer(unsigned int id) : LeafDBMeta(id), counter_slot(nullptr) {}
 
     TYPENAME("encLayer")
 
@@ -65,6 +70,25 @@ public:
     virtual Item *encrypt(const Item &ptext, uint64_t IV) const = 0;
     virtual Item *decrypt(const Item &ctext, uint64_t IV) const = 0;
 
+    // decrypts a column of integer ciphertexts in place (IVs[i] goes with
+    // vals[i]); layers without a batched path return false and leave
+    // vals alone, so the caller falls back to decrypt()
+    virtual bool decryptBatch(uint64_t *const vals,
+                              const uint64_t *const IVs, size_t n) const
+    {
+        return false;
+    }
+
+    // same for a column of binary string ciphertexts whose plaintexts are
+    // integers (HOM); the strings are only borrowed
+    virtual bool
+        decryptBatchBytes(const std::vector<std::pair<const uint8_t *,
+                                                      size_t> > &ctexts,
+                          uint64_t *const vals) const
+    {
+        return false;
+    }
+
     // returns the decryptUDF to remove the onion layer
     virtual Item *decryptUDF(Item * const col, Item * const ivcol = NULL)
         const
@@ -79,6 +103,9 @@ public:
                            this->doSerialize());
     }
 
+    // found on the layer's first count
+    mutable std::atomic<const LayerSlot *> counter_slot;
+
 protected:
      friend class EncLayerFactory;
 };
@@ -101,10 +128,15 @@ public:
     //TODO needs multi encrypt and decrypt
     Item *encrypt(const Item &p, uint64_t IV) const;
     Item * decrypt(const Item &c, uint64_t IV) const;
+    bool decryptBatchBytes(const std::vector<std::pair<const uint8_t *,
+                                                       size_t> > &ctexts,
+                           uint64_t *const vals) const;
 
     //expr is the expression (e.g. a field) over which to sum
     Item *sumUDA(Item *const expr) const;
     Item *sumUDF(Item *const i1, Item *const i2) const;
+    // the ciphertext that subtracts what @ctext adds when summed
+    Item *negate(const Item &ctext) const;
 
 protected:
     std::string const seed_key;
@@ -112,9 +144,11 @@ protected:
     mutable Paillier_priv * sk;
 
 private:
+    // makes the key the first time it is needed, once whatever the thread
     void unwait() const;
 
-    mutable bool waiting;
+    mutable std::once_flag keygen;
+    mutable std::atomic<bool> waiting;
 };
 
 class Search : public EncLayer {
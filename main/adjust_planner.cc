@@ -0,0 +1,191 @@
+#include <ctype.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <tuple>
+
+#include <main/adjust_planner.hh>
+#include <main/macro_util.hh>
+#include <util/cryptdb_log.hh>
+
+// A change of the default database: the bare name traces log for
+// COM_INIT_DB, or USE db; either name may be quoted with backticks.
+static bool
+databaseSwitch(const std::string &statement, std::string *const db)
+{
+    static const char *const keywords[] = {"BEGIN", "COMMIT", "ROLLBACK"};
+
+    std::istringstream in(statement);
+    std::string first;
+    std::string name;
+    std::string rest;
+    if (!(in >> first) || (in >> name && in >> rest)) {
+        return false;
+    }
+    if (false == name.empty() && false == equalsIgnoreCase("USE", first)) {
+        return false;
+    }
+    if (name.empty()) {
+        for (const char *const keyword : keywords) {
+            if (equalsIgnoreCase(keyword, first)) {
+                return false;
+            }
+        }
+        name = first;
+    }
+
+    if (name.length() > 1 && '`' == name[0] && '`' == *name.rbegin()) {
+        name = name.substr(1, name.length() - 2);
+    }
+    if (name.empty()
+        || name.end() !=
+            std::find_if(name.begin(), name.end(),
+                         [] (char c) {return !isalnum(c) && '_' != c
+                                             && '$' != c;})) {
+        return false;
+    }
+
+    *db = name;
+    return true;
+}
+
+std::vector<TraceStatement>
+readTraceStatements(std::istream &in, const std::string &default_db)
+{
+    std::vector<TraceStatement> statements;
+    std::string db = default_db;
+    std::string statement;
+    std::string line;
+    while (true) {
+        const bool more = static_cast<bool>(std::getline(in, line));
+        if (more && 0 == line.compare(0, 2, "--")) {
+            continue;
+        }
+
+        const bool last_line = !more || line.empty() || ';' == *line.rbegin();
+        if (more && false == line.empty()) {
+            statement += (statement.empty() ? "" : " ")
+                       + (';' == *line.rbegin()
+                            ? line.substr(0, line.length() - 1) : line);
+        }
+
+        if (last_line && false == statement.empty()) {
+            if (false == databaseSwitch(statement, &db)) {
+                statements.push_back(TraceStatement{db, statement});
+            }
+            statement.clear();
+        }
+
+        if (!more) {
+            return statements;
+        }
+    }
+}
+
+void
+AdjustmentPlanner::readTrace(std::istream &in, const std::string &default_db)
+{
+    const std::vector<TraceStatement> &read =
+        readTraceStatements(in, default_db);
+    this->statements.insert(this->statements.end(), read.begin(),
+                            read.end());
+}
+
+AdjustmentPlanner::Plan
+AdjustmentPlanner::plan()
+{
+    // (database, table, field, onion) -> level
+    std::map<std::tuple<std::string, std::string, std::string, onion>,
+             SECLEVEL> lowest;
+
+    this->failures = 0;
+    for (const auto &it : this->statements) {
+        AdjustmentNeed need;
+        bool needed = false;
+        bool failed = false;
+        try {
+            needed = Rewriter::neededAdjustment(it.query,
+                                                *this->ps.getSchemaInfo(),
+                                                it.default_db, this->ps,
+                                                &need);
+        } catch (const AbstractException &e) {
+            LOG(warn) << "can not plan [" << it.query << "]: " << e;
+            failed = true;
+        } catch (const CryptDBError &e) {
+            LOG(warn) << "can not plan [" << it.query << "]: " << e.msg;
+            failed = true;
+        }
+        // the THDs of the rewrite and the embedded connection go with
+        // each statement, not with the whole trace
+        this->ps.endQuery(failed);
+        if (failed) {
+            ++this->failures;
+            continue;
+        }
+        if (false == needed) {
+            continue;
+        }
+
+        const auto key =
+            std::make_tuple(need.database, need.table, need.field, need.o);
+        const auto level = lowest.find(key);
+        if (lowest.end() == level || need.tolevel < level->second) {
+            lowest[key] = need.tolevel;
+        }
+    }
+
+    Plan out;
+    for (const auto &it : lowest) {
+        const AdjustmentNeed need{std::get<0>(it.first),
+                                  std::get<1>(it.first),
+                                  std::get<2>(it.first),
+                                  std::get<3>(it.first), it.second};
+        out[std::make_pair(need.database, need.table)].push_back(need);
+    }
+
+    return out;
+}
+
+void
+AdjustmentPlanner::apply(const Plan &plan)
+{
+    for (const auto &it : plan) {
+        std::cout << GREEN_BEGIN << "Adjusting " << it.first.first << "."
+                  << it.first.second << ":" << COLOR_END;
+        for (const auto &need : it.second) {
+            std::cout << " " << need.field << "."
+                      << TypeText<onion>::toText(need.o) << "="
+                      << TypeText<SECLEVEL>::toText(need.tolevel);
+        }
+        std::cout << std::endl;
+
+        {
+            const std::unique_ptr<AbstractQueryExecutor>
+                executor(Rewriter::batchAdjustment(it.second,
+                                                   *this->ps.getSchemaInfo(),
+                                                   this->ps));
+            Rewriter::drive(executor.get(),
+                            NextParams(this->ps, it.first.first, "DO 0;"));
+        }
+        this->ps.endQuery(false);
+    }
+}
+
+unsigned int
+AdjustmentPlanner::run(unsigned int max_rounds)
+{
+    unsigned int adjusted = 0;
+    for (unsigned int round = 0; round < max_rounds; ++round) {
+        const Plan &plan = this->plan();
+        if (plan.empty()) {
+            break;
+        }
+
+        this->apply(plan);
+        for (const auto &it : plan) {
+            adjusted += it.second.size();
+        }
+    }
+
+    return adjusted;
+}
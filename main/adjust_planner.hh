@@ -0,0 +1,66 @@
+#pragma once
+
+/*
+ * adjust_planner.hh
+ *
+ *  Offline onion pre-adjustment.  A trace of the production workload is
+ *  rewritten against the current schema without executing any of it,
+ *  collecting the lowest level every onion it touches has to reach;
+ *  then each table has all of those onions peeled by a single UPDATE.
+ *  Peeling an onion can expose the next adjustment a statement needs
+ *  (the rewriter stops at the first), so planning repeats until the
+ *  trace needs none.  The proxy then starts with its onions at the
+ *  workload's steady state instead of adjusting them under live traffic.
+ *
+ *  Traces hold one statement per line (a blank line or a trailing ';'
+ *  ends it, '--' starts a comment).  A line with only a database name,
+ *  which is how COM_INIT_DB packets are written to them, changes the
+ *  default database, as does USE.
+ *  See traces/wordpress-usage.sql.
+ */
+
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <main/rewrite_main.hh>
+
+struct TraceStatement {
+    std::string default_db;
+    std::string query;
+};
+
+// the statements of a trace, in order; @default_db until it changes
+std::vector<TraceStatement> readTraceStatements(std::istream &in,
+                                               const std::string &default_db);
+
+class AdjustmentPlanner {
+public:
+    // (database, table) -> the onions it needs adjusted
+    typedef std::map<std::pair<std::string, std::string>,
+                     std::vector<AdjustmentNeed> > Plan;
+
+    // each statement is a query of @ps, which starts with a THD as a
+    // client connection does
+    AdjustmentPlanner(ProxyState &ps)
+        : ps(ps), failures(0) {ps.safeCreateEmbeddedTHD();}
+
+    void readTrace(std::istream &in, const std::string &default_db);
+
+    Plan plan();
+    // adjusts the onions of the plan, one table at a time
+    void apply(const Plan &plan);
+    // plans and applies at most max_rounds times, until the trace needs
+    // no adjustments; returns the number of onions adjusted
+    unsigned int run(unsigned int max_rounds);
+
+    size_t statementCount() const {return statements.size();}
+    // statements the last plan() could not rewrite
+    unsigned int failureCount() const {return failures;}
+
+private:
+    ProxyState &ps;
+    std::vector<TraceStatement> statements;
+    unsigned int failures;
+};
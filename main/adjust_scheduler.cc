@@ -0,0 +1,333 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include <main/adjust_scheduler.hh>
+#include <util/util.hh>
+
+static uint64_t
+envCount(const char *const name, uint64_t dflt)
+{
+    const char *const s = getenv(name);
+    return s ? strtoull(s, NULL, 10) : dflt;
+}
+
+uint64_t
+adjustWorkers()
+{
+    static const uint64_t workers = envCount("CRYPTDB_ADJUST_WORKERS", 1);
+    return workers;
+}
+
+uint64_t
+adjustPerTable()
+{
+    static const uint64_t per_table =
+        std::max(envCount("CRYPTDB_ADJUST_PER_TABLE", 1), uint64_t(1));
+    return per_table;
+}
+
+uint64_t
+adjustBudget()
+{
+    static const uint64_t budget =
+        std::min(std::max(envCount("CRYPTDB_ADJUST_BUDGET", 50),
+                          uint64_t(1)),
+                 uint64_t(100));
+    return budget;
+}
+
+// how long a failed peel waits before a query may retry it
+static const std::chrono::seconds retry_after(5);
+
+static std::string
+firstValue(const std::unique_ptr<DBResult> &dbres, unsigned int column)
+{
+    const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+    if (!row) {
+        throw std::runtime_error("empty result");
+    }
+    if (!row[column]) {
+        return "NULL";
+    }
+
+    const unsigned long *const l = mysql_fetch_lengths(dbres->n);
+    return std::string(row[column], l[column]);
+}
+
+// the same steps as the chunk loop in OnionAdjustmentExecutor, inside a
+// transaction the caller opened
+static bool
+peelChunkSteps(const std::unique_ptr<Connect> &conn, const OnionPeel &peel,
+               std::string *const boundary, bool *const done)
+{
+    std::unique_ptr<DBResult> dbres;
+    RETURN_FALSE_IF_FALSE(conn->execute(peel.lockProgressQuery(), &dbres));
+    if (1 != mysql_num_rows(dbres->n)) {
+        throw std::runtime_error("peel progress is missing");
+    }
+    const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+    const std::string lower = row[0] ? row[0] : "NULL";
+    *done = row[1] && std::string("1") == row[1];
+    *boundary = lower;
+    if (*done) {
+        return true;
+    }
+
+    RETURN_FALSE_IF_FALSE(conn->execute(peel.nextBoundaryQuery(lower),
+                                        &dbres));
+    const std::string upper = firstValue(dbres, 0);
+    if ("NULL" == upper) {
+        RETURN_FALSE_IF_FALSE(conn->execute(peel.finishProgressQuery()));
+        *done = true;
+        return true;
+    }
+
+    RETURN_FALSE_IF_FALSE(conn->execute(peel.peelChunkQuery(lower, upper)));
+    RETURN_FALSE_IF_FALSE(conn->execute(peel.advanceProgressQuery(upper)));
+    *boundary = upper;
+
+    return true;
+}
+
+static void
+peelChunk(const std::unique_ptr<Connect> &conn, const OnionPeel &peel,
+          std::string *const boundary, bool *const done)
+{
+    if (false == conn->execute("START TRANSACTION")) {
+        throw std::runtime_error(conn->getError());
+    }
+
+    std::string error;
+    try {
+        if (false == peelChunkSteps(conn, peel, boundary, done)) {
+            error = conn->getError();
+        }
+    } catch (const std::runtime_error &e) {
+        error = e.what();
+    }
+
+    if (false == error.empty()) {
+        conn->execute("ROLLBACK");
+        throw std::runtime_error(error);
+    }
+
+    if (false == conn->execute("COMMIT")) {
+        throw std::runtime_error(conn->getError());
+    }
+}
+
+AdjustmentScheduler::AdjustmentScheduler(const std::string &server,
+                                         const std::string &user,
+                                         const std::string &passwd,
+                                         uint port)
+    : server(server), user(user), passwd(passwd), port(port),
+      has_server(true), stopping(false), next_seq(0) {}
+
+AdjustmentScheduler::AdjustmentScheduler()
+    : port(0), has_server(false), stopping(false), next_seq(0) {}
+
+AdjustmentScheduler::~AdjustmentScheduler()
+{
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->wakeup.notify_all();
+
+    // unfinished peels are picked up again by the next proxy
+    for (auto &it : this->workers) {
+        it.join();
+    }
+}
+
+std::string
+AdjustmentScheduler::tableKey(const OnionPeel &peel)
+{
+    return peel.getDatabase() + "." + peel.getAnonTable();
+}
+
+void
+AdjustmentScheduler::enqueue(Job *const job)
+{
+    job->state = State::Queued;
+    this->queue.insert(Ticket{job->priority, job->seq, job->peel.getId()});
+    this->wakeup.notify_all();
+}
+
+void
+AdjustmentScheduler::startWorkers()
+{
+    // no threads until there is something to peel
+    while (this->workers.size() < adjustWorkers()) {
+        this->workers.push_back(
+            std::thread(&AdjustmentScheduler::worker, this));
+    }
+}
+
+void
+AdjustmentScheduler::submit(const OnionPeel &peel)
+{
+    assert(this->enabled() && peel.getId());
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (this->jobs.end() != this->jobs.find(peel.getId())) {
+        return;
+    }
+
+    Job *const job = new Job(peel, this->next_seq++);
+    this->jobs[peel.getId()] = std::shared_ptr<Job>(job);
+    this->enqueue(job);
+    this->startWorkers();
+}
+
+bool
+AdjustmentScheduler::demand(const OnionPeel &peel)
+{
+    if (false == this->enabled()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    const auto it = this->jobs.find(peel.getId());
+    if (this->jobs.end() == it) {
+        Job *const job = new Job(peel, this->next_seq++);
+        job->priority = 1;
+        this->jobs[peel.getId()] = std::shared_ptr<Job>(job);
+        this->enqueue(job);
+        this->startWorkers();
+        return false;
+    }
+
+    Job *const job = it->second.get();
+    switch (job->state) {
+        case State::Done:
+            return true;
+        case State::Queued:
+            this->queue.erase(Ticket{job->priority, job->seq, peel.getId()});
+            ++job->priority;
+            this->enqueue(job);
+            return false;
+        case State::Running:
+            ++job->priority;
+            return false;
+        case State::Failed:
+            ++job->priority;
+            if (std::chrono::steady_clock::now() - job->failed_at
+                > retry_after) {
+                this->enqueue(job);
+            }
+            return false;
+    }
+
+    assert(false);
+}
+
+void
+AdjustmentScheduler::forget(uint64_t id)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    const auto it = this->jobs.find(id);
+    if (this->jobs.end() == it) {
+        return;
+    }
+
+    // a running job is let go by its worker
+    const Job &job = *it->second;
+    if (State::Queued == job.state) {
+        this->queue.erase(Ticket{job.priority, job.seq, id});
+    }
+    this->jobs.erase(it);
+}
+
+std::vector<AdjustmentScheduler::Status>
+AdjustmentScheduler::status() const
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    std::vector<Status> out;
+    for (const auto &it : this->jobs) {
+        const Job &job = *it.second;
+        out.push_back(Status{it.first, job.peel.getDatabase(),
+                             job.peel.getAnonTable(), job.peel.getAnonOnion(),
+                             job.state, job.priority, job.chunks,
+                             job.boundary, job.error});
+    }
+
+    return out;
+}
+
+std::shared_ptr<AdjustmentScheduler::Job>
+AdjustmentScheduler::take()
+{
+    std::unique_lock<std::mutex> guard(this->lock);
+    while (false == this->stopping) {
+        for (auto it = this->queue.begin(); it != this->queue.end(); ++it) {
+            const std::shared_ptr<Job> job = this->jobs[it->id];
+            uint64_t &table_running = this->running[tableKey(job->peel)];
+            if (table_running >= adjustPerTable()) {
+                continue;
+            }
+
+            ++table_running;
+            job->state = State::Running;
+            this->queue.erase(it);
+            return job;
+        }
+
+        this->wakeup.wait(guard);
+    }
+
+    return std::shared_ptr<Job>();
+}
+
+void
+AdjustmentScheduler::worker()
+{
+    assert(0 == mysql_thread_init());
+
+    std::unique_ptr<Connect> conn;
+    while (const std::shared_ptr<Job> job = this->take()) {
+        const auto start = std::chrono::steady_clock::now();
+        std::string boundary, error;
+        bool done = false;
+        try {
+            if (!conn) {
+                conn.reset(new Connect(this->server, this->user,
+                                       this->passwd, this->port));
+            }
+            peelChunk(conn, job->peel, &boundary, &done);
+        } catch (const std::runtime_error &e) {
+            error = e.what();
+            conn.reset();
+        }
+        const auto took = std::chrono::steady_clock::now() - start;
+
+        std::unique_lock<std::mutex> guard(this->lock);
+        --this->running[tableKey(job->peel)];
+        // forgotten while we were peeling
+        if (this->jobs.end() != this->jobs.find(job->peel.getId())) {
+            if (false == error.empty()) {
+                job->state = State::Failed;
+                job->error = error;
+                job->failed_at = std::chrono::steady_clock::now();
+            } else if (done) {
+                job->state = State::Done;
+            } else {
+                ++job->chunks;
+                job->boundary = boundary;
+                this->enqueue(job.get());
+            }
+        }
+        this->wakeup.notify_all();
+
+        // stay within the budget
+        const int64_t budget = adjustBudget();
+        const auto rest =
+            took * (100 - budget) / budget
+            + std::chrono::milliseconds(peelThrottleMs());
+        this->wakeup.wait_for(guard, rest,
+                              [this] () {return this->stopping;});
+    }
+
+    mysql_thread_end();
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+/*
+ * adjust_scheduler.hh
+ *
+ *  Background onion peeling.  With CRYPTDB_ADJUST_WORKERS (1 by default)
+ *  above 0, the query that triggers a chunked adjustment only moves the
+ *  metadata and hands the peel to this scheduler; it is then answered
+ *  through bothLayers(), which decrypts the rows that are not peeled yet
+ *  on the server.  That is slower than reading the peeled column, but
+ *  correct, and the client no longer waits for the whole column.
+ *
+ *  The workers peel one chunk per turn on their own connections to the
+ *  remote server, taking the queued peel with the highest priority (the
+ *  number of queries that had to read through the fallback; oldest
+ *  first among equals) whose table has fewer than CRYPTDB_ADJUST_PER_TABLE
+ *  (1) peels running.  Each worker keeps its share of the time to
+ *  CRYPTDB_ADJUST_BUDGET (50) percent by sleeping after every chunk in
+ *  proportion to how long the chunk took, on top of
+ *  CRYPTDB_PEEL_THROTTLE_MS.
+ *
+ *  The workers never touch the embedded database; once a peel is done
+ *  the next query on its table takes it out of the schema.  Peels that
+ *  fail are retried when a query next needs them.  Writes meanwhile put
+ *  back the peeled layers on the rows the peel has yet to reach; see
+ *  OnionPeel::writeBothLayers().  They lock the progress row in share
+ *  mode and the chunks lock it for update, so an UPDATE and a chunk over
+ *  the same rows can deadlock; InnoDB rolls one of them back, and a
+ *  chunk that fails is retried.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <main/onion_peel.hh>
+
+// 0 if adjustments should finish in the query that triggered them
+uint64_t adjustWorkers();
+uint64_t adjustPerTable();
+// percent of each worker's time spent peeling
+uint64_t adjustBudget();
+
+class AdjustmentScheduler {
+public:
+    enum class State {Queued, Running, Done, Failed};
+
+    struct Status {
+        uint64_t id;
+        std::string db;
+        std::string anon_table;
+        std::string anon_onion;
+        State state;
+        uint64_t priority;
+        uint64_t chunks;
+        // the last peeled primary key, "NULL" before the first chunk
+        std::string boundary;
+        std::string error;
+    };
+
+    AdjustmentScheduler(const std::string &server, const std::string &user,
+                        const std::string &passwd, uint port);
+    // no server to peel on: never enabled
+    AdjustmentScheduler();
+    ~AdjustmentScheduler();
+
+    bool enabled() const {return has_server && adjustWorkers() > 0;}
+
+    // hand over a peel whose progress row is committed
+    void submit(const OnionPeel &peel);
+    // a query had to read through the fallback; queues peels the
+    // scheduler does not know about (ie, left by an earlier proxy) and
+    // retries failed ones.  Returns true once the peel is done.
+    bool demand(const OnionPeel &peel);
+    // the peel was taken out of the schema
+    void forget(uint64_t id);
+
+    std::vector<Status> status() const;
+
+private:
+    struct Job {
+        Job(const OnionPeel &peel, uint64_t seq)
+            : peel(peel), seq(seq), state(State::Queued), priority(0),
+              chunks(0), boundary("NULL") {}
+
+        const OnionPeel peel;
+        const uint64_t seq;
+        State state;
+        uint64_t priority;
+        uint64_t chunks;
+        std::string boundary;
+        std::string error;
+        std::chrono::steady_clock::time_point failed_at;
+    };
+
+    // highest priority first, then oldest
+    struct Ticket {
+        uint64_t priority;
+        uint64_t seq;
+        uint64_t id;
+
+        bool operator<(const Ticket &other) const
+        {
+            return priority != other.priority ? priority > other.priority
+                                              : seq < other.seq;
+        }
+    };
+
+    const std::string server;
+    const std::string user;
+    const std::string passwd;
+    const uint port;
+    const bool has_server;
+
+    mutable std::mutex lock;
+    std::condition_variable wakeup;
+    bool stopping;
+    uint64_t next_seq;
+    std::map<uint64_t, std::shared_ptr<Job> > jobs;
+    std::set<Ticket> queue;
+    // running peels per db.table
+    std::map<std::string, uint64_t> running;
+    std::vector<std::thread> workers;
+
+    // lock must be held
+    void enqueue(Job *const job);
+    void startWorkers();
+
+    std::shared_ptr<Job> take();
+    void worker();
+
+    static std::string tableKey(const OnionPeel &peel);
+};
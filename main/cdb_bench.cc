@@ -0,0 +1,565 @@
+/*
+ * cdb_bench.cc
+ *
+ *  Microbenchmarks of the crypto primitives and of the encryption and
+ *  decryption of every EncLayer, printed as the CSV of util/bench.hh.
+ *
+ *    cdb_bench [-f filter] [-n samples] [-t target_msec] [-d embed_dir]
+ *
+ *  The inputs come from a fixed seed, so two runs measure the same work.
+ *  The layers need the embedded MySQL for their Items and column
+ *  definitions; it is only started (in embed_dir) if a layer benchmark
+ *  passes the filter.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <crypto/aes.hh>
+#include <crypto/arc4.hh>
+#include <crypto/BasicCrypto.hh>
+#include <crypto/blowfish.hh>
+#include <crypto/cbc.hh>
+#include <crypto/cmc.hh>
+#include <crypto/ECJoin.hh>
+#include <crypto/hgd.hh>
+#include <crypto/ope.hh>
+#include <crypto/paillier.hh>
+#include <crypto/prng.hh>
+#include <crypto/SWPSearch.hh>
+#include <main/CryptoHandlers.hh>
+#include <parser/embedmysql.hh>
+#include <parser/lex_util.hh>
+#include <parser/sql_utils.hh>
+#include <util/bench.hh>
+#include <util/onions.hh>
+
+using NTL::ZZ;
+using NTL::to_ZZ;
+
+// inputs a benchmark cycles through
+static const size_t ninputs = 1024;
+
+static std::string
+letters(PRNG *const r, size_t length)
+{
+    std::string out = r->rand_string(length);
+    for (auto &c : out) {
+        c = 'a' + static_cast<uint8_t>(c) % 26;
+    }
+
+    return out;
+}
+
+// words of 3 to 10 letters, as SWP takes them
+static std::string
+words(PRNG *const r, size_t length)
+{
+    std::string out;
+    while (out.size() < length) {
+        if (false == out.empty()) {
+            out += ' ';
+        }
+        out += letters(r, 3 + r->rand<uint8_t>() % 8);
+    }
+
+    return out.substr(0, length);
+}
+
+template<class BlockCipher>
+static void
+benchBlockCipher(BenchSuite *const suite, const std::string &name,
+                 const BlockCipher &c, PRNG *const r)
+{
+    const std::string block = r->rand_string(BlockCipher::blocksize);
+    suite->run(name, "block_enc", BlockCipher::blocksize,
+               [&] (uint64_t n) {
+        std::string out(BlockCipher::blocksize, 0);
+        for (uint64_t i = 0; i < n; ++i) {
+            c.block_encrypt(&block[0], &out[0]);
+            benchKeep(out);
+        }
+    });
+
+    for (const size_t size : {16, 64, 256, 1024, 4096}) {
+        const std::string ptext = r->rand_string(size);
+        const std::string iv = r->rand_string(BlockCipher::blocksize);
+        const std::string bytes = std::to_string(size);
+        std::string cbc, cmc;
+        cbc_encrypt(&c, iv, ptext, &cbc);
+        cmc_encrypt(&c, ptext, &cmc);
+
+        suite->run(name + "_cbc", "enc:" + bytes, size, [&] (uint64_t n) {
+            std::string out;
+            for (uint64_t i = 0; i < n; ++i) {
+                cbc_encrypt(&c, iv, ptext, &out);
+                benchKeep(out);
+            }
+        });
+        suite->run(name + "_cbc", "dec:" + bytes, size, [&] (uint64_t n) {
+            std::string out;
+            for (uint64_t i = 0; i < n; ++i) {
+                cbc_decrypt(&c, iv, cbc, &out);
+                benchKeep(out);
+            }
+        });
+        suite->run(name + "_cmc", "enc:" + bytes, size, [&] (uint64_t n) {
+            std::string out;
+            for (uint64_t i = 0; i < n; ++i) {
+                cmc_encrypt(&c, ptext, &out);
+                benchKeep(out);
+            }
+        });
+        suite->run(name + "_cmc", "dec:" + bytes, size, [&] (uint64_t n) {
+            std::string out;
+            for (uint64_t i = 0; i < n; ++i) {
+                cmc_decrypt(&c, cmc, &out);
+                benchKeep(out);
+            }
+        });
+    }
+}
+
+static void
+benchBlowfish(BenchSuite *const suite, PRNG *const r)
+{
+    const blowfish bf(r->rand_string(16));
+    std::vector<uint64_t> values(ninputs);
+    for (auto &v : values) {
+        v = r->rand<uint64_t>();
+    }
+
+    suite->run("blowfish", "enc:u64", 8, [&] (uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            benchKeep(bf.encrypt(values[i % ninputs]));
+        }
+    });
+    suite->run("blowfish", "dec:u64", 8, [&] (uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            benchKeep(bf.decrypt(values[i % ninputs]));
+        }
+    });
+    suite->run("blowfish", "enc_batch:u64", 8, [&] (uint64_t n) {
+        std::vector<uint64_t> out(ninputs);
+        for (uint64_t done = 0; done < n; done += ninputs) {
+            bf.encrypt_batch(values.data(), out.data(),
+                             std::min<uint64_t>(ninputs, n - done));
+            benchKeep(out);
+        }
+    });
+    suite->run("blowfish", "dec_batch:u64", 8, [&] (uint64_t n) {
+        std::vector<uint64_t> out(ninputs);
+        for (uint64_t done = 0; done < n; done += ninputs) {
+            bf.decrypt_batch(values.data(), out.data(),
+                             std::min<uint64_t>(ninputs, n - done));
+            benchKeep(out);
+        }
+    });
+}
+
+// The OPE caches the gaps of every range it went through, so the inputs
+// of a benchmark that cycles through them soon find their whole path
+// cached.  The enc and dec rows start each pass over the inputs from a
+// fresh OPE, as the first values of a column do; the _warm rows reuse
+// one that has seen every input.
+static void
+benchOPE(BenchSuite *const suite, PRNG *const r)
+{
+    for (const auto bits : {std::make_pair(32, 64), std::make_pair(64, 128)}) {
+        const std::string params =
+            std::to_string(bits.first) + ":" + std::to_string(bits.second);
+        const std::string key = r->rand_string(16);
+        OPE warm(key, bits.first, bits.second);
+        std::vector<ZZ> ptexts(ninputs), ctexts(ninputs);
+        for (size_t i = 0; i < ninputs; ++i) {
+            ptexts[i] = r->rand_zz_mod(to_ZZ(1) << bits.first);
+            ctexts[i] = warm.encrypt(ptexts[i]);
+        }
+
+        suite->run("ope", "enc:" + params, bits.first / 8,
+                   [&] (uint64_t n) {
+            std::unique_ptr<OPE> ope;
+            for (uint64_t i = 0; i < n; ++i) {
+                if (0 == i % ninputs) {
+                    ope.reset(new OPE(key, bits.first, bits.second));
+                }
+                benchKeep(ope->encrypt(ptexts[i % ninputs]));
+            }
+        });
+        suite->run("ope", "dec:" + params, bits.first / 8,
+                   [&] (uint64_t n) {
+            std::unique_ptr<OPE> ope;
+            for (uint64_t i = 0; i < n; ++i) {
+                if (0 == i % ninputs) {
+                    ope.reset(new OPE(key, bits.first, bits.second));
+                }
+                benchKeep(ope->decrypt(ctexts[i % ninputs]));
+            }
+        });
+        suite->run("ope", "enc_warm:" + params, bits.first / 8,
+                   [&] (uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                benchKeep(warm.encrypt(ptexts[i % ninputs]));
+            }
+        });
+        suite->run("ope", "dec_warm:" + params, bits.first / 8,
+                   [&] (uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                benchKeep(warm.decrypt(ctexts[i % ninputs]));
+            }
+        });
+
+        // the draws of the OPE's first step
+        const ZZ domain = to_ZZ(1) << bits.first;
+        const ZZ range = to_ZZ(1) << bits.second;
+        streamrng<arc4> coins("cdb_bench hgd");
+        suite->run("hgd", params, 0, [&] (uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                benchKeep(HGD(range / 2, domain, range - domain, &coins));
+            }
+        });
+    }
+}
+
+static void
+benchPaillier(BenchSuite *const suite, PRNG *const r)
+{
+    Paillier_priv pp(Paillier_priv::keygen(r));
+    std::vector<ZZ> ptexts(ninputs), ctexts(ninputs);
+    for (size_t i = 0; i < ninputs; ++i) {
+        ptexts[i] = to_ZZ(r->rand<uint64_t>());
+        ctexts[i] = pp.encrypt(ptexts[i]);
+    }
+
+    suite->run("paillier", "enc:u64", 8, [&] (uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            benchKeep(pp.encrypt(ptexts[i % ninputs]));
+        }
+    });
+    suite->run("paillier", "dec:u64", 8, [&] (uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            benchKeep(pp.decrypt(ctexts[i % ninputs]));
+        }
+    });
+    suite->run("paillier", "add", 0, [&] (uint64_t n) {
+        ZZ sum = ctexts[0];
+        for (uint64_t i = 0; i < n; ++i) {
+            sum = pp.add(sum, ctexts[i % ninputs]);
+        }
+        benchKeep(sum);
+    });
+}
+
+static void
+benchSWP(BenchSuite *const suite, PRNG *const r)
+{
+    const std::string key = r->rand_string(16);
+    for (const size_t count : {8, 64}) {
+        std::list<std::string> plain;
+        for (size_t i = 0; i < count; ++i) {
+            plain.push_back(letters(r, 3 + r->rand<uint8_t>() % 8));
+        }
+        const std::unique_ptr<std::list<std::string> >
+            ciphs(SWP::encrypt(key, plain));
+        const Token token = SWP::token(key, plain.back());
+        const std::string params = std::to_string(count) + "_words";
+
+        suite->run("swp", "enc:" + params, 0, [&] (uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                delete SWP::encrypt(key, plain);
+            }
+        });
+        suite->run("swp", "dec:" + params, 0, [&] (uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                delete SWP::decrypt(key, *ciphs);
+            }
+        });
+        suite->run("swp", "search:" + params, 0, [&] (uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                benchKeep(SWP::searchExists(token, *ciphs));
+            }
+        });
+    }
+
+    suite->run("swp", "token", 0, [&] (uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            benchKeep(SWP::token(key, "benchmark"));
+        }
+    });
+}
+
+static void
+benchECJoin(BenchSuite *const suite, PRNG *const r)
+{
+    ECJoin ec;
+    const AES_KEY *const base = get_AES_KEY(r->rand_string(16));
+    const ECJoinSK *const from = ec.getSKey(base, "cdb_bench from");
+    const ECJoinSK *const to = ec.getSKey(base, "cdb_bench to");
+    const ECDeltaSK *const delta = ec.getDeltaKey(from, to);
+    std::vector<std::string> ptexts(ninputs), ctexts(ninputs);
+    for (size_t i = 0; i < ninputs; ++i) {
+        ptexts[i] = letters(r, 16);
+        ctexts[i] = ec.encrypt(from, ptexts[i]);
+    }
+
+    suite->run("ecjoin", "enc:16", 16, [&] (uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            benchKeep(ec.encrypt(from, ptexts[i % ninputs]));
+        }
+    });
+    suite->run("ecjoin", "adjust", 0, [&] (uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            benchKeep(ECJoin::adjust(delta, ctexts[i % ninputs]));
+        }
+    });
+}
+
+// the Items a sample makes, freed after it
+class BenchArena {
+public:
+    BenchArena() : thd(current_thd), saved_root(thd->mem_root),
+                   saved_items(thd->free_list)
+    {
+        init_sql_alloc(&this->root, 64 * 1024, 0);
+        thd->mem_root = &this->root;
+        thd->free_list = NULL;
+    }
+
+    ~BenchArena()
+    {
+        for (Item *i = thd->free_list; i; ) {
+            Item *const next = i->next;
+            i->delete_self();
+            i = next;
+        }
+        thd->mem_root = this->saved_root;
+        thd->free_list = this->saved_items;
+        free_root(&this->root, MYF(0));
+    }
+
+private:
+    THD *const thd;
+    MEM_ROOT *const saved_root;
+    Item *const saved_items;
+    MEM_ROOT root;
+};
+
+struct LayerInput {
+    std::string column;
+    std::string distribution;
+    uint64_t bytes;
+    std::function<Item *(PRNG *)> make;
+};
+
+struct LayerBench {
+    onion o;
+    SECLEVEL level;
+    // the column, by name
+    std::string column;
+};
+
+static std::string
+layerName(const LayerBench &bench)
+{
+    return "layer_" + TypeText<SECLEVEL>::toText(bench.level);
+}
+
+static std::string
+layerParams(const LayerBench &bench, const LayerInput &input)
+{
+    return TypeText<onion>::toText(bench.o) + ":" + input.column + ":"
+           + input.distribution;
+}
+
+static bool
+layerWanted(const BenchSuite &suite, const LayerBench &bench,
+            const LayerInput &input)
+{
+    if (bench.column != input.column) {
+        return false;
+    }
+
+    const std::string &params = layerParams(bench, input);
+    for (const char *const op : {"enc:", "dec:", "enc_warm:", "dec_warm:"}) {
+        if (suite.wanted(layerName(bench), op + params)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+benchLayer(BenchSuite *const suite, const LayerBench &bench,
+           const LayerInput &input, const Create_field &cf, PRNG *const r)
+{
+    const std::string name = layerName(bench);
+    const std::string params = layerParams(bench, input);
+
+    const auto fresh = [&] () {
+        return EncLayerFactory::encLayer(bench.o, bench.level, cf,
+                                         "cdb_bench key 16");
+    };
+    const std::unique_ptr<EncLayer> layer = fresh();
+    // on the THD's own root, so they outlive the samples
+    std::vector<Item *> ptexts(ninputs), ctexts(ninputs);
+    std::vector<uint64_t> ivs(ninputs);
+    for (size_t i = 0; i < ninputs; ++i) {
+        ptexts[i] = input.make(r);
+        ivs[i] = r->rand<uint64_t>();
+        ctexts[i] = layer->encrypt(*ptexts[i], ivs[i]);
+    }
+
+    // as in benchOPE(), OPE starts each pass over the inputs cold, and
+    // the layer that encrypted them is the warm case
+    const bool cached = SECLEVEL::OPE == bench.level;
+    const auto cold = [&] (bool decrypt) -> BenchSuite::Body {
+        return [&, decrypt] (uint64_t n) {
+            const BenchArena arena;
+            std::unique_ptr<EncLayer> l;
+            for (uint64_t i = 0; i < n; ++i) {
+                if (0 == i % ninputs) {
+                    l = fresh();
+                }
+                const size_t k = i % ninputs;
+                benchKeep(decrypt ? l->decrypt(*ctexts[k], ivs[k])
+                                  : l->encrypt(*ptexts[k], ivs[k]));
+            }
+        };
+    };
+    const auto warm = [&] (bool decrypt) -> BenchSuite::Body {
+        return [&, decrypt] (uint64_t n) {
+            const BenchArena arena;
+            for (uint64_t i = 0; i < n; ++i) {
+                const size_t k = i % ninputs;
+                benchKeep(decrypt ? layer->decrypt(*ctexts[k], ivs[k])
+                                  : layer->encrypt(*ptexts[k], ivs[k]));
+            }
+        };
+    };
+
+    suite->run(name, "enc:" + params, input.bytes,
+               cached ? cold(false) : warm(false));
+    if (cached) {
+        suite->run(name, "enc_warm:" + params, input.bytes, warm(false));
+    }
+    // SWP can not be decrypted
+    if (SECLEVEL::SEARCH != bench.level) {
+        suite->run(name, "dec:" + params, input.bytes,
+                   cached ? cold(true) : warm(true));
+        if (cached) {
+            suite->run(name, "dec_warm:" + params, input.bytes, warm(true));
+        }
+    }
+}
+
+static void
+benchLayers(BenchSuite *const suite, const std::string &embed_dir,
+            PRNG *const r)
+{
+    const std::vector<LayerBench> layers = {
+        {oDET, SECLEVEL::RND, "i"}, {oDET, SECLEVEL::DET, "i"},
+        {oDET, SECLEVEL::DETJOIN, "i"}, {oOPE, SECLEVEL::OPE, "i"},
+        {oAGG, SECLEVEL::HOM, "i"},
+        {oDET, SECLEVEL::RND, "s"}, {oDET, SECLEVEL::DET, "s"},
+        {oDET, SECLEVEL::DETJOIN, "s"}, {oOPE, SECLEVEL::OPE, "s"},
+        {oSWP, SECLEVEL::SEARCH, "s"}};
+
+    std::vector<LayerInput> inputs = {
+        {"i", "small", 8, [] (PRNG *const r) -> Item * {
+            return new Item_int(static_cast<ulonglong>(r->rand<uint64_t>()
+                                                       % 1000));
+        }},
+        {"i", "u32", 8, [] (PRNG *const r) -> Item * {
+            return new Item_int(static_cast<ulonglong>(r->rand<uint32_t>()));
+        }},
+        {"i", "u64", 8, [] (PRNG *const r) -> Item * {
+            return new Item_int(static_cast<ulonglong>(r->rand<uint64_t>()));
+        }}};
+    for (const size_t length : {8, 32, 255, 1024}) {
+        inputs.push_back({"s", "words" + std::to_string(length), length,
+                          [length] (PRNG *const r) -> Item * {
+            return make_item_string(words(r, length));
+        }});
+    }
+
+    bool any = false;
+    for (const auto &layer : layers) {
+        for (const auto &input : inputs) {
+            any = any || layerWanted(*suite, layer, input);
+        }
+    }
+    if (false == any) {
+        return;
+    }
+
+    if (mkdir(embed_dir.c_str(), 0700) && EEXIST != errno) {
+        std::cerr << "cannot create " << embed_dir << std::endl;
+        exit(1);
+    }
+    init_mysql(embed_dir);
+    // its THD holds the column definitions and makes the Items
+    query_parse parse("cdb_bench",
+                            "CREATE TABLE t (i BIGINT UNSIGNED,"
+                            "                s VARCHAR(1024))");
+    std::map<std::string, const Create_field *> columns;
+    List_iterator<Create_field> it(parse.lex()->alter_info.create_list);
+    for (const Create_field *cf = it++; cf; cf = it++) {
+        columns[cf->field_name] = cf;
+    }
+
+    for (const auto &layer : layers) {
+        for (const auto &input : inputs) {
+            if (layerWanted(*suite, layer, input)) {
+                benchLayer(suite, layer, input, *columns.at(layer.column), r);
+            }
+        }
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    BenchConfig config;
+    std::string embed_dir = "/tmp/cdb_bench";
+    int c;
+    while (-1 != (c = getopt(argc, argv, "f:n:t:d:"))) {
+        switch (c) {
+        case 'f': config.filter = optarg; break;
+        case 'n': config.samples = strtoul(optarg, NULL, 10); break;
+        case 't': config.target_msec = strtoull(optarg, NULL, 10); break;
+        case 'd': embed_dir = optarg; break;
+        default:
+            std::cerr << "usage: " << argv[0] << " [-f filter] [-n samples]"
+                      << " [-t target_msec] [-d embed_dir]" << std::endl;
+            return 1;
+        }
+    }
+
+    BenchSuite suite(config, std::cout);
+    streamrng<arc4> r("cdb_bench");
+
+    const blowfish bf(r.rand_string(16));
+    benchBlockCipher(&suite, "blowfish", bf, &r);
+    benchBlowfish(&suite, &r);
+    const AES aes128(r.rand_string(16));
+    benchBlockCipher(&suite, "aes128", aes128, &r);
+    const AES aes256(r.rand_string(32));
+    benchBlockCipher(&suite, "aes256", aes256, &r);
+    benchOPE(&suite, &r);
+    benchPaillier(&suite, &r);
+    benchSWP(&suite, &r);
+    benchECJoin(&suite, &r);
+    benchLayers(&suite, embed_dir, &r);
+
+    return 0;
+}
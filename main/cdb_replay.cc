@@ -0,0 +1,414 @@
+/*
+ * cdb_replay.cc
+ *
+ *  End to end benchmark of the rewrite path without a backend: traces are
+ *  replayed through Rewriter::rewrite and the executors (and so
+ *  Rewriter::decryptResults), whose queries a mock backend answers.
+ *  Prints queries/s and latency percentiles by statement kind as CSV.
+ *
+ *    cdb_replay [-j threads] [-p passes] [-r rows] [-u] [-d dir] [trace ...]
+ *
+ *  The traces default to traces/wordpress-install.sql and
+ *  traces/wordpress-usage.sql (run it from the top of the tree); see
+ *  main/adjust_planner.hh for their format.  The "load" phase replays them
+ *  once on one thread, which creates the schema and adjusts the onions the
+ *  statements need.  In the "replay" phase each of -j threads replays all
+ *  but their DDL -p times, through its own ProxyState as every client
+ *  connection of the proxy has one.  A lock serializes rewrite() and every
+ *  next() like the big lock of mysqlproxy/ConnectWrapper.cc; -u drops it,
+ *  though the rewriter was not written to run without it.
+ *
+ *  The mock backend runs nothing.  The first query of a statement that
+ *  returns fields (a SELECT) gets -r rows (10) of random plaintexts
+ *  encrypted down to the onion levels its ReturnMeta names, so they
+ *  decrypt as real results would; every other query succeeds with no
+ *  rows, which includes the query reissued after an onion adjustment.
+ *  There are no peel progress rows to answer chunked peels with, so onions
+ *  are adjusted by one UPDATE (CRYPTDB_PEEL_CHUNK=0).
+ *
+ *  Latencies count the time spent in rewrite() and next(), lock waits
+ *  included, but not making the mock's results; queries/s are over that
+ *  time.  Percentiles are bucket bounds of the histograms of
+ *  util/latency.hh, so they are within an eighth of a power of two.
+ *
+ *  The embedded MySQL starts afresh in a directory made under -d (/tmp).
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <crypto/arc4.hh>
+#include <crypto/prng.hh>
+#include <main/adjust_planner.hh>
+#include <main/rewrite_main.hh>
+#include <main/rewrite_util.hh>
+#include <parser/lex_util.hh>
+#include <util/cryptdb_log.hh>
+#include <util/latency.hh>
+
+struct ReplayConfig {
+    ReplayConfig() : threads(1), passes(3), rows(10), lock(true) {}
+
+    unsigned int threads;
+    unsigned int passes;
+    unsigned int rows;
+    bool lock;
+};
+
+// what a phase measured, by statement kind
+struct ReplayStats {
+    ReplayStats()
+    {
+        for (auto &it : errors) {
+            it.store(0);
+        }
+    }
+
+    LatencyHistogram
+        latency[static_cast<int>(statement_kind::kind_count)];
+    LatencyHistogram all;
+    std::atomic<uint64_t>
+        errors[static_cast<int>(statement_kind::kind_count)];
+};
+
+static std::mutex proxy_lock;
+
+// A call into the proxy, timed from before it waits on @lock (if any).
+class ProxyCall {
+public:
+    ProxyCall(std::mutex *const lock, uint64_t *const nsec)
+        : lock(lock), nsec(nsec), start(latencyClock())
+    {
+        if (this->lock) {
+            this->lock->lock();
+        }
+    }
+
+    ~ProxyCall()
+    {
+        if (this->lock) {
+            this->lock->unlock();
+        }
+        *this->nsec += latencyClock() - this->start;
+    }
+
+private:
+    ProxyCall(const ProxyCall &);
+    ProxyCall &operator=(const ProxyCall &);
+
+    std::mutex *const lock;
+    uint64_t *const nsec;
+    const uint64_t start;
+};
+
+static Item *
+mockPlaintext(const FieldMeta *const fm, PRNG *const r)
+{
+    // only numeric fields get an oAGG onion; see
+    // FieldMeta::determineOnionLayout
+    if (!fm || fm->getOnionLayout().count(oAGG)) {
+        return new Item_int(static_cast<ulonglong>(r->rand<uint8_t>()
+                                                   % 100));
+    }
+
+    std::string out = r->rand_string(8 + r->rand<uint8_t>() % 57);
+    for (auto &c : out) {
+        c = 'a' + static_cast<uint8_t>(c) % 26;
+    }
+    return make_item_string(out);
+}
+
+// @count rows as the server would send them for the query of @rmeta
+static ResType
+mockRows(const ReturnMeta &rmeta, const Analysis &a, unsigned int count,
+         PRNG *const r)
+{
+    const unsigned int cols = rmeta.rfmeta.size();
+    std::vector<std::string> names;
+    for (unsigned int c = 0; c < cols; ++c) {
+        names.push_back("field" + std::to_string(c));
+    }
+
+    std::vector<std::vector<Item *> > rows;
+    for (unsigned int i = 0; i < count; ++i) {
+        std::vector<Item *> row(cols);
+        std::vector<uint64_t> salts(cols, 0);
+        // the salts first, the fields they encrypt refer to them
+        for (unsigned int c = 0; c < cols; ++c) {
+            if (rmeta.rfmeta.at(c).getIsSalt()) {
+                salts[c] = r->rand<uint64_t>();
+                row[c] = new Item_int(static_cast<ulonglong>(salts[c]));
+            }
+        }
+
+        for (unsigned int c = 0; c < cols; ++c) {
+            const ReturnField &rf = rmeta.rfmeta.at(c);
+            if (rf.getIsSalt()) {
+                continue;
+            }
+
+            FieldMeta *const fm = rf.getOLK().key;
+            Item *const plain = mockPlaintext(fm, r);
+            if (!fm) {
+                row[c] = plain;
+                continue;
+            }
+
+            const onion o = rf.getOLK().o;
+            const int salt_pos = rf.getSaltPosition();
+            row[c] = encrypt_item_layers(*plain, o, *fm->getOnionMeta(o), a,
+                                         salt_pos < 0 ? 0
+                                                      : salts.at(salt_pos));
+        }
+        rows.push_back(row);
+    }
+
+    std::vector<enum_field_types> types;
+    for (unsigned int c = 0; c < cols; ++c) {
+        types.push_back(rows.empty() ? MYSQL_TYPE_BLOB
+                                     : rows.front()[c]->field_type());
+    }
+
+    return ResType(true, 0, 0, std::move(names), std::move(types),
+                   std::move(rows));
+}
+
+// Replays @statement through @ps, adding the time it took to @nsec;
+// returns false if the client would have gotten an error, which is put in
+// @error.
+static bool
+replayStatement(ProxyState *const ps, const TraceStatement &statement,
+                const ReplayConfig &config, PRNG *const r,
+                statement_kind *const kind, uint64_t *const nsec,
+                std::string *const error)
+{
+    std::mutex *const lock = config.lock ? &proxy_lock : NULL;
+    *kind = statement_kind::kind_other;
+    *nsec = 0;
+    ps->safeCreateEmbeddedTHD();
+
+    try {
+        // the executor points into the schema it was rewritten against
+        std::shared_ptr<const SchemaInfo> schema;
+        std::unique_ptr<QueryRewrite> qr;
+        {
+            const ProxyCall call(lock, nsec);
+            setStatementKind(statement_kind::kind_other);
+            schema = ps->getSchemaInfo();
+            qr.reset(new QueryRewrite(
+                Rewriter::rewrite(statement.query, *schema.get(),
+                                  statement.default_db, *ps)));
+            *kind = currentStatementKind();
+        }
+
+        // the ReturnMeta of an adjustment is that of the query it reissues
+        const bool has_rows = false == qr->executor->adjustsOnion()
+                              && false == qr->rmeta.rfmeta.empty();
+        const NextParams nparams(*ps, statement.default_db, statement.query);
+        std::unique_ptr<ResType> res(new ResType(true, 0, 0));
+        for (unsigned int n = 0;; ++n) {
+            std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+                out;
+            {
+                const ProxyCall call(lock, nsec);
+                out = qr->executor->next(*res, nparams);
+            }
+            const std::unique_ptr<AbstractAnything> anything(out.second);
+            if (AbstractQueryExecutor::ResultType::QUERY_COME_AGAIN
+                != out.first) {
+                return true;
+            }
+
+            if (0 == n && has_rows) {
+                const Analysis a(statement.default_db, *schema.get(),
+                                 ps->getMasterKey(),
+                                 ps->defaultSecurityRating());
+                res.reset(new ResType(mockRows(qr->rmeta, a, config.rows,
+                                               r)));
+            } else {
+                res.reset(new ResType(true, 0, 0));
+            }
+        }
+    } catch (const AbstractException &e) {
+        *error = e.to_string();
+    } catch (const ErrorPacketException &e) {
+        *error = e.getMessage();
+    } catch (const CryptDBError &e) {
+        *error = e.msg;
+    }
+
+    return false;
+}
+
+// Replays @statements once through a new ProxyState, whose THDs are gone
+// with it.  Fills @kinds (if not NULL) with the kind of every statement.
+static void
+replayPass(SharedProxyState *const shared,
+           const std::vector<TraceStatement> &statements,
+           const ReplayConfig &config, PRNG *const r,
+           ReplayStats *const stats,
+           std::vector<statement_kind> *const kinds)
+{
+    ProxyState ps(*shared);
+    thread_ps = &ps;
+    for (size_t i = 0; i < statements.size(); ++i) {
+        statement_kind kind;
+        uint64_t nsec;
+        std::string error;
+        const bool ok = replayStatement(&ps, statements[i], config, r,
+                                        &kind, &nsec, &error);
+        if (kinds) {
+            kinds->at(i) = kind;
+        }
+        if (false == ok) {
+            // the same errors again in the replay phase
+            if (kinds) {
+                LOG(warn) << "can not replay [" << statements[i].query
+                          << "]: " << error;
+            }
+            stats->errors[static_cast<int>(kind)].fetch_add(1);
+            continue;
+        }
+
+        stats->latency[static_cast<int>(kind)].record(nsec);
+        stats->all.record(nsec);
+    }
+    thread_ps = NULL;
+}
+
+static void
+replayThread(SharedProxyState *const shared,
+             const std::vector<TraceStatement> *const statements,
+             const ReplayConfig *const config, unsigned int index,
+             ReplayStats *const stats)
+{
+    assert(0 == mysql_thread_init());
+
+    streamrng<arc4> r("cdb_replay" + std::to_string(index));
+    for (unsigned int pass = 0; pass < config->passes; ++pass) {
+        replayPass(shared, *statements, *config, &r, stats, NULL);
+    }
+
+    mysql_thread_end();
+}
+
+static void
+printRow(std::ostream &out, const std::string &phase, unsigned int threads,
+         const std::string &kind, const LatencyHistogram &latency,
+         uint64_t errors)
+{
+    const uint64_t count = latency.count();
+    if (0 == count && 0 == errors) {
+        return;
+    }
+
+    // each thread spent sum / threads of the time
+    const uint64_t qps =
+        latency.sum() ? count * threads * 1000000000 / latency.sum() : 0;
+    out << phase << "," << threads << "," << kind << "," << count << ","
+        << errors << "," << qps << ","
+        << (count ? latency.sum() / count : 0) << ","
+        << latency.percentile(0.5) << "," << latency.percentile(0.99) << ","
+        << latency.percentile(0.999) << "," << latency.max() << std::endl;
+}
+
+static void
+printStats(std::ostream &out, const std::string &phase, unsigned int threads,
+           const ReplayStats &stats)
+{
+    uint64_t errors = 0;
+    for (int k = 0; k < static_cast<int>(statement_kind::kind_count); ++k) {
+        printRow(out, phase, threads,
+                 statementKindName(static_cast<statement_kind>(k)),
+                 stats.latency[k], stats.errors[k].load());
+        errors += stats.errors[k].load();
+    }
+    printRow(out, phase, threads, "all", stats.all, errors);
+}
+
+int
+main(int argc, char **argv)
+{
+    ReplayConfig config;
+    std::string parent = "/tmp";
+    int c;
+    while (-1 != (c = getopt(argc, argv, "j:p:r:ud:"))) {
+        switch (c) {
+        case 'j': config.threads = strtoul(optarg, NULL, 10); break;
+        case 'p': config.passes = strtoul(optarg, NULL, 10); break;
+        case 'r': config.rows = strtoul(optarg, NULL, 10); break;
+        case 'u': config.lock = false; break;
+        case 'd': parent = optarg; break;
+        default:
+            std::cerr << "usage: " << argv[0] << " [-j threads] [-p passes]"
+                      << " [-r rows] [-u] [-d dir] [trace ...]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::string> traces(argv + optind, argv + argc);
+    if (traces.empty()) {
+        traces = {"traces/wordpress-install.sql",
+                  "traces/wordpress-usage.sql"};
+    }
+    std::vector<TraceStatement> statements;
+    for (const auto &it : traces) {
+        std::ifstream in(it);
+        if (false == in.is_open()) {
+            std::cerr << "cannot open " << it << std::endl;
+            return 1;
+        }
+        const std::vector<TraceStatement> &read =
+            readTraceStatements(in, "");
+        statements.insert(statements.end(), read.begin(), read.end());
+    }
+
+    setenv("CRYPTDB_PEEL_CHUNK", "0", 1);
+    std::string embed_dir = parent + "/cdb_replay.XXXXXX";
+    if (NULL == mkdtemp(&embed_dir[0])) {
+        std::cerr << "cannot create a directory in " << parent << std::endl;
+        return 1;
+    }
+    std::cerr << "embedded MySQL in " << embed_dir << std::endl;
+
+    SharedProxyState shared(embed_dir, "2392834", determineSecurityRating());
+    std::cout << "phase,threads,kind,statements,errors,qps,mean_ns,p50_ns,"
+                 "p99_ns,p999_ns,max_ns" << std::endl;
+
+    std::vector<statement_kind> kinds(statements.size());
+    {
+        ReplayStats load;
+        streamrng<arc4> r("cdb_replay");
+        replayPass(&shared, statements, config, &r, &load, &kinds);
+        printStats(std::cout, "load", 1, load);
+    }
+
+    // replaying DDL would create the schema a second time
+    std::vector<TraceStatement> dml;
+    for (size_t i = 0; i < statements.size(); ++i) {
+        if (statement_kind::kind_ddl != kinds[i]) {
+            dml.push_back(statements[i]);
+        }
+    }
+
+    ReplayStats replay;
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < config.threads; ++t) {
+        threads.push_back(std::thread(replayThread, &shared, &dml, &config,
+                                      t, &replay));
+    }
+    for (auto &it : threads) {
+        it.join();
+    }
+    printStats(std::cout, "replay", config.threads, replay);
+
+    return 0;
+}
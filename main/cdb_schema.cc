@@ -0,0 +1,424 @@
+/*
+ * cdb_schema.cc
+ *
+ *  Benchmark of schema handling as the schema grows, without a backend.
+ *  For every combination of -t tables, -c columns per table and -l column
+ *  types it creates a database of that many tables through the rewrite
+ *  path (CreateTableHandler and the DDL executor, whose queries for the
+ *  server succeed without running), measures, and drops it again:
+ *
+ *    create_ms         the CREATE TABLEs, one after another
+ *    load_ms           loadSchemaInfo(), the median of -r loads
+ *    heap_bytes        what a loaded SchemaInfo holds on the heap;
+ *                      bytes_per_field is that over its FieldMetas
+ *    field_meta_bytes, onion_meta_bytes, layer_<name>_bytes
+ *                      the heap one FieldMeta, OnionMeta or EncLayer of
+ *                      a kind takes without its children, the mean over
+ *                      up to 64 of them restored from their serials
+ *    first_query_us    a SELECT right after the schema went stale, so
+ *                      with its reload; query_us is the median of -q more
+ *    peak_rss_kb       the peak resident set of the process so far
+ *
+ *    cdb_schema [-t tables,...] [-c columns,...] [-l num|str|mix,...]
+ *               [-r loads] [-q queries] [-d dir]
+ *
+ *  The column types are num (INTEGER), str (VARCHAR(64)) or mix (one of
+ *  each in turns); their onion layouts also depend on SECURE_CRYPTDB.
+ *  A SELECT is timed up to the query its executor sends to the server.
+ *  Heap figures come from mallinfo() and so include whatever the embedded
+ *  MySQL kept meanwhile; HOM layers make their keys on first use, which
+ *  none of this gets to.
+ *
+ *  Every measurement is a CSV row "tables,columns,types,metric,value", so
+ *  the output of two commits can be joined.  The embedded MySQL starts
+ *  afresh in a directory made under -d (/tmp).
+ */
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <main/CryptoHandlers.hh>
+#include <main/rewrite_main.hh>
+#include <main/rewrite_util.hh>
+#include <main/schema.hh>
+#include <util/cryptdb_log.hh>
+#include <util/latency.hh>
+
+static const std::string bench_db = "cdb_schema";
+// objects of a kind restored for its footprint
+static const unsigned int footprint_samples = 64;
+
+struct SchemaConfig {
+    SchemaConfig()
+        : tables({10, 100, 1000}), columns({8}), types({"mix"}), loads(3),
+          queries(20) {}
+
+    std::vector<unsigned int> tables;
+    std::vector<unsigned int> columns;
+    std::vector<std::string> types;
+    unsigned int loads;
+    unsigned int queries;
+};
+
+// bytes handed out by malloc
+static uint64_t
+heapBytes()
+{
+#if __GLIBC_PREREQ(2, 33)
+    const struct mallinfo2 info = mallinfo2();
+#else
+    const struct mallinfo info = mallinfo();
+#endif
+    return static_cast<uint64_t>(info.uordblks) + info.hblkhd;
+}
+
+static uint64_t
+peakRSSKB()
+{
+    struct rusage usage;
+    return 0 == getrusage(RUSAGE_SELF, &usage) ? usage.ru_maxrss : 0;
+}
+
+static std::vector<std::string>
+splitList(const std::string &list)
+{
+    std::vector<std::string> out;
+    std::string::size_type start = 0;
+    while (true) {
+        const std::string::size_type end = list.find(',', start);
+        out.push_back(list.substr(start, end - start));
+        if (std::string::npos == end) {
+            return out;
+        }
+        start = end + 1;
+    }
+}
+
+static std::vector<unsigned int>
+splitNumbers(const std::string &list)
+{
+    std::vector<unsigned int> out;
+    for (const auto &it : splitList(list)) {
+        out.push_back(strtoul(it.c_str(), NULL, 10));
+    }
+    return out;
+}
+
+static std::string
+columnType(const std::string &types, unsigned int column)
+{
+    if ("num" == types) {
+        return "INTEGER";
+    }
+    if ("str" == types) {
+        return "VARCHAR(64)";
+    }
+    assert("mix" == types);
+    return 0 == column % 2 ? "INTEGER" : "VARCHAR(64)";
+}
+
+// Runs @query through @ps as cdb_replay's mock backend would: every query
+// of the executor succeeds with no rows.  With @first_only it stops at the
+// first query for the server.  Returns false if the client would have
+// gotten an error, which is put in @error.
+static bool
+runStatement(ProxyState *const ps, const std::string &query,
+             const std::string &default_db, bool first_only,
+             std::string *const error)
+{
+    ps->safeCreateEmbeddedTHD();
+    try {
+        // the executor points into the schema it was rewritten against
+        const std::shared_ptr<const SchemaInfo> schema = ps->getSchemaInfo();
+        const std::unique_ptr<QueryRewrite> qr(new QueryRewrite(
+            Rewriter::rewrite(query, *schema.get(), default_db, *ps)));
+        const NextParams nparams(*ps, default_db, query);
+        const ResType res(true, 0, 0);
+        while (true) {
+            const std::pair<AbstractQueryExecutor::ResultType,
+                            AbstractAnything *> out =
+                qr->executor->next(res, nparams);
+            const std::unique_ptr<AbstractAnything> anything(out.second);
+            if (first_only
+                || AbstractQueryExecutor::ResultType::QUERY_COME_AGAIN
+                   != out.first) {
+                return true;
+            }
+        }
+    } catch (const AbstractException &e) {
+        *error = e.to_string();
+    } catch (const ErrorPacketException &e) {
+        *error = e.getMessage();
+    } catch (const CryptDBError &e) {
+        *error = e.msg;
+    }
+
+    return false;
+}
+
+static void
+mustRun(ProxyState *const ps, const std::string &query,
+        const std::string &default_db)
+{
+    std::string error;
+    TEST_TextMessageError(runStatement(ps, query, default_db, false,
+                                       &error),
+                          "[" + query + "] failed: " + error);
+}
+
+// the heap one restored object takes, by metric name
+class Footprints {
+public:
+    // @restore returns the object restored from its serial
+    template <typename Type>
+    void sample(const std::string &metric,
+                const std::function<std::unique_ptr<Type>()> &restore)
+    {
+        Footprint &f = this->footprints[metric];
+        if (f.count >= footprint_samples) {
+            return;
+        }
+
+        const uint64_t before = heapBytes();
+        const std::unique_ptr<Type> object = restore();
+        const uint64_t after = heapBytes();
+        f.bytes += after > before ? after - before : 0;
+        f.count += 1;
+    }
+
+    std::map<std::string, uint64_t> means() const
+    {
+        std::map<std::string, uint64_t> out;
+        for (const auto &it : this->footprints) {
+            out[it.first] = it.second.bytes / std::max(1u, it.second.count);
+        }
+        return out;
+    }
+
+private:
+    struct Footprint {
+        Footprint() : bytes(0), count(0) {}
+
+        uint64_t bytes;
+        unsigned int count;
+    };
+
+    std::map<std::string, Footprint> footprints;
+};
+
+struct SchemaCounts {
+    SchemaCounts() : fields(0), onions(0), layers(0) {}
+
+    uint64_t fields;
+    uint64_t onions;
+    uint64_t layers;
+};
+
+// counts the DBMetas under @schema and samples their footprints
+static SchemaCounts
+walkSchema(const SchemaInfo &schema, Footprints *const footprints)
+{
+    SchemaCounts counts;
+    for (const auto &db : schema.getChildren()) {
+        for (const auto &table : db.second->getChildren()) {
+            const TableMeta &tm = *table.second;
+            for (const auto &field : tm.getChildren()) {
+                const FieldMeta &fm = *field.second;
+                counts.fields += 1;
+                const std::string fm_serial = fm.serialize(tm);
+                footprints->sample<FieldMeta>("field_meta_bytes",
+                    [&fm, &fm_serial] () {
+                        return FieldMeta::deserialize(fm.getDatabaseID(),
+                                                      fm_serial);
+                    });
+                for (const auto &onion : fm.getChildren()) {
+                    const OnionMeta &om = *onion.second;
+                    counts.onions += 1;
+                    const std::string om_serial = om.serialize(fm);
+                    footprints->sample<OnionMeta>("onion_meta_bytes",
+                        [&om, &om_serial] () {
+                            return OnionMeta::deserialize(
+                                om.getDatabaseID(), om_serial);
+                        });
+                    for (const auto &layer : om.getLayers()) {
+                        counts.layers += 1;
+                        const std::string layer_serial =
+                            layer->serialize(om);
+                        const unsigned int id = layer->getDatabaseID();
+                        footprints->sample<EncLayer>(
+                            "layer_" + layer->name() + "_bytes",
+                            [id, &layer_serial] () {
+                                return EncLayerFactory::deserializeLayer(
+                                    id, layer_serial);
+                            });
+                    }
+                }
+            }
+        }
+    }
+
+    return counts;
+}
+
+static void
+printMetric(unsigned int tables, unsigned int columns,
+            const std::string &types, const std::string &metric,
+            uint64_t value)
+{
+    std::cout << tables << "," << columns << "," << types << "," << metric
+              << "," << value << std::endl;
+}
+
+static uint64_t
+median(std::vector<uint64_t> values)
+{
+    assert(false == values.empty());
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+static void
+benchSchema(ProxyState *const ps, const SchemaConfig &config,
+            unsigned int tables, unsigned int columns,
+            const std::string &types)
+{
+    mustRun(ps, "DROP DATABASE IF EXISTS " + bench_db, "");
+    mustRun(ps, "CREATE DATABASE " + bench_db, "");
+
+    const uint64_t create_start = latencyClock();
+    for (unsigned int t = 0; t < tables; ++t) {
+        std::string create = "CREATE TABLE t" + std::to_string(t) + " (";
+        for (unsigned int c = 0; c < columns; ++c) {
+            create += (c ? ", c" : "c") + std::to_string(c) + " "
+                      + columnType(types, c);
+        }
+        mustRun(ps, create + ")", bench_db);
+    }
+    const uint64_t create_nsec = latencyClock() - create_start;
+
+    std::vector<uint64_t> loads;
+    uint64_t heap = 0;
+    SchemaCounts counts;
+    Footprints footprints;
+    for (unsigned int i = 0; i < std::max(1u, config.loads); ++i) {
+        const uint64_t before = heapBytes();
+        const uint64_t start = latencyClock();
+        const std::unique_ptr<SchemaInfo> schema =
+            loadSchemaInfo(ps->getConn(), ps->getEConn());
+        loads.push_back(latencyClock() - start);
+        const uint64_t after = heapBytes();
+        heap = after > before ? after - before : 0;
+        if (0 == i) {
+            counts = walkSchema(*schema, &footprints);
+        }
+    }
+
+    // the first query after a DDL statement of another client
+    const std::string select = "SELECT * FROM t" + std::to_string(tables - 1);
+    ps->getSchemaCache().updateStaleness(ps->getEConn(), true);
+    std::string error;
+    std::vector<uint64_t> queries;
+    for (unsigned int i = 0; i < config.queries + 1; ++i) {
+        const uint64_t start = latencyClock();
+        TEST_TextMessageError(runStatement(ps, select, bench_db, true,
+                                           &error),
+                              "[" + select + "] failed: " + error);
+        queries.push_back(latencyClock() - start);
+    }
+    const uint64_t first_query = queries.front();
+    queries.erase(queries.begin());
+
+    mustRun(ps, "DROP DATABASE " + bench_db, "");
+
+    printMetric(tables, columns, types, "fields", counts.fields);
+    printMetric(tables, columns, types, "onions", counts.onions);
+    printMetric(tables, columns, types, "layers", counts.layers);
+    printMetric(tables, columns, types, "create_ms", create_nsec / 1000000);
+    printMetric(tables, columns, types, "load_ms", median(loads) / 1000000);
+    printMetric(tables, columns, types, "heap_bytes", heap);
+    printMetric(tables, columns, types, "bytes_per_field",
+                heap / std::max<uint64_t>(1, counts.fields));
+    for (const auto &it : footprints.means()) {
+        printMetric(tables, columns, types, it.first, it.second);
+    }
+    printMetric(tables, columns, types, "first_query_us",
+                first_query / 1000);
+    if (false == queries.empty()) {
+        printMetric(tables, columns, types, "query_us",
+                    median(queries) / 1000);
+    }
+    printMetric(tables, columns, types, "peak_rss_kb", peakRSSKB());
+}
+
+int
+main(int argc, char **argv)
+{
+    SchemaConfig config;
+    std::string parent = "/tmp";
+    int c;
+    while (-1 != (c = getopt(argc, argv, "t:c:l:r:q:d:"))) {
+        switch (c) {
+        case 't': config.tables = splitNumbers(optarg); break;
+        case 'c': config.columns = splitNumbers(optarg); break;
+        case 'l': config.types = splitList(optarg); break;
+        case 'r': config.loads = strtoul(optarg, NULL, 10); break;
+        case 'q': config.queries = strtoul(optarg, NULL, 10); break;
+        case 'd': parent = optarg; break;
+        default:
+            std::cerr << "usage: " << argv[0] << " [-t tables,...]"
+                      << " [-c columns,...] [-l num|str|mix,...]"
+                      << " [-r loads] [-q queries] [-d dir]" << std::endl;
+            return 1;
+        }
+    }
+
+    for (const auto &it : config.types) {
+        if ("num" != it && "str" != it && "mix" != it) {
+            std::cerr << "unknown column types " << it << std::endl;
+            return 1;
+        }
+    }
+    for (const auto &it : config.tables) {
+        if (0 == it) {
+            std::cerr << "a schema needs a table" << std::endl;
+            return 1;
+        }
+    }
+
+    std::string embed_dir = parent + "/cdb_schema.XXXXXX";
+    if (NULL == mkdtemp(&embed_dir[0])) {
+        std::cerr << "cannot create a directory in " << parent << std::endl;
+        return 1;
+    }
+    std::cerr << "embedded MySQL in " << embed_dir << std::endl;
+
+    SharedProxyState shared(embed_dir, "2392834", determineSecurityRating());
+    ProxyState ps(shared);
+    thread_ps = &ps;
+
+    std::cout << "tables,columns,types,metric,value" << std::endl;
+    try {
+        for (const auto &tables : config.tables) {
+            for (const auto &columns : config.columns) {
+                for (const auto &types : config.types) {
+                    benchSchema(&ps, config, tables, columns, types);
+                }
+            }
+        }
+    } catch (const AbstractException &e) {
+        std::cerr << e.to_string() << std::endl;
+        return 1;
+    }
+
+    thread_ps = NULL;
+    return 0;
+}
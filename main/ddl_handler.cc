@@ -309,6 +309,8 @@ empty_if_null(const char *const p)
 AbstractQueryExecutor *DDLHandler::
 transformLex(Analysis &a, LEX *lex) const
 {
+    // DDL has no gather step of its own
+    const LatencyScope latency(latency_stage::stage_rewrite);
     assert(a.deltas.size() == 0);
 
     AssignOnce<std::string> db;
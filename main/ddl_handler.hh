@@ -24,6 +24,7 @@ public:
         nextImpl(const ResType &res, const NextParams &nparams);
 
 private:
+    const char *traceName() const {return "DDLQueryExecutor";}
     bool stales() const {return true;}
     bool usesEmbedded() const {return true;}
 };
@@ -1,3 +1,7 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
 #include <functional>
 
 #include <main/dml_handler.hh>
@@ -6,8 +10,12 @@
 #include <main/dispatcher.hh>
 #include <main/macro_util.hh>
 #include <main/metadata_tables.hh>
+#include <main/layer_counters.hh>
+#include <main/parallel_encrypt.hh>
 #include <parser/lex_util.hh>
+#include <util/latency.hh>
 #include <util/onions.hh>
+#include <util/trace.hh>
 #include <util/yield.hpp>
 
 extern CItemTypesDir itemTypes;
@@ -59,6 +67,74 @@ void rewriteInsertHelper(const Item &i, const FieldMeta &fm, Analysis &a,
     }
 }
 
+// The names of the columns an INSERT without a field list writes, in the
+// order rewriteInsertHelper() puts their values.
+static std::vector<std::string>
+insertColumns(const std::vector<FieldMeta *> &fmVec)
+{
+    std::vector<std::string> out;
+    for (const FieldMeta *const fm : fmVec) {
+        for (const auto &it : fm->orderedOnionMetas()) {
+            out.push_back(it.second->getAnonOnionName());
+        }
+        if (fm->getHasSalt()) {
+            out.push_back(fm->getSaltName());
+        }
+    }
+
+    return out;
+}
+
+// Rows that the peel of one of the table's onions has yet to reach get
+// the onion's value with the layers the peel will remove.
+static void
+insertThroughPeels(const Analysis &a, const TableMeta &tm,
+                   const std::vector<std::string> &columns,
+                   std::vector<Item *> *const row)
+{
+    if (row->size() != columns.size()) {
+        return;
+    }
+
+    const auto onionMeta = [&tm] (const std::string &anon_onion)
+        -> const OnionMeta &
+    {
+        for (const FieldMeta *const fm : tm.orderedFieldMetas()) {
+            for (const auto &it : fm->orderedOnionMetas()) {
+                if (it.second->getAnonOnionName() == anon_onion) {
+                    return *it.second;
+                }
+            }
+        }
+        FAIL_TextMessageError("no onion " + anon_onion);
+    };
+
+    const auto column = [&columns] (const std::string &name) -> size_t {
+        return std::find(columns.begin(), columns.end(), name)
+               - columns.begin();
+    };
+    const size_t count = columns.size();
+    for (const OnionPeel *const peel :
+            a.getSchema().getTablePeels(tm.getAnonTableName())) {
+        const size_t onion = column(peel->getAnonOnion());
+        if (count == onion) {
+            continue;
+        }
+
+        const size_t pk = column(peel->getPrimaryKey());
+        Item *const pk_value =
+            count == pk || Item::NULL_ITEM == (*row)[pk]->type()
+                ? NULL : (*row)[pk];
+        const size_t salt = column(peel->getSalt());
+        const uint64_t IV =
+            count == salt ? 0
+                          : static_cast<uint64_t>((*row)[salt]->val_int());
+        (*row)[onion] =
+            peel->writeBothLayers(onionMeta(peel->getAnonOnion()), pk_value,
+                                  (*row)[onion], IV);
+    }
+}
+
 class InsertHandler : public DMLHandler {
     virtual void gather(Analysis &a, LEX *const lex) const
     {
@@ -154,15 +230,18 @@ class InsertHandler : public DMLHandler {
         // -----------------
         //      Values
         // -----------------
+        // The Items of rows encrypted on the workers; they must outlive
+        // the DMLQueryExecutor, which prints the query.
+        ParallelRows parallel_rows;
         if (lex->many_values.head()) {
             auto it = List_iterator<List_item>(lex->many_values);
-            List<List_item> newList;
+            std::vector<List_item *> rows;
+            bool constant = true;
             for (;;) {
                 List_item *const li = it++;
                 if (!li) {
                     break;
                 }
-                List<Item> *const newList0 = new List<Item>();
                 if (li->elements != fmVec.size()) {
                     TEST_TextMessageError(0 == li->elements
                                          && NULL == lex->field_list.head(),
@@ -171,20 +250,65 @@ class InsertHandler : public DMLHandler {
                     // Query such as this.
                     // > INSERT INTO <table> () VALUES ();
                     // > INSERT INTO <table> VALUES ();
-                } else {
-                    auto it0 = List_iterator<Item>(*li);
+                }
+                auto it0 = List_iterator<Item>(*li);
+                for (const Item *i = it0++; i; i = it0++) {
+                    constant = constant && i->basic_const_item();
+                }
+                rows.push_back(li);
+            }
+
+            // Values that are not constants may need the THD of the
+            // query, so only rows of constants go to the workers.
+            const ParallelRows::Encrypter encrypt =
+                [&rows, &fmVec, &a] (size_t row,
+                                     std::vector<Item *> *const out) {
+                    auto it0 = List_iterator<Item>(*rows[row]);
                     auto fmVecIt = fmVec.begin();
                     for (;;) {
                         const Item *const i = it0++;
-                        assert(!!i == (fmVec.end() != fmVecIt));
+                        assert(!!i == (fmVec.end() != fmVecIt)
+                               || 0 == rows[row]->elements);
                         if (!i) {
                             break;
                         }
-                        rewriteInsertHelper(*i, **fmVecIt, a, newList0);
+                        rewriteInsertHelper(*i, **fmVecIt, a, out);
                         ++fmVecIt;
                     }
-                    for (auto def_it : implicit_defaults) {
-                        newList0->push_back(def_it);
+                };
+            std::vector<std::vector<Item *> > encrypted;
+            if (constant) {
+                parallel_rows.run(rows.size(), encrypt, &encrypted);
+            } else {
+                encrypted.resize(rows.size());
+                for (size_t row = 0; row < rows.size(); ++row) {
+                    encrypt(row, &encrypted[row]);
+                }
+            }
+
+            // the rewritten columns, for the peels of the table
+            std::vector<std::string> columns;
+            if (lex->field_list.head()) {
+                auto it = List_iterator<Item>(new_lex->field_list);
+                for (const Item *i = it++; i; i = it++) {
+                    assert(Item::FIELD_ITEM == i->type());
+                    columns.push_back(
+                        static_cast<const Item_field *>(i)->field_name);
+                }
+            } else {
+                columns = insertColumns(fmVec);
+            }
+
+            List<List_item> newList;
+            for (size_t row = 0; row < rows.size(); ++row) {
+                List<Item> *const newList0 = new List<Item>();
+                if (0 != rows[row]->elements) {
+                    std::vector<Item *> values(encrypted[row]);
+                    values.insert(values.end(), implicit_defaults.begin(),
+                                  implicit_defaults.end());
+                    insertThroughPeels(a, tm, columns, &values);
+                    for (auto it : values) {
+                        newList0->push_back(it);
                     }
                 }
                 newList.push_back(newList0);
@@ -268,8 +392,22 @@ class UpdateHandler : public DMLHandler {
                 where_clause = " TRUE ";
             }
 
+            std::vector<std::string> set_fields;
+            auto set_it = List_iterator<Item>(lex->select_lex.item_list);
+            while (const Item *const set_item = set_it++) {
+                assert(Item::Type::FIELD_ITEM == set_item->type());
+                set_fields.push_back(
+                    static_cast<const Item_field *>(set_item)->field_name);
+            }
+
+            // a LIMIT applies to all of the rows, not to each chunk
+            const bool chunkable = NULL == lex->select_lex.select_limit;
+            // the proxy would update every row it read
+            std::unique_ptr<SetEvaluator> evaluator(
+                chunkable ? SetEvaluator::compile(lex) : NULL);
             return new SpecialUpdateExecutor(plain_table, crypted_table,
-                                             where_clause.get());
+                                             where_clause.get(), set_fields,
+                                             chunkable, std::move(evaluator));
         }
 
         new_lex->select_lex.item_list = res_fields;
@@ -422,8 +560,12 @@ class SelectHandler : public DMLHandler {
 AbstractQueryExecutor *DMLHandler::
 transformLex(Analysis &analysis, LEX *lex) const
 {
-    this->gather(analysis, lex);
+    {
+        const LatencyScope latency(latency_stage::stage_gather);
+        this->gather(analysis, lex);
+    }
 
+    const LatencyScope latency(latency_stage::stage_rewrite);
     return this->rewrite(analysis, lex);
 }
 
@@ -828,21 +970,54 @@ doPairRewrite(FieldMeta &fm, const EncSet &es,
               List<Item> *const res_fields, List<Item> *const res_values,
               Analysis &a)
 {
-    const std::unique_ptr<RewritePlan> &field_rp =
-        constGetAssert(a.rewritePlans,
-                       &static_cast<const Item &>(field_item));
     const std::unique_ptr<RewritePlan> &value_rp =
         constGetAssert(a.rewritePlans, &value_item);
 
+    const std::string anon_table_name =
+        a.getAnonTableName(a.getDatabaseName(), field_item.table_name);
     for (auto pair : es.osl) {
         const OLK &olk = {pair.first, pair.second.first, &fm};
 
-        Item *const re_field =
-            itemTypes.do_rewrite(field_item, olk, *field_rp, a);
-        res_fields->push_back(re_field);
+        // the column itself, as rewriting the field would read it
+        // through a peel
+        const OnionMeta &om = a.getOnionMeta(fm, olk.o);
+        res_fields->push_back(
+            make_item_field(field_item, anon_table_name,
+                            om.getAnonOnionName()));
+
+        // cleared, so that populating the onion redoes the row
+        if (false == om.isPopulated()) {
+            res_values->push_back(new Item_null());
+            continue;
+        }
+
+        // the row may be on either side of a peel's boundary
+        const OnionPeel *const peel =
+            a.getSchema().getPeel(anon_table_name, om.getAnonOnionName());
+        if (peel && SIMPLE_UPDATE_TYPE::SAME_VALUE
+                        == determineUpdateType(value_item, fm, es)) {
+            // the row keeps the level of its side
+            res_values->push_back(
+                make_item_field(field_item, anon_table_name,
+                                om.getAnonOnionName()));
+            continue;
+        }
 
-        Item *const re_value =
+        Item *re_value =
             itemTypes.do_rewrite(value_item, olk, *value_rp, a);
+        if (peel) {
+            // peelInFlight(...) finishes the peel before computed values
+            TEST_TextMessageError(value_item.basic_const_item(),
+                "can not write a computed value to " + fm.getFieldName()
+                + " until the onion adjustment in progress finishes");
+            const auto it_salt = a.salts.find(&fm);
+            const uint64_t IV =
+                a.salts.end() == it_salt ? 0 : it_salt->second;
+            re_value = peel->writeBothLayers(om,
+                make_item_field(field_item, anon_table_name,
+                                peel->getPrimaryKey()),
+                re_value, IV);
+        }
         res_values->push_back(re_value);
     }
 }
@@ -962,7 +1137,13 @@ class SetHandler : public DMLHandler {
              {"sensitive",
               DIRECTIVE_HANDLER(&SetHandler::handleSensitiveDirective)},
              {"killzone",
-              DIRECTIVE_HANDLER(&SetHandler::handleKillZoneDirective)}};
+              DIRECTIVE_HANDLER(&SetHandler::handleKillZoneDirective)},
+             {"adjustments",
+              DIRECTIVE_HANDLER(&SetHandler::handleAdjustmentsDirective)},
+             {"stats", DIRECTIVE_HANDLER(&SetHandler::handleStatsDirective)},
+             {"trace", DIRECTIVE_HANDLER(&SetHandler::handleTraceDirective)},
+             {"layers",
+              DIRECTIVE_HANDLER(&SetHandler::handleLayersDirective)}};
 
         DirectiveHandler dhandler = nullptr;
         std::map<std::string, std::string> var_pairs;
@@ -1058,6 +1239,10 @@ private:
 
         for (const auto &it : params.onions) {
             const OnionMeta &om = a.getOnionMeta(params.fm, it.first);
+            if (false == om.isPopulated()) {
+                throw OnionMaterializeExcept(params.tm, params.fm,
+                                             it.first);
+            }
             const SECLEVEL current_level = a.getOnionLevel(om);
             if (it.second < current_level) {
                 throw OnionAdjustExcept(params.tm, params.fm, it.first,
@@ -1079,6 +1264,63 @@ private:
         return new ShowDirectiveExecutor(a.getSchema());
     }
 
+    AbstractQueryExecutor *
+    handleAdjustmentsDirective(std::map<std::string, std::string> &var_pairs,
+                               Analysis &a) const
+    {
+        TEST_Text(0 == var_pairs.size(),
+                  "the adjustments directive takes no parameters");
+
+        return new AdjustmentsDirectiveExecutor(a.getSchema());
+    }
+
+    AbstractQueryExecutor *
+    handleStatsDirective(std::map<std::string, std::string> &var_pairs,
+                         Analysis &a) const
+    {
+        const auto reset = var_pairs.find("reset");
+        TEST_Text(var_pairs.size() == (var_pairs.end() == reset ? 0 : 1),
+                  "the stats directive takes one parameter, 'reset'");
+
+        return new StatsDirectiveExecutor(var_pairs.end() != reset
+                                          && equalsIgnoreCase("true",
+                                                              reset->second));
+    }
+
+    AbstractQueryExecutor *
+    handleTraceDirective(std::map<std::string, std::string> &var_pairs,
+                         Analysis &a) const
+    {
+        TEST_Text(0 == var_pairs.size(),
+                  "the trace directive takes no parameters");
+
+        return new TraceDirectiveExecutor();
+    }
+
+    AbstractQueryExecutor *
+    handleLayersDirective(std::map<std::string, std::string> &var_pairs,
+                          Analysis &a) const
+    {
+        const auto by = var_pairs.find("by");
+        const auto reset = var_pairs.find("reset");
+        TEST_Text(var_pairs.size() == (var_pairs.end() == by ? 0 : 1)
+                                    + (var_pairs.end() == reset ? 0 : 1),
+                  "the layers directive takes two parameters, 'by' and"
+                  " 'reset'");
+        TEST_Text(var_pairs.end() == by
+                  || equalsIgnoreCase("type", by->second)
+                  || equalsIgnoreCase("onion", by->second),
+                  "'by' is either 'type' or 'onion'");
+
+        return new LayersDirectiveExecutor(a.getSchema(),
+                                           var_pairs.end() == by
+                                           || equalsIgnoreCase("onion",
+                                                               by->second),
+                                           var_pairs.end() != reset
+                                           && equalsIgnoreCase("true",
+                                                               reset->second));
+    }
+
     AbstractQueryExecutor *
     handleSensitiveDirective(std::map<std::string, std::string> &var_pairs,
                              Analysis &a) const
@@ -1214,6 +1456,98 @@ private:
 
 };
 
+class LoadDataHandler : public DMLHandler {
+    virtual void gather(Analysis &a, LEX *const lex) const
+    {}
+
+    virtual AbstractQueryExecutor *rewrite(Analysis &a, LEX *const lex)
+        const
+    {
+        const sql_exchange &exchange = *lex->exchange;
+        TEST_TextMessageError(false == lex->local_file,
+                              "LOAD DATA LOCAL is not supported");
+        const std::string &path = infilePath(exchange.file_name);
+        TEST_TextMessageError(false == path.empty(),
+                              "LOAD DATA only reads files inside"
+                              " CRYPTDB_LOAD_DATA_DIR");
+        TEST_TextMessageError(FILETYPE_CSV == exchange.filetype,
+                              "LOAD XML is not supported");
+        TEST_TextMessageError(0 == lex->update_list.elements,
+                              "LOAD DATA ... SET is not supported");
+        const InfileFormat &format = InfileFormat::fromExchange(exchange);
+        TEST_TextMessageError(false == format.field_term.empty()
+                              && false == format.line_term.empty(),
+                              "LOAD DATA with fixed-size rows is not"
+                              " supported");
+
+        const std::string &table =
+            lex->select_lex.table_list.first->table_name;
+        const std::string &db_name =
+            lex->select_lex.table_list.first->db;
+        TEST_DatabaseDiscrepancy(db_name, a.getDatabaseName());
+        const TableMeta &tm = a.getTableMeta(db_name, table);
+
+        std::vector<FieldMeta *> fmVec;
+        if (lex->field_list.head()) {
+            auto it = List_iterator<Item>(lex->field_list);
+            for (const Item *i = it++; i; i = it++) {
+                TEST_TextMessageError(i->type() == Item::FIELD_ITEM,
+                                      "LOAD DATA into user variables is"
+                                      " not supported");
+                fmVec.push_back(&a.getFieldMeta(db_name, table,
+                    static_cast<const Item_field *>(i)->field_name));
+            }
+        } else {
+            fmVec = tm.orderedFieldMetas();
+        }
+
+        // every onion and salt of the file's fields, in the order
+        // rewriteInsertHelper() encrypts them
+        const auto anonColumns = [] (const FieldMeta &fm) {
+            std::vector<std::string> out;
+            for (auto it : fm.orderedOnionMetas()) {
+                out.push_back(quoteText(it.second->getAnonOnionName()));
+            }
+            if (fm.getHasSalt()) {
+                out.push_back(quoteText(fm.getSaltName()));
+            }
+            return out;
+        };
+        std::vector<std::string> fields, columns;
+        for (const FieldMeta *const fm : fmVec) {
+            fields.push_back(fm->getFieldName());
+            const std::vector<std::string> &anon = anonColumns(*fm);
+            columns.insert(columns.end(), anon.begin(), anon.end());
+        }
+
+        // as INSERT does, the fields the file leaves out get their
+        // defaults encrypted here rather than in plaintext by the server
+        std::string defaults;
+        for (FieldMeta *const fm :
+                vectorDifference(tm.defaultedFieldMetas(), fmVec)) {
+            std::vector<Item *> l;
+            rewriteInsertHelper(*make_item_string(fm->defaultValue()), *fm,
+                                a, &l);
+            const std::vector<std::string> &anon = anonColumns(*fm);
+            assert(anon.size() == l.size());
+            columns.insert(columns.end(), anon.begin(), anon.end());
+            for (const Item *const it : l) {
+                defaults += ", " + printItemToString(*it);
+            }
+        }
+
+        const std::string &insert_head =
+            std::string(DUP_REPLACE == lex->duplicates ? "REPLACE"
+                        : lex->ignore ? "INSERT IGNORE" : "INSERT") +
+            " INTO " + quoteText(db_name) + "." +
+            quoteText(a.getAnonTableName(db_name, table)) +
+            " (" + vector_join(columns, ", ") + ") VALUES ";
+
+        return new LoadDataExecutor(db_name, table, path, fields, format,
+                                    insert_head, defaults);
+    }
+};
+
 class ShowTablesHandlers : public DMLHandler {
     virtual void gather(Analysis &a, LEX *const lex) const
     {}
@@ -1254,6 +1588,9 @@ SQLDispatcher *buildDMLDispatcher()
     h = new ShowTablesHandlers;
     dispatcher->addHandler(SQLCOM_SHOW_TABLES, h);
 
+    h = new LoadDataHandler;
+    dispatcher->addHandler(SQLCOM_LOAD, h);
+
     return dispatcher;
 }
 
@@ -1307,6 +1644,354 @@ rewriteAndGetFirstQuery(const std::string &query, NextParams nparams)
 #define SPECIALIZED_SYNC(test)                               \
     SYNC_IF_FALSE((test), nparams.ps.getEConn())
 
+static uint64_t
+specialUpdateChunkRows()
+{
+    static const uint64_t rows = [] () {
+        const char *const s = getenv("CRYPTDB_SPECIAL_UPDATE_CHUNK");
+        return std::max(static_cast<uint64_t>(s ? strtoull(s, NULL, 10)
+                                                : 1000),
+                        uint64_t(1));
+    }();
+    return rows;
+}
+
+// escaping and quoting the string creates a value that can actually be
+// used in an INSERT statement
+static std::string
+itemToNiceString(const std::unique_ptr<Connect> &e_conn, const Item &item)
+{
+    const std::string &s = ItemToString(item);
+    if (Item::Type::STRING_ITEM != item.type()) {
+        return s;
+    }
+
+    return "'" + escapeString(e_conn, s) + "'";
+}
+
+// > (a, b), (c, d)
+static std::string
+rowsToValueList(const std::unique_ptr<Connect> &e_conn,
+                const std::vector<std::vector<Item *> > &rows)
+{
+    std::string out;
+    for (const auto &row : rows) {
+        out += out.empty() ? "(" : ",(";
+        for (auto it = row.begin(); it != row.end(); ++it) {
+            out += (row.begin() == it ? "" : ",")
+                 + itemToNiceString(e_conn, **it);
+        }
+        out += ")";
+    }
+
+    return out;
+}
+
+// the same as rowsToValueList, without unpacking the rows into Items
+static std::string
+resultToValueList(const std::unique_ptr<Connect> &e_conn,
+                  const std::unique_ptr<DBResult> &dbres)
+{
+    const unsigned int col_count = mysql_num_fields(dbres->n);
+    const MYSQL_FIELD *const fields = mysql_fetch_fields(dbres->n);
+
+    std::string out;
+    while (const MYSQL_ROW row = mysql_fetch_row(dbres->n)) {
+        const unsigned long *const l = mysql_fetch_lengths(dbres->n);
+        out += out.empty() ? "(" : ",(";
+        for (unsigned int i = 0; i < col_count; ++i) {
+            out += 0 == i ? "" : ",";
+            if (!row[i]) {
+                out += "NULL";
+            } else if (IS_NUM(fields[i].type)) {
+                out += std::string(row[i], l[i]);
+            } else {
+                out += "'" + escapeString(e_conn, std::string(row[i], l[i]))
+                     + "'";
+            }
+        }
+        out += ")";
+    }
+
+    return out;
+}
+
+std::string
+SpecialUpdateExecutor::chunkKey(const NextParams &nparams,
+                                std::string *const onion) const
+{
+    if (false == this->chunkable) {
+        return "";
+    }
+
+    const std::unique_ptr<Connect> &e_conn = nparams.ps.getEConn();
+    std::unique_ptr<DBResult> dbres;
+    const std::string query =
+        " SELECT MIN(column_name), COUNT(*)"
+        "   FROM INFORMATION_SCHEMA.KEY_COLUMN_USAGE"
+        "  WHERE table_schema = DATABASE()"
+        "    AND table_name = '" + escapeString(e_conn, this->plain_table) + "'"
+        "    AND constraint_name = 'PRIMARY';";
+    if (false == e_conn->execute(query, &dbres)) {
+        return "";
+    }
+
+    const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+    if (!row || !row[0] || std::string("1") != row[1]) {
+        return "";
+    }
+
+    // rows moving to the keys of a later chunk would come up again
+    const std::string pk = row[0];
+    for (const auto &it : this->set_fields) {
+        if (equalsIgnoreCase(pk, it)) {
+            return "";
+        }
+    }
+
+    // the ciphertexts are paged as they are, which a peel of the onion
+    // would change under the UPDATE
+    try {
+        const std::shared_ptr<const SchemaInfo> &schema =
+            nparams.ps.getSchemaInfo();
+        Analysis a(nparams.default_db, *schema.get(),
+                   nparams.ps.getMasterKey(),
+                   nparams.ps.defaultSecurityRating());
+        const TableMeta &tm =
+            a.getTableMeta(nparams.default_db, this->plain_table);
+        const OnionMeta *const om =
+            a.getFieldMeta(tm, pk).getOnionMeta(oDET);
+        if (NULL == om) {
+            return "";
+        }
+        const SECLEVEL level = a.getOnionLevel(*om);
+        if ((SECLEVEL::DET != level && SECLEVEL::DETJOIN != level)
+            || a.getSchema().getPeel(tm.getAnonTableName(),
+                                     om->getAnonOnionName())) {
+            return "";
+        }
+        *onion = om->getAnonOnionName();
+    } catch (...) {
+        return "";
+    }
+
+    return pk;
+}
+
+std::string
+SpecialUpdateExecutor::keysQuery(const std::string &last) const
+{
+    return " SELECT " + this->pk_onion + " FROM " + this->crypted_table +
+           (last.empty() ? "" : " WHERE " + this->pk_onion + " > " + last) +
+           "  ORDER BY " + this->pk_onion +
+           "  LIMIT " + std::to_string(specialUpdateChunkRows()) + ";";
+}
+
+bool
+SpecialUpdateExecutor::nextKeys(const ResType &res,
+                                const NextParams &nparams)
+{
+    std::string in;
+    uint64_t count = 0;
+    try {
+        const std::shared_ptr<const SchemaInfo> &schema =
+            nparams.ps.getSchemaInfo();
+        Analysis a(nparams.default_db, *schema.get(),
+                   nparams.ps.getMasterKey(),
+                   nparams.ps.defaultSecurityRating());
+        const FieldMeta &fm =
+            a.getFieldMeta(nparams.default_db, this->plain_table, this->pk);
+        for (const auto &row : res.rows) {
+            assert(1 == row.size());
+            this->last_key = printItemToString(*row[0]);
+            const Item *const key = decrypt_item_layers(*row[0], &fm, oDET, 0);
+            in += (in.empty() ? "" : ", ")
+                + itemToNiceString(nparams.ps.getEConn(), *key);
+            ++count;
+        }
+    } catch (...) {
+        this->chunk_error = "decrypting keys failed for SpecialUpdate";
+        return false;
+    }
+
+    // a page has the keys of every row, which the WHERE clause narrows
+    this->keys_done = count < specialUpdateChunkRows();
+    this->chunk_where =
+        in.empty() ? ""
+                   : " (" + this->where_clause + ") AND " + this->pk
+                     + " IN (" + in + ") ";
+    return true;
+}
+
+bool
+SpecialUpdateExecutor::prepare(const NextParams &nparams) const
+{
+    const std::unique_ptr<Connect> &e_conn = nparams.ps.getEConn();
+
+    // a prepared statement can not end with a ';'
+    std::string update = nparams.original_query;
+    while (false == update.empty()
+           && (';' == *update.rbegin() || isspace(*update.rbegin()))) {
+        update.erase(update.length() - 1);
+    }
+
+    // parsed as the UPDATE always was, in strict mode
+    RETURN_FALSE_IF_FALSE(strictMode(e_conn.get()));
+    const bool prepared =
+        e_conn->execute("PREPARE cryptdb_special_update FROM '"
+                        + escapeString(e_conn, update) + "';")
+        && e_conn->execute("PREPARE cryptdb_special_select FROM"
+                           " 'SELECT * FROM "
+                           + escapeString(e_conn, this->plain_table) + "';")
+        && e_conn->execute("PREPARE cryptdb_special_cleanup FROM"
+                           " 'DELETE FROM "
+                           + escapeString(e_conn, this->plain_table) + "';");
+    RETURN_FALSE_IF_FALSE(e_conn->execute("SET SESSION sql_mode = ''"));
+
+    return prepared;
+}
+
+void
+SpecialUpdateExecutor::loadColumns(const std::unique_ptr<Connect> &e_conn)
+{
+    std::unique_ptr<DBResult> dbres;
+    const std::string query =
+        " SELECT column_name, data_type, column_type LIKE '%unsigned%',"
+        "        is_nullable = 'YES', character_maximum_length"
+        "   FROM INFORMATION_SCHEMA.COLUMNS"
+        "  WHERE table_schema = DATABASE()"
+        "    AND table_name = '" + escapeString(e_conn, this->plain_table) + "'"
+        "  ORDER BY ordinal_position;";
+    if (false == e_conn->execute(query, &dbres)) {
+        return;
+    }
+
+    while (const MYSQL_ROW row = mysql_fetch_row(dbres->n)) {
+        this->columns.push_back(
+            EvalColumn{row[0], row[1], std::string("1") == row[2],
+                       std::string("1") == row[3],
+                       row[4] ? static_cast<uint64_t>(
+                                    strtoull(row[4], NULL, 10))
+                              : 0});
+    }
+}
+
+static std::string
+evalValueToNiceString(const std::unique_ptr<Connect> &e_conn,
+                      const EvalValue &value)
+{
+    switch (value.kind) {
+        case EvalValue::Kind::Null:
+            return "NULL";
+        case EvalValue::Kind::Int:
+            return std::to_string(value.i);
+        case EvalValue::Kind::String:
+            return "'" + escapeString(e_conn, value.s) + "'";
+        case EvalValue::Kind::Opaque:
+            break;
+    }
+
+    assert(false);
+}
+
+bool
+SpecialUpdateExecutor::evaluateInProxy(const ResType &dec_res,
+                                       const std::unique_ptr<Connect> &e_conn)
+{
+    // the rows must have the columns the evaluator was given
+    RETURN_FALSE_IF_FALSE(dec_res.names.size() == this->columns.size());
+    for (size_t i = 0; i < this->columns.size(); ++i) {
+        RETURN_FALSE_IF_FALSE(equalsIgnoreCase(dec_res.names[i],
+                                               this->columns[i].name));
+    }
+
+    std::string values;
+    uint64_t changed_rows = 0;
+    std::map<size_t, EvalValue> assigned;
+    for (const auto &row : dec_res.rows) {
+        bool changed = false;
+        RETURN_FALSE_IF_FALSE(this->evaluator->update(this->columns, row,
+                                                      &assigned, &changed));
+        changed_rows += changed ? 1 : 0;
+
+        values += values.empty() ? "(" : ",(";
+        for (size_t i = 0; i < row.size(); ++i) {
+            values += 0 == i ? "" : ",";
+            const auto it = assigned.find(i);
+            values += assigned.end() == it
+                ? itemToNiceString(e_conn, *row[i])
+                : evalValueToNiceString(e_conn, it->second);
+        }
+        values += ")";
+    }
+
+    // like MySQL, only rows whose values changed count as affected
+    this->output_values = values;
+    this->affected_rows += changed_rows;
+    return true;
+}
+
+bool
+SpecialUpdateExecutor::evaluate(const ResType &res,
+                                const NextParams &nparams)
+{
+    const std::unique_ptr<Connect> &e_conn = nparams.ps.getEConn();
+
+    this->output_values.clear();
+    std::string values;
+    try {
+        const ResType &dec_res =
+            Rewriter::decryptResults(res, *this->select_rmeta.get());
+        assert(dec_res.success());
+        if (this->evaluator && this->evaluateInProxy(dec_res, e_conn)) {
+            return true;
+        }
+        values = rowsToValueList(e_conn, dec_res.rows);
+    } catch (...) {
+        this->chunk_error = "decrypting rows failed for SpecialUpdate";
+        return false;
+    }
+
+    if (values.empty()) {
+        return true;
+    }
+
+    // Each chunk is updated in a transaction of its own, so that failures
+    // leave nothing behind in the embedded database; strict mode tells us
+    // about bad values
+    // > ie trying to insert 256 into a TINYINT UNSIGNED column.
+    std::unique_ptr<DBResult> update_dbres;
+    std::unique_ptr<DBResult> dbres;
+    const bool updated =
+        e_conn->execute("START TRANSACTION;")
+        && strictMode(e_conn.get())
+        && e_conn->execute(" INSERT INTO " + this->plain_table +
+                           " VALUES " + values + ";")
+        && e_conn->execute("EXECUTE cryptdb_special_update;", &update_dbres)
+        && e_conn->execute("SET SESSION sql_mode = ''")
+        && e_conn->execute("EXECUTE cryptdb_special_select;", &dbres);
+    if (false == updated) {
+        this->chunk_error = "SpecialUpdate failed: " + e_conn->getError();
+        e_conn->execute("ROLLBACK;");
+        e_conn->execute("SET SESSION sql_mode = ''");
+        return false;
+    }
+
+    this->affected_rows += update_dbres->unpack().affected_rows;
+    this->output_values = resultToValueList(e_conn, dbres);
+
+    const bool cleaned =
+        e_conn->execute("EXECUTE cryptdb_special_cleanup;")
+        && e_conn->execute("COMMIT;");
+    if (false == cleaned) {
+        this->chunk_error = "SpecialUpdate cleanup failed";
+        e_conn->execute("ROLLBACK;");
+        return false;
+    }
+
+    return true;
+}
+
 std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
 SpecialUpdateExecutor::
 nextImpl(const ResType &res, const NextParams &nparams)
@@ -1323,125 +2008,18 @@ nextImpl(const ResType &res, const NextParams &nparams)
     reenter(this->corot) {
         assert(res.success());
 
-        yield {
-            // Retrieve rows from database.
-            const std::string &select_q =
-                " SELECT * FROM " + this->plain_table +
-                " WHERE " + this->where_clause + ";";
-            // Should never cause an onion adjustment
-            const auto &rewritten_select_q =
-                rewriteAndGetFirstQuery(select_q, nparams);
-            this->select_rmeta = rewritten_select_q.second;
-            return CR_QUERY_AGAIN(rewritten_select_q.first);
-        }
-        TEST_ErrPkt(res.success(),
-                    "initial select query in SpecialUpdate failed");
+        this->pk = this->chunkKey(nparams, &this->pk_onion);
 
-        try {
-            this->dec_res =
-                Rewriter::decryptResults(res, this->select_rmeta.get());
-        } catch (...) {
-            TEST_ErrPkt(res.success(),
-                        "decrypting initial SELECT failed for SpecialUpdate");
-        }
-        assert(this->dec_res.get().success());
-        if (this->dec_res.get().rows.size() == 0) {
-            yield return CR_RESULTS(ResType(true, 0, 0));
-        }
-
-        yield {
-            const auto itemToNiceString =
-                [&nparams] (const Item *const p_item)
-                {
-                    const std::string &s = ItemToString(*p_item);
-
-                    if (Item::Type::STRING_ITEM != p_item->type()) {
-                        return s;
-                    }
-
-                    // escaping and quoting the string creates a value that can
-                    // actually be used in an INSERT statement
-                    return "'" + escapeString(nparams.ps.getEConn(), s) + "'";
-                };
-
-            // We must take these items and convert them into quoted, escaped
-            // strings
-            //  > Item -> std::string -> escaped -> quoted
-            // then we join the results into a single comma seperated values list
-            const auto pItemVectorToNiceValueList =
-                [&itemToNiceString]
-                    (const std::vector<std::vector<Item *> > &vec)
-                {
-                    std::vector<std::string> esses;
-                    for (auto row_it : vec) {
-                        std::vector<std::string> nice_values(row_it.size());
-                        std::transform(row_it.begin(), row_it.end(),
-                                       nice_values.begin(), itemToNiceString);
-                        esses.push_back("("+ vector_join(nice_values, ",") + ")");
-                    }
-
-                    return vector_join(esses, ",");
-                };
-
-            const std::string &values_string =
-                pItemVectorToNiceValueList(dec_res.get().rows);
-
-            // do the query on the embedded database inside of a transaction
-            // so that we can prevent failure artifacts from populating the
-            // embedded database
-            TEST_ErrPkt(nparams.ps.getEConn()->execute("START TRANSACTION;"),
-                        "failed to start transaction");
-
-            // turn on strict mode so we can determine if we have bad values
-            // > ie trying to insert 256 into a TINYINT UNSIGNED column
-            SPECIALIZED_SYNC(strictMode(nparams.ps.getEConn().get()));
-
-            // Push the plaintext rows to the embedded database.
-            const std::string &push_q =
-                " INSERT INTO " + this->plain_table +
-                " VALUES " + values_string + ";";
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute(push_q));
-
-            // Run the original (unmodified) query on the data in the embedded
-            // database.
-            std::unique_ptr<DBResult> original_query_dbres;
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute(
-                                nparams.original_query, &original_query_dbres));
-            assert(original_query_dbres);
-            // HACK
-            this->original_query_dbres = original_query_dbres.release();
-
-            // strict mode off
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute(
-                                "SET SESSION sql_mode = ''"));
-
-            // > Collect the results from the embedded database.
-            // > This code relies on single threaded access to the database
-            //   and on the fact that the database is cleaned up after
-            //   every such operation.
-            std::unique_ptr<DBResult> dbres;
-            const std::string &select_results_q =
-                " SELECT * FROM " + this->plain_table + ";";
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute(select_results_q,
-                                                            &dbres));
-            const ResType interim_res = ResType(dbres->unpack());
-            assert(interim_res.success());
-            this->escaped_output_values =
-                pItemVectorToNiceValueList(interim_res.rows);
-
-            // Cleanup the embedded database.
-            const std::string &cleanup_q =
-                "DELETE FROM " + this->plain_table + ";";
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute(cleanup_q));
-
-            SPECIALIZED_SYNC(nparams.ps.getEConn()->execute("COMMIT;"));
-
-            // This query is necessary to propagate a transaction into
-            // INFORMATION_SCHEMA.
-            return CR_QUERY_AGAIN(
-                "SELECT NULL FROM " + this->crypted_table + ";");
+        TEST_ErrPkt(this->prepare(nparams),
+                    "failed to prepare statements for SpecialUpdate");
+        if (this->evaluator) {
+            this->loadColumns(nparams.ps.getEConn());
         }
 
+        // This query is necessary to propagate a transaction into
+        // INFORMATION_SCHEMA.
+        yield return CR_QUERY_AGAIN(
+            "SELECT NULL FROM " + this->crypted_table + ";");
         TEST_ErrPkt(res.success(),
             "transaction propagation query failed in SpecialUpdate");
 
@@ -1457,27 +2035,80 @@ nextImpl(const ResType &res, const NextParams &nparams)
                         "failed to start transaction in SpecialUpdate");
         }
 
-        yield {
-            // DELETE the rows matching the WHERE clause from the database.
-            const std::string &delete_q =
-                " DELETE FROM " + this->plain_table +
-                " WHERE " + this->where_clause + ";";
-            const auto &rewritten_delete_q =
-                rewriteAndGetFirstQuery(delete_q, nparams);
-            return CR_QUERY_AGAIN(rewritten_delete_q.first);
-        }
-        CR_ROLLBACK_AND_FAIL(res, "delete query failed in SpecialUpdate");
+        do {
+            if (this->pk.empty()) {
+                this->chunk_where = this->where_clause;
+            } else {
+                // The rows of the chunks before keep their keys, so
+                // the page after them only has rows yet to be updated.
+                yield return CR_QUERY_AGAIN(this->keysQuery(this->last_key));
+                CR_ROLLBACK_AND_FAIL(res,
+                                     "key select query in SpecialUpdate"
+                                     " failed");
+
+                this->chunk_ok = this->nextKeys(res, nparams);
+                if (false == this->chunk_ok) {
+                    yield return CR_QUERY_AGAIN("ROLLBACK");
+                    FAIL_GenericPacketException(this->chunk_error);
+                }
+                if (this->chunk_where.empty()) {
+                    break;
+                }
+            }
 
-        yield {
-            // > Add each row from the embedded database to the data database.
-            const std::string &insert_q =
-                " INSERT INTO " + this->plain_table +
-                " VALUES " + this->escaped_output_values.get() + ";";
-            const auto &rewritten_insert_q =
-                rewriteAndGetFirstQuery(insert_q, nparams);
-            return CR_QUERY_AGAIN(rewritten_insert_q.first);
-        }
-        CR_ROLLBACK_AND_FAIL(res, "insert query failed in SpecialUpdate");
+            yield {
+                // Retrieve the rows of the chunk from database.
+                const std::string &select_q =
+                    " SELECT * FROM " + this->plain_table +
+                    " WHERE " + this->chunk_where + ";";
+                const auto &rewritten_select_q =
+                    rewriteAndGetFirstQuery(select_q, nparams);
+                this->select_rmeta.reset(
+                    new ReturnMeta(rewritten_select_q.second));
+                return CR_QUERY_AGAIN(rewritten_select_q.first);
+            }
+            CR_ROLLBACK_AND_FAIL(res, "select query failed in SpecialUpdate");
+
+            this->chunk_ok = this->evaluate(res, nparams);
+            if (false == this->chunk_ok) {
+                yield return CR_QUERY_AGAIN("ROLLBACK");
+                FAIL_GenericPacketException(this->chunk_error);
+            }
+
+            if (false == this->output_values.empty()) {
+                yield {
+                    // DELETE the rows of the chunk from the database.
+                    const std::string &delete_q =
+                        " DELETE FROM " + this->plain_table +
+                        " WHERE " + this->chunk_where + ";";
+                    const auto &rewritten_delete_q =
+                        rewriteAndGetFirstQuery(delete_q, nparams);
+                    return CR_QUERY_AGAIN(rewritten_delete_q.first);
+                }
+                CR_ROLLBACK_AND_FAIL(res,
+                                     "delete query failed in SpecialUpdate");
+
+                yield {
+                    // > Add each updated row of the chunk to the data
+                    //   database.
+                    const std::string &insert_q =
+                        " INSERT INTO " + this->plain_table +
+                        " VALUES " + this->output_values + ";";
+                    const auto &rewritten_insert_q =
+                        rewriteAndGetFirstQuery(insert_q, nparams);
+                    return CR_QUERY_AGAIN(rewritten_insert_q.first);
+                }
+                CR_ROLLBACK_AND_FAIL(res,
+                                     "insert query failed in SpecialUpdate");
+            }
+        } while (false == this->lastChunk());
+
+        nparams.ps.getEConn()->execute(
+            "DEALLOCATE PREPARE cryptdb_special_update;");
+        nparams.ps.getEConn()->execute(
+            "DEALLOCATE PREPARE cryptdb_special_select;");
+        nparams.ps.getEConn()->execute(
+            "DEALLOCATE PREPARE cryptdb_special_cleanup;");
 
         if (false == this->in_trx.get()) {
             yield return CR_QUERY_AGAIN("COMMIT");
@@ -1492,7 +2123,103 @@ nextImpl(const ResType &res, const NextParams &nparams)
         crEndBlock
         */
 
-        return CR_RESULTS(this->original_query_dbres.get()->unpack());
+        return CR_RESULTS(ResType(true, this->affected_rows, 0));
+    }
+
+    assert(false);
+}
+
+bool
+LoadDataExecutor::encryptBatch(const NextParams &nparams)
+{
+    static const uint64_t batch_rows = 256;
+
+    const std::shared_ptr<const SchemaInfo> &schema =
+        nparams.ps.getSchemaInfo();
+    Analysis a(this->db, *schema.get(), nparams.ps.getMasterKey(),
+               nparams.ps.defaultSecurityRating());
+    std::vector<const FieldMeta *> fms;
+    for (const auto &it : this->fields) {
+        fms.push_back(&a.getFieldMeta(this->db, this->table, it));
+    }
+
+    const auto encrypt =
+        [this, &a, &fms] (const std::vector<InfileField> &row,
+                          std::string *const out)
+    {
+        TEST_TextMessageError(row.size() == fms.size(),
+            "expected " + std::to_string(fms.size())
+            + " fields, found " + std::to_string(row.size()));
+        bool first = true;
+        for (size_t i = 0; i < row.size(); ++i) {
+            Item *const item =
+                row[i].null ? static_cast<Item *>(new Item_null())
+                            : make_item_string(row[i].value);
+            std::vector<Item *> l;
+            rewriteInsertHelper(*item, *fms[i], a, &l);
+            for (const Item *const it : l) {
+                *out += (first ? "" : ", ") + printItemToString(*it);
+                first = false;
+            }
+        }
+        *out += this->defaults;
+    };
+
+    try {
+        this->values = this->rows->next(encrypt, batch_rows);
+    } catch (const CryptDBError &e) {
+        this->batch_error = "LOAD DATA failed at " + e.msg;
+        return false;
+    }
+
+    return true;
+}
+
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+LoadDataExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    reenter(this->corot) {
+        this->file.reset(new std::ifstream(this->path, std::ios::binary));
+        TEST_ErrPkt(this->file->is_open(), "can not open " + this->path);
+        this->reader.reset(new InfileReader(*this->file, this->format));
+        this->rows.reset(new EncryptedRows(*this->reader));
+
+        yield return CR_QUERY_AGAIN(
+            "CALL " + MetaData::Proc::activeTransactionP());
+        TEST_ErrPkt(res.success(),
+                    "failed to determine if we are in a transaction");
+        this->in_trx = handleActiveTransactionPResults(res);
+
+        if (false == this->in_trx.get()) {
+            yield return CR_QUERY_AGAIN("START TRANSACTION");
+            TEST_ErrPkt(res.success(),
+                        "failed to start transaction in LOAD DATA");
+        }
+
+        // the rows go to the server in batches, so a file never has to
+        // fit in the proxy
+        while (true) {
+            if (false == this->encryptBatch(nparams)) {
+                yield return CR_QUERY_AGAIN("ROLLBACK");
+                FAIL_GenericPacketException(this->batch_error);
+            }
+            if (this->values.empty()) {
+                break;
+            }
+
+            yield return CR_QUERY_AGAIN(this->insert_head + this->values
+                                        + ";");
+            CR_ROLLBACK_AND_FAIL(res, "insert query failed in LOAD DATA");
+            this->affected_rows += res.affected_rows;
+        }
+
+        if (false == this->in_trx.get()) {
+            yield return CR_QUERY_AGAIN("COMMIT");
+            CR_ROLLBACK_AND_FAIL(res, "commit failed in LOAD DATA");
+        }
+
+        return CR_RESULTS(ResType(true, this->affected_rows, 0));
     }
 
     assert(false);
@@ -1533,9 +2260,9 @@ nextImpl(const ResType &res, const NextParams &nparams)
                                 TypeText<SECLEVEL>::toText(om->getSecLevel());
                             const bool b =
                                 addShowDirectiveEntry(nparams.ps.getEConn(),
-                                                      db_name, table_name,
-                                                      field_name, onion_name,
-                                                      level);
+                                    db_name, table_name, field_name,
+                                    onion_name, level, om->isPopulated(),
+                                    onionUses(om->getAnonOnionName()));
                             TEST_ErrPkt(true == b,
                                         "failed producing directive results");
                         }
@@ -1568,13 +2295,16 @@ addShowDirectiveEntry(const std::unique_ptr<Connect> &e_conn,
                       const std::string &table,
                       const std::string &field,
                       const std::string &onion,
-                      const std::string &level)
+                      const std::string &level, bool populated,
+                      uint64_t uses)
 {
     const std::string &query =
         "INSERT INTO " + MetaData::Table::showDirective() +
-        " (_database, _table, _field, _onion, _level) VALUES "
+        " (_database, _table, _field, _onion, _level, populated, uses)"
+        " VALUES "
         " ('" + database + "', '" + table + "',"
-        "  '" + field + "', '" + onion + "', '" + level + "')";
+        "  '" + field + "', '" + onion + "', '" + level + "',"
+        "  " + bool_to_string(populated) + ", " + std::to_string(uses) + ")";
     return e_conn->execute(query);
 }
 
@@ -1588,6 +2318,229 @@ getAllShowDirectiveEntries(const std::unique_ptr<Connect> &e_conn,
     return e_conn->execute(query, db_res);
 }
 
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+AdjustmentsDirectiveExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    reenter(this->corot) {
+        yield {
+            const std::unique_ptr<Connect> &e_conn = nparams.ps.getEConn();
+            TEST_ErrPkt(e_conn->execute(
+                            "DELETE FROM "
+                            + MetaData::Table::adjustmentStatus() + ";"),
+                        "failed to initialize adjustments table");
+
+            for (const auto &it :
+                    nparams.ps.getAdjustmentScheduler().status()) {
+                TEST_ErrPkt(addAdjustmentEntry(e_conn, this->schema, it),
+                            "failed producing directive results");
+            }
+
+            std::unique_ptr<DBResult> db_res;
+            TEST_ErrPkt(e_conn->execute(
+                            "SELECT * FROM "
+                            + MetaData::Table::adjustmentStatus() + ";",
+                            &db_res),
+                        "failed retrieving directive results");
+            return CR_RESULTS(db_res->unpack());
+        }
+    }
+
+    assert(false);
+}
+
+static std::string
+adjustmentStateText(AdjustmentScheduler::State state)
+{
+    switch (state) {
+        case AdjustmentScheduler::State::Queued:
+            return "queued";
+        case AdjustmentScheduler::State::Running:
+            return "running";
+        case AdjustmentScheduler::State::Done:
+            return "done";
+        case AdjustmentScheduler::State::Failed:
+            return "failed";
+    }
+
+    assert(false);
+}
+
+bool AdjustmentsDirectiveExecutor::
+addAdjustmentEntry(const std::unique_ptr<Connect> &e_conn,
+                   const SchemaInfo &schema,
+                   const AdjustmentScheduler::Status &status)
+{
+    // the scheduler only knows the anonymized names, which are shown
+    // when the table is gone
+    std::string table = status.anon_table;
+    std::string field = "";
+    std::string onion_name = status.anon_onion;
+    if (const DatabaseMeta *const dm =
+            schema.getChild(IdentityMetaKey(status.db))) {
+        for (const auto &table_it : dm->getChildren()) {
+            const TableMeta &tm = *table_it.second;
+            if (tm.getAnonTableName() != status.anon_table) {
+                continue;
+            }
+            table = table_it.first.getValue();
+            for (const auto &field_it : tm.getChildren()) {
+                for (const auto &onion_it : field_it.second->getChildren()) {
+                    if (onion_it.second->getAnonOnionName()
+                        == status.anon_onion) {
+                        field = field_it.first.getValue();
+                        onion_name =
+                          TypeText<onion>::toText(onion_it.first.getValue());
+                    }
+                }
+            }
+        }
+    }
+
+    const std::string &query =
+        "INSERT INTO " + MetaData::Table::adjustmentStatus() +
+        " (_database, _table, _field, _onion, state, priority, chunks,"
+        "  boundary, error, id) VALUES"
+        " ('" + escapeString(e_conn, status.db) + "',"
+        "  '" + escapeString(e_conn, table) + "',"
+        "  '" + escapeString(e_conn, field) + "',"
+        "  '" + escapeString(e_conn, onion_name) + "',"
+        "  '" + adjustmentStateText(status.state) + "',"
+        "  " + std::to_string(status.priority) + ","
+        "  " + std::to_string(status.chunks) + ","
+        "  '" + escapeString(e_conn, status.boundary) + "',"
+        "  '" + escapeString(e_conn, status.error) + "',"
+        "  " + std::to_string(status.id) + ")";
+    return e_conn->execute(query);
+}
+
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+StatsDirectiveExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    reenter(this->corot) {
+        yield {
+            std::vector<std::string> names =
+                {"kind", "stage", "count", "mean_usec", "p50_usec",
+                 "p90_usec", "p99_usec", "max_usec"};
+            std::vector<enum_field_types> types =
+                {MYSQL_TYPE_VARCHAR, MYSQL_TYPE_VARCHAR, MYSQL_TYPE_LONGLONG,
+                 MYSQL_TYPE_DOUBLE, MYSQL_TYPE_DOUBLE, MYSQL_TYPE_DOUBLE,
+                 MYSQL_TYPE_DOUBLE, MYSQL_TYPE_DOUBLE};
+            const auto usec = [] (uint64_t nsec) {
+                return new Item_float(nsec / 1000.0, 1);
+            };
+
+            std::vector<std::vector<Item *> > rows;
+            for (const auto &it : latencySummaries()) {
+                rows.push_back({make_item_string(it.kind),
+                                make_item_string(it.stage),
+                                new Item_int(static_cast<ulonglong>(it.count)),
+                                usec(it.mean), usec(it.p50), usec(it.p90),
+                                usec(it.p99), usec(it.max)});
+            }
+            if (this->reset) {
+                resetLatencies();
+            }
+
+            return CR_RESULTS(ResType(true, 0, 0, std::move(names),
+                                      std::move(types), std::move(rows)));
+        }
+    }
+
+    assert(false);
+}
+
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+TraceDirectiveExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    reenter(this->corot) {
+        yield {
+            const std::string &json = traceJSON();
+            std::vector<std::string> names = {"trace", "bytes"};
+            std::vector<enum_field_types> types =
+                {MYSQL_TYPE_BLOB, MYSQL_TYPE_LONGLONG};
+            std::vector<std::vector<Item *> > rows =
+                {{make_item_string(json),
+                  new Item_int(static_cast<ulonglong>(json.size()))}};
+
+            return CR_RESULTS(ResType(true, 0, 0, std::move(names),
+                                      std::move(types), std::move(rows)));
+        }
+    }
+
+    assert(false);
+}
+
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+LayersDirectiveExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    reenter(this->corot) {
+        yield {
+            // onions of tables that are gone keep their anonymized name
+            const std::map<std::string, std::vector<std::string> > &onions =
+                this->by_onion
+                    ? onionNames(this->schema)
+                    : std::map<std::string, std::vector<std::string> >();
+
+            std::map<std::vector<std::string>, LayerCost> costs;
+            for (const auto &it : layerCosts()) {
+                std::vector<std::string> key;
+                if (this->by_onion) {
+                    const auto known = onions.find(it.first.second);
+                    key = onions.end() != known
+                        ? known->second
+                        : std::vector<std::string>{"", "", "",
+                                                   it.first.second};
+                }
+                key.push_back(it.first.first);
+                costs[key] += it.second;
+            }
+            if (this->reset) {
+                resetLayerCosts();
+            }
+
+            std::vector<std::string> names;
+            std::vector<enum_field_types> types;
+            if (this->by_onion) {
+                names = {"_database", "_table", "_field", "_onion"};
+                types.assign(names.size(), MYSQL_TYPE_VARCHAR);
+            }
+            names.push_back("layer");
+            types.push_back(MYSQL_TYPE_VARCHAR);
+            for (const char *const column :
+                    {"encrypts", "decrypts", "enc_bytes", "dec_bytes",
+                     "enc_cycles", "dec_cycles"}) {
+                names.push_back(column);
+                types.push_back(MYSQL_TYPE_LONGLONG);
+            }
+
+            std::vector<std::vector<Item *> > rows;
+            for (const auto &it : costs) {
+                std::vector<Item *> row;
+                for (const auto &text : it.first) {
+                    row.push_back(make_item_string(text));
+                }
+                for (const uint64_t count :
+                        {it.second.encrypts, it.second.decrypts,
+                         it.second.enc_bytes, it.second.dec_bytes,
+                         it.second.enc_cycles, it.second.dec_cycles}) {
+                    row.push_back(
+                        new Item_int(static_cast<ulonglong>(count)));
+                }
+                rows.push_back(row);
+            }
+
+            return CR_RESULTS(ResType(true, 0, 0, std::move(names),
+                                      std::move(types), std::move(rows)));
+        }
+    }
+
+    assert(false);
+}
+
 std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
 SensitiveDirectiveExecutor::
 nextImpl(const ResType &res, const NextParams &nparams)
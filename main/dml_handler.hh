@@ -1,10 +1,16 @@
 #pragma once
 
+#include <fstream>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <main/Analysis.hh>
 #include <main/sql_handler.hh>
 #include <main/dispatcher.hh>
+#include <main/expr_eval.hh>
+#include <main/load_data.hh>
 
 #include <sql_lex.h>
 
@@ -19,33 +25,136 @@ public:
 private:
     const std::string query;
     const ReturnMeta rmeta;
+
+    const char *traceName() const {return "DMLQueryExecutor";}
 };
 
+/*
+ * Runs an UPDATE the server can not do on ciphertexts: the matching rows
+ * are decrypted, updated and written back.  The SET list is evaluated in
+ * the proxy when SetEvaluator covers it, by the embedded server
+ * otherwise.  With a single column primary key that the UPDATE leaves
+ * alone, the rows are handled CRYPTDB_SPECIAL_UPDATE_CHUNK keys at a
+ * time: each chunk is the next page of the key's oDET ciphertexts past
+ * the last one of the previous chunk, in the server's order of the
+ * ciphertexts.  A unique key's oDET onion never goes below DET, so the
+ * paging needs no adjustment, and the proxy only ever holds one chunk.
+ * Otherwise, or if the UPDATE has a LIMIT, all of the rows are one chunk.
+ */
 class SpecialUpdateExecutor : public AbstractQueryExecutor {
-    const std::string original_query;
     const std::string plain_table;
     const std::string crypted_table;
     const std::string where_clause;
+    const std::vector<std::string> set_fields;
+    const bool chunkable;
+    // NULL if the embedded server evaluates the SET list
+    const std::unique_ptr<SetEvaluator> evaluator;
 
     // coroutine state
-    AssignOnce<ResType> dec_res;
-    AssignOnce<DBResult *> original_query_dbres;
-    AssignOnce<std::string> escaped_output_values;
-    AssignOnce<ReturnMeta> select_rmeta;
     AssignOnce<bool> in_trx;
+    // the columns of plain_table, for the evaluator
+    std::vector<EvalColumn> columns;
+    // empty if the rows are not chunked
+    std::string pk;
+    // the anonymized column of pk's oDET onion
+    std::string pk_onion;
+    // the quoted ciphertext of the last key of the previous chunk
+    std::string last_key;
+    bool keys_done;
+    std::string chunk_where;
+    std::unique_ptr<ReturnMeta> select_rmeta;
+    bool chunk_ok;
+    std::string chunk_error;
+    std::string output_values;
+    uint64_t affected_rows;
 
 public:
     SpecialUpdateExecutor(const std::string &plain_table,
                           const std::string &crypted_table,
-                          const std::string &where_clause)
+                          const std::string &where_clause,
+                          const std::vector<std::string> &set_fields,
+                          bool chunkable,
+                          std::unique_ptr<SetEvaluator> &&evaluator)
         : plain_table(plain_table), crypted_table(crypted_table),
-          where_clause(where_clause) {}
+          where_clause(where_clause), set_fields(set_fields),
+          chunkable(chunkable), evaluator(std::move(evaluator)),
+          keys_done(false), chunk_ok(true), affected_rows(0) {}
     ~SpecialUpdateExecutor() {}
     std::pair<ResultType, AbstractAnything *>
         nextImpl(const ResType &res, const NextParams &nparams);
 
 private:
+    const char *traceName() const {return "SpecialUpdateExecutor";}
     bool usesEmbedded() const {return true;}
+
+    // the primary key to chunk by, if any, and the column of its oDET
+    // onion in @onion
+    std::string chunkKey(const NextParams &nparams,
+                         std::string *const onion) const;
+    // the key ciphertexts of the chunk after the one ending at @last
+    std::string keysQuery(const std::string &last) const;
+    // decrypts the chunk's keys out of @res into chunk_where, which is
+    // left empty if there are none
+    bool nextKeys(const ResType &res, const NextParams &nparams);
+    bool lastChunk() const
+    {
+        return this->pk.empty() || this->keys_done;
+    }
+    // prepares the statements run for every chunk
+    bool prepare(const NextParams &nparams) const;
+    // leaves columns empty if it fails, which keeps the evaluator off
+    void loadColumns(const std::unique_ptr<Connect> &e_conn);
+    // decrypts the rows of a chunk and updates them into output_values
+    bool evaluate(const ResType &res, const NextParams &nparams);
+    // false if the embedded server has to update @dec_res
+    bool evaluateInProxy(const ResType &dec_res,
+                         const std::unique_ptr<Connect> &e_conn);
+};
+
+// LOAD DATA INFILE into an encrypted table; see load_data.hh
+class LoadDataExecutor : public AbstractQueryExecutor {
+    const std::string db;
+    const std::string table;
+    // resolved by infilePath()
+    const std::string path;
+    // in the order of the file's fields
+    const std::vector<std::string> fields;
+    const InfileFormat format;
+    // > INSERT INTO db.anon_table (onions and salts) VALUES
+    const std::string insert_head;
+    // the encrypted defaults of the fields the file leaves out, each
+    // after a comma
+    const std::string defaults;
+
+    std::unique_ptr<std::ifstream> file;
+    std::unique_ptr<InfileReader> reader;
+    std::unique_ptr<EncryptedRows> rows;
+    AssignOnce<bool> in_trx;
+    std::string values;
+    std::string batch_error;
+    uint64_t affected_rows;
+
+public:
+    LoadDataExecutor(const std::string &db, const std::string &table,
+                     const std::string &path,
+                     const std::vector<std::string> &fields,
+                     const InfileFormat &format,
+                     const std::string &insert_head,
+                     const std::string &defaults)
+        : db(db), table(table), path(path), fields(fields),
+          format(format), insert_head(insert_head), defaults(defaults),
+          affected_rows(0) {}
+    ~LoadDataExecutor() {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    const char *traceName() const {return "LoadDataExecutor";}
+
+    // encrypts the next rows of the file into values, which is left
+    // empty at its end
+    bool encryptBatch(const NextParams &nparams);
 };
 
 class ShowDirectiveExecutor : public AbstractQueryExecutor {
@@ -60,6 +169,7 @@ public:
         nextImpl(const ResType &res, const NextParams &nparams);
 
 private:
+    const char *traceName() const {return "ShowDirectiveExecutor";}
     bool usesEmbedded() const {return true;}
 
     static bool
@@ -71,13 +181,87 @@ private:
                           const std::string &table,
                           const std::string &field,
                           const std::string &onion,
-                          const std::string &level);
+                          const std::string &level, bool populated,
+                          uint64_t uses);
 
     static bool
     getAllShowDirectiveEntries(const std::unique_ptr<Connect> &e_conn,
                                std::unique_ptr<DBResult> *db_res);
 };
 
+// lists the peels the adjustment scheduler knows about
+class AdjustmentsDirectiveExecutor : public AbstractQueryExecutor {
+    const SchemaInfo &schema;
+
+public:
+    AdjustmentsDirectiveExecutor(const SchemaInfo &schema)
+        : schema(schema) {}
+    ~AdjustmentsDirectiveExecutor() {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    const char *traceName() const {return "AdjustmentsDirectiveExecutor";}
+    bool usesEmbedded() const {return true;}
+
+    static bool
+    addAdjustmentEntry(const std::unique_ptr<Connect> &e_conn,
+                       const SchemaInfo &schema,
+                       const AdjustmentScheduler::Status &status);
+};
+
+// SET @cryptdb='stats' [, @reset='true']: the latency histograms of the
+// query pipeline (util/latency.hh), in microseconds
+class StatsDirectiveExecutor : public AbstractQueryExecutor {
+    const bool reset;
+
+public:
+    StatsDirectiveExecutor(bool reset) : reset(reset) {}
+    ~StatsDirectiveExecutor() {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    const char *traceName() const {return "StatsDirectiveExecutor";}
+};
+
+// SET @cryptdb='trace': the spans of the sampled queries (util/trace.hh)
+// as Chrome trace JSON, in a one row result set; the proxy writes no file
+class TraceDirectiveExecutor : public AbstractQueryExecutor {
+public:
+    TraceDirectiveExecutor() {}
+    ~TraceDirectiveExecutor() {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    const char *traceName() const {return "TraceDirectiveExecutor";}
+};
+
+// SET @cryptdb='layers' [, @by='type'|'onion'] [, @reset='true']: what
+// the onion layers cost (main/layer_counters.hh), per layer type or per
+// (database, table, field, onion, layer)
+class LayersDirectiveExecutor : public AbstractQueryExecutor {
+    const SchemaInfo &schema;
+    const bool by_onion;
+    const bool reset;
+
+public:
+    LayersDirectiveExecutor(const SchemaInfo &schema, bool by_onion,
+                            bool reset)
+        : schema(schema), by_onion(by_onion), reset(reset) {}
+    ~LayersDirectiveExecutor() {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    const char *traceName() const {return "LayersDirectiveExecutor";}
+};
+
 class SensitiveDirectiveExecutor : public AbstractQueryExecutor {
     const std::vector<std::unique_ptr<Delta> > deltas;
 
@@ -90,6 +274,7 @@ public:
         nextImpl(const ResType &res, const NextParams &nparams);
 
 private:
+    const char *traceName() const {return "SensitiveDirectiveExecutor";}
     bool stales() const {return true;}
     bool usesEmbedded() const {return true;}
 };
@@ -103,6 +288,9 @@ public:
 
     std::pair<ResultType, AbstractAnything *>
         nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    const char *traceName() const {return "ShowTablesExecutor";}
 };
 
 // Abstract base class for query handler.
@@ -0,0 +1,531 @@
+#include <ctype.h>
+#include <time.h>
+#include <algorithm>
+#include <limits>
+
+#include <main/expr_eval.hh>
+#include <parser/lex_util.hh>
+#include <util/util.hh>
+
+bool
+EvalValue::operator==(const EvalValue &other) const
+{
+    if (this->kind != other.kind) {
+        return false;
+    }
+
+    switch (this->kind) {
+        case Kind::Null:
+            return true;
+        case Kind::Int:
+            return this->i == other.i;
+        case Kind::String:
+            return this->s == other.s;
+        case Kind::Opaque:
+            return false;
+    }
+
+    assert(false);
+}
+
+EvalValue
+itemToEvalValue(const Item &item)
+{
+    if (RiboldMYSQL::is_null(item)) {
+        return EvalValue();
+    }
+
+    switch (item.type()) {
+        case Item::Type::INT_ITEM: {
+            const int64_t i =
+                static_cast<int64_t>(RiboldMYSQL::val_uint(item));
+            // past INT64_MAX
+            if (item.unsigned_flag && i < 0) {
+                return EvalValue(EvalValue::Kind::Opaque);
+            }
+            return EvalValue(i, item.unsigned_flag);
+        }
+        case Item::Type::STRING_ITEM: {
+            bool is_null;
+            return EvalValue(RiboldMYSQL::val_str(item, &is_null));
+        }
+        default:
+            return EvalValue(EvalValue::Kind::Opaque);
+    }
+}
+
+static std::string
+intToString(const EvalValue &v)
+{
+    assert(EvalValue::Kind::Int == v.kind);
+    return std::to_string(v.i);
+}
+
+static bool
+isAscii(const std::string &s)
+{
+    for (const char c : s) {
+        if (c & 0x80) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+class EvalConst : public EvalExpr {
+public:
+    EvalConst(const EvalValue &value) : value(value) {}
+
+    bool eval(const std::vector<EvalColumn> &columns,
+              const std::vector<EvalValue> &row, EvalValue *const out) const
+    {
+        *out = this->value;
+        return true;
+    }
+
+private:
+    const EvalValue value;
+};
+
+class EvalField : public EvalExpr {
+public:
+    EvalField(const std::string &name) : name(name) {}
+
+    bool eval(const std::vector<EvalColumn> &columns,
+              const std::vector<EvalValue> &row, EvalValue *const out) const
+    {
+        assert(columns.size() == row.size());
+        for (size_t i = 0; i < columns.size(); ++i) {
+            if (equalsIgnoreCase(this->name, columns[i].name)) {
+                *out = row[i];
+                return EvalValue::Kind::Opaque != out->kind;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    const std::string name;
+};
+
+class EvalCall : public EvalExpr {
+public:
+    enum class Op {Plus, Minus, Mul, Neg, Eq, Ne, Lt, Le, Gt, Ge, IsNull,
+                   IsNotNull, If, IfNull, Concat, Lower, Upper, Length};
+
+    EvalCall(Op op, std::vector<std::unique_ptr<EvalExpr> > &&args)
+        : op(op), args(std::move(args)) {}
+
+    bool eval(const std::vector<EvalColumn> &columns,
+              const std::vector<EvalValue> &row, EvalValue *const out) const;
+
+    // the operator of @name with @count arguments; false if there is none
+    static bool lookup(const std::string &name, size_t count, Op *const op);
+
+private:
+    bool arithmetic(const EvalValue &a, const EvalValue &b,
+                    EvalValue *const out) const;
+    bool comparison(const EvalValue &a, const EvalValue &b,
+                    EvalValue *const out) const;
+
+    const Op op;
+    const std::vector<std::unique_ptr<EvalExpr> > args;
+};
+
+bool
+EvalCall::lookup(const std::string &name, size_t count, Op *const op)
+{
+    static const std::map<std::pair<std::string, size_t>, Op> ops = {
+        {{"+", 2}, Op::Plus}, {{"-", 2}, Op::Minus}, {{"*", 2}, Op::Mul},
+        {{"-", 1}, Op::Neg}, {{"=", 2}, Op::Eq}, {{"<>", 2}, Op::Ne},
+        {{"<", 2}, Op::Lt}, {{"<=", 2}, Op::Le}, {{">", 2}, Op::Gt},
+        {{">=", 2}, Op::Ge}, {{"isnull", 1}, Op::IsNull},
+        {{"isnotnull", 1}, Op::IsNotNull}, {{"if", 3}, Op::If},
+        {{"ifnull", 2}, Op::IfNull}, {{"lcase", 1}, Op::Lower},
+        {{"ucase", 1}, Op::Upper}, {{"length", 1}, Op::Length}
+    };
+
+    if ("concat" == name && count >= 1) {
+        *op = Op::Concat;
+        return true;
+    }
+
+    const auto it = ops.find(std::make_pair(name, count));
+    if (ops.end() == it) {
+        return false;
+    }
+
+    *op = it->second;
+    return true;
+}
+
+bool
+EvalCall::arithmetic(const EvalValue &a, const EvalValue &b,
+                     EvalValue *const out) const
+{
+    if (EvalValue::Kind::Null == a.kind || EvalValue::Kind::Null == b.kind) {
+        *out = EvalValue();
+        return true;
+    }
+
+    // MySQL would convert strings to doubles
+    RETURN_FALSE_IF_FALSE(EvalValue::Kind::Int == a.kind
+                          && EvalValue::Kind::Int == b.kind);
+
+    const int64_t max = std::numeric_limits<int64_t>::max();
+    const int64_t min = std::numeric_limits<int64_t>::min();
+    const int64_t bound = static_cast<int64_t>(1) << 31;
+    int64_t result = 0;
+    switch (this->op) {
+        case Op::Plus:
+            RETURN_FALSE_IF_FALSE(!(b.i > 0 && a.i > max - b.i)
+                                  && !(b.i < 0 && a.i < min - b.i));
+            result = a.i + b.i;
+            break;
+        case Op::Minus:
+            RETURN_FALSE_IF_FALSE(!(b.i < 0 && a.i > max + b.i)
+                                  && !(b.i > 0 && a.i < min + b.i));
+            result = a.i - b.i;
+            break;
+        case Op::Mul:
+            // products of larger factors are rare enough to leave alone
+            RETURN_FALSE_IF_FALSE(a.i < bound && a.i > -bound
+                                  && b.i < bound && b.i > -bound);
+            result = a.i * b.i;
+            break;
+        default:
+            assert(false);
+    }
+
+    // out of range for MySQL
+    const bool is_unsigned = a.is_unsigned || b.is_unsigned;
+    RETURN_FALSE_IF_FALSE(!(is_unsigned && result < 0));
+
+    *out = EvalValue(result, is_unsigned);
+    return true;
+}
+
+bool
+EvalCall::comparison(const EvalValue &a, const EvalValue &b,
+                     EvalValue *const out) const
+{
+    if (EvalValue::Kind::Null == a.kind || EvalValue::Kind::Null == b.kind) {
+        *out = EvalValue();
+        return true;
+    }
+
+    // strings compare by collation
+    RETURN_FALSE_IF_FALSE(EvalValue::Kind::Int == a.kind
+                          && EvalValue::Kind::Int == b.kind);
+
+    bool result = false;
+    switch (this->op) {
+        case Op::Eq: result = a.i == b.i; break;
+        case Op::Ne: result = a.i != b.i; break;
+        case Op::Lt: result = a.i < b.i; break;
+        case Op::Le: result = a.i <= b.i; break;
+        case Op::Gt: result = a.i > b.i; break;
+        case Op::Ge: result = a.i >= b.i; break;
+        default: assert(false);
+    }
+
+    *out = EvalValue(result ? 1 : 0, false);
+    return true;
+}
+
+bool
+EvalCall::eval(const std::vector<EvalColumn> &columns,
+               const std::vector<EvalValue> &row, EvalValue *const out) const
+{
+    std::vector<EvalValue> values(this->args.size());
+    for (size_t i = 0; i < this->args.size(); ++i) {
+        // IF only evaluates the branch it takes
+        if (Op::If == this->op && i > 0) {
+            break;
+        }
+        RETURN_FALSE_IF_FALSE(this->args[i]->eval(columns, row, &values[i]));
+    }
+
+    switch (this->op) {
+        case Op::Plus: case Op::Minus: case Op::Mul:
+            return this->arithmetic(values[0], values[1], out);
+        case Op::Neg: {
+            const EvalValue &a = values[0];
+            if (EvalValue::Kind::Null == a.kind) {
+                *out = a;
+                return true;
+            }
+            RETURN_FALSE_IF_FALSE(EvalValue::Kind::Int == a.kind
+                                  && false == a.is_unsigned
+                                  && std::numeric_limits<int64_t>::min()
+                                     != a.i);
+            *out = EvalValue(-a.i, false);
+            return true;
+        }
+        case Op::Eq: case Op::Ne: case Op::Lt: case Op::Le: case Op::Gt:
+        case Op::Ge:
+            return this->comparison(values[0], values[1], out);
+        case Op::IsNull: case Op::IsNotNull: {
+            const bool null = EvalValue::Kind::Null == values[0].kind;
+            *out = EvalValue((Op::IsNull == this->op) == null ? 1 : 0,
+                             false);
+            return true;
+        }
+        case Op::If: {
+            const EvalValue &c = values[0];
+            RETURN_FALSE_IF_FALSE(EvalValue::Kind::Null == c.kind
+                                  || EvalValue::Kind::Int == c.kind);
+            const bool taken = EvalValue::Kind::Int == c.kind && 0 != c.i;
+            return this->args[taken ? 1 : 2]->eval(columns, row, out);
+        }
+        case Op::IfNull:
+            // the type of the result depends on both arguments
+            RETURN_FALSE_IF_FALSE(values[0].kind == values[1].kind
+                                  || EvalValue::Kind::Null == values[0].kind
+                                  || EvalValue::Kind::Null == values[1].kind);
+            *out = EvalValue::Kind::Null == values[0].kind ? values[1]
+                                                           : values[0];
+            return true;
+        case Op::Concat: {
+            std::string s;
+            for (const auto &it : values) {
+                if (EvalValue::Kind::Null == it.kind) {
+                    *out = EvalValue();
+                    return true;
+                }
+                s += EvalValue::Kind::Int == it.kind ? intToString(it) : it.s;
+            }
+            *out = EvalValue(s);
+            return true;
+        }
+        case Op::Lower: case Op::Upper: {
+            const EvalValue &a = values[0];
+            if (EvalValue::Kind::Null == a.kind) {
+                *out = a;
+                return true;
+            }
+            std::string s =
+                EvalValue::Kind::Int == a.kind ? intToString(a) : a.s;
+            // case mapping beyond ASCII is the collation's
+            RETURN_FALSE_IF_FALSE(isAscii(s));
+            for (char &c : s) {
+                c = Op::Lower == this->op ? tolower(c) : toupper(c);
+            }
+            *out = EvalValue(s);
+            return true;
+        }
+        case Op::Length: {
+            const EvalValue &a = values[0];
+            if (EvalValue::Kind::Null == a.kind) {
+                *out = a;
+                return true;
+            }
+            const std::string &s =
+                EvalValue::Kind::Int == a.kind ? intToString(a) : a.s;
+            *out = EvalValue(static_cast<int64_t>(s.length()), false);
+            return true;
+        }
+    }
+
+    assert(false);
+}
+
+// the NOW() of the UPDATE, in the proxy's time zone as the embedded
+// server has it
+static std::string
+now()
+{
+    const time_t t = time(NULL);
+    struct tm local;
+    localtime_r(&t, &local);
+
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &local);
+    return buf;
+}
+
+static EvalExpr *
+compileItem(const Item &item, const std::string &now_value)
+{
+    switch (item.type()) {
+        case Item::Type::FIELD_ITEM:
+            return new EvalField(
+                static_cast<const Item_field &>(item).field_name);
+        case Item::Type::INT_ITEM: case Item::Type::STRING_ITEM:
+        case Item::Type::NULL_ITEM: {
+            const EvalValue value = itemToEvalValue(item);
+            if (EvalValue::Kind::Opaque == value.kind) {
+                return NULL;
+            }
+            return new EvalConst(value);
+        }
+        case Item::Type::FUNC_ITEM: {
+            const Item_func &func = static_cast<const Item_func &>(item);
+            const std::string name = func.func_name();
+            if ("now" == name && 0 == func.argument_count()) {
+                return new EvalConst(EvalValue(now_value));
+            }
+
+            EvalCall::Op op;
+            if (false == EvalCall::lookup(name, func.argument_count(), &op)) {
+                return NULL;
+            }
+
+            std::vector<std::unique_ptr<EvalExpr> > args;
+            Item *const *const func_args = func.arguments();
+            for (uint i = 0; i < func.argument_count(); ++i) {
+                EvalExpr *const arg = compileItem(*func_args[i], now_value);
+                if (!arg) {
+                    return NULL;
+                }
+                args.push_back(std::unique_ptr<EvalExpr>(arg));
+            }
+
+            return new EvalCall(op, std::move(args));
+        }
+        default:
+            return NULL;
+    }
+}
+
+SetEvaluator *
+SetEvaluator::compile(LEX *const lex)
+{
+    std::unique_ptr<SetEvaluator> evaluator(new SetEvaluator());
+    const std::string now_value = now();
+
+    auto fd_it = List_iterator<Item>(lex->select_lex.item_list);
+    auto val_it = List_iterator<Item>(lex->value_list);
+    for (;;) {
+        const Item *const field = fd_it++;
+        const Item *const value = val_it++;
+        assert(!!field == !!value);
+        if (!field) {
+            break;
+        }
+
+        assert(Item::Type::FIELD_ITEM == field->type());
+        EvalExpr *const expr = compileItem(*value, now_value);
+        if (!expr) {
+            return NULL;
+        }
+        evaluator->assignments.push_back(
+            std::make_pair(static_cast<const Item_field *>(field)->field_name,
+                           std::unique_ptr<EvalExpr>(expr)));
+    }
+
+    return evaluator.release();
+}
+
+static bool
+isDatetime(const std::string &s)
+{
+    static const std::string format = "dddd-dd-dd dd:dd:dd";
+    if (format.length() != s.length()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < format.length(); ++i) {
+        if ('d' == format[i] ? !isdigit(s[i]) : format[i] != s[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// whether MySQL stores @value in @column as it is, without converting,
+// truncating or failing
+static bool
+fits(const EvalValue &value, const EvalColumn &column)
+{
+    static const std::map<std::string, unsigned int> int_bits = {
+        {"tinyint", 8}, {"smallint", 16}, {"mediumint", 24}, {"int", 32},
+        {"bigint", 64}
+    };
+    static const std::vector<std::string> string_types = {
+        "varchar", "tinytext", "text", "mediumtext", "longtext"
+    };
+
+    switch (value.kind) {
+        case EvalValue::Kind::Null:
+            return column.nullable;
+        case EvalValue::Kind::Int: {
+            const auto bits = int_bits.find(column.data_type);
+            if (int_bits.end() == bits) {
+                return false;
+            }
+            if (column.is_unsigned) {
+                return value.i >= 0
+                    && (64 == bits->second
+                        || static_cast<uint64_t>(value.i)
+                           < static_cast<uint64_t>(1) << bits->second);
+            }
+            if (64 == bits->second) {
+                return false == value.is_unsigned;
+            }
+            const int64_t bound = static_cast<int64_t>(1) << (bits->second - 1);
+            return value.i >= -bound && value.i < bound;
+        }
+        case EvalValue::Kind::String:
+            if ("datetime" == column.data_type
+                || "timestamp" == column.data_type) {
+                return isDatetime(value.s);
+            }
+            // the byte length bounds the character length; CHAR would
+            // strip trailing spaces
+            return (std::find(string_types.begin(), string_types.end(),
+                              column.data_type) != string_types.end()
+                    || ("char" == column.data_type
+                        && (value.s.empty() || ' ' != *value.s.rbegin())))
+                && value.s.length() <= column.max_length;
+        case EvalValue::Kind::Opaque:
+            return false;
+    }
+
+    assert(false);
+}
+
+bool
+SetEvaluator::update(const std::vector<EvalColumn> &columns,
+                     const std::vector<Item *> &row,
+                     std::map<size_t, EvalValue> *const assigned,
+                     bool *const changed) const
+{
+    assert(columns.size() == row.size());
+
+    std::vector<EvalValue> values;
+    for (const auto &it : row) {
+        values.push_back(itemToEvalValue(*it));
+    }
+    const std::vector<EvalValue> old_values = values;
+
+    // MySQL assigns left to right; later expressions see earlier values
+    assigned->clear();
+    for (const auto &it : this->assignments) {
+        size_t position = 0;
+        while (position < columns.size()
+               && false == equalsIgnoreCase(it.first,
+                                            columns[position].name)) {
+            ++position;
+        }
+        RETURN_FALSE_IF_FALSE(position < columns.size());
+
+        EvalValue value;
+        RETURN_FALSE_IF_FALSE(it.second->eval(columns, values, &value));
+        RETURN_FALSE_IF_FALSE(fits(value, columns[position]));
+        values[position] = value;
+        (*assigned)[position] = value;
+    }
+
+    *changed = false;
+    for (const auto &it : *assigned) {
+        RETURN_FALSE_IF_FALSE(EvalValue::Kind::Opaque
+                              != old_values[it.first].kind);
+        *changed = *changed || !(old_values[it.first] == it.second);
+    }
+
+    return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+/*
+ * expr_eval.hh
+ *
+ *  Evaluates the SET list of an UPDATE over decrypted rows in the proxy,
+ *  so that SpecialUpdateExecutor does not have to copy them through a
+ *  table of the embedded server.  It covers what those UPDATEs commonly
+ *  use: integer arithmetic and comparisons, IF, IFNULL, CONCAT, LOWER,
+ *  UPPER, LENGTH and NOW().  Anything else, and any value that might not
+ *  come out exactly as MySQL would store it (an overflow, a string too
+ *  long for its column, ...), is left to the embedded server.
+ */
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sql_lex.h>
+
+class EvalValue {
+public:
+    // Opaque values can only be copied
+    enum class Kind {Null, Int, String, Opaque};
+
+    EvalValue() : kind(Kind::Null), i(0), is_unsigned(false) {}
+    explicit EvalValue(Kind kind) : kind(kind), i(0), is_unsigned(false) {}
+    EvalValue(int64_t i, bool is_unsigned)
+        : kind(Kind::Int), i(i), is_unsigned(is_unsigned) {}
+    explicit EvalValue(const std::string &s)
+        : kind(Kind::String), i(0), is_unsigned(false), s(s) {}
+
+    bool operator==(const EvalValue &other) const;
+
+    Kind kind;
+    int64_t i;
+    // MySQL does unsigned arithmetic if an operand is unsigned
+    bool is_unsigned;
+    std::string s;
+};
+
+// a column of the plaintext table, as INFORMATION_SCHEMA.COLUMNS has it
+struct EvalColumn {
+    std::string name;
+    std::string data_type;
+    bool is_unsigned;
+    bool nullable;
+    // in characters, for strings
+    uint64_t max_length;
+};
+
+class EvalExpr {
+public:
+    virtual ~EvalExpr() {}
+    // false if the value can not be computed in the proxy
+    virtual bool eval(const std::vector<EvalColumn> &columns,
+                      const std::vector<EvalValue> &row,
+                      EvalValue *const out) const = 0;
+};
+
+class SetEvaluator {
+public:
+    // NULL if the SET list is not covered
+    static SetEvaluator *compile(LEX *const lex);
+
+    // Applies the SET list to @row, the decrypted values of @columns;
+    // @assigned holds the new values by column position.  False if the
+    // embedded server has to do it.
+    bool update(const std::vector<EvalColumn> &columns,
+                const std::vector<Item *> &row,
+                std::map<size_t, EvalValue> *const assigned,
+                bool *const changed) const;
+
+private:
+    SetEvaluator() {}
+
+    std::vector<std::pair<std::string, std::unique_ptr<EvalExpr> > >
+        assignments;
+};
+
+EvalValue itemToEvalValue(const Item &item);
@@ -0,0 +1,283 @@
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <main/layer_counters.hh>
+#include <util/scopedperf.hh>
+
+LayerCost &
+LayerCost::operator+=(const LayerCost &other)
+{
+    this->encrypts += other.encrypts;
+    this->decrypts += other.decrypts;
+    this->enc_bytes += other.enc_bytes;
+    this->dec_bytes += other.dec_bytes;
+    this->enc_cycles += other.enc_cycles;
+    this->dec_cycles += other.dec_cycles;
+    return *this;
+}
+
+struct LayerSlot {
+    const size_t index;
+    const LayerKey key;
+};
+
+// the slots of a thread come in chunks, made as the thread needs them
+static const size_t chunk_slots = 256;
+static const size_t max_chunks = 1024;
+
+// the owning thread adds to it while readers load it
+struct SlotCost {
+    std::atomic<uint64_t> encrypts;
+    std::atomic<uint64_t> decrypts;
+    std::atomic<uint64_t> enc_bytes;
+    std::atomic<uint64_t> dec_bytes;
+    std::atomic<uint64_t> enc_cycles;
+    std::atomic<uint64_t> dec_cycles;
+};
+
+struct ThreadCosts {
+    std::atomic<SlotCost *> chunks[max_chunks];
+};
+
+// slots and the counts of threads live as long as the process, so that
+// neither a layer nor a reader ever sees one go away
+static std::mutex slots_lock;
+static std::map<LayerKey, const LayerSlot *> slot_index;
+static std::deque<LayerSlot> slots;
+static std::mutex registry_lock;
+static std::vector<ThreadCosts *> registry;
+static __thread ThreadCosts *thread_costs = NULL;
+static __thread QueryLayerCosts *query_costs = NULL;
+
+static const LayerSlot &
+layerSlot(const EncLayer &layer, const OnionMeta &om)
+{
+    const LayerSlot *slot =
+        layer.counter_slot.load(std::memory_order_acquire);
+    if (NULL == slot) {
+        const LayerKey key(layer.name(), om.getAnonOnionName());
+        std::lock_guard<std::mutex> guard(slots_lock);
+        const LayerSlot *&known = slot_index[key];
+        if (NULL == known) {
+            slots.push_back(LayerSlot{slots.size(), key});
+            known = &slots.back();
+        }
+        slot = known;
+        layer.counter_slot.store(slot, std::memory_order_release);
+    }
+
+    return *slot;
+}
+
+static ThreadCosts &
+threadCosts()
+{
+    if (NULL == thread_costs) {
+        thread_costs = new ThreadCosts();
+        std::lock_guard<std::mutex> guard(registry_lock);
+        registry.push_back(thread_costs);
+    }
+
+    return *thread_costs;
+}
+
+// NULL past the last chunk
+static SlotCost *
+threadSlotCost(size_t index)
+{
+    const size_t c = index / chunk_slots;
+    if (c >= max_chunks) {
+        return NULL;
+    }
+
+    // only this thread stores chunks
+    std::atomic<SlotCost *> &chunk = threadCosts().chunks[c];
+    SlotCost *costs = chunk.load(std::memory_order_relaxed);
+    if (NULL == costs) {
+        costs = new SlotCost[chunk_slots]();
+        chunk.store(costs, std::memory_order_release);
+    }
+
+    return &costs[index % chunk_slots];
+}
+
+// calls @fn with every slot @costs counted in; slots_lock must be held
+template <typename Fn>
+static void
+forEachSlotCost(const ThreadCosts &costs, Fn fn)
+{
+    for (size_t c = 0; c * chunk_slots < slots.size() && c < max_chunks;
+         ++c) {
+        SlotCost *const chunk =
+            costs.chunks[c].load(std::memory_order_acquire);
+        if (NULL == chunk) {
+            continue;
+        }
+        for (size_t i = 0;
+             i < chunk_slots && c * chunk_slots + i < slots.size(); ++i) {
+            fn(slots[c * chunk_slots + i], &chunk[i]);
+        }
+    }
+}
+
+uint64_t
+layerCycles()
+{
+    return tscp_ctr::sample();
+}
+
+uint64_t
+itemBytes(const Item &i)
+{
+    if (STRING_RESULT != i.result_type()) {
+        return sizeof(ulonglong);
+    }
+
+    // constants and the layers' outputs keep their value in str_value
+    return i.str_value.length();
+}
+
+void
+countLayer(const EncLayer &layer, const OnionMeta &om, bool encrypt,
+           uint64_t values, uint64_t bytes, uint64_t cycles)
+{
+    LayerCost cost = LayerCost();
+    if (encrypt) {
+        cost.encrypts = values;
+        cost.enc_bytes = bytes;
+        cost.enc_cycles = cycles;
+    } else {
+        cost.decrypts = values;
+        cost.dec_bytes = bytes;
+        cost.dec_cycles = cycles;
+    }
+
+    const LayerSlot &slot = layerSlot(layer, om);
+    if (query_costs) {
+        (*query_costs)[slot.index] += cost;
+    }
+
+    SlotCost *const counts = threadSlotCost(slot.index);
+    if (NULL == counts) {
+        return;
+    }
+    const auto relaxed = std::memory_order_relaxed;
+    counts->encrypts.fetch_add(cost.encrypts, relaxed);
+    counts->decrypts.fetch_add(cost.decrypts, relaxed);
+    counts->enc_bytes.fetch_add(cost.enc_bytes, relaxed);
+    counts->dec_bytes.fetch_add(cost.dec_bytes, relaxed);
+    counts->enc_cycles.fetch_add(cost.enc_cycles, relaxed);
+    counts->dec_cycles.fetch_add(cost.dec_cycles, relaxed);
+}
+
+Item *
+countedEncrypt(const EncLayer &layer, const OnionMeta &om,
+               const Item &ptext, uint64_t IV)
+{
+    const uint64_t start = layerCycles();
+    Item *const out = layer.encrypt(ptext, IV);
+    countLayer(layer, om, true, 1, itemBytes(ptext), layerCycles() - start);
+    return out;
+}
+
+Item *
+countedDecrypt(const EncLayer &layer, const OnionMeta &om,
+               const Item &ctext, uint64_t IV)
+{
+    const uint64_t start = layerCycles();
+    Item *const out = layer.decrypt(ctext, IV);
+    countLayer(layer, om, false, 1, itemBytes(ctext), layerCycles() - start);
+    return out;
+}
+
+std::map<LayerKey, LayerCost>
+layerCosts()
+{
+    std::map<LayerKey, LayerCost> out;
+    std::lock_guard<std::mutex> guard(registry_lock);
+    std::lock_guard<std::mutex> slots_guard(slots_lock);
+    for (const ThreadCosts *const it : registry) {
+        forEachSlotCost(*it,
+            [&out] (const LayerSlot &slot, const SlotCost *const counts)
+        {
+            const auto relaxed = std::memory_order_relaxed;
+            const LayerCost cost = {counts->encrypts.load(relaxed),
+                                    counts->decrypts.load(relaxed),
+                                    counts->enc_bytes.load(relaxed),
+                                    counts->dec_bytes.load(relaxed),
+                                    counts->enc_cycles.load(relaxed),
+                                    counts->dec_cycles.load(relaxed)};
+            if (cost.encrypts || cost.decrypts) {
+                out[slot.key] += cost;
+            }
+        });
+    }
+
+    return out;
+}
+
+void
+resetLayerCosts()
+{
+    std::lock_guard<std::mutex> guard(registry_lock);
+    std::lock_guard<std::mutex> slots_guard(slots_lock);
+    for (ThreadCosts *const it : registry) {
+        forEachSlotCost(*it,
+            [] (const LayerSlot &slot, SlotCost *const counts)
+        {
+            const auto relaxed = std::memory_order_relaxed;
+            counts->encrypts.store(0, relaxed);
+            counts->decrypts.store(0, relaxed);
+            counts->enc_bytes.store(0, relaxed);
+            counts->dec_bytes.store(0, relaxed);
+            counts->enc_cycles.store(0, relaxed);
+            counts->dec_cycles.store(0, relaxed);
+        });
+    }
+}
+
+void
+setQueryLayerCosts(QueryLayerCosts *costs)
+{
+    query_costs = costs;
+}
+
+QueryLayerCosts *
+queryLayerCosts()
+{
+    return query_costs;
+}
+
+std::map<LayerKey, LayerCost>
+layerCostsByKey(const QueryLayerCosts &costs)
+{
+    std::map<LayerKey, LayerCost> out;
+    std::lock_guard<std::mutex> guard(slots_lock);
+    for (const auto &it : costs) {
+        out[slots[it.first].key] += it.second;
+    }
+
+    return out;
+}
+
+std::map<std::string, std::vector<std::string> >
+onionNames(const SchemaInfo &schema)
+{
+    std::map<std::string, std::vector<std::string> > out;
+    for (const auto &db_it : schema.getChildren()) {
+        for (const auto &table_it : db_it.second->getChildren()) {
+            for (const auto &field_it : table_it.second->getChildren()) {
+                for (const auto &onion_it : field_it.second->getChildren()) {
+                    out[onion_it.second->getAnonOnionName()] =
+                        {db_it.first.getValue(), table_it.first.getValue(),
+                         field_it.first.getValue(),
+                         TypeText<onion>::toText(onion_it.first.getValue())};
+                }
+            }
+        }
+    }
+
+    return out;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+/*
+ * layer_counters.hh
+ *
+ *  What each onion layer costs: how many values it encrypted and
+ *  decrypted, how many bytes those were (the string's length, 8 for a
+ *  number) and how many TSC cycles it spent on them.  The counts are
+ *  kept by layer type and anonymized onion, each pair of which gets a
+ *  slot the first time one of its layers is counted; the layer keeps its
+ *  slot, so counting a value builds no key and takes no lock.  Each
+ *  thread counts into atomics of its own, which are merged when read.
+ *
+ *  Every call into a layer goes through countedEncrypt(),
+ *  countedDecrypt() or, for the batched decryptions, countLayer().
+ */
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <main/CryptoHandlers.hh>
+#include <main/schema.hh>
+
+struct LayerCost {
+    uint64_t encrypts;
+    uint64_t decrypts;
+    uint64_t enc_bytes;
+    uint64_t dec_bytes;
+    uint64_t enc_cycles;
+    uint64_t dec_cycles;
+
+    LayerCost &operator+=(const LayerCost &other);
+};
+
+// (layer type, anonymized onion name)
+typedef std::pair<std::string, std::string> LayerKey;
+
+uint64_t layerCycles();
+uint64_t itemBytes(const Item &i);
+
+Item *countedEncrypt(const EncLayer &layer, const OnionMeta &om,
+                     const Item &ptext, uint64_t IV);
+Item *countedDecrypt(const EncLayer &layer, const OnionMeta &om,
+                     const Item &ctext, uint64_t IV);
+// @values went through @layer of @om at once
+void countLayer(const EncLayer &layer, const OnionMeta &om, bool encrypt,
+                uint64_t values, uint64_t bytes, uint64_t cycles);
+
+// the counts of all threads
+std::map<LayerKey, LayerCost> layerCosts();
+void resetLayerCosts();
+
+// what one query cost, by slot
+typedef std::map<size_t, LayerCost> QueryLayerCosts;
+// while set, the thread also counts into @costs
+void setQueryLayerCosts(QueryLayerCosts *costs);
+QueryLayerCosts *queryLayerCosts();
+// @costs by layer type and anonymized onion
+std::map<LayerKey, LayerCost> layerCostsByKey(const QueryLayerCosts &costs);
+
+// anonymized onion name -> database, table, field, onion
+std::map<std::string, std::vector<std::string> >
+onionNames(const SchemaInfo &schema);
@@ -0,0 +1,256 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <sstream>
+
+#include <main/load_data.hh>
+#include <main/error.hh>
+#include <parser/lex_util.hh>
+#include <util/errstream.hh>
+
+#include <sql_class.h>
+
+static const size_t read_size = 64 * 1024;
+
+static std::string
+exchangeString(const String *const s)
+{
+    return s ? std::string(s->ptr(), s->length()) : "";
+}
+
+InfileFormat
+InfileFormat::fromExchange(const sql_exchange &exchange)
+{
+    return InfileFormat{exchangeString(exchange.field_term),
+                        exchangeString(exchange.enclosed),
+                        exchangeString(exchange.escaped),
+                        exchangeString(exchange.line_term),
+                        exchangeString(exchange.line_start),
+                        exchange.skip_lines};
+}
+
+bool
+InfileReader::fill(size_t n)
+{
+    while (this->buffer.size() - this->pos < n) {
+        if (this->pos >= read_size) {
+            this->buffer.erase(0, this->pos);
+            this->pos = 0;
+        }
+
+        char chunk[read_size];
+        this->in.read(chunk, sizeof(chunk));
+        if (0 == this->in.gcount()) {
+            return false;
+        }
+        this->buffer.append(chunk, this->in.gcount());
+    }
+
+    return true;
+}
+
+bool
+InfileReader::lookingAt(const std::string &s)
+{
+    return false == s.empty() && this->fill(s.size())
+           && 0 == this->buffer.compare(this->pos, s.size(), s);
+}
+
+bool
+InfileReader::rowStart()
+{
+    if (false == this->skipped) {
+        this->skipped = true;
+        for (uint64_t i = 0; i < this->format.skip_lines; ++i) {
+            while (false == this->atEnd()
+                   && false == this->lookingAt(this->format.line_term)) {
+                ++this->pos;
+            }
+            if (this->atEnd()) {
+                return false;
+            }
+            this->pos += this->format.line_term.size();
+        }
+    }
+
+    // as the server does, lines without the prefix are skipped
+    if (false == this->format.line_start.empty()) {
+        while (false == this->lookingAt(this->format.line_start)) {
+            if (this->atEnd()) {
+                return false;
+            }
+            ++this->pos;
+        }
+        this->pos += this->format.line_start.size();
+        return true;
+    }
+
+    return false == this->atEnd();
+}
+
+InfileField
+InfileReader::field()
+{
+    const std::string &enclosed = this->format.enclosed;
+    const std::string &escaped = this->format.escaped;
+    const auto atTerminator = [this] () {
+        return this->atEnd() || this->lookingAt(this->format.field_term)
+               || this->lookingAt(this->format.line_term);
+    };
+
+    InfileField f{false, ""};
+    const bool was_quoted = this->lookingAt(enclosed);
+    bool quoted = was_quoted;
+    if (quoted) {
+        this->pos += enclosed.size();
+    }
+
+    while (false == this->atEnd()) {
+        if (quoted) {
+            if (this->lookingAt(enclosed)) {
+                this->pos += enclosed.size();
+                // a doubled quote is a quote
+                if (false == this->lookingAt(enclosed)) {
+                    quoted = false;
+                    continue;
+                }
+                this->pos += enclosed.size();
+                f.value += enclosed;
+                continue;
+            }
+        } else if (atTerminator()) {
+            break;
+        }
+
+        if (this->lookingAt(escaped) && this->fill(escaped.size() + 1)) {
+            this->pos += escaped.size();
+            const char c = this->buffer[this->pos++];
+            if ('N' == c && false == was_quoted && f.value.empty()
+                && atTerminator()) {
+                f.null = true;
+                continue;
+            }
+
+            switch (c) {
+                case '0': f.value += '\0'; break;
+                case 'b': f.value += '\b'; break;
+                case 'n': f.value += '\n'; break;
+                case 'r': f.value += '\r'; break;
+                case 't': f.value += '\t'; break;
+                case 'Z': f.value += '\032'; break;
+                default: f.value += c; break;
+            }
+            continue;
+        }
+
+        f.value += this->buffer[this->pos++];
+    }
+
+    // with FIELDS ENCLOSED BY, so is a bare NULL
+    if (false == was_quoted && false == enclosed.empty()
+        && "NULL" == f.value) {
+        f.null = true;
+    }
+
+    return f;
+}
+
+bool
+InfileReader::next(std::vector<InfileField> *const row)
+{
+    row->clear();
+    if (false == this->rowStart()) {
+        return false;
+    }
+
+    while (true) {
+        row->push_back(this->field());
+        if (this->lookingAt(this->format.field_term)) {
+            this->pos += this->format.field_term.size();
+            continue;
+        }
+        if (this->lookingAt(this->format.line_term)) {
+            this->pos += this->format.line_term.size();
+        }
+        return true;
+    }
+}
+
+class ItemArena {
+public:
+    ItemArena()
+        : thd(current_thd), saved_root(thd->mem_root),
+          saved_items(thd->free_list)
+    {
+        init_sql_alloc(&this->root, 64 * 1024, 0);
+        thd->mem_root = &this->root;
+        thd->free_list = NULL;
+    }
+
+    ~ItemArena()
+    {
+        thd->free_items();
+        thd->mem_root = this->saved_root;
+        thd->free_list = this->saved_items;
+        free_root(&this->root, MYF(0));
+    }
+
+private:
+    THD *const thd;
+    MEM_ROOT *const saved_root;
+    Item *const saved_items;
+    MEM_ROOT root;
+};
+
+std::string
+infilePath(const std::string &path)
+{
+    static const std::string root = [] () -> std::string {
+        const char *const dir = getenv("CRYPTDB_LOAD_DATA_DIR");
+        char resolved[PATH_MAX];
+        if (NULL == dir || NULL == realpath(dir, resolved)) {
+            return "";
+        }
+        return resolved;
+    }();
+    if (root.empty() || path.empty()) {
+        return "";
+    }
+
+    const std::string &full = '/' == path[0] ? path : root + "/" + path;
+    char resolved[PATH_MAX];
+    if (NULL == realpath(full.c_str(), resolved)) {
+        return "";
+    }
+    // symlinks are resolved, so they can not lead out of the directory
+    const std::string out(resolved);
+    if (0 != out.compare(0, root.size() + 1, root + "/")) {
+        return "";
+    }
+
+    return out;
+}
+
+std::string
+EncryptedRows::next(const Encrypter &encrypt, uint64_t max_rows)
+{
+    ItemArena arena;
+    std::string out;
+    std::vector<InfileField> row;
+    for (uint64_t i = 0; i < max_rows && this->reader.next(&row); ++i) {
+        ++this->rows;
+        out += out.empty() ? "(" : ", (";
+        try {
+            encrypt(row, &out);
+        } catch (const AbstractException &e) {
+            std::ostringstream s;
+            s << "row " << this->rows << ": " << e;
+            throw CryptDBError(s.str());
+        } catch (const CryptDBError &e) {
+            throw CryptDBError("row " + std::to_string(this->rows) + ": "
+                               + e.msg);
+        }
+        out += ")";
+    }
+
+    return out;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+/*
+ * load_data.hh
+ *
+ *  LOAD DATA INFILE into encrypted tables.  The proxy reads the file
+ *  itself, since plaintext never lives on the server, and only from the
+ *  directory CRYPTDB_LOAD_DATA_DIR names, as the server only reads from
+ *  secure_file_priv; without it LOAD DATA is refused.  LOAD DATA LOCAL
+ *  is refused as well: the client's file never reaches the rewriter.
+ *  Each row is encrypted as INSERT would encrypt it, and the rows go to
+ *  the server as INSERTs of a few hundred rows on the client's
+ *  connection, in one transaction, so the proxy only ever holds a batch
+ *  of them.
+ */
+
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sql_lex.h>
+
+// FIELDS and LINES of a LOAD DATA
+struct InfileFormat {
+    std::string field_term;
+    std::string enclosed;
+    std::string escaped;
+    std::string line_term;
+    std::string line_start;
+    uint64_t skip_lines;
+
+    static InfileFormat fromExchange(const sql_exchange &exchange);
+};
+
+struct InfileField {
+    bool null;
+    std::string value;
+};
+
+// splits a LOAD DATA file into rows, the way the server does
+class InfileReader {
+public:
+    InfileReader(std::istream &in, const InfileFormat &format)
+        : in(in), format(format), pos(0), skipped(false) {}
+
+    // false at the end of the file
+    bool next(std::vector<InfileField> *const row);
+
+private:
+    std::istream &in;
+    const InfileFormat format;
+    std::string buffer;
+    size_t pos;
+    bool skipped;
+
+    // false if the file ends before @n more bytes
+    bool fill(size_t n);
+    bool lookingAt(const std::string &s);
+    bool atEnd() {return false == this->fill(1);}
+    // after the LINES STARTING BY prefix of the next row
+    bool rowStart();
+    // up to the next field or line terminator, unescaped
+    InfileField field();
+};
+
+// @path, resolved, if it is inside CRYPTDB_LOAD_DATA_DIR; relative paths
+// are relative to it.  Empty otherwise.
+std::string infilePath(const std::string &path);
+
+// Encrypts the rows of an InfileReader into the VALUES lists of INSERTs.
+// The Items made while encrypting a batch are freed with it rather than
+// with the THD.
+class EncryptedRows {
+public:
+    // appends the encrypted values of a row, in the order of the INSERT's
+    // columns and separated by commas; throws if the row can not be
+    // encrypted
+    typedef std::function<void (const std::vector<InfileField> &,
+                                std::string *const)> Encrypter;
+
+    EncryptedRows(InfileReader &reader) : reader(reader), rows(0) {}
+
+    // > (a, b), (c, d)
+    // for the next @max_rows rows at most; empty at the end of the file.
+    // Throws, naming the row, if one can not be encrypted.
+    std::string next(const Encrypter &encrypt, uint64_t max_rows);
+
+private:
+    InfileReader &reader;
+    uint64_t rows;
+};
@@ -39,6 +39,19 @@ MetaData::Table::showDirective()
            "showDirective";
 }
 
+std::string
+MetaData::Table::onionPeel()
+{
+    return DB::embeddedDB() + "." + Internal::getPrefix() + "onionPeel";
+}
+
+std::string
+MetaData::Table::adjustmentStatus()
+{
+    return DB::embeddedDB() + "." + Internal::getPrefix() +
+           "adjustmentStatus";
+}
+
 std::string
 MetaData::Table::remoteQueryCompletion()
 {
@@ -46,6 +59,18 @@ MetaData::Table::remoteQueryCompletion()
            "remoteQueryCompletion";
 }
 
+std::string
+MetaData::Table::remotePeelProgress()
+{
+    return DB::remoteDB() + "." + Internal::getPrefix() + "peelProgress";
+}
+
+std::string
+MetaData::Table::remoteImportProgress()
+{
+    return DB::remoteDB() + "." + Internal::getPrefix() + "importProgress";
+}
+
 std::string
 MetaData::Proc::activeTransactionP()
 {
@@ -141,6 +166,10 @@ MetaData::initialize(const std::unique_ptr<Connect> &conn,
         " ENGINE=InnoDB;";
     RETURN_FALSE_IF_FALSE(e_conn->execute(create_staleness));
 
+    // only ever holds the results of the last directive, so older
+    // layouts of the table are simply replaced
+    RETURN_FALSE_IF_FALSE(e_conn->execute(
+        " DROP TABLE IF EXISTS " + Table::showDirective() + ";"));
     const std::string create_show_directive =
         " CREATE TABLE IF NOT EXISTS " + Table::showDirective() +
         "   (_database VARCHAR(500) NOT NULL,"
@@ -148,11 +177,48 @@ MetaData::initialize(const std::unique_ptr<Connect> &conn,
         "    _field VARCHAR(500) NOT NULL,"
         "    _onion VARCHAR(500) NOT NULL,"
         "    _level VARCHAR(500) NOT NULL,"
+        "    populated BOOLEAN NOT NULL,"
+        "    uses BIGINT UNSIGNED NOT NULL,"
         "    id SERIAL PRIMARY KEY)"
         " ENGINE=InnoDB;";
     RETURN_FALSE_IF_FALSE(e_conn->execute(create_show_directive));
 
-    // Remote database.
+    // id is the embedded completion id of the adjustment
+    const std::string create_onion_peel =
+        " CREATE TABLE IF NOT EXISTS " + Table::onionPeel() +
+        "   (_database VARCHAR(500) NOT NULL,"
+        "    _table VARCHAR(500) NOT NULL,"
+        "    _onion VARCHAR(500) NOT NULL,"
+        "    _salt VARCHAR(500) NOT NULL,"
+        "    _pk VARCHAR(500) NOT NULL,"
+        "    peel BLOB NOT NULL,"
+        "    layers BLOB NOT NULL,"
+        "    id BIGINT UNSIGNED PRIMARY KEY)"
+        " ENGINE=InnoDB;";
+    RETURN_FALSE_IF_FALSE(e_conn->execute(create_onion_peel));
+
+    // id is the peel's
+    const std::string create_adjustment_status =
+        " CREATE TABLE IF NOT EXISTS " + Table::adjustmentStatus() +
+        "   (_database VARCHAR(500) NOT NULL,"
+        "    _table VARCHAR(500) NOT NULL,"
+        "    _field VARCHAR(500) NOT NULL,"
+        "    _onion VARCHAR(500) NOT NULL,"
+        "    state VARCHAR(100) NOT NULL,"
+        "    priority BIGINT UNSIGNED NOT NULL,"
+        "    chunks BIGINT UNSIGNED NOT NULL,"
+        "    boundary VARCHAR(100) NOT NULL,"
+        "    error BLOB NOT NULL,"
+        "    id BIGINT UNSIGNED PRIMARY KEY)"
+        " ENGINE=InnoDB;";
+    RETURN_FALSE_IF_FALSE(e_conn->execute(create_adjustment_status));
+
+    // Remote database; none for a SharedProxyState without a server.
+    if (!conn) {
+        initialized = true;
+        return true;
+    }
+
     const std::string create_remote_db =
         " CREATE DATABASE IF NOT EXISTS " + DB::remoteDB() + ";";
     RETURN_FALSE_IF_FALSE(conn->execute(create_remote_db));
@@ -165,6 +231,27 @@ MetaData::initialize(const std::unique_ptr<Connect> &conn,
         " ENGINE=InnoDB;";
     RETURN_FALSE_IF_FALSE(conn->execute(create_remote_completion));
 
+    // rows of the peeled table with a primary key <= boundary are done
+    const std::string create_peel_progress =
+        " CREATE TABLE IF NOT EXISTS " + Table::remotePeelProgress() +
+        "   (boundary DECIMAL(20, 0),"
+        "    done BOOLEAN NOT NULL,"
+        "    id BIGINT UNSIGNED PRIMARY KEY)"
+        " ENGINE=InnoDB;";
+    RETURN_FALSE_IF_FALSE(conn->execute(create_peel_progress));
+
+    // the last statement of a dump cryptdbimport loaded into a table; ''
+    // for statements that are not INSERTs
+    const std::string create_import_progress =
+        " CREATE TABLE IF NOT EXISTS " + Table::remoteImportProgress() +
+        "   (dump VARCHAR(255) NOT NULL,"
+        "    _database VARCHAR(64) NOT NULL,"
+        "    _table VARCHAR(64) NOT NULL,"
+        "    statement BIGINT UNSIGNED NOT NULL,"
+        "    PRIMARY KEY (dump, _database, _table))"
+        " ENGINE=InnoDB;";
+    RETURN_FALSE_IF_FALSE(conn->execute(create_import_progress));
+
     initialized = true;
     return true;
 }
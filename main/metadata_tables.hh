@@ -18,7 +18,11 @@ namespace MetaData {
         std::string embeddedQueryCompletion();
         std::string staleness();
         std::string showDirective();
+        std::string onionPeel();
+        std::string adjustmentStatus();
         std::string remoteQueryCompletion();
+        std::string remotePeelProgress();
+        std::string remoteImportProgress();
     };
 
     namespace Proc {
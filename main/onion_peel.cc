@@ -0,0 +1,367 @@
+#include <stdlib.h>
+#include <string>
+#include <memory>
+#include <vector>
+
+#include <main/onion_peel.hh>
+#include <main/schema.hh>
+#include <main/metadata_tables.hh>
+#include <main/rewrite_util.hh>
+#include <main/serializers.hh>
+#include <main/macro_util.hh>
+#include <main/layer_counters.hh>
+#include <parser/lex_util.hh>
+#include <parser/stringify.hh>
+#include <util/rob.hh>
+
+static uint64_t
+envCount(const char *const name, uint64_t dflt)
+{
+    const char *const s = getenv(name);
+    return s ? strtoull(s, NULL, 10) : dflt;
+}
+
+uint64_t
+peelChunkRows()
+{
+    static const uint64_t rows = envCount("CRYPTDB_PEEL_CHUNK", 10000);
+    return rows;
+}
+
+uint64_t
+peelThrottleMs()
+{
+    static const uint64_t ms = envCount("CRYPTDB_PEEL_THROTTLE_MS", 0);
+    return ms;
+}
+
+/*
+ * Whether the row with primary key @pk is at the new level: the peel is
+ * done or has gone past the row.  Without @pk (the server picks the key
+ * of an inserted row, which is past every key the peel knows of) only
+ * the former.  Writes read the progress row with a shared lock, so they
+ * wait for the chunk in flight and the chunk waits for them.
+ */
+static void
+printPeeledSide(String *const str, enum_query_type query_type,
+                Item *const pk, uint64_t id, bool lock)
+{
+    str->append("(SELECT peel_progress.done");
+    if (pk) {
+        str->append(" OR ");
+        pk->print(str, query_type);
+        str->append(" <= peel_progress.boundary");
+    }
+
+    const std::string from =
+        " FROM " + MetaData::Table::remotePeelProgress() +
+        " AS peel_progress WHERE peel_progress.id = " + std::to_string(id) +
+        (lock ? " LOCK IN SHARE MODE)" : ")");
+    str->append(from.c_str(), from.length());
+}
+
+/*
+ * Prints as IF(peeled side, col, peeled col).  It stays an Item_field
+ * so that the rest of the rewriter (salts, HAVING) still treats it as
+ * the column.  Items live on the THD's mem_root and are never destroyed,
+ * hence no std::string members.
+ */
+class Item_field_peeling : public Item_field {
+public:
+    Item_field_peeling(THD *const thd, Item_field *const col,
+                       Item *const pk, Item *const peeled, uint64_t id)
+        : Item_field(thd, col), pk(pk), peeled(peeled), id(id) {}
+
+    void print(String *str, enum_query_type query_type)
+    {
+        // the boundary is read in the same snapshot as the row
+        str->append("IF(");
+        printPeeledSide(str, query_type, this->pk, this->id, false);
+        str->append(", ");
+        Item_field::print(str, query_type);
+        str->append(", ");
+        peeled->print(str, query_type);
+        str->append(")");
+    }
+
+private:
+    Item *const pk;
+    Item *const peeled;
+    const uint64_t id;
+};
+
+// the condition of the IF() writeBothLayers() returns
+class Item_peeled_side : public Item_int {
+public:
+    Item_peeled_side(Item *const pk, uint64_t id)
+        : Item_int(static_cast<int32>(0)), pk(pk), id(id) {}
+
+    void print(String *str, enum_query_type query_type)
+    {
+        printPeeledSide(str, query_type, this->pk, this->id, true);
+    }
+
+private:
+    Item *const pk;
+    const uint64_t id;
+};
+
+OnionPeel::OnionPeel(uint64_t id, const std::string &db,
+                     const std::string &anon_table,
+                     const std::string &anon_onion,
+                     const std::string &salt, const std::string &pk,
+                     const std::string &peel_expr,
+                     const std::vector<std::string> &layer_serials)
+    : id(id), db(db), anon_table(anon_table), anon_onion(anon_onion),
+      salt(salt), pk(pk), peel_expr(peel_expr),
+      layer_serials(layer_serials)
+{
+    // a new peel is only driven by the executor that started it; queries
+    // read through restored ones
+    if (0 == id) {
+        return;
+    }
+
+    auto *const restored = new std::vector<std::unique_ptr<EncLayer> >();
+    this->layers =
+        std::shared_ptr<const std::vector<std::unique_ptr<EncLayer> > >(
+            restored);
+    for (const auto &it : layer_serials) {
+        restored->push_back(EncLayerFactory::deserializeLayer(id, it));
+    }
+}
+
+Item_field *
+OnionPeel::bothLayers(const Item_field &col) const
+{
+    assert(this->layers);
+    THD *const thd = current_thd;
+    assert(thd);
+
+    const std::string table = col.table_name;
+    Item_field *const pk_field = make_item_field(col, table, this->pk);
+    Item_field *const salt_field = make_item_field(col, table, this->salt);
+    Item *peeled = make_item_field(col, table, this->anon_onion);
+    for (const auto &it : *this->layers) {
+        peeled = it->decryptUDF(peeled, salt_field);
+    }
+
+    return new (thd->mem_root)
+        Item_field_peeling(thd, &const_cast<Item_field &>(col), pk_field,
+                           peeled, this->id);
+}
+
+Item *
+OnionPeel::writeBothLayers(const OnionMeta &om, Item *const pk,
+                           Item *const value, uint64_t IV) const
+{
+    assert(this->layers);
+    if (Item::NULL_ITEM == value->type()) {
+        return value;
+    }
+
+    // the layers go back on innermost first
+    Item *layered = value;
+    for (auto it = this->layers->rbegin(); it != this->layers->rend();
+         ++it) {
+        layered = countedEncrypt(**it, om, *layered, IV);
+    }
+
+    THD *const thd = current_thd;
+    assert(thd);
+    return new (thd->mem_root)
+        Item_func_if(new (thd->mem_root) Item_peeled_side(pk, this->id),
+                     value, layered);
+}
+
+std::string
+OnionPeel::qualifiedTable() const
+{
+    return quoteText(this->db) + "." + this->anon_table;
+}
+
+std::string
+OnionPeel::primaryKeyQuery() const
+{
+    return
+        " SELECT MIN(k.column_name), COUNT(*),"
+        "        SUM(c.data_type IN ('tinyint', 'smallint', 'mediumint',"
+        "                            'int', 'bigint'))"
+        "   FROM INFORMATION_SCHEMA.KEY_COLUMN_USAGE AS k"
+        "   JOIN INFORMATION_SCHEMA.COLUMNS AS c"
+        "     ON c.table_schema = k.table_schema"
+        "    AND c.table_name = k.table_name"
+        "    AND c.column_name = k.column_name"
+        "  WHERE k.table_schema = '" + this->db + "'"
+        "    AND k.table_name = '" + this->anon_table + "'"
+        "    AND k.constraint_name = 'PRIMARY';";
+}
+
+bool
+OnionPeel::chunkable(const ResType &pk_res, std::string *const pk) const
+{
+    if (false == pk_res.success() || 1 != pk_res.rows.size()) {
+        return false;
+    }
+
+    const std::vector<Item *> &row = pk_res.rows.front();
+    assert(3 == row.size());
+    if (RiboldMYSQL::is_null(*row[0])) {
+        return false;
+    }
+
+    // peeling the key column itself would reorder the chunks under us
+    *pk = ItemToString(*row[0]);
+    return "1" == ItemToString(*row[1]) && "1" == ItemToString(*row[2])
+        && *pk != this->anon_onion;
+}
+
+void
+OnionPeel::begin(uint64_t id, const std::string &pk)
+{
+    assert(0 == this->id && id);
+    this->id = id;
+    this->pk = pk;
+}
+
+bool
+OnionPeel::record(const std::unique_ptr<Connect> &e_conn) const
+{
+    assert(this->id);
+
+    std::string layers;
+    for (const auto &it : this->layer_serials) {
+        layers += serialize_string(it);
+    }
+
+    const std::string query =
+        " INSERT INTO " + MetaData::Table::onionPeel() +
+        "   (_database, _table, _onion, _salt, _pk, peel, layers, id)"
+        "   VALUES ('" + escapeString(e_conn, this->db) + "',"
+        "           '" + escapeString(e_conn, this->anon_table) + "',"
+        "           '" + escapeString(e_conn, this->anon_onion) + "',"
+        "           '" + escapeString(e_conn, this->salt) + "',"
+        "           '" + escapeString(e_conn, this->pk) + "',"
+        "           '" + escapeString(e_conn, this->peel_expr) + "',"
+        "           '" + escapeString(e_conn, layers) + "',"
+        "           " + std::to_string(this->id) + ");";
+    RETURN_FALSE_IF_FALSE(e_conn->execute(query));
+
+    return true;
+}
+
+bool
+OnionPeel::forget(const std::unique_ptr<Connect> &e_conn) const
+{
+    const std::string query =
+        " DELETE FROM " + MetaData::Table::onionPeel() +
+        "  WHERE id = " + std::to_string(this->id) + ";";
+    RETURN_FALSE_IF_FALSE(e_conn->execute(query));
+
+    return true;
+}
+
+std::string
+OnionPeel::createProgressQuery() const
+{
+    return
+        " INSERT INTO " + MetaData::Table::remotePeelProgress() +
+        "   (boundary, done, id) VALUES"
+        "   (NULL, FALSE, " + std::to_string(this->id) + ");";
+}
+
+std::string
+OnionPeel::lockProgressQuery() const
+{
+    // concurrent drivers of the same peel take turns here
+    return
+        " SELECT boundary, done FROM " +
+                 MetaData::Table::remotePeelProgress() +
+        "  WHERE id = " + std::to_string(this->id) +
+        "    FOR UPDATE;";
+}
+
+std::string
+OnionPeel::nextBoundaryQuery(const std::string &lower) const
+{
+    const std::string where =
+        "NULL" == lower ? "" : " WHERE " + this->pk + " > " + lower;
+    return
+        " SELECT MAX(" + this->pk + ") FROM"
+        "   (SELECT " + this->pk + " FROM " + this->qualifiedTable() +
+                 where +
+        "     ORDER BY " + this->pk +
+        "     LIMIT " + std::to_string(peelChunkRows()) + ") AS peel_chunk;";
+}
+
+std::string
+OnionPeel::peelChunkQuery(const std::string &lower,
+                          const std::string &upper) const
+{
+    const std::string from =
+        "NULL" == lower ? "" : this->pk + " > " + lower + " AND ";
+    return
+        " UPDATE " + this->qualifiedTable() +
+        "    SET " + this->setClause() +
+        "  WHERE " + from + this->pk + " <= " + upper + ";";
+}
+
+std::string
+OnionPeel::setClause() const
+{
+    return this->anon_onion + " = " + this->peel_expr;
+}
+
+std::string
+OnionPeel::advanceProgressQuery(const std::string &upper) const
+{
+    return
+        " UPDATE " + MetaData::Table::remotePeelProgress() +
+        "    SET boundary = " + upper +
+        "  WHERE id = " + std::to_string(this->id) + ";";
+}
+
+std::string
+OnionPeel::finishProgressQuery() const
+{
+    // the row stays, queries rewritten before the peel disappeared from
+    // the schema may still read the boundary
+    return
+        " UPDATE " + MetaData::Table::remotePeelProgress() +
+        "    SET done = TRUE"
+        "  WHERE id = " + std::to_string(this->id) + ";";
+}
+
+bool
+loadOnionPeels(const std::unique_ptr<Connect> &e_conn,
+               SchemaInfo *const schema)
+{
+    // peels whose adjustment never completed were rolled back with it
+    std::unique_ptr<DBResult> dbres;
+    const std::string query =
+        " SELECT p.id, p._database, p._table, p._onion, p._salt, p._pk,"
+        "        p.peel, p.layers"
+        "   FROM " + MetaData::Table::onionPeel() + " AS p"
+        "   JOIN " + MetaData::Table::embeddedQueryCompletion() + " AS c"
+        "     ON c.id = p.id"
+        "  WHERE c.complete = TRUE AND c.aborted = FALSE;";
+    RETURN_FALSE_IF_FALSE(e_conn->execute(query, &dbres));
+
+    while (const MYSQL_ROW row = mysql_fetch_row(dbres->n)) {
+        const unsigned long *const l = mysql_fetch_lengths(dbres->n);
+        const uint64_t id = strtoull(row[0], NULL, 10);
+        const std::string db(row[1], l[1]);
+        const std::string table(row[2], l[2]);
+        const std::string onion(row[3], l[3]);
+        const std::string salt(row[4], l[4]);
+        const std::string pk(row[5], l[5]);
+        const std::string peel_expr(row[6], l[6]);
+        const std::string layers(row[7], l[7]);
+
+        schema->addPeel(std::unique_ptr<OnionPeel>(
+            new OnionPeel(id, db, table, onion, salt, pk, peel_expr,
+                          unserialize_string(layers))));
+    }
+
+    return true;
+}
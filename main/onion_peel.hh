@@ -0,0 +1,115 @@
+#pragma once
+
+/*
+ * onion_peel.hh
+ *
+ *  Chunked onion peeling.  Removing an onion layer used to be one
+ *  UPDATE over the whole table, which holds every row lock (and grows
+ *  the undo log) until the last row is done.  When the anonymized table
+ *  has a single integer primary key, the layers are instead peeled in
+ *  primary key order, CRYPTDB_PEEL_CHUNK rows (10000 by default; 0
+ *  disables chunking) per transaction, sleeping CRYPTDB_PEEL_THROTTLE_MS
+ *  between chunks.  Unless CRYPTDB_ADJUST_WORKERS is 0 the chunks are
+ *  peeled in the background; see adjust_scheduler.hh.
+ *
+ *  The metadata moves to the new level before the first chunk.  Until
+ *  the last one, rows with a primary key up to the boundary in
+ *  remote_db's peel progress table have been peeled and the others have
+ *  not, so queries read the column through bothLayers() and write it
+ *  through writeBothLayers(), which puts the layers back on values for
+ *  rows the peel has yet to reach.  The boundary is advanced in the same
+ *  transaction as its chunk, and the peel itself is recorded in the
+ *  embedded database, so after a crash the next query that needs it
+ *  finished picks up where the last chunk left off.
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <main/CryptoHandlers.hh>
+#include <main/Connect.hh>
+#include <parser/sql_utils.hh>
+
+class OnionMeta;
+class SchemaInfo;
+
+// rows per chunk; 0 if peels should use a single statement
+uint64_t peelChunkRows();
+// pause between chunks, in milliseconds
+uint64_t peelThrottleMs();
+
+class OnionPeel {
+public:
+    // New; the id and primary key are filled in by begin().
+    OnionPeel(const std::string &db, const std::string &anon_table,
+              const std::string &anon_onion, const std::string &salt,
+              const std::string &peel_expr,
+              const std::vector<std::string> &layer_serials)
+        : OnionPeel(0, db, anon_table, anon_onion, salt, "", peel_expr,
+                    layer_serials) {}
+    // Restore.
+    OnionPeel(uint64_t id, const std::string &db,
+              const std::string &anon_table, const std::string &anon_onion,
+              const std::string &salt, const std::string &pk,
+              const std::string &peel_expr,
+              const std::vector<std::string> &layer_serials);
+
+    uint64_t getId() const {return id;}
+    const std::string &getDatabase() const {return db;}
+    const std::string &getAnonTable() const {return anon_table;}
+    const std::string &getAnonOnion() const {return anon_onion;}
+    const std::string &getPrimaryKey() const {return pk;}
+    const std::string &getSalt() const {return salt;}
+
+    // the onion column as it reads at the new level, whichever side of
+    // the boundary its row is on
+    Item_field *bothLayers(const Item_field &col) const;
+    // @value, encrypted at the new level of @om with @IV, as it must be
+    // written to the row with primary key @pk (NULL if the server picks
+    // the key) for the side of the boundary the row is on
+    Item *writeBothLayers(const OnionMeta &om, Item *const pk,
+                          Item *const value, uint64_t IV) const;
+
+    // the table can be chunked if the result of primaryKeyQuery() names
+    // a single integer column other than the onion itself
+    std::string primaryKeyQuery() const;
+    bool chunkable(const ResType &pk_res, std::string *const pk) const;
+    void begin(uint64_t id, const std::string &pk);
+
+    // embedded bookkeeping
+    bool record(const std::unique_ptr<Connect> &e_conn) const;
+    bool forget(const std::unique_ptr<Connect> &e_conn) const;
+
+    // remote queries, in the order the chunk loop issues them; a NULL
+    // bound means the start of the table
+    std::string createProgressQuery() const;
+    std::string lockProgressQuery() const;
+    std::string nextBoundaryQuery(const std::string &lower) const;
+    std::string peelChunkQuery(const std::string &lower,
+                               const std::string &upper) const;
+    std::string advanceProgressQuery(const std::string &upper) const;
+    std::string finishProgressQuery() const;
+
+    // onion = peeled onion, for an UPDATE of the whole table
+    std::string setClause() const;
+
+private:
+    uint64_t id;
+    std::string db;
+    std::string anon_table;
+    std::string anon_onion;
+    std::string salt;
+    std::string pk;
+    // SET expression removing the layers from the column, as stored
+    std::string peel_expr;
+    // outermost layer first
+    std::vector<std::string> layer_serials;
+    std::shared_ptr<const std::vector<std::unique_ptr<EncLayer> > > layers;
+
+    std::string qualifiedTable() const;
+};
+
+bool
+loadOnionPeels(const std::unique_ptr<Connect> &e_conn,
+               SchemaInfo *const schema);
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <main/parallel_encrypt.hh>
+#include <main/Connect.hh>
+#include <main/error.hh>
+#include <main/layer_counters.hh>
+#include <main/macro_util.hh>
+#include <util/errstream.hh>
+
+#include <NTL/ZZ.h>
+
+static uint64_t
+envCount(const char *const name, uint64_t dflt)
+{
+    const char *const s = getenv(name);
+    return s ? strtoull(s, NULL, 10) : dflt;
+}
+
+uint64_t
+insertWorkers()
+{
+#if defined(NTL_THREADS)
+    static const uint64_t workers =
+        std::max(envCount("CRYPTDB_INSERT_WORKERS",
+                          std::thread::hardware_concurrency()),
+                 uint64_t(1));
+#else
+    static const uint64_t workers = 1;
+#endif
+    return workers;
+}
+
+uint64_t
+parallelInsertRows()
+{
+    static const uint64_t rows =
+        std::max(envCount("CRYPTDB_PARALLEL_INSERT_ROWS", 64), uint64_t(1));
+    return rows;
+}
+
+// Items made on a worker, kept for the thread that prints them
+class EncryptArena {
+public:
+    EncryptArena() : items(NULL)
+    {
+        init_sql_alloc(&this->root, 64 * 1024, 0);
+    }
+
+    ~EncryptArena()
+    {
+        for (Item *i = this->items; i; ) {
+            Item *const next = i->next;
+            i->delete_self();
+            i = next;
+        }
+        free_root(&this->root, MYF(0));
+    }
+
+    // the Items @f makes on current_thd go to the arena
+    void run(const std::function<void ()> &f)
+    {
+        THD *const thd = current_thd;
+        MEM_ROOT *const saved_root = thd->mem_root;
+        Item *const saved_items = thd->free_list;
+        thd->mem_root = &this->root;
+        thd->free_list = this->items;
+
+        const auto restore = [&] () {
+            this->items = thd->free_list;
+            thd->mem_root = saved_root;
+            thd->free_list = saved_items;
+        };
+        try {
+            f();
+        } catch (...) {
+            restore();
+            throw;
+        }
+        restore();
+    }
+
+private:
+    MEM_ROOT root;
+    Item *items;
+};
+
+// the workers live as long as the process
+class EncryptPool {
+public:
+    explicit EncryptPool(uint64_t workers)
+    {
+        for (uint64_t i = 0; i < workers; ++i) {
+            std::thread(&EncryptPool::work, this).detach();
+        }
+    }
+
+    void submit(std::function<void ()> &&task)
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->tasks.push_back(std::move(task));
+        this->ready.notify_one();
+    }
+
+private:
+    void work()
+    {
+        assert(0 == mysql_thread_init());
+        assert(create_embedded_thd(0));
+
+        while (true) {
+            std::function<void ()> task;
+            {
+                std::unique_lock<std::mutex> guard(this->mutex);
+                while (this->tasks.empty()) {
+                    this->ready.wait(guard);
+                }
+                task = std::move(this->tasks.front());
+                this->tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void ()> > tasks;
+};
+
+static EncryptPool &
+encryptPool()
+{
+    static EncryptPool *const pool = new EncryptPool(insertWorkers());
+    return *pool;
+}
+
+ParallelRows::ParallelRows() {}
+
+ParallelRows::~ParallelRows() {}
+
+void
+ParallelRows::run(size_t rows, const Encrypter &encrypt,
+                  std::vector<std::vector<Item *> > *const out)
+{
+    out->assign(rows, std::vector<Item *>());
+    if (insertWorkers() < 2 || rows < parallelInsertRows()) {
+        for (size_t i = 0; i < rows; ++i) {
+            encrypt(i, &(*out)[i]);
+        }
+        return;
+    }
+
+    const size_t chunks = insertWorkers();
+    const size_t chunk = (rows + chunks - 1) / chunks;
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t pending = 0;
+    std::vector<std::string> errors(chunks);
+    // the pool's threads count what the layers cost towards the query of
+    // the thread that submits to them
+    QueryLayerCosts *const query_costs = queryLayerCosts();
+    for (size_t c = 0; c < chunks && c * chunk < rows; ++c) {
+        const size_t begin = c * chunk;
+        const size_t end = std::min(rows, begin + chunk);
+        this->arenas.push_back(
+            std::unique_ptr<EncryptArena>(new EncryptArena()));
+        EncryptArena *const arena = this->arenas.back().get();
+
+        ++pending;
+        encryptPool().submit([&, arena, begin, end, c, query_costs] () {
+            QueryLayerCosts costs;
+            setQueryLayerCosts(query_costs ? &costs : NULL);
+            std::string error;
+            try {
+                arena->run([&] () {
+                    for (size_t i = begin; i < end; ++i) {
+                        encrypt(i, &(*out)[i]);
+                    }
+                });
+            } catch (const AbstractException &e) {
+                std::ostringstream s;
+                s << e;
+                error = s.str();
+            } catch (const CryptDBError &e) {
+                error = e.msg;
+            } catch (const std::exception &e) {
+                error = e.what();
+            }
+
+            setQueryLayerCosts(NULL);
+
+            std::lock_guard<std::mutex> guard(mutex);
+            if (query_costs) {
+                for (const auto &it : costs) {
+                    (*query_costs)[it.first] += it.second;
+                }
+            }
+            errors[c] = error;
+            if (0 == --pending) {
+                finished.notify_one();
+            }
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        while (pending > 0) {
+            finished.wait(guard);
+        }
+    }
+
+    for (const auto &it : errors) {
+        if (false == it.empty()) {
+            FAIL_TextMessageError(it);
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+/*
+ * parallel_encrypt.hh
+ *
+ *  Encrypts the rows of a large INSERT ... VALUES on a pool of
+ *  CRYPTDB_INSERT_WORKERS threads (one per core by default; 1 turns it
+ *  off).  Each worker keeps an embedded THD of its own, and each chunk of
+ *  rows makes its Items in an arena of its own that lives as long as the
+ *  ParallelRows, ie until the rewritten query is printed.  Rows come back
+ *  in their order, so the query is the one a single thread would write.
+ *
+ *  Only INSERTs of at least CRYPTDB_PARALLEL_INSERT_ROWS (64) rows are
+ *  split.  NTL can only be used from several threads when it was built
+ *  with NTL_THREADS; without it rows are always encrypted by the caller.
+ */
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <sql_class.h>
+
+// 1 if rows are encrypted by the thread that rewrites the query
+uint64_t insertWorkers();
+uint64_t parallelInsertRows();
+
+class EncryptArena;
+
+class ParallelRows {
+public:
+    // appends the encrypted values of a row; throws if it can not
+    typedef std::function<void (size_t, std::vector<Item *> *const)>
+        Encrypter;
+
+    ParallelRows();
+    ~ParallelRows();
+
+    // encrypts rows [0, @rows) into @out, on the workers if there are
+    // enough of them; throws the error of the first row that failed
+    void run(size_t rows, const Encrypter &encrypt,
+             std::vector<std::vector<Item *> > *const out);
+
+private:
+    std::vector<std::unique_ptr<EncryptArena> > arenas;
+};
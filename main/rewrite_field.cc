@@ -103,6 +103,12 @@ class ANON : public CItemSubtypeIT<Item_field, Item::Type::FIELD_ITEM> {
         const OnionMeta &om =
             a.getOnionMeta(db_name, plain_table_name, i.field_name,
                            constr.o);
+        if (false == om.isPopulated()) {
+            throw OnionMaterializeExcept(
+                a.getTableMeta(db_name, plain_table_name), fm, constr.o);
+        }
+        noteOnionUse(om.getAnonOnionName());
+
         const SECLEVEL onion_level = a.getOnionLevel(om);
         assert(onion_level != SECLEVEL::INVALID);
         if (constr.l < onion_level) {
@@ -117,7 +123,7 @@ class ANON : public CItemSubtypeIT<Item_field, Item::Type::FIELD_ITEM> {
             a.getAnonTableName(db_name, plain_table_name, &is_alias);
         const std::string anon_field_name = om.getAnonOnionName();
 
-        Item_field * const res =
+        Item_field *res =
             make_item_field(i, anon_table_name, anon_field_name);
 
         // HACK: to get aliases to work in DELETE FROM statements
@@ -125,6 +131,17 @@ class ANON : public CItemSubtypeIT<Item_field, Item::Type::FIELD_ITEM> {
             res->db_name = NULL;
         }
 
+        // some rows may still have the layers the metadata no longer
+        // lists (VALUES(...) is the value the write itself put in the
+        // row, at the level of the row's side of the boundary)
+        const OnionPeel *const peel =
+            a.getSchema().getPeel(
+                a.getTableMeta(db_name, plain_table_name).getAnonTableName(),
+                anon_field_name);
+        if (peel && !isItem_insert_value(i)) {
+            res = peel->bothLayers(*res);
+        }
+
         // This information is only relevant if it comes from a
         // HAVING clause.
         // FIXME: Enforce this semantically.
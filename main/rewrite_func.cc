@@ -486,6 +486,8 @@ static class ANON : public CItemSubtypeFT<Item_func_get_system_var, Item_func::F
     }
 } ANON;
 
+extern const char str_minus[];
+
 template<class IT, const char *NAME>
 class CItemAdditive : public CItemSubtypeFN<IT, NAME> {
     virtual RewritePlan *
@@ -537,7 +539,15 @@ class CItemAdditive : public CItemSubtypeFN<IT, NAME> {
             EncLayer const &el = a.getBackEncLayer(*om);
             TEST_UnexpectedSecurityLevel(oAGG, SECLEVEL::HOM,
                                          el.level());
-            return static_cast<const HOM &>(el).sumUDF(arg0, arg1);
+            const HOM &hom = static_cast<const HOM &>(el);
+            if (std::string(str_minus) != NAME) {
+                return hom.sumUDF(arg0, arg1);
+            }
+
+            // the proxy can only negate constants
+            TEST_Text(Item::STRING_ITEM == arg1->type(),
+                      "HOM can only subtract constants");
+            return hom.sumUDF(arg0, hom.negate(*arg1));
         }
         default:
             return new IT(arg0, arg1);
@@ -16,6 +16,7 @@
 #include <main/rewrite_util.hh>
 #include <util/cryptdb_log.hh>
 #include <util/enum_text.hh>
+#include <util/latency.hh>
 #include <util/yield.hpp>
 #include <main/CryptoHandlers.hh>
 #include <parser/lex_util.hh>
@@ -23,7 +24,10 @@
 #include <main/dml_handler.hh>
 #include <main/ddl_handler.hh>
 #include <main/metadata_tables.hh>
+#include <main/onion_peel.hh>
+#include <main/layer_counters.hh>
 #include <main/macro_util.hh>
+#include <main/slow_query_log.hh>
 
 #include "field.h"
 #include <errmsg.h>
@@ -511,6 +515,9 @@ deltaSanityCheck(const std::unique_ptr<Connect> &conn,
 
     const unsigned long unfinished_id =
         atoi(string_unfinished_id.c_str());
+    TEST_TextMessageError(nullptr != conn,
+                          "can not finish an interrupted delta without a"
+                          " server!");
     const CompletionType type =
         TypeText<CompletionType>::toType(string_unfinished_type);
 
@@ -611,10 +618,12 @@ loadSchemaInfo(const std::unique_ptr<Connect> &conn,
         };
 
     loadChildren(schema.get());
+    assert(loadOnionPeels(e_conn, schema.get()));
 
     assert(sanityCheck(*schema.get()));
     assert(metaSanityCheck(e_conn));
-    assert(tablesSanityCheck(*schema.get(), e_conn, conn));
+    // without a server there are no anonymous tables to compare with
+    assert(!conn || tablesSanityCheck(*schema.get(), e_conn, conn));
 
     return std::move(schema);
 }
@@ -743,14 +752,14 @@ buildTypeTextTranslator()
     {
         "PLAIN_ONION_LAYOUT", "NUM_ONION_LAYOUT",
         "BEST_EFFORT_NUM_ONION_LAYOUT", "STR_ONION_LAYOUT",
-        "BEST_EFFORT_STR_ONION_LAYOUT"
-        
+        "BEST_EFFORT_STR_ONION_LAYOUT", "HOM_ONION_LAYOUT"
+
     };
     const std::vector<onionlayout> onion_layouts
     {
         PLAIN_ONION_LAYOUT, NUM_ONION_LAYOUT,
         BEST_EFFORT_NUM_ONION_LAYOUT, STR_ONION_LAYOUT,
-        BEST_EFFORT_STR_ONION_LAYOUT
+        BEST_EFFORT_STR_ONION_LAYOUT, HOM_ONION_LAYOUT
     };
     RETURN_FALSE_IF_FALSE(onion_layout_strings.size() ==
                             onion_layouts.size());
@@ -873,7 +882,8 @@ removeOnionLayer(const Analysis &a, const TableMeta &tm,
 static std::pair<std::vector<std::unique_ptr<Delta> >,
                  std::list<std::string>>
 adjustOnion(const Analysis &a, onion o, const TableMeta &tm,
-            const FieldMeta &fm, SECLEVEL tolevel)
+            const FieldMeta &fm, SECLEVEL tolevel,
+            std::unique_ptr<OnionPeel> *const peel)
 {
     TEST_Text(tolevel >= a.getOnionMeta(fm, o).getMinimumSecLevel(),
               "your query requires to permissive of a security level");
@@ -885,9 +895,26 @@ adjustOnion(const Analysis &a, onion o, const TableMeta &tm,
     SECLEVEL newlevel = om_adjustor.getSecLevel();
     assert(newlevel != SECLEVEL::INVALID);
 
+    // the same layers again, removed by one expression, in case the
+    // table can be peeled in chunks
+    const std::string dbname = a.getDatabaseName();
+    const std::string anon_table_name = tm.getAnonTableName();
+    Item *const salt =
+        new Item_field(NULL, dbname.c_str(), anon_table_name.c_str(),
+                       fm.getSaltName().c_str());
+    Item *peel_expr =
+        new Item_field(NULL, dbname.c_str(), anon_table_name.c_str(),
+                       om_adjustor.getAnonOnionName().c_str());
+    std::vector<std::string> layer_serials;
+
     std::list<std::string> adjust_queries;
     std::vector<std::unique_ptr<Delta> > deltas;
     while (newlevel > tolevel) {
+        const EncLayer &back_el = om_adjustor.getBackEncLayer();
+        layer_serials.push_back(
+            back_el.serialize(om_adjustor.getOnionMeta()));
+        peel_expr = back_el.decryptUDF(peel_expr, salt);
+
         auto query =
             removeOnionLayer(a, tm, fm, &om_adjustor, &newlevel,
                              &deltas);
@@ -895,11 +922,134 @@ adjustOnion(const Analysis &a, onion o, const TableMeta &tm,
     }
     TEST_UnexpectedSecurityLevel(o, tolevel, newlevel);
 
+    std::stringstream expr;
+    expr << *peel_expr;
+    peel->reset(new OnionPeel(dbname, anon_table_name,
+                              om_adjustor.getAnonOnionName(),
+                              fm.getSaltName(), expr.str(),
+                              layer_serials));
+
     return make_pair(std::move(deltas), adjust_queries);
     // return make_pair(deltas, adjust_queries);
 }
 //TODO: propagate these adjustments in the embedded database?
 
+// Whether a SET writes a value into the peeled onion that
+// writeBothLayers() can not encrypt.
+static bool
+computesPeeledOnion(const Analysis &a, const TableMeta &tm,
+                    const OnionPeel &peel, const List<Item> &fields,
+                    const List<Item> &values)
+{
+    auto fd_it = List_iterator<Item>(const_cast<List<Item> &>(fields));
+    auto val_it = List_iterator<Item>(const_cast<List<Item> &>(values));
+    for (const Item *fd = fd_it++, *val = val_it++; fd && val;
+         fd = fd_it++, val = val_it++) {
+        assert(Item::FIELD_ITEM == fd->type());
+        const std::string &name =
+            static_cast<const Item_field *>(fd)->field_name;
+        // only constants can be encrypted to either side's level, and a
+        // column set to itself keeps the level it has
+        if (val->basic_const_item()
+            || (Item::FIELD_ITEM == val->type()
+                && false == isItem_insert_value(*val)
+                && equalsIgnoreCase(name,
+                    static_cast<const Item_field *>(val)->field_name))) {
+            continue;
+        }
+
+        for (const auto &om : a.getFieldMeta(tm, name).orderedOnionMetas()) {
+            if (om.second->getAnonOnionName() == peel.getAnonOnion()) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Queries against a table that is still being peeled read the onion
+// through bothLayers() and write it through writeBothLayers(), so they
+// only push the peel up the adjustment scheduler's queue; the first one
+// to find it done takes it out of the schema.  Without the scheduler
+// nothing else drives a peel (ie, one left by an earlier proxy), so
+// writes and DDL finish it themselves as adjustments do in that mode; so
+// does any write of a computed value into the onion being peeled.
+static AbstractQueryExecutor *
+peelInFlight(const Analysis &a, const LEX &lex,
+             AdjustmentScheduler &scheduler)
+{
+    bool must_finish = false == scheduler.enabled();
+    switch (lex.sql_command) {
+        case SQLCOM_SELECT:
+        case SQLCOM_DELETE:
+        case SQLCOM_DELETE_MULTI:
+            must_finish = false;
+            break;
+        default:
+            break;
+    }
+
+    for (const TABLE_LIST *tbl = lex.select_lex.table_list.first; tbl;
+         tbl = tbl->next_local) {
+        const std::string db = tbl->db ? tbl->db : a.getDatabaseName();
+        if (!a.databaseMetaExists(db)
+            || !a.nonAliasTableMetaExists(db, tbl->table_name)) {
+            continue;
+        }
+
+        const TableMeta &tm = a.getTableMeta(db, tbl->table_name);
+        for (const OnionPeel *const peel :
+                a.getSchema().getTablePeels(tm.getAnonTableName())) {
+            if (must_finish) {
+                return new OnionAdjustmentExecutor(*peel,
+                    OnionAdjustmentExecutor::Leftover::Chunks);
+            }
+            // a row moving across the boundary would keep the level of
+            // the side it left
+            if (SQLCOM_UPDATE == lex.sql_command) {
+                auto it = List_iterator<Item>(
+                    const_cast<LEX &>(lex).select_lex.item_list);
+                for (const Item *i = it++; i; i = it++) {
+                    assert(Item::FIELD_ITEM == i->type());
+                    const FieldMeta &fm =
+                        a.getFieldMeta(tm,
+                            static_cast<const Item_field *>(i)->field_name);
+                    for (const auto &om : fm.orderedOnionMetas()) {
+                        TEST_TextMessageError(
+                            om.second->getAnonOnionName()
+                                != peel->getPrimaryKey(),
+                            "can not change the primary key of "
+                            + std::string(tbl->table_name) + " until the"
+                            " onion adjustment in progress finishes");
+                    }
+                }
+            }
+            // such a value has to be written to a single level
+            const bool computes =
+                SQLCOM_UPDATE == lex.sql_command
+                    ? computesPeeledOnion(a, tm, *peel,
+                                          lex.select_lex.item_list,
+                                          lex.value_list)
+                : SQLCOM_INSERT == lex.sql_command
+                  || SQLCOM_INSERT_SELECT == lex.sql_command
+                    ? computesPeeledOnion(a, tm, *peel, lex.update_list,
+                                          lex.value_list)
+                : false;
+            if (computes) {
+                return new OnionAdjustmentExecutor(*peel,
+                    OnionAdjustmentExecutor::Leftover::Chunks);
+            }
+            if (scheduler.demand(*peel)) {
+                return new OnionAdjustmentExecutor(*peel,
+                    OnionAdjustmentExecutor::Leftover::Nothing);
+            }
+        }
+    }
+
+    return NULL;
+}
+
 static inline bool
 FieldQualifies(const FieldMeta *const restriction,
                const FieldMeta *const field)
@@ -999,7 +1149,7 @@ do_optimize_const_item(T *i, Analysis &a) {
     */
 }
 
-static Item *
+Item *
 decrypt_item_layers(const Item &i, const FieldMeta *const fm, onion o,
                     uint64_t IV)
 {
@@ -1012,7 +1162,7 @@ decrypt_item_layers(const Item &i, const FieldMeta *const fm, onion o,
     assert(om);
     const auto &enc_layers = om->getLayers();
     for (auto it = enc_layers.rbegin(); it != enc_layers.rend(); ++it) {
-        out_i = (*it)->decrypt(*dec, IV);
+        out_i = countedDecrypt(**it, *om, *dec, IV);
         assert(out_i);
         dec = out_i;
         LOG(cdb_v) << "dec okay";
@@ -1022,6 +1172,115 @@ decrypt_item_layers(const Item &i, const FieldMeta *const fm, onion o,
     return out_i;
 }
 
+static uint64_t
+getRowSalt(const ResType &dbres, unsigned int r, const ReturnField &rf)
+{
+    const int salt_pos = rf.getSaltPosition();
+    if (salt_pos < 0) {
+        return 0;
+    }
+
+    Item_int *const salt_item =
+        static_cast<Item_int *>(dbres.rows[r][salt_pos]);
+    assert_s(!salt_item->null_value, "salt item is null");
+    return salt_item->value;
+}
+
+// Integer columns whose outer layers are blowfish based (RND_int, DET_int,
+// ...) are decrypted a column at a time through EncLayer::decryptBatch,
+// which avoids boxing every intermediate value in an Item; HOM columns
+// (binary strings) go through EncLayer::decryptBatchBytes, straight from
+// the result's buffers.  Whatever layers are left once a layer has no
+// batched path go through decrypt() as usual.  Returns false, without
+// touching dec_rows, if the outermost layer can't batch.
+static bool
+decrypt_column_batched(const ResType &dbres, unsigned int c,
+                       const ReturnField &rf, const FieldMeta &fm,
+                       unsigned int col_index,
+                       std::vector<std::vector<Item *> > *const dec_rows)
+{
+    const OnionMeta *const om = fm.getOnionMeta(rf.getOLK().o);
+    assert(om);
+    const auto &enc_layers = om->getLayers();
+    if (enc_layers.empty()) {
+        return false;
+    }
+
+    std::vector<unsigned int> row_index;
+    std::vector<uint64_t> vals;
+    std::vector<uint64_t> IVs;
+    std::vector<std::pair<const uint8_t *, size_t> > bytes;
+    String scratch;
+    for (unsigned int r = 0; r < dbres.rows.size(); r++) {
+        Item *const i = dbres.rows[r][c];
+        if (i->is_null()) {
+            continue;
+        }
+        if (Item::INT_ITEM == i->type() && bytes.empty()) {
+            vals.push_back(static_cast<const Item_int *>(i)->value);
+        } else if (Item::STRING_ITEM == i->type() && vals.empty()) {
+            // Item_string hands back its own buffer
+            const String *const s = i->val_str(&scratch);
+            if (!s || s == &scratch) {
+                return false;
+            }
+            bytes.push_back(std::make_pair(
+                reinterpret_cast<const uint8_t *>(s->ptr()), s->length()));
+        } else {
+            return false;
+        }
+        row_index.push_back(r);
+        IVs.push_back(getRowSalt(dbres, r, rf));
+    }
+
+    auto it = enc_layers.rbegin();
+    uint64_t start = layerCycles();
+    if (false == bytes.empty()) {
+        vals.resize(bytes.size());
+        if (false == (*it)->decryptBatchBytes(bytes, vals.data())) {
+            return false;
+        }
+        uint64_t total = 0;
+        for (const auto &b : bytes) {
+            total += b.second;
+        }
+        countLayer(**it, *om, false, vals.size(), total,
+                   layerCycles() - start);
+    } else if (false == (*it)->decryptBatch(vals.data(), IVs.data(),
+                                            vals.size())) {
+        return false;
+    } else {
+        countLayer(**it, *om, false, vals.size(),
+                   vals.size() * sizeof(uint64_t), layerCycles() - start);
+    }
+    for (++it; it != enc_layers.rend(); ++it) {
+        start = layerCycles();
+        if (false == (*it)->decryptBatch(vals.data(), IVs.data(),
+                                         vals.size())) {
+            break;
+        }
+        countLayer(**it, *om, false, vals.size(),
+                   vals.size() * sizeof(uint64_t), layerCycles() - start);
+    }
+
+    for (unsigned int r = 0; r < dbres.rows.size(); r++) {
+        if (dbres.rows[r][c]->is_null()) {
+            (*dec_rows)[r][col_index] = dbres.rows[r][c];
+        }
+    }
+    for (unsigned int k = 0; k < vals.size(); k++) {
+        Item *out_i = new (current_thd->mem_root)
+                          Item_int(static_cast<ulonglong>(vals[k]));
+        for (auto rest = it; rest != enc_layers.rend(); ++rest) {
+            out_i = countedDecrypt(**rest, *om, *out_i, IVs[k]);
+            assert(out_i);
+        }
+        (*dec_rows)[row_index[k]][col_index] = out_i;
+    }
+
+    return true;
+}
+
 
 /*
  * Actual item handlers.
@@ -1367,10 +1626,38 @@ const std::unique_ptr<SQLDispatcher> Rewriter::dml_dispatcher =
 const std::unique_ptr<SQLDispatcher> Rewriter::ddl_dispatcher =
     std::unique_ptr<SQLDispatcher>(buildDDLDispatcher());
 
+static statement_kind
+statementKind(const LEX &lex, bool ddl)
+{
+    switch (lex.sql_command) {
+        case SQLCOM_SELECT:
+            return statement_kind::kind_select;
+        case SQLCOM_INSERT:
+        case SQLCOM_INSERT_SELECT:
+        case SQLCOM_REPLACE:
+        case SQLCOM_REPLACE_SELECT:
+        case SQLCOM_LOAD:
+            return statement_kind::kind_insert;
+        case SQLCOM_UPDATE:
+        case SQLCOM_UPDATE_MULTI:
+            return statement_kind::kind_update;
+        case SQLCOM_DELETE:
+        case SQLCOM_DELETE_MULTI:
+            return statement_kind::kind_delete;
+        case SQLCOM_SET_OPTION:
+            return statement_kind::kind_set;
+        default:
+            return ddl ? statement_kind::kind_ddl
+                       : statement_kind::kind_other;
+    }
+}
+
 // NOTE : This will probably choke on multidatabase queries.
 AbstractQueryExecutor *
-Rewriter::dispatchOnLex(Analysis &a, const std::string &query)
+Rewriter::dispatchOnLex(Analysis &a, const std::string &query,
+                        const ProxyState &ps)
 {
+    const uint64_t parse_start = latencyClock();
     std::unique_ptr<query_parse> p;
     try {
         p = std::unique_ptr<query_parse>(
@@ -1380,6 +1667,9 @@ Rewriter::dispatchOnLex(Analysis &a, const std::string &query)
                               "Error Data: " + e.msg);
     }
     LEX *const lex = p->lex();
+    // the parse is only counted under its kind once that is known
+    setStatementKind(statementKind(*lex, ddl_dispatcher->canDo(lex)));
+    recordLatency(latency_stage::stage_parse, parse_start);
 
     LOG(cdb_v) << "pre-analyze " << *lex;
 
@@ -1397,6 +1687,11 @@ Rewriter::dispatchOnLex(Analysis &a, const std::string &query)
             }
         }
 
+        if (AbstractQueryExecutor *const executor =
+                peelInFlight(a, *lex, ps.getAdjustmentScheduler())) {
+            return executor;
+        }
+
         const SQLHandler &handler = dml_dispatcher->dispatch(lex);
         AssignOnce<AbstractQueryExecutor *> executor;
 
@@ -1407,18 +1702,52 @@ Rewriter::dispatchOnLex(Analysis &a, const std::string &query)
             std::cout << GREEN_BEGIN << "Adjusting onion!" << COLOR_END
                       << std::endl;
 
+            // the onion may still be halfway through its last adjustment
+            const OnionPeel *const peel =
+                a.getSchema().getPeel(e.tm.getAnonTableName(),
+                                      a.getOnionMeta(e.fm, e.o)
+                                          .getAnonOnionName());
+            if (peel) {
+                return new OnionAdjustmentExecutor(*peel,
+                    OnionAdjustmentExecutor::Leftover::Chunks);
+            }
+
+            std::unique_ptr<OnionPeel> new_peel;
             std::pair<std::vector<std::unique_ptr<Delta> >,
                       std::list<std::string> >
-                out_data = adjustOnion(a, e.o, e.tm, e.fm, e.tolevel);
+                out_data = adjustOnion(a, e.o, e.tm, e.fm, e.tolevel,
+                                       &new_peel);
             std::vector<std::unique_ptr<Delta> > &deltas = out_data.first;
             const std::list<std::string> &adjust_queries = out_data.second;
+            if (0 == peelChunkRows()) {
+                new_peel.reset();
+            }
 
             return new OnionAdjustmentExecutor(std::move(deltas),
-                                               adjust_queries);
+                                               adjust_queries,
+                                               std::move(new_peel));
+        } catch (OnionMaterializeExcept e) {
+            LOG(cdb_v) << "caught onion materialization";
+            std::cout << GREEN_BEGIN << "Populating onion!" << COLOR_END
+                      << std::endl;
+
+            const OnionMeta &om = a.getOnionMeta(e.fm, e.o);
+            std::vector<std::unique_ptr<Delta> > deltas;
+            deltas.push_back(std::unique_ptr<Delta>(
+                new ReplaceDelta(om, e.fm, om.populatedSerial())));
+            return new OnionMaterializeExecutor(std::move(deltas),
+                quoteText(a.getDatabaseName()) + "." +
+                    e.tm.getAnonTableName(),
+                e.fm, om);
         }
 
         return executor.get();
     } else if (ddl_dispatcher->canDo(lex)) {
+        if (AbstractQueryExecutor *const executor =
+                peelInFlight(a, *lex, ps.getAdjustmentScheduler())) {
+            return executor;
+        }
+
         const SQLHandler &handler = ddl_dispatcher->dispatch(lex);
         AbstractQueryExecutor *const executor = handler.transformLex(a, lex);
         /*
@@ -1446,7 +1775,7 @@ Rewriter::rewrite(const std::string &q, const SchemaInfo &schema,
     // NOTE: Care what data you try to read from Analysis
     // at this height.
     AbstractQueryExecutor *const executor =
-        Rewriter::dispatchOnLex(analysis, q);
+        Rewriter::dispatchOnLex(analysis, q, ps);
     if (!executor) {
         return QueryRewrite(true, analysis.rmeta, analysis.kill_zone,
                             new NoOpExecutor());
@@ -1455,6 +1784,126 @@ Rewriter::rewrite(const std::string &q, const SchemaInfo &schema,
     return QueryRewrite(true, analysis.rmeta, analysis.kill_zone, executor);
 }
 
+ResType
+Rewriter::drive(AbstractQueryExecutor *const executor,
+                const NextParams &nparams)
+{
+    const ProxyState &ps = nparams.ps;
+    std::unique_ptr<ResType> res(new ResType(true, 0, 0));
+    while (true) {
+        const auto &out = executor->next(*res, nparams);
+        const std::unique_ptr<AbstractAnything> anything(out.second);
+
+        std::string query;
+        switch (out.first) {
+            case AbstractQueryExecutor::ResultType::RESULTS:
+                return anything->extract<ResType>();
+            case AbstractQueryExecutor::ResultType::QUERY_COME_AGAIN:
+                query = anything->extract<std::pair<bool, std::string> >()
+                            .second;
+                break;
+            case AbstractQueryExecutor::ResultType::QUERY_USE_RESULTS:
+                query = anything->extract<std::string>();
+                break;
+        }
+
+        std::unique_ptr<DBResult> dbres;
+        TEST_Text(ps.getConn()->execute(query, &dbres),
+                  "query failed: " + ps.getConn()->getError());
+        if (AbstractQueryExecutor::ResultType::QUERY_USE_RESULTS
+            == out.first) {
+            return dbres->unpack();
+        }
+        res.reset(new ResType(dbres->unpack()));
+    }
+}
+
+ResType
+Rewriter::execute(const std::string &q, const std::string &default_db,
+                  const ProxyState &ps)
+{
+    const QueryRewrite &qr =
+        Rewriter::rewrite(q, *ps.getSchemaInfo().get(), default_db, ps);
+    return Rewriter::drive(qr.executor.get(),
+                           NextParams(ps, default_db, q));
+}
+
+bool
+Rewriter::neededAdjustment(const std::string &q, const SchemaInfo &schema,
+                           const std::string &default_db,
+                           const ProxyState &ps, AdjustmentNeed *const need)
+{
+    assert(0 == mysql_thread_init());
+
+    Analysis a(default_db, schema, ps.getMasterKey(),
+               ps.defaultSecurityRating());
+    std::unique_ptr<query_parse> p;
+    try {
+        p = std::unique_ptr<query_parse>(new query_parse(default_db, q));
+    } catch (const CryptDBError &e) {
+        FAIL_TextMessageError("Bad Query: [" + q + "]\n"
+                              "Error Data: " + e.msg);
+    }
+    LEX *const lex = p->lex();
+
+    if (noRewrite(*lex) || false == dml_dispatcher->canDo(lex)) {
+        return false;
+    }
+
+    try {
+        const SQLHandler &handler = dml_dispatcher->dispatch(lex);
+        delete handler.transformLex(a, lex);
+    } catch (OnionAdjustExcept e) {
+        const DatabaseMeta *const dm = schema.getChildWithGChild(e.tm);
+        assert(dm);
+        need->database = schema.getKey(*dm).getValue();
+        need->table = dm->getKey(e.tm).getValue();
+        need->field = e.tm.getKey(e.fm).getValue();
+        need->o = e.o;
+        need->tolevel = e.tolevel;
+        return true;
+    } catch (OnionMaterializeExcept e) {
+        FAIL_TextMessageError("needs the " + TypeText<onion>::toText(e.o) +
+                              " onion of " + e.fm.getFieldName() +
+                              " populated first");
+    }
+
+    return false;
+}
+
+AbstractQueryExecutor *
+Rewriter::batchAdjustment(const std::vector<AdjustmentNeed> &needs,
+                          const SchemaInfo &schema, const ProxyState &ps)
+{
+    assert(needs.size() > 0);
+    const std::string &db = needs.front().database;
+    const std::string &table = needs.front().table;
+
+    // adjustOnion works in the default database
+    Analysis a(db, schema, ps.getMasterKey(), ps.defaultSecurityRating());
+    const TableMeta &tm = a.getTableMeta(db, table);
+
+    std::vector<std::unique_ptr<Delta> > deltas;
+    std::string sets;
+    for (const auto &it : needs) {
+        assert(db == it.database && table == it.table);
+
+        std::unique_ptr<OnionPeel> peel;
+        auto out_data = adjustOnion(a, it.o, tm, a.getFieldMeta(tm, it.field),
+                                    it.tolevel, &peel);
+        for (auto &delta : out_data.first) {
+            deltas.push_back(std::move(delta));
+        }
+        // each onion loses all of its layers in one expression
+        sets += (sets.empty() ? "" : ", ") + peel->setClause();
+    }
+
+    const std::string query =
+        " UPDATE " + quoteText(db) + "." + tm.getAnonTableName() +
+        "    SET " + sets + ";";
+    return new OnionAdjustmentExecutor(std::move(deltas), {query}, nullptr);
+}
+
 //TODO: replace stringify with <<
 std::string ReturnField::stringify() {
     std::stringstream res;
@@ -1477,11 +1926,15 @@ std::string ReturnMeta::stringify() {
 ResType
 Rewriter::decryptResults(const ResType &dbres, const ReturnMeta &rmeta)
 {
+    const LatencyScope latency(latency_stage::stage_decrypt);
     assert(dbres.success());
 
     const unsigned int rows = dbres.rows.size();
     LOG(cdb_v) << "rows in result " << rows << "\n";
     const unsigned int cols = dbres.names.size();
+    if (QueryProfile *const profile = currentQueryProfile()) {
+        profile->rows_decrypted += rows;
+    }
 
     // un-anonymize the names
     std::vector<std::string> dec_names;
@@ -1512,22 +1965,20 @@ Rewriter::decryptResults(const ResType &dbres, const ReturnMeta &rmeta)
         }
 
         FieldMeta *const fm = rf.getOLK().key;
+        if (fm && decrypt_column_batched(dbres, c, rf, *fm, col_index,
+                                         &dec_rows)) {
+            col_index++;
+            continue;
+        }
+
         for (unsigned int r = 0; r < rows; r++) {
             if (!fm || dbres.rows[r][c]->is_null()) {
                 dec_rows[r][col_index] = dbres.rows[r][c];
             } else {
-                uint64_t salt = 0;
-                const int salt_pos = rf.getSaltPosition();
-                if (salt_pos >= 0) {
-                    Item_int *const salt_item =
-                        static_cast<Item_int *>(dbres.rows[r][salt_pos]);
-                    assert_s(!salt_item->null_value, "salt item is null");
-                    salt = salt_item->value;
-                }
-
-                dec_rows[r][col_index] = 
+                dec_rows[r][col_index] =
                     decrypt_item_layers(*dbres.rows[r][c],
-                                        fm, rf.getOLK().o, salt);
+                                        fm, rf.getOLK().o,
+                                        getRowSalt(dbres, r, rf));
             }
         }
         col_index++;
@@ -1615,19 +2066,262 @@ OnionAdjustmentExecutor::
 nextImpl(const ResType &res, const NextParams &nparams)
 {
     reenter(this->corot) {
-        yield {
-            assert(this->adjust_queries.size() == 1
-                   || this->adjust_queries.size() == 2);
-
-            {
-                uint64_t embedded_completion_id;
-                deltaOutputBeforeQuery(nparams.ps.getEConn(),
-                                       nparams.original_query, "",
-                                       this->deltas,
-                                       CompletionType::Onion,
-                                       &embedded_completion_id);
-                this->embedded_completion_id = embedded_completion_id;
+        if (this->peel_finished) {
+            // the scheduler peeled every row; only the embedded database
+            // changes, so the client's transaction can stay
+            this->in_trx = false;
+        } else {
+            yield {
+                if (false == this->resuming) {
+                    assert(this->adjust_queries.size() == 1
+                           || this->adjust_queries.size() == 2);
+
+                    uint64_t embedded_completion_id;
+                    deltaOutputBeforeQuery(nparams.ps.getEConn(),
+                                           nparams.original_query, "",
+                                           this->deltas,
+                                           CompletionType::Onion,
+                                           &embedded_completion_id);
+                    this->embedded_completion_id = embedded_completion_id;
+                }
+
+                return CR_QUERY_AGAIN(
+                    "CALL " + MetaData::Proc::activeTransactionP());
             }
+            TEST_ErrPkt(res.success(),
+                    "failed to determine if there is an active transasction");
+            this->in_trx = handleActiveTransactionPResults(res);
+
+            // always rollback
+            yield return CR_QUERY_AGAIN("ROLLBACK");
+            TEST_ErrPkt(res.success(), "failed to rollback");
+        }
+
+        if (false == this->resuming) {
+            if (this->peel) {
+                yield return CR_QUERY_AGAIN(this->peel->primaryKeyQuery());
+                TEST_ErrPkt(res.success(),
+                            "failed to look up the primary key of the"
+                            " adjusted table");
+                {
+                    std::string pk;
+                    this->chunked = this->peel->chunkable(res, &pk);
+                    if (this->chunked) {
+                        this->peel->begin(this->embedded_completion_id.get(),
+                                          pk);
+                        TEST_ErrPkt(
+                            this->peel->record(nparams.ps.getEConn()),
+                            "failed to record the onion peel");
+                    }
+                }
+            }
+
+            yield return CR_QUERY_AGAIN("START TRANSACTION");
+            TEST_ErrPkt(res.success(), "failed to start transaction");
+
+            if (this->chunked) {
+                // the metadata moves now, the rows follow chunk by chunk
+                yield return
+                    CR_QUERY_AGAIN(this->peel->createProgressQuery());
+                CR_ROLLBACK_AND_FAIL(res,
+                                "failed to create the onion peel progress!");
+            } else {
+                // issue first adjustment
+                yield return CR_QUERY_AGAIN(this->adjust_queries.front());
+                CR_ROLLBACK_AND_FAIL(res,
+                            "failed to execute first onion adjustment query!");
+
+                // issue (possible) second adjustment
+                yield {
+                    assert(res.success());
+
+                    return CR_QUERY_AGAIN(
+                        this->adjust_queries.size() == 2
+                            ? this->adjust_queries.back()
+                            : "DO 0;");
+                }
+                CR_ROLLBACK_AND_FAIL(res,
+                            "failed to execute second onion adjustment query!");
+            }
+
+            yield {
+                return CR_QUERY_AGAIN(
+                    " INSERT INTO " + MetaData::Table::remoteQueryCompletion() +
+                    "   (embedded_completion_id, completion_type) VALUES"
+                    "   (" + std::to_string(this->embedded_completion_id.get()) + ","
+                    "   '"+TypeText<CompletionType>::toText(CompletionType::Onion)+"'"
+                    "        );");
+            }
+            TEST_ErrPkt(res.success(), "failed issuing adjustment completion");
+
+            yield return CR_QUERY_AGAIN("COMMIT");
+            TEST_ErrPkt(res.success(), "failed to commit");
+
+            TEST_ErrPkt(deltaOutputAfterQuery(nparams.ps.getEConn(), this->deltas,
+                                              this->embedded_completion_id.get()),
+                        "deltaOutputAfterQuery failed for onion adjustment");
+
+            // the reissued query reads through bothLayers() meanwhile
+            if (this->chunked
+                && nparams.ps.getAdjustmentScheduler().enabled()) {
+                nparams.ps.getAdjustmentScheduler().submit(*this->peel);
+                this->backgrounded = true;
+            }
+        }
+
+        // peel one chunk per transaction; other connections finishing
+        // the same peel (and the scheduler's workers) serialize on the
+        // progress row
+        while (this->chunked && false == this->backgrounded
+               && false == this->peel_finished) {
+            yield return CR_QUERY_AGAIN("START TRANSACTION");
+            TEST_ErrPkt(res.success(), "failed to start transaction");
+
+            yield return CR_QUERY_AGAIN(this->peel->lockProgressQuery());
+            CR_ROLLBACK_AND_FAIL(res, "failed to lock the peel progress!");
+            TEST_ErrPkt(1 == res.rows.size(), "peel progress is missing");
+            this->peel_lower = ItemToString(*res.rows.front()[0]);
+            this->peel_finished = "1" == ItemToString(*res.rows.front()[1]);
+
+            if (false == this->peel_finished) {
+                yield return CR_QUERY_AGAIN(
+                    this->peel->nextBoundaryQuery(this->peel_lower));
+                CR_ROLLBACK_AND_FAIL(res, "failed to find the next chunk!");
+                this->peel_upper = ItemToString(*res.rows.front()[0]);
+
+                if ("NULL" == this->peel_upper) {
+                    yield return
+                        CR_QUERY_AGAIN(this->peel->finishProgressQuery());
+                    CR_ROLLBACK_AND_FAIL(res,
+                                    "failed to finish the peel progress!");
+                    this->peel_finished = true;
+                } else {
+                    yield return CR_QUERY_AGAIN(
+                        this->peel->peelChunkQuery(this->peel_lower,
+                                                   this->peel_upper));
+                    CR_ROLLBACK_AND_FAIL(res, "failed to peel a chunk!");
+
+                    yield return CR_QUERY_AGAIN(
+                        this->peel->advanceProgressQuery(this->peel_upper));
+                    CR_ROLLBACK_AND_FAIL(res,
+                                    "failed to advance the peel progress!");
+                }
+            }
+
+            yield return CR_QUERY_AGAIN("COMMIT");
+            TEST_ErrPkt(res.success(), "failed to commit a peeled chunk");
+
+            if (false == this->peel_finished && peelThrottleMs()) {
+                yield return CR_QUERY_AGAIN(
+                    "DO SLEEP(" + std::to_string(peelThrottleMs() / 1000.0)
+                    + ");");
+                TEST_ErrPkt(res.success(), "failed to throttle the peel");
+            }
+        }
+
+        if (this->chunked && false == this->backgrounded) {
+            TEST_ErrPkt(this->peel->forget(nparams.ps.getEConn()),
+                        "failed to forget the finished onion peel");
+            nparams.ps.getAdjustmentScheduler().forget(this->peel->getId());
+        }
+
+        // if the client was in the middle of a transaction we must alert
+        // him that we had to rollback his queries
+        if (true == this->in_trx.get()) {
+            ROLLBACK_ERROR_PACKET
+        }
+
+        try {
+            this->reissue_query_rewrite = new QueryRewrite(
+                Rewriter::rewrite(
+                    nparams.original_query, *nparams.ps.getSchemaInfo().get(),
+                    nparams.default_db, nparams.ps));
+        } catch (const AbstractException &e) {
+            FAIL_GenericPacketException(e.to_string());
+        } catch (...) {
+            FAIL_GenericPacketException(
+                "unknown error occured while rewriting onion adjusment query");
+        }
+
+        this->reissue_nparams =
+            NextParams(nparams.ps, nparams.default_db, nparams.original_query);
+        while (true) {
+            yield {
+                auto result =
+                    this->reissue_query_rewrite->executor->next(
+                        first_reissue ? ResType(true, 0, 0)
+                                      : res,
+                        reissue_nparams.get());
+                this->first_reissue = false;
+                return result;
+            }
+        }
+    }
+
+    assert(false);
+}
+
+std::string
+OnionMaterializeExecutor::emptyRowsQuery() const
+{
+    const std::string limit =
+        0 == peelChunkRows() ? ""
+                             : " LIMIT " + std::to_string(peelChunkRows());
+    const std::string &src = this->fm.getOnionMeta(this->source)
+                                 ->getAnonOnionName();
+    return
+        " SELECT " + this->fm.getSaltName() + ", " + src +
+        "   FROM " + this->table +
+        "  WHERE " + this->om.getAnonOnionName() + " IS NULL"
+        "    AND " + src + " IS NOT NULL" + limit + ";";
+}
+
+std::string
+OnionMaterializeExecutor::populateQuery(const ResType &rows) const
+{
+    assert(rows.rows.size() > 0);
+
+    const std::string &salt_name = this->fm.getSaltName();
+    const std::string &src = this->fm.getOnionMeta(this->source)
+                                 ->getAnonOnionName();
+    std::string cases;
+    std::string salts;
+    for (const auto &row : rows.rows) {
+        const uint64_t salt = static_cast<Item_int *>(row[0])->value;
+        const Item *enc =
+            decrypt_item_layers(*row[1], &this->fm, this->source, salt);
+        for (const auto &it : this->om.getLayers()) {
+            enc = countedEncrypt(*it, this->om, *enc, salt);
+        }
+
+        // a row updated since it was read keeps its NULL for next time
+        const std::string s = std::to_string(salt);
+        cases += " WHEN " + salt_name + " = " + s +
+                 "  AND " + src + " = " + printItemToString(*row[1]) +
+                 " THEN " + printItemToString(*enc);
+        salts += (salts.empty() ? "" : ", ") + s;
+    }
+
+    const std::string &dst = this->om.getAnonOnionName();
+    return
+        " UPDATE " + this->table +
+        "    SET " + dst + " = CASE" + cases + " END"
+        "  WHERE " + dst + " IS NULL"
+        "    AND " + salt_name + " IN (" + salts + ");";
+}
+
+std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
+OnionMaterializeExecutor::
+nextImpl(const ResType &res, const NextParams &nparams)
+{
+    reenter(this->corot) {
+        yield {
+            uint64_t embedded_completion_id;
+            deltaOutputBeforeQuery(nparams.ps.getEConn(),
+                                   nparams.original_query, "",
+                                   this->deltas, CompletionType::Onion,
+                                   &embedded_completion_id);
+            this->embedded_completion_id = embedded_completion_id;
 
             return CR_QUERY_AGAIN(
                 "CALL " + MetaData::Proc::activeTransactionP());
@@ -1640,25 +2334,21 @@ nextImpl(const ResType &res, const NextParams &nparams)
         yield return CR_QUERY_AGAIN("ROLLBACK");
         TEST_ErrPkt(res.success(), "failed to rollback");
 
+        // every row has the onion before the metadata says so
+        while (false == this->populated) {
+            yield return CR_QUERY_AGAIN(this->emptyRowsQuery());
+            TEST_ErrPkt(res.success(), "failed to read rows to populate");
+            if (res.rows.empty()) {
+                this->populated = true;
+            } else {
+                yield return CR_QUERY_AGAIN(this->populateQuery(res));
+                TEST_ErrPkt(res.success(), "failed to populate the onion");
+            }
+        }
+
         yield return CR_QUERY_AGAIN("START TRANSACTION");
         TEST_ErrPkt(res.success(), "failed to start transaction");
 
-        // issue first adjustment
-        yield return CR_QUERY_AGAIN(this->adjust_queries.front());
-        CR_ROLLBACK_AND_FAIL(res,
-                        "failed to execute first onion adjustment query!");
-
-        // issue (possible) second adjustment
-        yield {
-            assert(res.success());
-
-            return CR_QUERY_AGAIN(
-                    this->adjust_queries.size() == 2 ? this->adjust_queries.back()
-                                                     : "DO 0;");
-        }
-        CR_ROLLBACK_AND_FAIL(res,
-                        "failed to execute second onion adjustment query!");
-
         yield {
             return CR_QUERY_AGAIN(
                 " INSERT INTO " + MetaData::Table::remoteQueryCompletion() +
@@ -1667,17 +2357,28 @@ nextImpl(const ResType &res, const NextParams &nparams)
                 "   '"+TypeText<CompletionType>::toText(CompletionType::Onion)+"'"
                 "        );");
         }
-        TEST_ErrPkt(res.success(), "failed issuing adjustment completion");
+        CR_ROLLBACK_AND_FAIL(res, "failed issuing population completion");
 
         yield return CR_QUERY_AGAIN("COMMIT");
         TEST_ErrPkt(res.success(), "failed to commit");
 
         TEST_ErrPkt(deltaOutputAfterQuery(nparams.ps.getEConn(), this->deltas,
                                           this->embedded_completion_id.get()),
-                    "deltaOutputAfterQuery failed for onion adjustment");
+                    "deltaOutputAfterQuery failed for onion population");
+
+        // rows written through the old metadata in the meantime
+        this->populated = false;
+        while (false == this->populated) {
+            yield return CR_QUERY_AGAIN(this->emptyRowsQuery());
+            TEST_ErrPkt(res.success(), "failed to read rows to populate");
+            if (res.rows.empty()) {
+                this->populated = true;
+            } else {
+                yield return CR_QUERY_AGAIN(this->populateQuery(res));
+                TEST_ErrPkt(res.success(), "failed to populate the onion");
+            }
+        }
 
-        // if the client was in the middle of a transaction we must alert
-        // him that we had to rollback his queries
         if (true == this->in_trx.get()) {
             ROLLBACK_ERROR_PACKET
         }
@@ -1691,7 +2392,8 @@ nextImpl(const ResType &res, const NextParams &nparams)
             FAIL_GenericPacketException(e.to_string());
         } catch (...) {
             FAIL_GenericPacketException(
-                "unknown error occured while rewriting onion adjusment query");
+                "unknown error occured while rewriting onion population"
+                " query");
         }
 
         this->reissue_nparams =
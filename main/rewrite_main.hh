@@ -67,6 +67,15 @@ public:
     std::unique_ptr<AbstractQueryExecutor> executor;
 };
 
+// an onion adjustment a query needs, by plaintext names
+struct AdjustmentNeed {
+    std::string database;
+    std::string table;
+    std::string field;
+    onion o;
+    SECLEVEL tolevel;
+};
+
 // Main class processing rewriting
 class Rewriter {
     Rewriter();
@@ -81,9 +90,32 @@ public:
     static ResType
         decryptResults(const ResType &dbres, const ReturnMeta &rm);
 
+    // the first onion adjustment a DML query would trigger; nothing is
+    // executed.  false if it needs none
+    static bool
+        neededAdjustment(const std::string &q, const SchemaInfo &schema,
+                         const std::string &default_db,
+                         const ProxyState &ps, AdjustmentNeed *const need);
+    // removes the layers of several onions of one table in a single
+    // UPDATE; the executor reissues original_query when it is done
+    static AbstractQueryExecutor *
+        batchAdjustment(const std::vector<AdjustmentNeed> &needs,
+                        const SchemaInfo &schema, const ProxyState &ps);
+
+    // For tools without a mysql-proxy in front: runs @executor to
+    // completion over ps.getConn(), as the proxy would, and returns its
+    // results undecrypted.  Throws if a query fails.
+    static ResType
+        drive(AbstractQueryExecutor *const executor,
+              const NextParams &nparams);
+    static ResType
+        execute(const std::string &q, const std::string &default_db,
+                const ProxyState &ps);
+
 private:
     static AbstractQueryExecutor *
-        dispatchOnLex(Analysis &a, const std::string &query);
+        dispatchOnLex(Analysis &a, const std::string &query,
+                      const ProxyState &ps);
 
     static const bool translator_dummy;
     static const std::unique_ptr<SQLDispatcher> dml_dispatcher;
@@ -311,6 +343,11 @@ std::unique_ptr<SchemaInfo>
 loadSchemaInfo(const std::unique_ptr<Connect> &conn,
                const std::unique_ptr<Connect> &e_conn);
 
+// @i, as stored in onion @o of @fm, with its layers taken off
+Item *
+decrypt_item_layers(const Item &i, const FieldMeta *const fm, onion o,
+                    uint64_t IV);
+
 class OnionMetaAdjustor {
 public:
     OnionMetaAdjustor(OnionMeta const &om) : original_om(om),
@@ -333,9 +370,20 @@ private:
 class OnionAdjustmentExecutor : public AbstractQueryExecutor {
     const std::vector<std::unique_ptr<Delta> > deltas;
     const std::list<std::string> adjust_queries;
+    // replaces adjust_queries when the table can be peeled in chunks;
+    // NULL if chunking is disabled
+    const std::unique_ptr<OnionPeel> peel;
+    // only finishing a peel an earlier adjustment left behind
+    const bool resuming;
 
     // coroutine state
     bool first_reissue;
+    bool chunked;
+    // the chunks were handed to the adjustment scheduler
+    bool backgrounded;
+    bool peel_finished;
+    std::string peel_lower;
+    std::string peel_upper;
     AssignOnce<std::shared_ptr<const SchemaInfo> > reissue_schema;
     AssignOnce<uint64_t> embedded_completion_id;
     AssignOnce<bool> in_trx;
@@ -343,15 +391,72 @@ class OnionAdjustmentExecutor : public AbstractQueryExecutor {
     AssignOnce<NextParams> reissue_nparams;
 
 public:
+    // what is left of an earlier adjustment's peel: the rest of its
+    // chunks, or only taking it out of the schema once the adjustment
+    // scheduler has peeled every row
+    enum class Leftover {Chunks, Nothing};
+
     OnionAdjustmentExecutor(std::vector<std::unique_ptr<Delta> > &&deltas,
-                            const std::list<std::string> &adjust_queries)
+                            const std::list<std::string> &adjust_queries,
+                            std::unique_ptr<OnionPeel> &&peel)
         : deltas(std::move(deltas)),
-          adjust_queries(adjust_queries), first_reissue(true) {}
+          adjust_queries(adjust_queries), peel(std::move(peel)),
+          resuming(false), first_reissue(true), chunked(false),
+          backgrounded(false), peel_finished(false) {}
+    OnionAdjustmentExecutor(const OnionPeel &unfinished, Leftover left)
+        : peel(new OnionPeel(unfinished)), resuming(true),
+          first_reissue(true), chunked(true), backgrounded(false),
+          peel_finished(Leftover::Nothing == left) {}
+
+    std::pair<ResultType, AbstractAnything *>
+        nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    const char *traceName() const {return "OnionAdjustmentExecutor";}
+    bool stales() const {return true;}
+    bool usesEmbedded() const {return true;}
+    bool adjustsOnion() const {return true;}
+};
+
+// Populates an onion that was only declared (CRYPTDB_ONIONS=lazy) from the
+// field's oDET onion, CRYPTDB_PEEL_CHUNK rows at a time: the proxy
+// decrypts each row and encrypts it into the new onion.  The metadata
+// only marks the onion populated once every row has it, and the rows
+// written meanwhile through the old metadata are filled in afterwards.
+class OnionMaterializeExecutor : public AbstractQueryExecutor {
+    const std::vector<std::unique_ptr<Delta> > deltas;
+    // db.anon_table
+    const std::string table;
+    const FieldMeta &fm;
+    const OnionMeta &om;
+    // the onion the plaintext is read from
+    const onion source;
+
+    // coroutine state
+    bool first_reissue;
+    bool populated;
+    AssignOnce<uint64_t> embedded_completion_id;
+    AssignOnce<bool> in_trx;
+    QueryRewrite *reissue_query_rewrite;
+    AssignOnce<NextParams> reissue_nparams;
+
+public:
+    OnionMaterializeExecutor(std::vector<std::unique_ptr<Delta> > &&deltas,
+                             const std::string &table, const FieldMeta &fm,
+                             const OnionMeta &om)
+        : deltas(std::move(deltas)), table(table), fm(fm), om(om),
+          source(fm.hasOnion(oDET) ? oDET : oPLAIN), first_reissue(true),
+          populated(false) {}
 
     std::pair<ResultType, AbstractAnything *>
         nextImpl(const ResType &res, const NextParams &nparams);
 
 private:
+    const char *traceName() const {return "OnionMaterializeExecutor";}
     bool stales() const {return true;}
     bool usesEmbedded() const {return true;}
+
+    std::string emptyRowsQuery() const;
+    // fills the rows emptyRowsQuery() returned
+    std::string populateQuery(const ResType &rows) const;
 };
@@ -4,6 +4,7 @@
 #include <main/rewrite_main.hh>
 #include <main/macro_util.hh>
 #include <main/metadata_tables.hh>
+#include <main/layer_counters.hh>
 #include <main/schema.hh>
 #include <parser/lex_util.hh>
 #include <parser/stringify.hh>
@@ -246,6 +247,10 @@ rewrite_create_field(const FieldMeta * const fm,
     for (auto oit : fm->orderedOnionMetas()) {
         OnionMeta * const om = oit.second;
         Create_field * const new_cf = get_create_field(a, f, *om);
+        // writes leave an unpopulated onion NULL
+        if (false == om->isPopulated()) {
+            new_cf->flags &= ~NOT_NULL_FLAG;
+        }
 
         output_cfields.push_back(new_cf);
     }
@@ -467,7 +472,7 @@ encrypt_item_layers(const Item &i, onion o, const OnionMeta &om,
     for (const auto &it : enc_layers) {
         LOG(encl) << "encrypt layer "
                   << TypeText<SECLEVEL>::toText(it->level()) << "\n";
-        new_enc = it->encrypt(*enc, IV);
+        new_enc = countedEncrypt(*it, om, *enc, IV);
         assert(new_enc);
         enc = new_enc;
     }
@@ -497,6 +502,10 @@ encrypt_item_all_onions(const Item &i, const FieldMeta &fm,
     for (auto it : fm.orderedOnionMetas()) {
         const onion o = it.first->getValue();
         OnionMeta * const om = it.second;
+        if (false == om->isPopulated()) {
+            l->push_back(new Item_null());
+            continue;
+        }
         l->push_back(encrypt_item_layers(i, o, *om, a, IV));
     }
 }
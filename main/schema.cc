@@ -1,6 +1,8 @@
+#include <stdlib.h>
 #include <algorithm>
 #include <functional>
 #include <memory>
+#include <mutex>
 
 #include <parser/lex_util.hh>
 #include <parser/stringify.hh>
@@ -54,9 +56,10 @@ DBMeta::doFetchChildren(const std::unique_ptr<Connect> &e_conn,
 OnionMeta::OnionMeta(onion o, std::vector<SECLEVEL> levels,
                      const AES_KEY * const m_key,
                      const Create_field &cf, unsigned long uniq_count,
-                     SECLEVEL minimum_seclevel)
+                     SECLEVEL minimum_seclevel, bool populated)
     : onionname(getpRandomName() + TypeText<onion>::toText(o)),
-      uniq_count(uniq_count), minimum_seclevel(minimum_seclevel)
+      uniq_count(uniq_count), minimum_seclevel(minimum_seclevel),
+      populated(populated)
 {
     assert(levels.size() >= 1);
 
@@ -84,22 +87,36 @@ OnionMeta::deserialize(unsigned int id, const std::string &serial)
 {
     assert(id != 0);
     const auto vec = unserialize_string(serial);
-    assert(3 == vec.size());
+    // onions from before lazy onions are all populated
+    assert(3 == vec.size() || 4 == vec.size());
 
     const std::string onionname = vec[0];
     const unsigned int uniq_count = atoi(vec[1].c_str());
     const SECLEVEL minimum_seclevel = TypeText<SECLEVEL>::toType(vec[2]);
+    const bool populated = 3 == vec.size() || string_to_bool(vec[3]);
 
     return std::unique_ptr<OnionMeta>
-        (new OnionMeta(id, onionname, uniq_count, minimum_seclevel));
+        (new OnionMeta(id, onionname, uniq_count, minimum_seclevel,
+                       populated));
 }
 
 std::string OnionMeta::serialize(const DBObject &parent) const
+{
+    return this->serializeWith(this->populated);
+}
+
+std::string OnionMeta::populatedSerial() const
+{
+    return this->serializeWith(true);
+}
+
+std::string OnionMeta::serializeWith(bool populated) const
 {
     const std::string &serial =
         serialize_string(this->onionname) +
         serialize_string(std::to_string(this->uniq_count)) +
-        serialize_string(TypeText<SECLEVEL>::toText(this->minimum_seclevel));
+        serialize_string(TypeText<SECLEVEL>::toText(this->minimum_seclevel)) +
+        serialize_string(bool_to_string(populated));
 
     return serial;
 }
@@ -207,6 +224,24 @@ SECLEVEL OnionMeta::getSecLevel() const
     return layers.back()->level();
 }
 
+static std::mutex onion_uses_lock;
+static std::map<std::string, uint64_t> onion_uses;
+
+void
+noteOnionUse(const std::string &anon_onion)
+{
+    std::lock_guard<std::mutex> guard(onion_uses_lock);
+    ++onion_uses[anon_onion];
+}
+
+uint64_t
+onionUses(const std::string &anon_onion)
+{
+    std::lock_guard<std::mutex> guard(onion_uses_lock);
+    const auto it = onion_uses.find(anon_onion);
+    return onion_uses.end() == it ? 0 : it->second;
+}
+
 std::unique_ptr<FieldMeta>
 FieldMeta::deserialize(unsigned int id, const std::string &serial)
 {
@@ -263,6 +298,30 @@ determineSecLevelData(onion o, std::vector<SECLEVEL> levels, bool unique)
     return std::make_pair(levels, levels.front());
 }
 
+/*
+ * With CRYPTDB_ONIONS=lazy in the environment, the oOPE and oAGG onions
+ * of new fields are only declared: their columns are created, but writes
+ * leave them NULL, sparing the OPE and HOM encryptions (the most
+ * expensive ones we have) for every value of a field that is never
+ * ordered or summed.  The first query that needs such an onion populates
+ * it from the oDET onion; SET @cryptdb='show' lists which onions are
+ * populated and how often each was used.  A column declared with
+ * COMMENT 'cryptdb:lazy' gets lazy onions whatever the environment says.
+ */
+static bool
+lazyOnions(const Create_field &cf)
+{
+    static const bool lazy = [] () {
+        const char *const onions = getenv("CRYPTDB_ONIONS");
+        return onions && equalsIgnoreCase("LAZY", onions);
+    }();
+    return lazy
+        || (cf.comment.str
+            && equalsIgnoreCase("cryptdb:lazy",
+                                std::string(cf.comment.str,
+                                            cf.comment.length)));
+}
+
 // If mkey == NULL, the field is not encrypted
 static bool
 init_onions_layout(const AES_KEY *const m_key, FieldMeta *const fm,
@@ -289,9 +348,14 @@ init_onions_layout(const AES_KEY *const m_key, FieldMeta *const fm,
 
         // A new OnionMeta will only occur with a new FieldMeta so
         // we never have to build Deltaz for our OnionMetaz.
+        // counters have nothing to populate their oAGG onion from
+        const bool populated =
+            !(lazyOnions(cf) && (oOPE == o || oAGG == o)
+              && onion_layout.end() != onion_layout.find(oDET));
         std::unique_ptr<OnionMeta>
             om(new OnionMeta(o, std::get<0>(level_data), m_key, cf,
-                             fm->leaseCount(), std::get<1>(level_data)));
+                             fm->leaseCount(), std::get<1>(level_data),
+                             populated));
         const std::string &onion_name = om->getAnonOnionName();
         fm->addChild(OnionMetaKey(o), std::move(om));
 
@@ -384,6 +448,23 @@ OnionMeta *FieldMeta::getOnionMeta(onion o) const
     return getChild(OnionMetaKey(o));
 }
 
+/*
+ * A numeric column declared with COMMENT 'cryptdb:hom' is a counter: it
+ * only gets the oAGG onion, so that UPDATE t SET c = c + k is rewritten
+ * into a single server side cryptdb_func_add_set() instead of going
+ * through SpecialUpdateExecutor.  The price is that the column can only
+ * be projected, summed and incremented; it can not be compared.  An
+ * UNSIGNED column keeps its usual onions: the server would have to
+ * refuse decrementing it past zero, which it can not see.
+ */
+static bool
+homCounter(const Create_field &f)
+{
+    return f.comment.str && 0 == (f.flags & UNSIGNED_FLAG)
+        && equalsIgnoreCase("cryptdb:hom",
+                            std::string(f.comment.str, f.comment.length));
+}
+
 onionlayout FieldMeta::determineOnionLayout(const AES_KEY *const m_key,
                                             const Create_field &f,
                                             SECURITY_RATING sec_rating)
@@ -408,6 +489,10 @@ onionlayout FieldMeta::determineOnionLayout(const AES_KEY *const m_key,
         return PLAIN_ONION_LAYOUT;
     }
 
+    if (true == isMySQLTypeNumeric(f) && true == homCounter(f)) {
+        return HOM_ONION_LAYOUT;
+    }
+
     if (SECURITY_RATING::SENSITIVE == sec_rating) {
         if (true == isMySQLTypeNumeric(f)) {
             return NUM_ONION_LAYOUT;
@@ -559,6 +644,37 @@ DatabaseMeta::serialize(const DBObject &parent) const
     return serial;
 }
 
+void
+SchemaInfo::addPeel(std::unique_ptr<OnionPeel> &&peel)
+{
+    const auto key =
+        std::make_pair(peel->getAnonTable(), peel->getAnonOnion());
+    TEST_TextMessageError(this->peels.end() == this->peels.find(key),
+                          "two unfinished peels of the same onion!");
+    this->peels[key] = std::move(peel);
+}
+
+const OnionPeel *
+SchemaInfo::getPeel(const std::string &anon_table,
+                    const std::string &anon_onion) const
+{
+    const auto it = this->peels.find(std::make_pair(anon_table, anon_onion));
+    return this->peels.end() == it ? NULL : it->second.get();
+}
+
+std::vector<const OnionPeel *>
+SchemaInfo::getTablePeels(const std::string &anon_table) const
+{
+    std::vector<const OnionPeel *> out;
+    for (const auto &it : this->peels) {
+        if (it.first.first == anon_table) {
+            out.push_back(it.second.get());
+        }
+    }
+
+    return out;
+}
+
 static bool
 lowLevelGetCurrentStaleness(const std::unique_ptr<Connect> &e_conn,
                             unsigned int cache_id)
@@ -8,6 +8,7 @@
 #include <main/Translator.hh>
 #include <main/dbobject.hh>
 #include <main/macro_util.hh>
+#include <main/onion_peel.hh>
 #include <string>
 #include <map>
 #include <list>
@@ -33,17 +34,21 @@ public:
     // New.
     OnionMeta(onion o, std::vector<SECLEVEL> levels,
               const AES_KEY * const m_key, const Create_field &cf,
-              unsigned long uniq_count, SECLEVEL minimum_seclevel);
+              unsigned long uniq_count, SECLEVEL minimum_seclevel,
+              bool populated);
 
     // Restore.
     static std::unique_ptr<OnionMeta>
         deserialize(unsigned int id, const std::string &serial);
     OnionMeta(unsigned int id, const std::string &onionname,
-              unsigned long uniq_count, SECLEVEL minimum_seclevel)
+              unsigned long uniq_count, SECLEVEL minimum_seclevel,
+              bool populated)
         : DBMeta(id), onionname(onionname), uniq_count(uniq_count),
-          minimum_seclevel(minimum_seclevel) {}
+          minimum_seclevel(minimum_seclevel), populated(populated) {}
 
     std::string serialize(const DBObject &parent) const;
+    // what serialize(...) returns once the onion has been populated
+    std::string populatedSerial() const;
     std::string getAnonOnionName() const;
     TYPENAME("onionMeta")
     std::vector<DBMeta *>
@@ -59,6 +64,10 @@ public:
         {return layers;}
     SECLEVEL getMinimumSecLevel() const {return minimum_seclevel;}
     void setMinimumSecLevel(SECLEVEL seclevel) {this->minimum_seclevel = seclevel;}
+    // false while the onion is only declared: its column exists, but
+    // writes leave it NULL until the rewriter first needs it; see
+    // OnionMaterializeExecutor
+    bool isPopulated() const {return populated;}
 
 private:
     // first in list is lowest layer
@@ -66,9 +75,18 @@ private:
     const std::string onionname;
     const unsigned long uniq_count;
     SECLEVEL minimum_seclevel;
+    const bool populated;
     mutable std::list<std::unique_ptr<UIntMetaKey>> generated_keys;
+
+    std::string serializeWith(bool populated) const;
 };
 
+// how many times the rewriter used each onion since the proxy started,
+// by anonymous onion name (which, unlike the OnionMeta, survives schema
+// reloads)
+void noteOnionUse(const std::string &anon_onion);
+uint64_t onionUses(const std::string &anon_onion);
+
 class UniqueCounter {
 public:
     uint64_t leaseCount() {return getCounter_()++;}
@@ -202,7 +220,17 @@ public:
 
     TYPENAME("schemaInfo")
 
+    // onions still being peeled in chunks; see onion_peel.hh
+    void addPeel(std::unique_ptr<OnionPeel> &&peel);
+    const OnionPeel *getPeel(const std::string &anon_table,
+                             const std::string &anon_onion) const;
+    std::vector<const OnionPeel *>
+        getTablePeels(const std::string &anon_table) const;
+
 private:
+    std::map<std::pair<std::string, std::string>,
+             std::unique_ptr<OnionPeel> > peels;
+
     std::string serialize(const DBObject &parent) const
     {
         FAIL_TextMessageError("SchemaInfo can not be serialized!");
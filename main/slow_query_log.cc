@@ -0,0 +1,232 @@
+#include <ctype.h>
+#include <time.h>
+#include <sstream>
+#include <thread>
+
+#include <main/slow_query_log.hh>
+#include <main/macro_util.hh>
+
+// entries waiting for the writer
+static const size_t queue_bound = 1024;
+static const size_t longest_shape = 1024;
+
+static __thread QueryProfile *current_profile = NULL;
+
+QueryProfile::QueryProfile()
+    : stages(), overhead(0), backend_queries(0), rewritten_bytes(0),
+      rows_decrypted(0), adjusted(false), thds(0), mem_root_bytes(0),
+      result_bytes(0), schema_refs(0)
+{
+}
+
+QueryProfile *
+currentQueryProfile()
+{
+    return current_profile;
+}
+
+QueryProfileScope::QueryProfileScope(QueryProfile *profile)
+    : profile(profile), start(latencyClock())
+{
+    current_profile = profile;
+    setStageTotals(&profile->stages);
+    setQueryLayerCosts(&profile->layers);
+}
+
+QueryProfileScope::~QueryProfileScope()
+{
+    this->profile->overhead = this->overhead();
+    current_profile = NULL;
+    setStageTotals(NULL);
+    setQueryLayerCosts(NULL);
+}
+
+uint64_t
+QueryProfileScope::overhead() const
+{
+    return this->profile->overhead + (latencyClock() - this->start);
+}
+
+static bool
+identifierChar(char c)
+{
+    return isalnum(static_cast<unsigned char>(c)) || '_' == c || '$' == c;
+}
+
+std::string
+queryShape(const std::string &query)
+{
+    std::string out;
+    size_t i = 0;
+    while (i < query.size() && out.size() < longest_shape) {
+        const char c = query[i];
+        if ('\'' == c || '"' == c) {
+            // backslashes escape the next character; a doubled quote
+            // is a quote
+            for (++i; i < query.size(); ++i) {
+                if ('\\' == query[i]) {
+                    ++i;
+                } else if (c == query[i]) {
+                    if (i + 1 < query.size() && c == query[i + 1]) {
+                        ++i;
+                    } else {
+                        break;
+                    }
+                }
+            }
+            ++i;
+            out += '?';
+        } else if ('`' == c) {
+            const size_t close = query.find('`', i + 1);
+            const size_t end =
+                std::string::npos == close ? query.size() : close + 1;
+            out.append(query, i, end - i);
+            i = end;
+        } else if (isdigit(static_cast<unsigned char>(c))
+                   && (out.empty() || false == identifierChar(out.back()))) {
+            // decimals, exponents and hex
+            while (i < query.size()
+                   && (identifierChar(query[i]) || '.' == query[i])) {
+                ++i;
+            }
+            out += '?';
+        } else if (isspace(static_cast<unsigned char>(c))) {
+            if (false == out.empty() && ' ' != out.back()) {
+                out += ' ';
+            }
+            ++i;
+        } else {
+            out += c;
+            ++i;
+        }
+    }
+
+    if (false == out.empty() && ' ' == out.back()) {
+        out.erase(out.size() - 1);
+    }
+    if (i < query.size()) {
+        out += "...";
+    }
+
+    return out;
+}
+
+SlowQueryLog::SlowQueryLog(const std::string &path, uint64_t threshold_usec)
+    : out(path.c_str(), std::ios_base::app),
+      threshold(threshold_usec * 1000), dropped(0)
+{
+    TEST_Text(this->out.is_open(),
+              "could not open the slow-query log " + path);
+
+    std::thread(&SlowQueryLog::writer, this).detach();
+}
+
+void
+SlowQueryLog::write(const std::string &query, statement_kind kind,
+                    const QueryProfile &profile, uint64_t overhead,
+                    const SchemaInfoRef &schema)
+{
+    char when[32];
+    const time_t now = time(NULL);
+    struct tm local;
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S",
+             localtime_r(&now, &local));
+
+    std::ostringstream entry;
+    entry << "# Time: " << when
+          << "  Kind: " << statementKindName(kind)
+          << "  Overhead_usec: " << overhead / 1000 << "\n";
+
+    entry << "# Stages_usec:";
+    for (int s = 0; s < static_cast<int>(latency_stage::stage_count); ++s) {
+        if (profile.stages.nsec[s]) {
+            entry << " "
+                  << latencyStageName(static_cast<latency_stage>(s))
+                  << "=" << profile.stages.nsec[s] / 1000;
+        }
+    }
+    entry << "\n";
+
+    entry << "# Backend_queries: " << profile.backend_queries
+          << "  Rewritten_bytes: " << profile.rewritten_bytes
+          << "  Rows_decrypted: " << profile.rows_decrypted
+          << "  Adjustment: " << (profile.adjusted ? "yes" : "no") << "\n";
+    entry << "# THDs: " << profile.thds
+          << "  Mem_root_bytes: " << profile.mem_root_bytes
+          << "  Result_bytes: " << profile.result_bytes
+          << "  Schema_refs: " << profile.schema_refs << "\n";
+
+    // the writer names the onions
+    Entry queued = {entry.str(), profile.layers,
+                    profile.layers.empty() ? SchemaInfoRef() : schema,
+                    queryShape(query) + ";\n"};
+
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (this->entries.size() >= queue_bound) {
+            ++this->dropped;
+            return;
+        }
+        this->entries.push_back(std::move(queued));
+    }
+    this->ready.notify_one();
+}
+
+void
+SlowQueryLog::writeOnions(const Entry &entry)
+{
+    if (entry.layers.empty()) {
+        return;
+    }
+
+    if (this->named_schema.lock() != entry.schema) {
+        this->onion_names = onionNames(*entry.schema);
+        this->named_schema = entry.schema;
+    }
+
+    // onions of tables that are gone keep their anonymized name
+    for (const auto &it : layerCostsByKey(entry.layers)) {
+        this->out << "# Onion: ";
+        const auto known = this->onion_names.find(it.first.second);
+        if (this->onion_names.end() != known) {
+            this->out << known->second[0] << "." << known->second[1] << "."
+                      << known->second[2] << " " << known->second[3];
+        } else {
+            this->out << it.first.second;
+        }
+        this->out << "  Layer: " << it.first.first
+                  << "  Encrypts: " << it.second.encrypts
+                  << "  Decrypts: " << it.second.decrypts
+                  << "  Cycles: "
+                  << it.second.enc_cycles + it.second.dec_cycles << "\n";
+    }
+}
+
+void
+SlowQueryLog::writer()
+{
+    std::deque<Entry> batch;
+    while (true) {
+        uint64_t lost;
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->ready.wait(guard, [this] () {
+                return false == this->entries.empty();
+            });
+            batch.swap(this->entries);
+            lost = this->dropped;
+            this->dropped = 0;
+        }
+
+        if (lost) {
+            this->out << "# Dropped: " << lost << " entries\n";
+        }
+        for (const auto &it : batch) {
+            this->out << it.head;
+            this->writeOnions(it);
+            this->out << it.shape;
+        }
+        this->out.flush();
+        batch.clear();
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+/*
+ * slow_query_log.hh
+ *
+ *  With LOG_SLOW_QUERIES=<file>, a query on which the proxy itself spends
+ *  more than LOG_SLOW_QUERIES_USEC (10000) microseconds, in rewrite() and
+ *  next() but not waiting on the backend, is logged with its shape, the
+ *  time it spent in each stage of util/latency.hh, the SQL it sent, the
+ *  onions and layers it went through, the rows it decrypted, whether it
+ *  adjusted an onion and the memory the client held for it.
+ *
+ *  The query thread only formats the entries of slow queries; a
+ *  background thread names their onions, once per schema, and writes
+ *  them.  Rather than make a query wait on a
+ *  writer that fell behind, entries past the queue's bound are dropped
+ *  and counted in the log.
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <main/layer_counters.hh>
+#include <main/schema.hh>
+#include <util/latency.hh>
+
+// what the proxy did for one query
+struct QueryProfile {
+    QueryProfile();
+
+    StageTotals stages;
+    QueryLayerCosts layers;
+    // nanoseconds in rewrite() and next()
+    uint64_t overhead;
+    uint64_t backend_queries;
+    uint64_t rewritten_bytes;
+    uint64_t rows_decrypted;
+    bool adjusted;
+    // what the client held on to when the query was done
+    uint64_t thds;
+    uint64_t mem_root_bytes;
+    // the largest result set seen by next()
+    uint64_t result_bytes;
+    uint64_t schema_refs;
+};
+
+// the profile of the query the thread works on; NULL if none
+QueryProfile *currentQueryProfile();
+
+// The thread works on @profile's query for the duration of the scope,
+// which counts towards its overhead.
+class QueryProfileScope {
+public:
+    explicit QueryProfileScope(QueryProfile *profile);
+    ~QueryProfileScope();
+
+    // including the scope so far
+    uint64_t overhead() const;
+
+private:
+    QueryProfileScope(const QueryProfileScope &);
+    QueryProfileScope &operator=(const QueryProfileScope &);
+
+    QueryProfile *const profile;
+    const uint64_t start;
+};
+
+// @query with its literals replaced by '?' and its whitespace runs by one
+// space; long queries are cut short
+std::string queryShape(const std::string &query);
+
+class SlowQueryLog {
+public:
+    // starts the writer; the log lives as long as the process
+    SlowQueryLog(const std::string &path, uint64_t threshold_usec);
+
+    bool slow(uint64_t overhead) const {return overhead >= threshold;}
+    // @overhead is what the query took so far; @schema names the onions
+    // of @profile
+    void write(const std::string &query, statement_kind kind,
+               const QueryProfile &profile, uint64_t overhead,
+               const SchemaInfoRef &schema);
+
+private:
+    SlowQueryLog(const SlowQueryLog &);
+    SlowQueryLog &operator=(const SlowQueryLog &);
+
+    // the lines before and after the onions, which the writer names
+    struct Entry {
+        std::string head;
+        QueryLayerCosts layers;
+        SchemaInfoRef schema;
+        std::string shape;
+    };
+
+    void writer();
+    void writeOnions(const Entry &entry);
+
+    std::ofstream out;
+    const uint64_t threshold;
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<Entry> entries;
+    uint64_t dropped;
+
+    // the writer's
+    std::weak_ptr<const SchemaInfo> named_schema;
+    std::map<std::string, std::vector<std::string> > onion_names;
+};
@@ -1,4 +1,5 @@
 #include <main/sql_handler.hh>
+#include <util/trace.hh>
 #include <util/yield.hpp>
 
 AbstractAnything::~AbstractAnything() {}
@@ -9,6 +10,9 @@ std::pair<AbstractQueryExecutor::ResultType, AbstractAnything *>
 AbstractQueryExecutor::
 next(const ResType &res, const NextParams &nparams)
 {
+    // one span per step, so a QUERY_COME_AGAIN loop shows each round
+    // trip
+    TraceScope trace_scope("executor", this->traceName());
     genericPreamble(nparams);
 
     return this->nextImpl(res, nparams);
@@ -76,6 +76,10 @@ public:
         nextImpl(const ResType &res, const NextParams &nparams) = 0;
     virtual bool stales() const {return false;}
     virtual bool usesEmbedded() const {return false;}
+    // names the spans of its steps (util/trace.hh); the build has no RTTI
+    virtual const char *traceName() const = 0;
+    // an OnionAdjustmentExecutor; the build has no RTTI
+    virtual bool adjustsOnion() const {return false;}
 
 private:
     void genericPreamble(const NextParams &nparams);
@@ -88,6 +92,9 @@ public:
 
     std::pair<ResultType, AbstractAnything *>
         nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    const char *traceName() const {return "SimpleExecutor";}
 };
 
 class NoOpExecutor : public AbstractQueryExecutor {
@@ -97,6 +104,9 @@ public:
 
     std::pair<ResultType, AbstractAnything *>
         nextImpl(const ResType &res, const NextParams &nparams);
+
+private:
+    const char *traceName() const {return "NoOpExecutor";}
 };
 
 class SQLHandler {
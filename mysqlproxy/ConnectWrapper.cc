@@ -5,13 +5,16 @@
 
 #include <util/ctr.hh>
 #include <util/cryptdb_log.hh>
+#include <util/latency.hh>
 #include <util/scoped_lock.hh>
+#include <util/trace.hh>
 #include <util/util.hh>
 
 #include <main/rewrite_main.hh>
 #include <main/rewrite_util.hh>
 #include <main/schema.hh>
 #include <main/Analysis.hh>
+#include <main/slow_query_log.hh>
 
 #include <parser/sql_utils.hh>
 #include <parser/mysql_type_metadata.hh>
@@ -27,9 +30,24 @@ class WrapperState {
 public:
     std::string last_query;
     std::string default_db;
-    std::ofstream * PLAIN_LOG;
-
-    WrapperState() {}
+    std::unique_ptr<std::ofstream> PLAIN_LOG;
+    // of the query in flight, for next() to record its stages under
+    statement_kind kind;
+    // when next() last handed mysql-proxy a query whose results it
+    // waits for; 0 if it did not
+    uint64_t sent;
+    // the query's id in the trace, 0 if it is not traced
+    uint64_t trace;
+    // for the slow-query log
+    QueryProfile profile;
+    // bytes on the mem_roots and in the result sets of the last query,
+    // and of the largest one, when they were done
+    uint64_t last_query_bytes;
+    uint64_t peak_query_bytes;
+
+    WrapperState()
+        : kind(statement_kind::kind_other), sent(0), trace(0),
+          last_query_bytes(0), peak_query_bytes(0) {}
     ~WrapperState() {}
 
     const std::unique_ptr<QueryRewrite> &getQueryRewrite() const {
@@ -45,6 +63,13 @@ public:
     void setKillZone(const KillZone &kz) {
         kill_zone = kz;
     }
+    // the client has what it asked for, so nothing of the query need
+    // stay with it until the next one
+    void endQuery(bool failed) {
+        this->qr = nullptr;
+        this->schema_info_refs.clear();
+        this->ps->endQuery(failed);
+    }
 
     std::unique_ptr<ProxyState> ps;
     // we are running cryptdb in a threaded environment without proper
@@ -73,6 +98,7 @@ public:
     //        when thread C gets his SchemaInfo the cache is stale so
     //        he deletes the only reference to the SchemaInfo thread A
     //        is using
+    // > the references go once the query is done
     std::vector<SchemaInfoRef> schema_info_refs;
 
 private:
@@ -91,6 +117,7 @@ static std::string TRAIN_QUERY ="";
 
 static bool LOG_PLAIN_QUERIES = false;
 static std::string PLAIN_BASELOG = "";
+static SlowQueryLog *SLOW_LOG = NULL;
 
 
 static int counter = 0;
@@ -195,11 +222,20 @@ connect(lua_State *const L)
                     new std::ofstream(logPlainQueries, std::ios_base::app);
                 LOG(wrapper) << "proxy logs plain queries at " << logPlainQueries;
                 assert_s(PLAIN_LOG != NULL, "could not create file " + logPlainQueries);
-                clients[client]->PLAIN_LOG = PLAIN_LOG;
+                clients[client]->PLAIN_LOG.reset(PLAIN_LOG);
             } else {
                 LOG_PLAIN_QUERIES = false;
             }
         }
+
+        ev = getenv("LOG_SLOW_QUERIES");
+        if (ev && std::string(ev) != "") {
+            const char *const usec = getenv("LOG_SLOW_QUERIES_USEC");
+            SLOW_LOG =
+                new SlowQueryLog(ev, usec ? strtoull(usec, NULL, 10)
+                                          : 10000);
+            LOG(wrapper) << "proxy logs slow queries at " << ev;
+        }
     } else {
         if (LOG_PLAIN_QUERIES) {
             std::string logPlainQueries =
@@ -210,7 +246,7 @@ connect(lua_State *const L)
             std::ofstream * const PLAIN_LOG =
                 new std::ofstream(logPlainQueries, std::ios_base::app);
             assert_s(PLAIN_LOG != NULL, "could not create file " + logPlainQueries);
-            clients[client]->PLAIN_LOG = PLAIN_LOG;
+            clients[client]->PLAIN_LOG.reset(PLAIN_LOG);
         }
     }
     clients[client]->ps =
@@ -271,16 +307,26 @@ rewrite(lua_State *const L)
     std::list<std::string> new_queries;
 
     c_wrapper->last_query = query;
+    c_wrapper->sent = 0;
+    setStatementKind(statement_kind::kind_other);
+    c_wrapper->trace = traceQueryBegin();
+    setTraceQuery(c_wrapper->trace);
+    TraceScope trace_scope("proxy", "rewrite");
+    c_wrapper->profile = QueryProfile();
+    const QueryProfileScope profile_scope(&c_wrapper->profile);
     t.lap_ms();
     if (EXECUTE_QUERIES) {
         try {
+            const uint64_t default_db_start = latencyClock();
             TEST_Text(retrieveDefaultDatabase(_thread_id, ps->getConn(),
                                               &c_wrapper->default_db),
                       "proxy failed to retrieve default database!");
             // save a reference so a second thread won't eat objects
             // that DeltaOuput wants later
+            const uint64_t schema_start = latencyClock();
             const std::shared_ptr<const SchemaInfo> &schema =
                 ps->getSchemaInfo();
+            const uint64_t schema_end = latencyClock();
             c_wrapper->schema_info_refs.push_back(schema);
 
             std::unique_ptr<QueryRewrite> qr =
@@ -289,12 +335,22 @@ rewrite(lua_State *const L)
                                       c_wrapper->default_db, *ps)));
             assert(qr);
 
+            // the statement kind is known once the rewriter parsed it
+            recordLatencyNsec(latency_stage::stage_default_db,
+                              schema_start - default_db_start);
+            recordLatencyNsec(latency_stage::stage_schema,
+                              schema_end - schema_start);
+            c_wrapper->kind = currentStatementKind();
+            c_wrapper->profile.adjusted = qr->executor->adjustsOnion();
+
             c_wrapper->setQueryRewrite(std::move(qr));
         } catch (const AbstractException &e) {
+            c_wrapper->endQuery(true);
             lua_pushboolean(L, false);              // status
             xlua_pushlstring(L, e.to_string());     // error message
             return 2;
         } catch (const CryptDBError &e) {
+            c_wrapper->endQuery(true);
             lua_pushboolean(L, false);              // status
             xlua_pushlstring(L, e.msg);             // error message
             return 2;
@@ -404,6 +460,50 @@ nilBuffer(lua_State *const L, size_t count)
     return;
 }
 
+// once the query is done
+static void
+logIfSlow(const WrapperState &c_wrapper,
+          const QueryProfileScope &profile_scope)
+{
+    const uint64_t overhead = profile_scope.overhead();
+    if (NULL == SLOW_LOG || false == SLOW_LOG->slow(overhead)) {
+        return;
+    }
+
+    assert(false == c_wrapper.schema_info_refs.empty());
+    SLOW_LOG->write(c_wrapper.last_query, c_wrapper.kind, c_wrapper.profile,
+                    overhead, c_wrapper.schema_info_refs.back());
+}
+
+static void
+recordResultBytes(WrapperState *const c_wrapper, const ResType &res)
+{
+    const uint64_t bytes = res.heapBytes();
+    if (bytes > c_wrapper->profile.result_bytes) {
+        c_wrapper->profile.result_bytes = bytes;
+    }
+}
+
+// once the query is done; records what it held on to and lets it go
+static void
+finishQuery(WrapperState *const c_wrapper,
+            const QueryProfileScope &profile_scope, bool failed)
+{
+    const ConnectionMemory &held = c_wrapper->ps->memory(false);
+    c_wrapper->profile.thds = held.thds;
+    c_wrapper->profile.mem_root_bytes = held.mem_root_bytes;
+    c_wrapper->profile.schema_refs = c_wrapper->schema_info_refs.size();
+
+    c_wrapper->last_query_bytes =
+        held.mem_root_bytes + c_wrapper->profile.result_bytes;
+    if (c_wrapper->last_query_bytes > c_wrapper->peak_query_bytes) {
+        c_wrapper->peak_query_bytes = c_wrapper->last_query_bytes;
+    }
+
+    logIfSlow(*c_wrapper, profile_scope);
+    c_wrapper->endQuery(failed);
+}
+
 static int
 next(lua_State *const L)
 {
@@ -429,7 +529,19 @@ next(lua_State *const L)
     assert(ps);
     ps->safeCreateEmbeddedTHD();
 
+    setStatementKind(c_wrapper->kind);
+    setTraceQuery(c_wrapper->trace);
+    TraceScope trace_scope("proxy", "next");
+    const QueryProfileScope profile_scope(&c_wrapper->profile);
+    if (c_wrapper->sent) {
+        recordLatency(latency_stage::stage_backend, c_wrapper->sent);
+        c_wrapper->sent = 0;
+    }
+
+    const uint64_t lua_start = latencyClock();
     const ResType &res = getResTypeFromLuaTable(L, 2, 3, 4, 5, 6);
+    recordLatency(latency_stage::stage_lua, lua_start);
+    recordResultBytes(c_wrapper, res);
     const std::unique_ptr<QueryRewrite> &qr = c_wrapper->getQueryRewrite();
     try {
         NextParams nparams(*ps, c_wrapper->default_db, c_wrapper->last_query);
@@ -457,8 +569,11 @@ next(lua_State *const L)
 
             const auto &next_query = output.second;
             xlua_pushlstring(L, next_query);
+            c_wrapper->profile.backend_queries += 1;
+            c_wrapper->profile.rewritten_bytes += next_query.size();
 
             nilBuffer(L, 2);
+            c_wrapper->sent = latencyClock();
             return 5;
         }
         case AbstractQueryExecutor::ResultType::QUERY_USE_RESULTS: {
@@ -470,6 +585,9 @@ next(lua_State *const L)
 
             xlua_pushlstring(L, new_query);
             nilBuffer(L, 3);
+            c_wrapper->profile.backend_queries += 1;
+            c_wrapper->profile.rewritten_bytes += new_query.size();
+            finishQuery(c_wrapper, profile_scope, false);
             return 5;
         }
         case AbstractQueryExecutor::ResultType::RESULTS: {
@@ -477,7 +595,12 @@ next(lua_State *const L)
             xlua_pushlstring(L, "results");
 
             const auto &res = new_results.second->extract<ResType>();
-            returnResultSet(L, res);        // pushes 4 items on stack
+            recordResultBytes(c_wrapper, res);
+            {
+                const LatencyScope latency(latency_stage::stage_lua);
+                returnResultSet(L, res);    // pushes 4 items on stack
+            }
+            finishQuery(c_wrapper, profile_scope, false);
             return 5;
         }
         default:
@@ -491,6 +614,7 @@ next(lua_State *const L)
         xlua_pushlstring(L, e.getSQLState());
 
         nilBuffer(L, 1);
+        finishQuery(c_wrapper, profile_scope, true);
         return 5;
     }
 }
@@ -547,6 +671,102 @@ returnResultSet(lua_State *const L, const ResType &rd)
     return;
 }
 
+// an array of {kind, stage, count, mean_usec, p50_usec, p90_usec,
+// p99_usec, max_usec}, one per histogram with samples
+static int
+stats(lua_State *const L)
+{
+    const std::vector<LatencySummary> &summaries = latencySummaries();
+
+    lua_createtable(L, static_cast<int>(summaries.size()), 0);
+    const int t_stats = lua_gettop(L);
+    for (uint i = 0; i < summaries.size(); i++) {
+        const LatencySummary &it = summaries[i];
+
+        lua_createtable(L, 0, 8);
+        const int t_stat = lua_gettop(L);
+        xlua_pushlstring(L, it.kind);
+        lua_setfield(L, t_stat, "kind");
+        xlua_pushlstring(L, it.stage);
+        lua_setfield(L, t_stat, "stage");
+        lua_pushnumber(L, it.count);
+        lua_setfield(L, t_stat, "count");
+
+        const std::pair<const char *, uint64_t> times[] =
+            {{"mean_usec", it.mean}, {"p50_usec", it.p50},
+             {"p90_usec", it.p90}, {"p99_usec", it.p99},
+             {"max_usec", it.max}};
+        for (const auto &time : times) {
+            lua_pushnumber(L, time.second / 1000.0);
+            lua_setfield(L, t_stat, time.first);
+        }
+
+        lua_rawseti(L, t_stats, i+1);
+    }
+
+    return 1;
+}
+
+// the spans of the sampled queries as Chrome trace JSON
+static int
+trace(lua_State *const L)
+{
+    xlua_pushlstring(L, traceJSON());
+    return 1;
+}
+
+// an array of {client, thds, mem_root_bytes, items, embedded,
+// schema_refs, last_query_bytes, peak_query_bytes}, one per client, and
+// {idle, opened} for the embedded connections of the proxy
+static int
+memory(lua_State *const L)
+{
+    scoped_lock l(&big_lock);
+
+    lua_createtable(L, static_cast<int>(clients.size()), 0);
+    const int t_clients = lua_gettop(L);
+    int i = 0;
+    for (const auto &it : clients) {
+        const WrapperState *const c_wrapper = it.second;
+        if (NULL == c_wrapper || !c_wrapper->ps) {
+            continue;
+        }
+        const ConnectionMemory &held = c_wrapper->ps->memory(true);
+
+        lua_createtable(L, 0, 8);
+        const int t_client = lua_gettop(L);
+        xlua_pushlstring(L, it.first);
+        lua_setfield(L, t_client, "client");
+        lua_pushboolean(L, held.embedded);
+        lua_setfield(L, t_client, "embedded");
+
+        const std::pair<const char *, uint64_t> counts[] =
+            {{"thds", held.thds},
+             {"mem_root_bytes", held.mem_root_bytes},
+             {"items", held.items},
+             {"schema_refs", c_wrapper->schema_info_refs.size()},
+             {"last_query_bytes", c_wrapper->last_query_bytes},
+             {"peak_query_bytes", c_wrapper->peak_query_bytes}};
+        for (const auto &count : counts) {
+            lua_pushnumber(L, count.second);
+            lua_setfield(L, t_client, count.first);
+        }
+
+        lua_rawseti(L, t_clients, ++i);
+    }
+
+    lua_createtable(L, 0, 2);
+    const int t_pool = lua_gettop(L);
+    lua_pushnumber(L, shared_ps ? shared_ps->getEmbeddedPool().idleCount()
+                                : 0);
+    lua_setfield(L, t_pool, "idle");
+    lua_pushnumber(L, shared_ps ? shared_ps->getEmbeddedPool().openedCount()
+                                : 0);
+    lua_setfield(L, t_pool, "opened");
+
+    return 2;
+}
+
 static const struct luaL_reg
 cryptdb_lib[] = {
 #define F(n) { #n, n }
@@ -554,6 +774,9 @@ cryptdb_lib[] = {
     F(disconnect),
     F(rewrite),
     F(next),
+    F(stats),
+    F(trace),
+    F(memory),
     { 0, 0 },
 };
 
@@ -40,6 +40,22 @@ init_mysql(const string &embed_db)
     assert(0 == mysql_thread_init());
 }
 
+uint64_t
+ResType::heapBytes() const
+{
+    uint64_t bytes = names.capacity() * sizeof(std::string)
+                   + types.capacity() * sizeof(enum_field_types)
+                   + rows.capacity() * sizeof(std::vector<Item *>);
+    for (const auto &it : names) {
+        bytes += it.capacity();
+    }
+    for (const auto &it : rows) {
+        bytes += it.capacity() * sizeof(Item *);
+    }
+
+    return bytes;
+}
+
 char *
 make_thd_string(const string &s, size_t *lenp)
 {
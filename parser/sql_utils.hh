@@ -39,6 +39,8 @@ public:
           names(res.names), types(res.types), rows(rows) {}
 
     bool success() const {return this->ok;}
+    // what the vectors hold on the heap; the Items are on a mem_root
+    uint64_t heapBytes() const;
 };
 
 char * make_thd_string(const std::string &s, size_t *lenp = 0);
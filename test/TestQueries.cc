@@ -4,6 +4,8 @@
  */
 
 #include <algorithm>
+#include <cstdlib>
+#include <sstream>
 #include <stdexcept>
 #include <netinet/in.h>
 
@@ -954,6 +956,206 @@ static QueryList Range = QueryList("Range",
       Query("DROP TABLE t"),
       Query("SET SESSION sql_mode = ''", Query::WHERE_EXEC::CONTROL)});
 
+// the columns have lazy onions whether or not CRYPTDB_ONIONS=lazy is set,
+// so the ORDER BY, range and SUM queries populate the oOPE and oAGG
+// onions of rows written before them
+static QueryList LazyOnions = QueryList("LazyOnions",
+    { Query("CREATE TABLE lazy (id INTEGER PRIMARY KEY,"
+            "                   n INTEGER COMMENT 'cryptdb:lazy',"
+            "                   s VARCHAR(50) COMMENT 'cryptdb:lazy')"),
+      Query("INSERT INTO lazy VALUES (1, 30, 'carrot'), (2, 10, 'apple'),"
+            "                        (3, NULL, NULL), (4, 20, 'banana')"),
+      Query("UPDATE lazy SET n = 15, s = 'bean' WHERE id = 4"),
+      Query("SELECT * FROM lazy WHERE n = 15"),
+      Query("SELECT id FROM lazy ORDER BY n"),
+      Query("SELECT id FROM lazy WHERE s < 'bz'"),
+      Query("INSERT INTO lazy VALUES (5, 5, 'date')"),
+      Query("SELECT SUM(n) FROM lazy"),
+      Query("UPDATE lazy SET n = n + 1"),
+      Query("UPDATE lazy SET n = 40 WHERE id = 2"),
+      Query("SELECT SUM(n) FROM lazy"),
+      Query("SELECT id FROM lazy WHERE n > 10 ORDER BY n"),
+      Query("DROP TABLE lazy")});
+
+static QueryList HOMCounter = QueryList("HOMCounter",
+    { Query("CREATE TABLE hits (id INTEGER PRIMARY KEY,"
+            "                   n INTEGER COMMENT 'cryptdb:hom')"),
+      Query("INSERT INTO hits VALUES (1, 10), (2, 0), (3, 7)"),
+      Query("UPDATE hits SET n = n + 1 WHERE id = 2"),
+      Query("UPDATE hits SET n = n + 5"),
+      Query("UPDATE hits SET n = n - 3 WHERE id = 1"),
+      Query("SELECT id, n FROM hits"),
+      Query("SELECT SUM(n) FROM hits"),
+      Query("UPDATE hits SET n = 4 WHERE id = 3"),
+      Query("SELECT n FROM hits WHERE id = 3"),
+      // past zero
+      Query("UPDATE hits SET n = n - 20 WHERE id < 3"),
+      Query("UPDATE hits SET n = n + -2 WHERE id = 3"),
+      Query("SELECT id, n FROM hits"),
+      Query("SELECT SUM(n) FROM hits"),
+      Query("UPDATE hits SET n = n + 100"),
+      Query("SELECT id, n FROM hits"),
+      Query("DROP TABLE hits"),
+      // not a counter; decrementing past zero is the server's error
+      Query("CREATE TABLE uhits (id INTEGER PRIMARY KEY,"
+            "                    n INTEGER UNSIGNED COMMENT 'cryptdb:hom')"),
+      Query("INSERT INTO uhits VALUES (1, 3), (2, 30)"),
+      Query("UPDATE uhits SET n = n - 5 WHERE id = 2"),
+      Query("UPDATE uhits SET n = n - 5 WHERE id = 1"),
+      Query("SELECT id, n FROM uhits"),
+      Query("DROP TABLE uhits")});
+
+static QueryList SpecialUpdateEval = QueryList("SpecialUpdateEval",
+    { Query("CREATE TABLE sue (id INTEGER PRIMARY KEY, n INTEGER,"
+            "                  u TINYINT UNSIGNED, s VARCHAR(8),"
+            "                  t TEXT, d DATETIME)"),
+      Query("INSERT INTO sue VALUES (1, 5, 250, 'ab', 'Text', NULL),"
+            "                       (2, NULL, 3, NULL, 'x', NULL),"
+            "                       (3, -7, 0, 'abcd', '', NULL)"),
+      Query("UPDATE sue SET n = n * 3 - 1, s = CONCAT(s, n)"),
+      Query("SELECT * FROM sue"),
+      Query("UPDATE sue SET t = UPPER(t), n = IF(n > 0, LENGTH(t), n)"
+            " WHERE id < 3"),
+      Query("SELECT id, n, t FROM sue"),
+      Query("UPDATE sue SET n = IFNULL(n, 0) + 1, s = LOWER(s)"),
+      Query("SELECT id, n, s FROM sue"),
+      // just fits the column
+      Query("UPDATE sue SET s = CONCAT(s, 'xyz') WHERE id = 1"),
+      Query("SELECT s FROM sue WHERE id = 1"),
+      Query("UPDATE sue SET u = u + 10 WHERE id = 2"),
+      Query("SELECT u FROM sue"),
+      Query("UPDATE sue SET d = NOW() WHERE id = 2"),
+      Query("SELECT id FROM sue WHERE d IS NOT NULL"),
+      // values that do not fit their column are left to the embedded
+      // server, which runs the UPDATE in strict mode
+      Query("SET SESSION sql_mode = 'ANSI,TRADITIONAL'",
+            Query::WHERE_EXEC::CONTROL),
+      Query("UPDATE sue SET s = CONCAT(s, 'toolong') WHERE id = 1"),
+      Query("SELECT s FROM sue WHERE id = 1"),
+      Query("UPDATE sue SET u = u + 10 WHERE id = 1"),
+      Query("UPDATE sue SET u = u - 10 WHERE id = 3"),
+      Query("SELECT u FROM sue"),
+      Query("UPDATE sue SET n = 2147483647 WHERE id = 2"),
+      Query("UPDATE sue SET n = n + 1 WHERE id = 2"),
+      Query("UPDATE sue SET n = n * 4294967296 WHERE id = 1"),
+      Query("SELECT id, n FROM sue"),
+      Query("DROP TABLE sue"),
+      Query("SET SESSION sql_mode = ''", Query::WHERE_EXEC::CONTROL)});
+
+// run with CRYPTDB_PEEL_CHUNK=2 (see TestQueries::run), so adjustments
+// peel the rows a couple at a time in the adjustment scheduler; meanwhile
+// the queries read the onions through the fallback and write rows on
+// either side of the peel's boundary
+static QueryList PeelChunks = QueryList("PeelChunks",
+    { Query("CREATE TABLE peel (id INTEGER PRIMARY KEY, n INTEGER,"
+            "                   s VARCHAR(20))"),
+      Query("INSERT INTO peel VALUES (1, 5, 'a'), (2, 15, 'b'),"
+            "                        (3, 25, 'c'), (4, 15, 'd'),"
+            "                        (5, 35, 'e'), (6, 15, 'f'),"
+            "                        (7, 45, 'g')"),
+      // oDET of n, then of s
+      Query("SELECT id FROM peel WHERE n = 15"),
+      Query("SELECT id, s FROM peel WHERE n = 15"),
+      Query("SELECT id FROM peel WHERE s = 'c'"),
+      Query("UPDATE peel SET n = 15 WHERE id = 1"),
+      Query("UPDATE peel SET n = 16, s = 'c' WHERE id = 7"),
+      Query("INSERT INTO peel VALUES (8, 15, 'h'), (9, 55, 'c')"),
+      Query("SELECT id FROM peel WHERE n = 15"),
+      Query("SELECT id, n FROM peel WHERE s = 'c'"),
+      // a column set to itself keeps the level of its row
+      Query("UPDATE peel SET n = n, s = 'z' WHERE id > 4"),
+      Query("SELECT id, s FROM peel WHERE n = 15"),
+      // oOPE of n; computed values finish the peel first
+      Query("SELECT id FROM peel WHERE n > 20 ORDER BY n"),
+      Query("UPDATE peel SET n = n + 1 WHERE id < 3"),
+      Query("SELECT id FROM peel WHERE n < 20 ORDER BY n"),
+      Query("INSERT INTO peel VALUES (2, 0, 'x')"
+            " ON DUPLICATE KEY UPDATE n = VALUES(n)"),
+      Query("SELECT * FROM peel WHERE n = 0"),
+      Query("SELECT * FROM peel"),
+      Query("DROP TABLE peel")});
+
+// also run with CRYPTDB_PEEL_CHUNK=2: two tables are peeled at once, and
+// the reads of the second push its peel ahead of the first's while both
+// answer through the fallback
+static QueryList PeelScheduler = QueryList("PeelScheduler",
+    { Query("CREATE TABLE queued (id INTEGER PRIMARY KEY, n INTEGER)"),
+      Query("CREATE TABLE pushed (id INTEGER PRIMARY KEY, n INTEGER)"),
+      Query("INSERT INTO queued VALUES (1, 10), (2, 20), (3, 30), (4, 40),"
+            "                          (5, 50), (6, 60), (7, 70), (8, 80)"),
+      Query("INSERT INTO pushed VALUES (1, 80), (2, 70), (3, 60), (4, 50),"
+            "                          (5, 40), (6, 30), (7, 20), (8, 10)"),
+      Query("SELECT id FROM queued WHERE n = 30"),
+      Query("SELECT id FROM pushed WHERE n = 30"),
+      Query("SELECT id FROM pushed WHERE n = 40"),
+      Query("SELECT id FROM pushed WHERE n = 50"),
+      Query("UPDATE pushed SET n = 90 WHERE id = 8"),
+      Query("SELECT id FROM pushed WHERE n = 90"),
+      Query("SELECT id FROM queued WHERE n = 70"),
+      Query("SELECT id FROM queued WHERE n > 35 ORDER BY n"),
+      Query("SELECT id FROM pushed WHERE n > 35 ORDER BY n"),
+      Query("SELECT * FROM queued"),
+      Query("SELECT * FROM pushed"),
+      Query("DROP TABLE queued"),
+      Query("DROP TABLE pushed")});
+
+// run with CRYPTDB_SPECIAL_UPDATE_CHUNK=2 (see TestQueries::run), so the
+// UPDATEs span several chunks; the rows they update stay matched, or stop
+// matching, as they go.  The chunks are paged by the keys' ciphertexts,
+// so nothing orders the keys first.
+static QueryList SpecialUpdateChunks = QueryList("SpecialUpdateChunks",
+    { Query("CREATE TABLE chunks (id INTEGER PRIMARY KEY, n INTEGER,"
+            "                     s VARCHAR(20))"),
+      Query("INSERT INTO chunks VALUES (1, 5, 'a'), (2, 15, 'b'),"
+            "                          (3, 25, 'c'), (4, 8, 'd'),"
+            "                          (5, 18, 'e'), (6, 1, 'f'),"
+            "                          (7, 30, 'g')"),
+      Query("UPDATE chunks SET n = n + 10 WHERE n < 20"),
+      Query("SELECT * FROM chunks"),
+      Query("UPDATE chunks SET n = n - 12, s = CONCAT(s, n) WHERE n > 12"),
+      Query("SELECT * FROM chunks"),
+      Query("UPDATE chunks SET n = n * 2 WHERE n < 10 AND id > 2"),
+      Query("SELECT * FROM chunks"),
+      Query("UPDATE chunks SET s = 'z' WHERE id > 2 ORDER BY id LIMIT 3"),
+      Query("SELECT * FROM chunks"),
+      Query("UPDATE chunks SET s = 'y' WHERE n > 1000"),
+      Query("SELECT * FROM chunks"),
+      Query("DROP TABLE chunks"),
+      Query("CREATE TABLE named (k VARCHAR(10) PRIMARY KEY, n INTEGER)"),
+      Query("INSERT INTO named VALUES ('e', 1), ('a', 2), ('d', 3),"
+            "                         ('b', 4), ('c', 5)"),
+      Query("UPDATE named SET n = n * 3 WHERE n > 1"),
+      Query("SELECT * FROM named"),
+      Query("DROP TABLE named")});
+
+// more rows than CRYPTDB_PARALLEL_INSERT_ROWS, so the insert workers
+// encrypt them
+static std::string
+manyRowsInsert()
+{
+    std::ostringstream s;
+    s << "INSERT INTO many VALUES ";
+    for (unsigned int i = 0; i < 200; ++i) {
+        s << (i ? ", " : "") << "(" << i << ", " << i * 7 % 13 << ", ";
+        if (i % 11) {
+            s << "'w" << i % 17 << "', " << i % 3 << ".25)";
+        } else {
+            s << "NULL, NULL)";
+        }
+    }
+    return s.str();
+}
+
+static QueryList ParallelInsert = QueryList("ParallelInsert",
+    { Query("CREATE TABLE many (id INTEGER PRIMARY KEY, n INTEGER,"
+            "                   s VARCHAR(10), d DECIMAL(5, 2))"),
+      Query(manyRowsInsert()),
+      Query("SELECT * FROM many WHERE id < 30 OR id > 180"),
+      Query("SELECT COUNT(*), SUM(n) FROM many WHERE s = 'w3'"),
+      Query("SELECT id FROM many WHERE n > 10 ORDER BY id"),
+      Query("SELECT id FROM many WHERE s IS NULL"),
+      Query("DROP TABLE many")});
+
 //-----------------------------------------------------------------------
 
 Connection::Connection(const TestConfig &input_tc, test_mode input_type) {
@@ -1359,6 +1561,14 @@ RunTest(const TestConfig &tc) {
     // Pass 43/44
     scores.push_back(CheckQueryList(tc, Range));
 
+    scores.push_back(CheckQueryList(tc, LazyOnions));
+    scores.push_back(CheckQueryList(tc, HOMCounter));
+    scores.push_back(CheckQueryList(tc, SpecialUpdateEval));
+    scores.push_back(CheckQueryList(tc, SpecialUpdateChunks));
+    scores.push_back(CheckQueryList(tc, ParallelInsert));
+    scores.push_back(CheckQueryList(tc, PeelChunks));
+    scores.push_back(CheckQueryList(tc, PeelScheduler));
+
     int npass = 0;
     int ntest = 0;
     for (auto it : scores) {
@@ -1433,6 +1643,10 @@ TestQueries::run(const TestConfig &tc, int argc, char ** argv) {
     }
 
 
+    // before the proxy reads them; see SpecialUpdateChunks and PeelChunks
+    setenv("CRYPTDB_SPECIAL_UPDATE_CHUNK", "2", 0);
+    setenv("CRYPTDB_PEEL_CHUNK", "2", 0);
+
     try {
         TestConfig control_tc = TestConfig();
         control_tc.db = control_tc.db+"_control";
@@ -7,14 +7,26 @@
 #include <istream>
 #include <fstream>
 #include <iomanip>
+#include <sstream>
 #include <pthread.h>
 #include <signal.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <sys/time.h>
 #include <time.h>
 #include <sys/wait.h>
 
 #include <main/Connect.hh>
+#include <main/adjust_planner.hh>
+#include <main/adjust_scheduler.hh>
+#include <main/load_data.hh>
+#include <main/metadata_tables.hh>
+#include <main/rewrite_util.hh>
+
+#include <crypto/BasicCrypto.hh>
+#include <crypto/aesni.hh>
+#include <crypto/blowfish.hh>
+#include <crypto/fpe.hh>
 
 #include <util/util.hh>
 #include <util/params.hh>
@@ -507,52 +519,385 @@ testCryptoManager()
 
 }*/
 
-static void
-testTrain(const TestConfig &tc, int ac, char **a) {
-    /*EDBProxy * pr = new EDBProxy(tc.host, tc.user, tc.pass, tc.db, tc.port, false, true);
-
-    pr->plain_execute("drop database cryptdbtest;");
-    pr->plain_execute("create database cryptdbtest;");
-    pr->plain_execute("use cryptdbtest;");
+// MetaData::initialize() only runs once a process, so every test shares
+// this one; it is never freed, as the embedded server outlives the tests
+static SharedProxyState &
+sharedProxyState(const TestConfig &tc)
+{
+    static SharedProxyState *const shared =
+        new SharedProxyState(ConnectionInfo(tc.host, tc.user, tc.pass,
+                                            tc.port),
+                             tc.shadowdb_dir, "2392834",
+                             determineSecurityRating());
+    return *shared;
+}
 
-    string mkey = randomBytes(AES_BLOCK_BYTES);
-    pr->setMasterKey(mkey);
+// plans a trace (traces/wordpress-usage.sql unless given) against tc.db,
+// whose tables must already have been created through the proxy, and
+// applies it; after that the trace must not need any more adjustments
+static void
+testTrain(const TestConfig &tc, int ac, char **av)
+{
+    const std::string trace =
+        ac > 1 ? av[1] : tc.edbdir + "/../traces/wordpress-usage.sql";
+    std::ifstream in(trace);
+    assert_s(in.is_open(), "cannot open " + trace);
+
+    ProxyState ps(sharedProxyState(tc));
+
+    AdjustmentPlanner planner(ps);
+    planner.readTrace(in, tc.db);
+    const unsigned int adjusted = planner.run(16);
+    assert_s(planner.plan().empty(),
+             "the trained workload still needs adjustments");
+
+    std::cerr << "Test train passed: " << planner.statementCount()
+              << " statements, " << adjusted << " onions adjusted, "
+              << planner.failureCount() << " not rewritable" << std::endl;
+}
 
-    pr->execute("train 1 testtraincreate testpatterns 1");
+static void
+dropDatabases(ProxyState &ps, const std::vector<std::string> &dbs)
+{
+    ps.safeCreateEmbeddedTHD();
+    for (const auto &it : dbs) {
+        if (ps.getSchemaInfo()->childExists(IdentityMetaKey(it))) {
+            Rewriter::execute("DROP DATABASE `" + it + "`", "", ps);
+        }
+    }
+}
 
+// the row counts of the tables of @db on the server, smallest first
+static std::vector<std::string>
+serverRowCounts(const std::unique_ptr<Connect> &conn, const std::string &db)
+{
+    std::unique_ptr<DBResult> tables;
+    assert_s(conn->execute("SHOW TABLES FROM `" + db + "`", &tables),
+             "can not list the tables of " + db);
+    std::vector<std::string> names;
+    while (const MYSQL_ROW row = mysql_fetch_row(tables->n)) {
+        names.push_back(row[0]);
+    }
+
+    std::vector<std::string> out;
+    for (const auto &it : names) {
+        std::unique_ptr<DBResult> count;
+        assert_s(conn->execute("SELECT COUNT(*) FROM `" + db + "`.`" + it
+                               + "`", &count),
+                 "can not count the rows of " + db + "." + it);
+        const MYSQL_ROW row = mysql_fetch_row(count->n);
+        assert_s(NULL != row, "no count for " + db + "." + it);
+        out.push_back(row[0]);
+    }
+    std::sort(out.begin(), out.end());
+
+    return out;
+}
 
-    LOG(test) << "\n \n ";
-    LOG(test) << "done training";
-    LOG(test) << "\n \n ";
+// imports a dump that switches databases with USE, with cryptdbimport
+// built next to the test; each table must land in the database the dump
+// put it in.  The tool gets an embedded server of its own, as two can
+// not share tc.shadowdb_dir, so the tables are counted on the server.
+static void
+testImport(const TestConfig &tc, int ac, char **av)
+{
+    const std::string tool = tc.edbdir + "/tools/import/cryptdbimport";
+    const std::vector<std::string> dbs = {"cryptdb_import_a",
+                                          "cryptdb_import_b"};
 
-    ifstream fc("testtraincreate");
+    ProxyState ps(sharedProxyState(tc));
+    const std::unique_ptr<Connect> &conn = ps.getConn();
+    const auto drop = [&conn, &dbs] () {
+        for (const auto &it : dbs) {
+            assert_s(conn->execute("DROP DATABASE IF EXISTS `" + it + "`"),
+                     "can not drop " + it);
+        }
+    };
+    drop();
+
+    char embed_dir[] = "/tmp/cryptdb_import_embed.XXXXXX";
+    assert_s(NULL != mkdtemp(embed_dir), "can not create a directory");
+    char path[] = "/tmp/cryptdb_import.XXXXXX";
+    const int fd = mkstemp(path);
+    assert_s(fd >= 0, "can not create a dump file");
+    close(fd);
+    {
+        std::ofstream dump(path);
+        dump << "CREATE DATABASE `cryptdb_import_a`;\n"
+             << "USE `cryptdb_import_a`;\n"
+             << "CREATE TABLE `t` (`id` int(11) NOT NULL,"
+             << " `name` varchar(20), PRIMARY KEY (`id`));\n"
+             << "INSERT INTO `t` VALUES (1,'one'),(2,'two');\n"
+             << "CREATE DATABASE `cryptdb_import_b`;\n"
+             << "USE `cryptdb_import_b`;\n"
+             << "CREATE TABLE `t` (`id` int(11) NOT NULL,"
+             << " PRIMARY KEY (`id`));\n"
+             << "INSERT INTO `t` VALUES (1),(2),(3);\n"
+             << "USE cryptdb_import_a;\n"
+             << "CREATE TABLE `u` (`n` int(11));\n"
+             << "INSERT INTO `u` VALUES (7);\n";
+    }
+
+    const std::string command =
+        tool + " -u" + tc.user + " -p" + tc.pass + " -H " + tc.host
+        + " -P " + std::to_string(tc.port) + " -e " + embed_dir
+        + " -f " + path;
+    const int status = system(command.c_str());
+    unlink(path);
+    assert_s(0 == system(("rm -rf " + std::string(embed_dir)).c_str()),
+             "can not remove " + std::string(embed_dir));
+    assert_s(0 == status, "import failed: " + command);
+
+    assert_s(std::vector<std::string>({"1", "2"})
+                 == serverRowCounts(conn, "cryptdb_import_a"),
+             "wrong rows in cryptdb_import_a");
+    assert_s(std::vector<std::string>({"3"})
+                 == serverRowCounts(conn, "cryptdb_import_b"),
+             "wrong rows in cryptdb_import_b");
+    drop();
+
+    std::cerr << "Test import passed" << std::endl;
+}
 
-    while (!fc.eof()) {
-        string query = getQuery(fc);
-        pr->plain_execute(query);
-    }
+static void
+checkInfile(const std::string &name, const std::string &text,
+            const InfileFormat &format,
+            const std::vector<std::vector<InfileField> > &expected)
+{
+    std::istringstream in(text);
+    InfileReader reader(in, format);
+    std::vector<InfileField> row;
+    for (const auto &it : expected) {
+        assert_s(reader.next(&row), name + ": too few rows");
+        assert_s(it.size() == row.size(), name + ": wrong field count");
+        for (size_t i = 0; i < it.size(); ++i) {
+            assert_s(it[i].null == row[i].null
+                     && it[i].value == row[i].value,
+                     name + ": wrong field " + std::to_string(i)
+                     + ", got '" + row[i].value + "'");
+        }
+    }
+    assert_s(false == reader.next(&row), name + ": too many rows");
+}
 
-    fc.close();
+// splits files the way the server does, and only reads files inside
+// CRYPTDB_LOAD_DATA_DIR
+static void
+testLoadData(const TestConfig &tc, int ac, char **av)
+{
+    const InfileFormat tabs{"\t", "", "\\", "\n", "", 0};
+    const InfileField null{true, ""};
+    checkInfile("escapes",
+                "a\tb\\tc\t\\N\n"
+                "x\\\ty\t\\N2\t\\Z\\0\n"
+                "last",
+                tabs,
+                {{{false, "a"}, {false, "b\tc"}, null},
+                 {{false, "x\ty"}, {false, "N2"},
+                  {false, std::string("\032\0", 2)}},
+                 {{false, "last"}}});
+
+    const std::string wide(100000, 'w');
+    checkInfile("wide field", wide + "\tb\n", tabs,
+                {{{false, wide}, {false, "b"}}});
+
+    const InfileFormat csv{",", "\"", "\\", "\r\n", "", 0};
+    checkInfile("enclosures",
+                "\"a,\"\"b\"\"\",NULL,\"NULL\",\\N\r\n"
+                "1,\"x\r\ny\"\r\n",
+                csv,
+                {{{false, "a,\"b\""}, null, {false, "NULL"}, null},
+                 {{false, "1"}, {false, "x\r\ny"}}});
+
+    const InfileFormat prefixed{",", "", "\\", "\n", "xx", 1};
+    checkInfile("line prefix", "xxheader\nskip me\nxxa,b\njunkxxc,d\n",
+                prefixed,
+                {{{false, "a"}, {false, "b"}}, {{false, "c"}, {false, "d"}}});
+
+    char dir[] = "/tmp/cryptdb_infile.XXXXXX";
+    assert_s(NULL != mkdtemp(dir), "can not create a directory");
+    const std::string &file = std::string(dir) + "/in.txt";
+    const std::string &link = std::string(dir) + "/out";
+    std::ofstream(file.c_str()) << "1\n";
+    assert_s(0 == symlink("/etc/passwd", link.c_str()),
+             "can not create a symlink");
+    setenv("CRYPTDB_LOAD_DATA_DIR", dir, 1);
+
+    char resolved[PATH_MAX];
+    assert_s(NULL != realpath(file.c_str(), resolved),
+             "can not resolve " + file);
+    assert_s(resolved == infilePath("in.txt"), "relative path refused");
+    assert_s(resolved == infilePath(file), "absolute path refused");
+    for (const std::string &it : {std::string("../../../../etc/passwd"),
+                                  std::string("/etc/passwd"),
+                                  std::string("out"), std::string("."),
+                                  std::string("missing"), std::string()}) {
+        assert_s(infilePath(it).empty(), "read outside the directory: " + it);
+    }
+
+    unlink(link.c_str());
+    unlink(file.c_str());
+    rmdir(dir);
+
+    std::cerr << "Test load_data passed" << std::endl;
+}
 
-    ifstream f("testpatterns");
+// the columns of SET @cryptdb='layers', by onion and by type, with the
+// inserts into a new table counted in them
+static void
+testLayers(const TestConfig &tc, int ac, char **av)
+{
+    const std::string db = "cryptdb_layers";
+    ProxyState ps(sharedProxyState(tc));
+    dropDatabases(ps, {db});
 
-    while (!f.eof()) {
-        string query = getQuery(f);
+    const auto run = [&ps] (const std::string &q, const std::string &cur)
+        -> ResType
+    {
+        ps.safeCreateEmbeddedTHD();
+        const ResType &res = Rewriter::execute(q, cur, ps);
+        assert_s(res.success(), "failed: " + q);
+        return res;
+    };
+    run("CREATE DATABASE " + db, "");
+    run("CREATE TABLE t (x integer, s varchar(20))", db);
+    run("SET @cryptdb='layers', @reset='true'", db);
+    run("INSERT INTO t VALUES (1, 'one'), (2, 'two')", db);
+
+    const std::vector<std::string> counts = {"encrypts", "decrypts",
+                                             "enc_bytes", "dec_bytes",
+                                             "enc_cycles", "dec_cycles"};
+    std::vector<std::string> names = {"layer"};
+    names.insert(names.end(), counts.begin(), counts.end());
+    const ResType &by_type = run("SET @cryptdb='layers', @by='type'", db);
+    assert_s(names == by_type.names, "wrong columns by type");
+    assert_s(names.size() == by_type.types.size(), "wrong types by type");
+    bool counted = false;
+    for (const auto &row : by_type.rows) {
+        assert_s(names.size() == row.size(), "wrong row by type");
+        counted = counted || "0" != ItemToString(*row[1]);
+    }
+    assert_s(counted, "the inserts were not counted");
+
+    names.insert(names.begin(), {"_database", "_table", "_field", "_onion"});
+    const ResType &by_onion = run("SET @cryptdb='layers'", db);
+    assert_s(names == by_onion.names, "wrong columns by onion");
+    assert_s(names.size() == by_onion.types.size(), "wrong types by onion");
+    counted = false;
+    for (const auto &row : by_onion.rows) {
+        assert_s(names.size() == row.size(), "wrong row by onion");
+        counted = counted || (db == ItemToString(*row[0])
+                              && "t" == ItemToString(*row[1])
+                              && "x" == ItemToString(*row[2])
+                              && "0" != ItemToString(*row[5]));
+    }
+    assert_s(counted, "the inserts into t.x were not counted");
+
+    dropDatabases(ps, {db});
+
+    std::cerr << "Test layers passed" << std::endl;
+}
 
-        ResType r1 = pr->execute(query);
-        ResType r2 = pr->plain_execute(query);
+// The scheduler's worker takes the queued peel that the most queries
+// demanded, and a failed peel only runs again when a query demands it
+// after a while.  The peels here are of no table: each one fails as soon
+// as its progress row turns out to be missing, and runs until then while
+// another connection holds that row's insert open.
+static void
+testScheduler(const TestConfig &tc, int ac, char **av)
+{
+    assert_s(1 == adjustWorkers() && 1 == adjustPerTable(),
+             "run with one adjustment worker and one peel per table");
+
+    // the remote metadata tables
+    ProxyState ps(sharedProxyState(tc));
+    const std::string &progress = MetaData::Table::remotePeelProgress();
+    const auto peel = [] (uint64_t id) {
+        return OnionPeel(id, "cryptdb_scheduler", "table", "onion", "salt",
+                         "pk", "onion", {});
+    };
+    const OnionPeel a = peel(1ULL << 62), b = peel((1ULL << 62) + 1),
+                    c = peel((1ULL << 62) + 2);
 
-        assert_s(r1.ok, "query failed: " + query);
-        assert_s(r2.ok, "query failed for plain: " + query);
+    const auto hold = [&tc, &progress] (const OnionPeel &p)
+        -> std::unique_ptr<Connect>
+    {
+        std::unique_ptr<Connect> conn(
+            new Connect(tc.host, tc.user, tc.pass, tc.port));
+        assert_s(conn->execute("START TRANSACTION")
+                 && conn->execute("INSERT INTO " + progress +
+                                  " (boundary, done, id) VALUES (NULL, FALSE, "
+                                  + std::to_string(p.getId()) + ")"),
+                 "can not hold the progress row");
+        return conn;
+    };
+    const auto release = [] (const std::unique_ptr<Connect> &conn) {
+        assert_s(conn->execute("ROLLBACK"), "can not release the row");
+    };
 
-        assert_s(match(r1, r2), "plain and trained cryptdb give different results on query " + query);
-        LOG(test) << "MATCH!";
-    }
+    AdjustmentScheduler scheduler(tc.host, tc.user, tc.pass, tc.port);
+    const auto status = [&scheduler] (const OnionPeel &p)
+        -> AdjustmentScheduler::Status
+    {
+        for (const auto &it : scheduler.status()) {
+            if (it.id == p.getId()) {
+                return it;
+            }
+        }
+        assert_s(false, "the scheduler lost a peel");
+        return AdjustmentScheduler::Status();
+    };
+    const auto wait = [&status] (const OnionPeel &p,
+                                 AdjustmentScheduler::State state) {
+        for (unsigned int i = 0; state != status(p).state; ++i) {
+            assert_s(i < 600, "the peel never got to its state");
+            usleep(100000);
+        }
+    };
 
-    f.close();
-    cerr << "Test train passed\n";
-    */
+    const std::unique_ptr<Connect> hold_a = hold(a);
+    const std::unique_ptr<Connect> hold_c = hold(c);
+    scheduler.submit(a);
+    wait(a, AdjustmentScheduler::State::Running);
+    scheduler.submit(b);
+    scheduler.submit(c);
+    assert_s(false == scheduler.demand(c) && false == scheduler.demand(c),
+             "a queued peel is not done");
+
+    // c was queued after b but demanded more
+    release(hold_a);
+    wait(a, AdjustmentScheduler::State::Failed);
+    wait(c, AdjustmentScheduler::State::Running);
+    assert_s(AdjustmentScheduler::State::Queued == status(b).state,
+             "b ran before c");
+    assert_s(false == status(a).error.empty(), "a failed without an error");
+
+    // too soon to retry
+    const uint64_t priority = status(a).priority;
+    assert_s(false == scheduler.demand(a), "a failed peel is not done");
+    assert_s(AdjustmentScheduler::State::Failed == status(a).state
+             && priority + 1 == status(a).priority,
+             "a failed peel was retried at once");
+
+    release(hold_c);
+    wait(c, AdjustmentScheduler::State::Failed);
+    wait(b, AdjustmentScheduler::State::Failed);
+
+    // a query demanding it later retries it
+    sleep(6);
+    const std::unique_ptr<Connect> hold_again = hold(a);
+    assert_s(false == scheduler.demand(a), "a failed peel is not done");
+    wait(a, AdjustmentScheduler::State::Running);
+    release(hold_again);
+    wait(a, AdjustmentScheduler::State::Failed);
+
+    for (const OnionPeel *const it : {&a, &b, &c}) {
+        scheduler.forget(it->getId());
+    }
+
+    std::cerr << "Test scheduler passed" << std::endl;
 }
+
 //do not change: has been used in creating the DUMPS for experiments
 const uint64_t mkey = 113341234;
 /*
@@ -3023,6 +3368,277 @@ test_PKCS(const TestConfig &tc, int ac, char **av)
     std::cerr << "msg" << dec << "\n";
 }
 
+// RND_str (CBC) and DET_str (CMC) over a range of string lengths, with the
+// portable and the AES-NI kernels; also checks the two agree byte for byte
+static void
+benchAESStrings(const TestConfig &tc, int ac, char **av)
+{
+    const unsigned int rounds = ac > 1 ? atoi(av[1]) : 100000;
+    const std::string key = randomBytes(AES_KEY_BYTES);
+    const std::unique_ptr<AES_KEY> enckey(get_AES_enc_key(key));
+    const std::unique_ptr<AES_KEY> deckey(get_AES_dec_key(key));
+    const std::string salt = randomBytes(SALT_LEN_BYTES);
+    const bool hw = aes_hw_available();
+
+    std::cout << "# aes-ni " << (hw ? "available" : "unavailable")
+              << ", " << rounds << " rounds per cell" << std::endl
+              << "mode len kernel enc_ns dec_ns" << std::endl;
+    for (const unsigned int len : {8, 16, 32, 64, 128, 256, 1024, 4096}) {
+        const std::string ptext = randomBytes(len);
+        std::string ref_cbc, ref_cmc;
+        for (const bool accel : {false, true}) {
+            if (accel && !hw) {
+                continue;
+            }
+            aes_hw_enable(accel);
+            const char *const kernel = accel ? "aesni" : "openssl";
+
+            std::string ctext, dec;
+            Timer t;
+            for (unsigned int i = 0; i < rounds; i++) {
+                ctext = encrypt_AES_CBC(ptext, enckey.get(), salt);
+            }
+            const double cbc_enc = t.lap() * 1000.0 / rounds;
+            for (unsigned int i = 0; i < rounds; i++) {
+                dec = decrypt_AES_CBC(ctext, deckey.get(), salt);
+            }
+            const double cbc_dec = t.lap() * 1000.0 / rounds;
+            assert_s(dec == ptext, "CBC round trip failed");
+            if (accel) {
+                assert_s(ctext == ref_cbc, "AES-NI CBC output differs");
+            }
+            ref_cbc = ctext;
+
+            t.lap();
+            for (unsigned int i = 0; i < rounds; i++) {
+                ctext = encrypt_AES_CMC(ptext, enckey.get());
+            }
+            const double cmc_enc = t.lap() * 1000.0 / rounds;
+            for (unsigned int i = 0; i < rounds; i++) {
+                dec = decrypt_AES_CMC(ctext, deckey.get());
+            }
+            const double cmc_dec = t.lap() * 1000.0 / rounds;
+            assert_s(dec == ptext, "CMC round trip failed");
+            if (accel) {
+                assert_s(ctext == ref_cmc, "AES-NI CMC output differs");
+            }
+            ref_cmc = ctext;
+
+            std::cout << "cbc " << len << " " << kernel << " "
+                      << cbc_enc << " " << cbc_dec << std::endl
+                      << "cmc " << len << " " << kernel << " "
+                      << cmc_enc << " " << cmc_dec << std::endl;
+        }
+    }
+    aes_hw_enable(hw);
+}
+
+/*
+ * Compares the blowfish integer layers (BIGINT ciphertexts) with the
+ * format preserving ones (same width as the plaintext): per value
+ * encrypt/decrypt cost, and the on disk size and full scan time of an
+ * indexed table holding the ciphertexts.
+ */
+static void
+benchFPESize(const TestConfig &tc, int ac, char **av)
+{
+    const unsigned int nrows = ac > 1 ? atoi(av[1]) : 100000;
+    const std::string key = randomBytes(fpe_int::key_bytes);
+    const blowfish bf(key);
+
+    Connect conn(tc.host, tc.user, tc.pass, tc.port);
+    assert_s(conn.execute("CREATE DATABASE IF NOT EXISTS " + tc.db),
+             "could not create " + tc.db);
+
+    const struct {
+        const char *type;
+        uint bits;
+    } widths[] = {
+        {"TINYINT", 8}, {"SMALLINT", 16}, {"MEDIUMINT", 24}, {"INT", 32}
+    };
+
+    std::cout << "# " << nrows << " rows per table" << std::endl
+              << "width layer enc_ns dec_ns data_bytes index_bytes scan_ms"
+              << std::endl;
+    for (const auto &w : widths) {
+        const fpe_int fpe(key, w.bits);
+        const uint64_t mask = (1ULL << w.bits) - 1;
+
+        for (const bool fp : {false, true}) {
+            std::vector<uint64_t> ctexts(nrows);
+            Timer t;
+            for (unsigned int i = 0; i < nrows; i++) {
+                const uint64_t p = i & mask;
+                ctexts[i] = fp ? fpe.encrypt(p, i) : bf.encrypt(p ^ i);
+            }
+            const double enc = t.lap() * 1000.0 / nrows;
+            for (unsigned int i = 0; i < nrows; i++) {
+                const uint64_t p = fp ? fpe.decrypt(ctexts[i], i)
+                                      : bf.decrypt(ctexts[i]) ^ i;
+                assert_s(p == (i & mask), "round trip failed");
+            }
+            const double dec = t.lap() * 1000.0 / nrows;
+
+            const std::string table =
+                std::string(fp ? "fpe_fp_" : "fpe_bf_") + w.type;
+            const std::string qtable = tc.db + "." + table;
+            const std::string coltype =
+                fp ? std::string(w.type) + " UNSIGNED" : "BIGINT UNSIGNED";
+            assert_s(conn.execute("DROP TABLE IF EXISTS " + qtable)
+                     && conn.execute("CREATE TABLE " + qtable
+                                     + " (id INT PRIMARY KEY, c " + coltype
+                                     + ", KEY(c)) ENGINE=InnoDB"),
+                     "could not create " + qtable);
+
+            const unsigned int batch = 1000;
+            for (unsigned int i = 0; i < nrows; i += batch) {
+                std::stringstream q;
+                q << "INSERT INTO " << qtable << " VALUES ";
+                for (unsigned int j = i; j < std::min(nrows, i + batch); j++) {
+                    q << (j == i ? "" : ",")
+                      << "(" << j << "," << ctexts[j] << ")";
+                }
+                assert_s(conn.execute(q.str()), "insert failed");
+            }
+            assert_s(conn.execute("ANALYZE TABLE " + qtable),
+                     "analyze failed");
+
+            std::unique_ptr<DBResult> dbres;
+            assert_s(conn.execute("SELECT data_length, index_length"
+                                  " FROM information_schema.tables"
+                                  " WHERE table_schema = '" + tc.db + "'"
+                                  " AND table_name = '" + table + "'",
+                                  &dbres),
+                     "could not read the table size");
+            const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+            assert_s(row && row[0] && row[1], "no size for " + qtable);
+            const std::string data_bytes(row[0]), index_bytes(row[1]);
+
+            t.lap();
+            assert_s(conn.execute("SELECT SUM(c) FROM " + qtable, &dbres),
+                     "scan failed");
+            const double scan = t.lap() / 1000.0;
+
+            std::cout << w.bits << " " << (fp ? "fpe" : "blowfish") << " "
+                      << enc << " " << dec << " " << data_bytes << " " << index_bytes
+                      << " " << scan << std::endl;
+            conn.execute("DROP TABLE " + qtable);
+        }
+    }
+}
+
+/*
+ * Ciphertext bytes of the default string layers (CBC for RND, CMC for
+ * DET, both padded) against the compact ones (CTR and fpe_str), and
+ * their cost per value.
+ */
+static void
+benchCompactStrings(const TestConfig &tc, int ac, char **av)
+{
+    const unsigned int rounds = ac > 1 ? atoi(av[1]) : 100000;
+    const std::string key = randomBytes(AES_KEY_BYTES);
+    const std::unique_ptr<AES_KEY> enckey(get_AES_enc_key(key));
+    const std::unique_ptr<AES_KEY> deckey(get_AES_dec_key(key));
+    const fpe_str fpe(randomBytes(fpe_str::key_bytes));
+    const std::string salt = randomBytes(SALT_LEN_BYTES);
+
+    std::cout << "len rnd_bytes ctr_bytes det_bytes lp_bytes"
+                 " cbc_ns ctr_ns cmc_ns lp_ns" << std::endl;
+    for (const unsigned int len : {1, 4, 8, 12, 16, 20, 32, 100}) {
+        const std::string ptext = randomBytes(len);
+        std::string cbc, ctr, cmc, lp;
+
+        Timer t;
+        for (unsigned int i = 0; i < rounds; i++) {
+            cbc = encrypt_AES_CBC(ptext, enckey.get(), salt);
+        }
+        const double cbc_ns = t.lap() * 1000.0 / rounds;
+        for (unsigned int i = 0; i < rounds; i++) {
+            ctr = encrypt_AES_CTR(ptext, enckey.get(), salt);
+        }
+        const double ctr_ns = t.lap() * 1000.0 / rounds;
+        for (unsigned int i = 0; i < rounds; i++) {
+            cmc = encrypt_AES_CMC(ptext, enckey.get());
+        }
+        const double cmc_ns = t.lap() * 1000.0 / rounds;
+        for (unsigned int i = 0; i < rounds; i++) {
+            lp = fpe.encrypt(ptext);
+        }
+        const double lp_ns = t.lap() * 1000.0 / rounds;
+
+        assert_s(decrypt_AES_CTR(ctr, enckey.get(), salt) == ptext,
+                 "CTR round trip failed");
+        assert_s(fpe.decrypt(lp) == ptext, "fpe_str round trip failed");
+        assert_s(lp.size() == fpe_str::ciphertext_length(len),
+                 "unexpected fpe_str length");
+
+        std::cout << len << " " << cbc.size() << " " << ctr.size() << " "
+                  << cmc.size() << " " << lp.size() << " " << cbc_ns << " "
+                  << ctr_ns << " " << cmc_ns << " " << lp_ns << std::endl;
+    }
+}
+
+/*
+ * Round trips of the format preserving integers and the compact strings,
+ * at the edges of their widths and lengths.
+ */
+static void
+testCompactFormats(const TestConfig &tc, int ac, char **av)
+{
+    const unsigned int rounds = ac > 1 ? atoi(av[1]) : 1000;
+
+    for (const uint bits : {8, 16, 24, 32}) {
+        const fpe_int fpe(randomBytes(fpe_int::key_bytes), bits);
+        const uint64_t max = (1ULL << bits) - 1;
+
+        std::vector<uint64_t> ptexts = {0, 1, max - 1, max};
+        for (unsigned int i = 0; i < rounds; i++) {
+            ptexts.push_back(randomValue() & max);
+        }
+        for (const uint64_t p : ptexts) {
+            const uint64_t det = fpe.encrypt(p);
+            assert_s(det <= max, "fpe_int ciphertext wider than "
+                                 + std::to_string(bits) + " bits");
+            assert_s(fpe.encrypt(p) == det, "fpe_int is not deterministic");
+            assert_s(fpe.decrypt(det) == p, "fpe_int round trip failed");
+
+            const uint64_t tweak = randomValue();
+            const uint64_t rnd = fpe.encrypt(p, tweak);
+            assert_s(rnd <= max, "tweaked fpe_int ciphertext wider than "
+                                 + std::to_string(bits) + " bits");
+            assert_s(fpe.decrypt(rnd, tweak) == p,
+                     "tweaked fpe_int round trip failed");
+        }
+    }
+
+    const fpe_str fpe(randomBytes(fpe_str::key_bytes));
+    const std::string key = randomBytes(AES_KEY_BYTES);
+    const std::unique_ptr<AES_KEY> enckey(get_AES_enc_key(key));
+    const std::string salt = randomBytes(SALT_LEN_BYTES);
+    for (unsigned int len = 0; len <= 2 * fpe_str::max_short + 8; len++) {
+        for (unsigned int i = 0; i < rounds / 10 + 1; i++) {
+            const std::string ptext = randomBytes(len);
+
+            const std::string lp = fpe.encrypt(ptext);
+            assert_s(fpe.encrypt(ptext) == lp, "fpe_str is not deterministic");
+            assert_s(fpe.decrypt(lp) == ptext, "fpe_str round trip failed");
+            assert_s(lp.size() <= fpe_str::ciphertext_length(len),
+                     "fpe_str ciphertext longer than its bound");
+            if (len <= fpe_str::max_short) {
+                assert_s(lp.size() == len,
+                         "short fpe_str ciphertext changed length");
+            }
+
+            const std::string ctr = encrypt_AES_CTR(ptext, enckey.get(), salt);
+            assert_s(ctr.size() == len, "CTR ciphertext changed length");
+            assert_s(decrypt_AES_CTR(ctr, enckey.get(), salt) == ptext,
+                     "CTR round trip failed");
+        }
+    }
+
+    std::cout << "compact formats ok" << std::endl;
+}
+
 static void help(const TestConfig &tc, int ac, char **av);
 
 static struct {
@@ -3031,7 +3647,11 @@ static struct {
     void (*f)(const TestConfig &, int ac, char **av);
 } tests[] = {
     //{ "aes",            "",                             &evaluate_AES },
+    { "aes_strings",    "AES CBC/CMC string benchmark", &benchAESStrings },
     { "autoinc",        "",                             &autoIncTest },
+    { "compact_strings","compact string ciphertexts",   &benchCompactStrings },
+    { "compact_formats","compact format round trips",   &testCompactFormats },
+    { "fpe_size",       "blowfish vs. format preserving ints", &benchFPESize },
     //{ "consider",       "consider queries (or not)",    &TestNotConsider::run },
     //{ "crypto",         "crypto functions",             &TestCrypto::run },
     //{ "paillier",       "",                             &testPaillier },
@@ -3045,7 +3665,12 @@ static struct {
     { "trace",          "trace eval",                   &testTrace },
     { "bench",          "TPC-C benchmark eval",         &testBench },
     //{ "utils",          "",                             &testUtils },
-        { "train",          "",                             &testTrain },
+    { "train",          "pre-adjust onions from a trace", &testTrain },
+    { "import",         "import a dump that switches databases", &testImport },
+    { "load_data",      "LOAD DATA file parsing and paths", &testLoadData },
+    { "layers",         "columns of the layers directive", &testLayers },
+    { "scheduler",      "adjustment scheduler priority and retry",
+                                                        &testScheduler },
     
     { "help",             "",                           &help },
 };
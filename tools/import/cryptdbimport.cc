@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <chrono>
+#include <functional>
 #include <string>
 #include <stdio.h>
 #include <iostream>
@@ -6,11 +8,19 @@
 #include <sstream>
 #include <stdexcept>
 #include <stdlib.h>
-#include <pthread.h>
+#include <thread>
 #include <getopt.h>
 #include <rewrite_main.hh>
+#include <main/macro_util.hh>
+#include <main/metadata_tables.hh>
+#include <main/rewrite_util.hh>
 #include <cryptdbimport.hh>
 
+// the Items and THDs of a rewrite are only freed with its ProxyState
+static const uint64_t jobs_per_proxy_state = 64;
+static const unsigned int report_seconds = 5;
+static const std::string benchmark_db = "cryptdb_import_benchmark";
+
 static void __attribute__((noreturn))
 do_display_help(const char *arg)
 {
@@ -19,101 +29,624 @@ do_display_help(const char *arg)
     std::cout << "OPTIONS are:" << std::endl;
     std::cout << "-u<username>: MySQL server username" << std::endl;
     std::cout << "-p<password>: MySQL server password" << std::endl;
+    std::cout << "-H <host>: MySQL server host (localhost)" << std::endl;
+    std::cout << "-P <port>: MySQL server port (3306)" << std::endl;
+    std::cout << "-e <dir>: embedded database directory (/var/lib/shadow-mysql)" << std::endl;
     std::cout << "-n: Do not execute queries. Only show stdout." << std::endl;
     std::cout << "-f <file>: MySQL's .sql dump file, originated from \"mysqldump\" tool." << std::endl;
+    std::cout << "-t <threads>: threads encrypting rows (1)" << std::endl;
+    std::cout << "-l <loaders>: connections loading rows (1)" << std::endl;
+    std::cout << "-b <rows>: rows per INSERT sent to the server (1000)" << std::endl;
+    std::cout << "-r: resume an import of the same file that stopped" << std::endl;
+    std::cout << "-B <rows>: import a generated table of <rows> rows, report the rate and drop it" << std::endl;
     std::cout << "To generate DB's dump file use mysqldump, e.g.:" << std::endl;
     std::cout << "$ mysqldump -u user -ppassword --all-databases >dumpfile.sql" << std::endl;
     exit(0);
 }
 
 
-static bool 
+static bool
 ignore_line(const std::string& line)
 {
     static const std::string begin_match("--");
 
-    return(line.compare(0,2,begin_match) == 0); 
+    return(line.compare(0,2,begin_match) == 0);
 }
 
-void
-Import::printOutOnly(void)
+// a statement ends with the line that ends with ';'; the ';' is dropped
+static bool
+nextStatement(std::istream &in, std::string *const statement)
 {
     std::string line;
-    std::string s("");
-    std::ifstream input(this->filename);
+    statement->clear();
+    while (std::getline(in, line)) {
+        if (ignore_line(line) || line.empty()) {
+            continue;
+        }
+
+        const bool last = ';' == *line.rbegin();
+        *statement += (statement->empty() ? "" : "\n")
+                    + (last ? line.substr(0, line.length() - 1) : line);
+        if (last) {
+            return true;
+        }
+    }
 
-    assert(input.is_open() == true); 
+    return false == statement->empty();
+}
 
-    while(std::getline(input, line )){
-        if(ignore_line(line))
-            continue;
+static bool
+startsWithIgnoreCase(const std::string &s, const std::string &prefix)
+{
+    return s.size() >= prefix.size()
+           && equalsIgnoreCase(prefix, s.substr(0, prefix.size()));
+}
 
-        if (!line.empty()){
-            char lastChar = *line.rbegin();
-            if(lastChar == ';'){
-                std::cout << s + line << std::endl;
-                s.clear();
-                continue;
+static std::string
+unquoteIdentifier(const std::string &identifier)
+{
+    if (identifier.size() >= 2 && '`' == identifier[0]
+        && '`' == *identifier.rbegin()) {
+        return identifier.substr(1, identifier.size() - 2);
+    }
+    return identifier;
+}
+
+// mysqldump's versioned comments (SET, ALTER TABLE ... DISABLE KEYS) only
+// speed up a plain load, and its table locks would keep the loaders out
+static bool
+skippable(const std::string &statement)
+{
+    return startsWithIgnoreCase(statement, "/*!")
+           || startsWithIgnoreCase(statement, "LOCK TABLES ")
+           || startsWithIgnoreCase(statement, "UNLOCK TABLES");
+}
+
+// > USE `db`
+static bool
+useDatabase(const std::string &statement, std::string *const db)
+{
+    static const std::string use = "USE ";
+    if (false == startsWithIgnoreCase(statement, use)) {
+        return false;
+    }
+
+    *db = unquoteIdentifier(statement.substr(use.size()));
+    return true;
+}
+
+// the rows in the VALUES list of an extended INSERT
+static uint64_t
+countRows(const std::string &values)
+{
+    uint64_t rows = 0;
+    unsigned int depth = 0;
+    char quote = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        const char c = values[i];
+        if (quote) {
+            if ('\\' == c) {
+                ++i;
+            } else if (quote == c) {
+                quote = 0;
+            }
+        } else if ('\'' == c || '"' == c) {
+            quote = c;
+        } else if ('(' == c) {
+            if (0 == depth++) {
+                ++rows;
             }
-            s += line;
+        } else if (')' == c && depth > 0) {
+            --depth;
         }
     }
+
+    return rows;
+}
+
+// > INSERT INTO `t` VALUES (...),(...)
+// as mysqldump writes them; @head is everything before the rows.  Other
+// INSERTs are left to run on their own.
+static bool
+splitInsert(const std::string &statement, std::string *const head,
+            std::string *const table, std::string *const values)
+{
+    static const std::string insert = "INSERT INTO ";
+    static const std::string keyword = " VALUES ";
+    if (false == startsWithIgnoreCase(statement, insert)) {
+        return false;
+    }
+
+    const size_t table_end = statement.find(' ', insert.size());
+    const size_t values_start = statement.find(keyword, insert.size());
+    if (std::string::npos == table_end || std::string::npos == values_start
+        || values_start < table_end) {
+        return false;
+    }
+
+    *table =
+        unquoteIdentifier(statement.substr(insert.size(),
+                                           table_end - insert.size()));
+    *head = statement.substr(0, values_start);
+    *values = statement.substr(values_start + keyword.size());
+    return false == values->empty() && '(' == (*values)[0]
+           && ')' == *values->rbegin()
+           && std::string::npos == values->find(" ON DUPLICATE KEY ");
+}
+
+// the first query of the rewritten INSERT, which is all there is to it
+static std::string
+encryptInsert(const ImportJob &job, const ProxyState &ps)
+{
+    const QueryRewrite &qr =
+        Rewriter::rewrite(job.query, *ps.getSchemaInfo().get(), job.db, ps);
+    const auto &out =
+        qr.executor->next(ResType(true, 0, 0),
+                          NextParams(ps, job.db, job.query));
+    const std::unique_ptr<AbstractAnything> anything(out.second);
+    TEST_Text(AbstractQueryExecutor::ResultType::QUERY_COME_AGAIN
+                == out.first,
+              "INSERT did not rewrite to a query: " + job.query);
+    return anything->extract<std::pair<bool, std::string> >().second;
+}
+
+// runs @f, turning what it throws into @message
+static bool
+attempt(const std::function<void()> &f, std::string *const message)
+{
+    try {
+        f();
+        return true;
+    } catch (const AbstractException &e) {
+        std::ostringstream s;
+        s << e;
+        *message = s.str();
+    } catch (const ErrorPacketException &e) {
+        *message = e.getMessage();
+    } catch (const CryptDBError &e) {
+        *message = e.msg;
+    } catch (const std::runtime_error &e) {
+        *message = e.what();
+    }
+
+    return false;
+}
+
+static std::string
+progressRow(const std::unique_ptr<Connect> &conn, const std::string &dump,
+            const std::string &db, const std::string &table,
+            uint64_t statement)
+{
+    return " REPLACE INTO " + MetaData::Table::remoteImportProgress() +
+           "   (dump, _database, _table, statement) VALUES"
+           "   ('" + escapeString(conn, dump) + "',"
+           "    '" + escapeString(conn, db) + "',"
+           "    '" + escapeString(conn, table) + "',"
+           "    " + std::to_string(statement) + ");";
+}
+
+Import::Import(const std::string &dump, const ImportOptions &options,
+               SharedProxyState &shared)
+    : dump(dump), options(options), shared(shared), ps(shared),
+      statements(0), rows_loaded(0),
+      elapsed(0), plain(2 * options.workers), issued(0), done(0),
+      finished(false)
+{
+    for (unsigned int i = 0; i < options.loaders; ++i) {
+        this->encrypted.push_back(std::unique_ptr<ImportQueue<ImportJob> >(
+            new ImportQueue<ImportJob>(2 * options.workers)));
+    }
 }
 
 void
-Import::executeQueries(ProxyState& ps)
+Import::printOutOnly(std::istream &in)
 {
-    std::string line;
-    std::string s("");
-    std::ifstream input(this->filename);
+    std::string statement;
+    while (nextStatement(in, &statement)) {
+        std::cout << statement << ";" << std::endl;
+    }
+}
+
+void
+Import::loadProgress()
+{
+    const std::unique_ptr<Connect> &conn = this->ps.getConn();
+    const std::string where =
+        " WHERE dump = '" + escapeString(conn, this->dump) + "'";
+    if (false == this->options.resume) {
+        TEST_Text(conn->execute(" DELETE FROM " +
+                                MetaData::Table::remoteImportProgress() +
+                                where + ";"),
+                  "failed to clear the import progress");
+        return;
+    }
+
+    std::unique_ptr<DBResult> dbres;
+    TEST_Text(conn->execute(" SELECT _database, _table, statement FROM " +
+                            MetaData::Table::remoteImportProgress() +
+                            where + ";", &dbres),
+              "failed to read the import progress");
+    while (const MYSQL_ROW row = mysql_fetch_row(dbres->n)) {
+        const unsigned long *const l = mysql_fetch_lengths(dbres->n);
+        this->loaded[TableKey(std::string(row[0], l[0]),
+                              std::string(row[1], l[1]))] =
+            std::stoull(std::string(row[2], l[2]));
+    }
+}
+
+void
+Import::run(std::istream &in)
+{
+    const auto start = std::chrono::steady_clock::now();
+    this->loadProgress();
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < this->options.workers; ++i) {
+        workers.push_back(std::thread(&Import::worker, this));
+    }
+    std::vector<std::thread> loaders;
+    for (unsigned int i = 0; i < this->options.loaders; ++i) {
+        loaders.push_back(std::thread(&Import::loader, this, i));
+    }
+    std::thread reporter(&Import::report, this);
+
+    std::string message;
+    if (false == attempt([this, &in] () {this->readDump(in);}, &message)) {
+        this->fail(message);
+    }
 
-    assert(input.is_open() == true); 
+    this->plain.close(false);
+    for (auto &it : workers) {
+        it.join();
+    }
+    for (const auto &it : this->encrypted) {
+        it->close(false);
+    }
+    for (auto &it : loaders) {
+        it.join();
+    }
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->finished = true;
+        this->stop.notify_all();
+    }
+    reporter.join();
 
-    while(std::getline(input, line )){
-        if(ignore_line(line))
+    this->elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                      - start).count();
+    if (false == this->error.empty()) {
+        FAIL_TextMessageError(this->error);
+    }
+}
+
+void
+Import::readDump(std::istream &in)
+{
+    const auto skip = [this] (const TableKey &key, uint64_t index) {
+        const auto it = this->loaded.find(key);
+        return this->loaded.end() != it && index <= it->second;
+    };
+
+    std::string db;
+    // the batch being gathered
+    ImportJob pending{0, "", "", 0, 0, ""};
+    std::string pending_head;
+    std::map<TableKey, uint64_t> seqs;
+    const auto flush = [this, &pending, &pending_head, &seqs] () {
+        if (pending.rows > 0) {
+            pending.seq = seqs[TableKey(pending.db, pending.table)]++;
+            this->issue(std::move(pending));
+        }
+        pending = ImportJob{0, "", "", 0, 0, ""};
+        pending_head.clear();
+    };
+
+    std::string statement;
+    while (nextStatement(in, &statement)) {
+        const uint64_t index = ++this->statements;
+        if (skippable(statement)) {
             continue;
+        }
 
-        if (!line.empty()){
-            char lastChar = *line.rbegin();
-            if(lastChar == ';'){
-                s += line;
-                std::cout << s << std::endl;
-                // FIXME
-                assert(false);
-                /*
-                const EpilogueResult &epi_res = executeQuery(ps, s);
-                assert(epi_res.res_type.success());
-                s.clear();
+        std::string head, table, values;
+        if (useDatabase(statement, &db)) {
+            flush();
+            // barrier() runs the rewritten statements on ps's connection
+            const std::unique_ptr<Connect> &conn = this->ps.getConn();
+            TEST_Text(conn->execute("USE `" + db + "`;"),
+                      "failed to use " + db + ": " + conn->getError());
+        } else if (splitInsert(statement, &head, &table, &values)) {
+            if (skip(TableKey(db, table), index)) {
                 continue;
-                */
             }
-            s += line;
+
+            if (head != pending_head || db != pending.db
+                || pending.rows >= this->options.batch_rows) {
+                flush();
+                pending.db = db;
+                pending.table = table;
+                pending.query = head + " VALUES " + values;
+                pending_head = head;
+            } else {
+                pending.query += "," + values;
+            }
+            pending.statement = index;
+            pending.rows += countRows(values);
+        } else {
+            flush();
+            if (false == skip(TableKey("", ""), index)) {
+                this->barrier(statement, index, db);
+            }
+        }
+    }
+
+    flush();
+    this->waitForLoaders();
+}
+
+void
+Import::issue(ImportJob &&job)
+{
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        ++this->issued;
+    }
+
+    if (false == this->plain.push(std::move(job))) {
+        this->waitForLoaders();
+    }
+}
+
+void
+Import::barrier(const std::string &statement, uint64_t index,
+                const std::string &db)
+{
+    this->waitForLoaders();
+
+    this->ps.safeCreateEmbeddedTHD();
+    Rewriter::execute(statement, db, this->ps);
+
+    const std::unique_ptr<Connect> &conn = this->ps.getConn();
+    TEST_Text(conn->execute(progressRow(conn, this->dump, "", "", index)),
+              "failed to record the import progress: " + conn->getError());
+}
+
+void
+Import::waitForLoaders()
+{
+    std::unique_lock<std::mutex> guard(this->mutex);
+    while (this->done < this->issued && this->error.empty()) {
+        this->progress.wait(guard);
+    }
+
+    if (false == this->error.empty()) {
+        FAIL_TextMessageError(this->error);
+    }
+}
+
+void
+Import::worker()
+{
+    assert(0 == mysql_thread_init());
+
+    std::unique_ptr<ProxyState> worker_ps;
+    uint64_t jobs = 0;
+    ImportJob job;
+    while (this->plain.pop(&job)) {
+        std::string message;
+        const bool ok = attempt([this, &worker_ps, &jobs, &job] () {
+            if (0 == jobs++ % jobs_per_proxy_state) {
+                thread_ps = NULL;
+                worker_ps.reset(new ProxyState(this->shared));
+                thread_ps = worker_ps.get();
+            }
+            worker_ps->safeCreateEmbeddedTHD();
+            job.query = encryptInsert(job, *worker_ps);
+        }, &message);
+        if (false == ok) {
+            this->fail("can not encrypt INSERT into " + job.db + "."
+                       + job.table + ": " + message);
+            break;
+        }
+
+        const size_t target =
+            std::hash<std::string>()(job.db + "." + job.table)
+            % this->encrypted.size();
+        if (false == this->encrypted[target]->push(std::move(job))) {
+            break;
+        }
+    }
+
+    thread_ps = NULL;
+    worker_ps.reset();
+    mysql_thread_end();
+}
+
+void
+Import::loader(unsigned int index)
+{
+    assert(0 == mysql_thread_init());
+
+    // batches that came before their turn, by table
+    std::map<TableKey, std::map<uint64_t, ImportJob> > waiting;
+    std::map<TableKey, uint64_t> next;
+    std::unique_ptr<ProxyState> loader_ps;
+    std::unique_ptr<Connect> conn;
+    std::string current_db;
+    uint64_t jobs = 0;
+    ImportJob job;
+    while (this->encrypted[index]->pop(&job)) {
+        const TableKey key(job.db, job.table);
+        std::map<uint64_t, ImportJob> &pending = waiting[key];
+        pending[job.seq] = std::move(job);
+
+        std::string message;
+        const bool ok = attempt([&] () {
+            if (!conn) {
+                conn.reset(new Connect(this->options.ci.server,
+                                       this->options.ci.user,
+                                       this->options.ci.passwd,
+                                       this->options.ci.port));
+            }
+            while (false == pending.empty()
+                   && next[key] == pending.begin()->first) {
+                // only for the THDs Connect::execute creates
+                if (0 == jobs++ % jobs_per_proxy_state) {
+                    thread_ps = NULL;
+                    loader_ps.reset(new ProxyState(this->shared));
+                    thread_ps = loader_ps.get();
+                }
+                this->load(conn, &current_db, pending.begin()->second);
+                pending.erase(pending.begin());
+                ++next[key];
+            }
+        }, &message);
+        if (false == ok) {
+            this->fail(message);
+            break;
         }
     }
+
+    thread_ps = NULL;
+    loader_ps.reset();
+    mysql_thread_end();
 }
 
+void
+Import::load(const std::unique_ptr<Connect> &conn,
+             std::string *const current_db, const ImportJob &job)
+{
+    if (*current_db != job.db) {
+        TEST_Text(conn->execute("USE `" + job.db + "`;"),
+                  "failed to use " + job.db + ": " + conn->getError());
+        *current_db = job.db;
+    }
+
+    TEST_Text(conn->execute("START TRANSACTION;"),
+              "failed to start transaction: " + conn->getError());
+    if (false == conn->execute(job.query)
+        || false == conn->execute(progressRow(conn, this->dump, job.db,
+                                              job.table, job.statement))) {
+        const std::string error = conn->getError();
+        conn->execute("ROLLBACK;");
+        FAIL_TextMessageError("loading " + job.db + "." + job.table
+                              + " failed: " + error);
+    }
+    TEST_Text(conn->execute("COMMIT;"),
+              "failed to commit: " + conn->getError());
+
+    this->rows_loaded += job.rows;
+    std::lock_guard<std::mutex> guard(this->mutex);
+    ++this->done;
+    this->progress.notify_all();
+}
+
+void
+Import::report()
+{
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> guard(this->mutex);
+    while (false == this->finished) {
+        this->stop.wait_for(guard, std::chrono::seconds(report_seconds));
+        if (this->finished) {
+            break;
+        }
+
+        const double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                          - start).count();
+        std::cout << "read " << this->statements << " statements, loaded "
+                  << this->rows_loaded << " rows ("
+                  << static_cast<uint64_t>(this->rows_loaded / seconds)
+                  << " rows/s)" << std::endl;
+    }
+}
+
+void
+Import::fail(const std::string &message)
+{
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        if (this->error.empty()) {
+            this->error = message;
+        }
+        this->progress.notify_all();
+    }
+
+    this->plain.close(true);
+    for (const auto &it : this->encrypted) {
+        it->close(true);
+    }
+}
+
+// mysqldump's layout, with its usual 100 rows per INSERT
+static std::string
+benchmarkDump(uint64_t rows)
+{
+    std::ostringstream dump;
+    dump << "CREATE DATABASE `" << benchmark_db << "`;\n"
+         << "USE `" << benchmark_db << "`;\n"
+         << "CREATE TABLE `bench` (\n"
+         << "  `id` int(11) NOT NULL,\n"
+         << "  `name` varchar(64) DEFAULT NULL,\n"
+         << "  `score` int(11) DEFAULT NULL,\n"
+         << "  PRIMARY KEY (`id`)\n"
+         << ") ENGINE=InnoDB;\n";
+    for (uint64_t row = 0; row < rows; ++row) {
+        dump << (0 == row % 100 ? "INSERT INTO `bench` VALUES " : ",")
+             << "(" << row << ",'name " << row << "'," << row * 7 % 1000
+             << ")"
+             << (99 == row % 100 || rows - 1 == row ? ";\n" : "");
+    }
+
+    return dump.str();
+}
+
+static void
+dropBenchmark(ProxyState &ps)
+{
+    ps.safeCreateEmbeddedTHD();
+    if (ps.getSchemaInfo()->childExists(IdentityMetaKey(benchmark_db))) {
+        Rewriter::execute("DROP DATABASE `" + benchmark_db + "`", "", ps);
+    }
+}
 
 int main(int argc, char **argv)
 {
-    int c, threads = 1, optind = 0;
+    int c, optind = 0;
 
     static struct option long_options[] = {
         {"help", no_argument, 0, 'h'},
         {"inputfile", required_argument, 0, 'f'},
         {"password", required_argument, 0, 'p'},
         {"user", required_argument, 0, 'u'},
-        {"noexec", required_argument, 0, 'n'},
+        {"host", required_argument, 0, 'H'},
+        {"port", required_argument, 0, 'P'},
+        {"embedded", required_argument, 0, 'e'},
+        {"noexec", no_argument, 0, 'n'},
         {"threads", required_argument, 0, 't'},
+        {"loaders", required_argument, 0, 'l'},
+        {"batch", required_argument, 0, 'b'},
+        {"resume", no_argument, 0, 'r'},
+        {"benchmark", required_argument, 0, 'B'},
         {NULL, 0, 0, 0},
     };
 
     std::string username("");
     std::string password("");
-    // bool exec = true;
+    std::string host("localhost");
+    uint port = 3306;
+    std::string filename("");
+    bool exec = true;
+    uint64_t benchmark_rows = 0;
+    ImportOptions options{ConnectionInfo(), "/var/lib/shadow-mysql",
+                          "2392834", 1, 1, 1000, false};
 
     while(1)
     {
-        c = getopt_long(argc, argv, "hf:p:u:t:n", long_options, &optind);
+        c = getopt_long(argc, argv, "hf:p:u:H:P:e:nt:l:b:rB:", long_options,
+                        &optind);
         if(c == -1)
             break;
 
@@ -122,24 +655,7 @@ int main(int argc, char **argv)
             case 'h':
                 do_display_help(argv[0]);
             case 'f':
-                {
-                    /*
-                    Import import(optarg);
-                    if(exec == true){
-                        ConnectionInfo ci("localhost", username, password);
-                        const std::string master_key = "2392834";
-                        SharedProxyState shared_ps(ci,
-                                                "/var/lib/shadow-mysql",
-                                                master_key);
-                        ProxyState ps(shared_ps);
-
-                        // Execute queries
-                        import.executeQueries(ps);
-                    } else {
-                        import.printOutOnly();
-                    }
-                    */
-                }
+                filename = optarg;
                 break;
             case 'p':
                 password = optarg;
@@ -147,12 +663,32 @@ int main(int argc, char **argv)
             case 'u':
                 username = optarg;
                 break;
-            case 't':
-                threads = atoi(optarg);
-                (void)threads;
+            case 'H':
+                host = optarg;
+                break;
+            case 'P':
+                port = atoi(optarg);
+                break;
+            case 'e':
+                options.embed_dir = optarg;
                 break;
             case 'n':
-                // exec = false;
+                exec = false;
+                break;
+            case 't':
+                options.workers = std::max(1, atoi(optarg));
+                break;
+            case 'l':
+                options.loaders = std::max(1, atoi(optarg));
+                break;
+            case 'b':
+                options.batch_rows = std::max(1, atoi(optarg));
+                break;
+            case 'r':
+                options.resume = true;
+                break;
+            case 'B':
+                benchmark_rows = strtoull(optarg, NULL, 10);
                 break;
             case '?':
                 break;
@@ -161,5 +697,60 @@ int main(int argc, char **argv)
 
         }
     }
+
+    if (filename.empty() && 0 == benchmark_rows) {
+        do_display_help(argv[0]);
+    }
+
+    std::ifstream file;
+    std::istringstream generated;
+    std::istream *input = &generated;
+    if (benchmark_rows > 0) {
+        generated.str(benchmarkDump(benchmark_rows));
+        filename = "benchmark";
+    } else {
+        file.open(filename);
+        if (false == file.is_open()) {
+            std::cerr << "can not open " << filename << std::endl;
+            return 1;
+        }
+        input = &file;
+    }
+
+    if (false == exec) {
+        Import::printOutOnly(*input);
+        return 0;
+    }
+
+    options.ci = ConnectionInfo(host, username, password, port);
+    SharedProxyState shared_ps(options.ci, options.embed_dir,
+                               options.master_key,
+                               determineSecurityRating());
+    ProxyState ps(shared_ps);
+    thread_ps = &ps;
+
+    Import import(filename, options, shared_ps);
+    std::string message;
+    const bool ok = attempt([&] () {
+        if (benchmark_rows > 0) {
+            dropBenchmark(ps);
+        }
+        import.run(*input);
+        if (benchmark_rows > 0) {
+            dropBenchmark(ps);
+        }
+    }, &message);
+    if (false == ok) {
+        std::cerr << "import failed after statement "
+                  << import.statementCount() << ": " << message << std::endl;
+        return 1;
+    }
+
+    std::cout << "Imported " << import.rowCount() << " rows from "
+              << import.statementCount() << " statements in "
+              << import.seconds() << "s ("
+              << static_cast<uint64_t>(import.rowCount()
+                                       / std::max(import.seconds(), 1e-6))
+              << " rows/s)" << std::endl;
     return 0;
 }
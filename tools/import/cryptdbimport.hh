@@ -1,21 +1,181 @@
 #pragma once
 
+/*
+ * cryptdbimport.hh
+ *
+ *  Loads a mysqldump file into CryptDB without a proxy in front.  The
+ *  reading thread splits the dump into statements and gathers runs of
+ *  extended INSERTs into the same table into batches of up to --batch
+ *  rows.  --threads workers encrypt the batches in parallel, each with a
+ *  ProxyState of its own over the one SharedProxyState; --loaders
+ *  threads send them to the server, each owning the tables that hash to
+ *  it and loading a table's batches in dump order.  Any other statement
+ *  waits for the batches before it to be loaded and then runs on the
+ *  reading thread, so CREATE TABLE and friends keep their place.
+ *
+ *  A batch commits together with the number of its last dump statement
+ *  (MetaData::Table::remoteImportProgress()), so --resume picks up an
+ *  import that stopped without loading a row twice; for tables that are
+ *  not transactional it is only a good guess.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <rewrite_main.hh>
+
 namespace {
 
+// a statement of the dump, or a batch of INSERTs into one table
+struct ImportJob {
+    // of the last dump statement in the job
+    uint64_t statement;
+    std::string db;
+    std::string table;
+    // of the batch among the batches of its table
+    uint64_t seq;
+    uint64_t rows;
+    // plaintext until a worker encrypts it
+    std::string query;
+};
+
+template <typename Type>
+class ImportQueue {
+public:
+    explicit ImportQueue(size_t capacity)
+        : capacity(capacity), closed(false) {}
+
+    // blocks while the queue is full; false if it was closed
+    bool push(Type &&item)
+    {
+        std::unique_lock<std::mutex> guard(this->mutex);
+        while (false == this->closed && this->items.size() >= capacity) {
+            this->changed.wait(guard);
+        }
+        if (this->closed) {
+            return false;
+        }
+
+        this->items.push_back(std::move(item));
+        this->changed.notify_all();
+        return true;
+    }
+
+    // false once the queue is closed and empty
+    bool pop(Type *const out)
+    {
+        std::unique_lock<std::mutex> guard(this->mutex);
+        while (this->items.empty() && false == this->closed) {
+            this->changed.wait(guard);
+        }
+        if (this->items.empty()) {
+            return false;
+        }
+
+        *out = std::move(this->items.front());
+        this->items.pop_front();
+        this->changed.notify_all();
+        return true;
+    }
+
+    // @discard drops what has not been popped yet
+    void close(bool discard)
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->closed = true;
+        if (discard) {
+            this->items.clear();
+        }
+        this->changed.notify_all();
+    }
+
+private:
+    const size_t capacity;
+    bool closed;
+    std::deque<Type> items;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+struct ImportOptions {
+    ConnectionInfo ci;
+    std::string embed_dir;
+    std::string master_key;
+    unsigned int workers;
+    unsigned int loaders;
+    uint64_t batch_rows;
+    bool resume;
+};
+
 /**
  * Import database tool class.
  */
 class Import
 {
     public:
-        Import(const char *fname) : filename(fname){}
-        ~Import(){}
+        // @dump names the dump in the progress table
+        Import(const std::string &dump, const ImportOptions &options,
+               SharedProxyState &shared);
+        ~Import() {}
+
+        // throws if a statement can not be imported
+        void run(std::istream &in);
+        static void printOutOnly(std::istream &in);
 
-        void executeQueries(ProxyState& ps);
-        void printOutOnly(void);
+        uint64_t statementCount() const {return statements;}
+        uint64_t rowCount() const {return rows_loaded;}
+        double seconds() const {return elapsed;}
 
     private:
-        std::string filename;
+        typedef std::pair<std::string, std::string> TableKey;
+
+        void readDump(std::istream &in);
+        void loadProgress();
+        void issue(ImportJob &&job);
+        // runs a statement that is not an INSERT once the batches before
+        // it are loaded
+        void barrier(const std::string &statement, uint64_t index,
+                     const std::string &db);
+        void waitForLoaders();
+
+        void worker();
+        void loader(unsigned int index);
+        void load(const std::unique_ptr<Connect> &conn,
+                  std::string *const current_db, const ImportJob &job);
+        void report();
+        void fail(const std::string &message);
+
+        const std::string dump;
+        const ImportOptions options;
+        SharedProxyState &shared;
+        // for the statements that are not INSERTs
+        ProxyState ps;
+
+        // the last statement an earlier run loaded into each table;
+        // ("", "") for the other statements
+        std::map<TableKey, uint64_t> loaded;
+        std::atomic<uint64_t> statements;
+        std::atomic<uint64_t> rows_loaded;
+        double elapsed;
+
+        ImportQueue<ImportJob> plain;
+        // by loader
+        std::vector<std::unique_ptr<ImportQueue<ImportJob> > > encrypted;
+
+        std::mutex mutex;
+        std::condition_variable progress;
+        std::condition_variable stop;
+        uint64_t issued;
+        uint64_t done;
+        bool finished;
+        std::string error;
 };
 };
 
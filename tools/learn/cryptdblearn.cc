@@ -12,72 +12,40 @@
 #include <onions.hh> //layout
 #include <Analysis.hh> //for intersect()
 #include <rewrite_main.hh>
+#include <main/adjust_planner.hh>
+#include <main/rewrite_util.hh>
 #include <parser/sql_utils.hh>
 
+// each round can only find one more adjustment per statement
+static const unsigned int max_rounds = 16;
+
 static void help(const char *prog)
 {
     std::cout << "Usage: " << prog << 
-        " -u user -p password -d database [-f input file]" << "\n";
-}
-
-static bool 
-ignore_line(const std::string& line)
-{
-    static const std::string begin_match("--");
-
-    return(line.compare(0,2,begin_match) == 0); 
+        " -u user -p password -d database [-H host] [-P port]"
+        " [-e embedded dir] [-f trace file]" << "\n";
 }
 
 void 
 Learn::status()
 {
     std::cout << "Total queries: " << this->m_totalnum << "\n";
-    std::cout << "Number of successfully executed queries: " << this->m_success_num << "\n";
+    std::cout << "Number of successfully rewritten queries: " << this->m_success_num << "\n";
+    std::cout << "Onions adjusted: " << this->m_adjusted_num << "\n";
 }
 
 void
 Learn::trainFromFile(ProxyState &ps)
 {
-    std::string line;
-    std::string s("");
     std::ifstream input(this->m_filename);
     assert(input.is_open() == true); 
 
-    while(std::getline(input, line )){
-        if(ignore_line(line))
-            continue;
-
-        if (!line.empty()){
-            char lastChar = *line.rbegin();
-            if(lastChar == ';'){
-                throw CryptDBError("fix Learn::trainFromFile!");
-                /*
-                // FIXME: Use executeQuery.
-                this->m_totalnum++;
-                s += line;
-                Rewriter r;
-                SchemaInfo *out_schema;
-                QueryRewrite qr = r.rewrite(ps, s, &out_schema);
-                // FIXME.
-                ResType *res =
-                    qr.output->doQuery(ps.conn, ps.e_conn);
-                if(res){
-                    if(res->ok)
-                        this->m_success_num++;
-                    delete res;
-                }
-                if (true == qr.output->queryAgain()){ 
-                    this->m_totalnum++;
-                    assert(executeQuery(ps, s));
-                    this->m_success_num++;
-                } 
-                */
-                s.clear();
-                continue;
-            }
-            s += line;
-        }
-    }
+    AdjustmentPlanner planner(ps);
+    planner.readTrace(input, this->m_dbname);
+    this->m_totalnum = planner.statementCount();
+    this->m_adjusted_num = planner.run(max_rounds);
+    this->m_errnum = planner.failureCount();
+    this->m_success_num = this->m_totalnum - this->m_errnum;
 }
         
 void 
@@ -101,6 +69,9 @@ int main(int argc, char **argv)
         {"password", required_argument, 0, 'p'},
         {"dbname", required_argument, 0, 'd'},
         {"file", required_argument, 0, 'f'},
+        {"host", required_argument, 0, 'H'},
+        {"port", required_argument, 0, 'P'},
+        {"embedded", required_argument, 0, 'e'},
         {NULL, 0, 0, 0},
     };
 
@@ -108,10 +79,14 @@ int main(int argc, char **argv)
     std::string password("");
     std::string dbname("");
     std::string filename("");
+    std::string host("localhost");
+    uint port = 3306;
+    std::string embed_dir("/var/lib/shadow-mysql");
 
     while(1)
     {
-        c = getopt_long(argc, argv, "hf:u:p:d:", long_options, &optind);
+        c = getopt_long(argc, argv, "hf:u:p:d:H:P:e:", long_options,
+                        &optind);
         if(c == -1)
             break;
 
@@ -132,6 +107,15 @@ int main(int argc, char **argv)
             case 'd':
                 dbname = optarg;
                 break;
+            case 'H':
+                host = optarg;
+                break;
+            case 'P':
+                port = atoi(optarg);
+                break;
+            case 'e':
+                embed_dir = optarg;
+                break;
             case '?':
                 break;
             default:
@@ -143,28 +127,34 @@ int main(int argc, char **argv)
     assert(password != "");
     assert(dbname != "");
 
-    
-    /*
-    ConnectionInfo ci("localhost", username, password);
+    ConnectionInfo ci(host, username, password, port);
     const std::string master_key = "2392834";
-    SharedProxyState shared_ps(ci, "/var/lib/shadow-mysql", master_key);
+    SharedProxyState shared_ps(ci, embed_dir, master_key,
+                               determineSecurityRating());
     ProxyState ps(shared_ps);
 
     Learn *learn; 
     
-    if(filename != "")
-    {
-        learn = new Learn(MODE_FILE, ps, dbname, filename);
-        learn->trainFromFile(ps);
-        learn->status();
-    }else{
-        learn = new Learn(MODE_FROM_SCRATCH, ps, dbname, "");
-        learn->trainFromScratch(ps);
-        learn->status();
+    try {
+        if(filename != "")
+        {
+            learn = new Learn(MODE_FILE, ps, dbname, filename);
+            learn->trainFromFile(ps);
+            learn->status();
+        }else{
+            learn = new Learn(MODE_FROM_SCRATCH, ps, dbname, "");
+            learn->trainFromScratch(ps);
+            learn->status();
+        }
+    } catch (const AbstractException &e) {
+        std::cerr << "adjustment failed: " << e << std::endl;
+        return 1;
+    } catch (const ErrorPacketException &e) {
+        std::cerr << "adjustment failed: " << e.getMessage() << std::endl;
+        return 1;
     }
    
     delete learn;
-    */
 
     return 0;
 }
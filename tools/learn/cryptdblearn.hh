@@ -33,7 +33,7 @@ class Learn
         Learn(mode_e mode, ProxyState& ps, const std::string &dbname,
               const std::string &filename)
             : m_totalnum(0), m_success_num(0), m_errnum(0),
-            m_mode(mode), m_ps(ps), m_dbname(dbname), m_filename(filename){}
+            m_adjusted_num(0), m_mode(mode), m_ps(ps), m_dbname(dbname), m_filename(filename){}
 
         ~Learn(){}
 
@@ -46,6 +46,7 @@ class Learn
         int m_totalnum;
         int m_success_num;
         int m_errnum;
+        int m_adjusted_num;
         mode_e m_mode;
         ProxyState& m_ps;
         std::string m_dbname;
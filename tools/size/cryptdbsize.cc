@@ -0,0 +1,299 @@
+/*
+ * cryptdbsize: reports the on disk size of every table in the backend
+ * databases, as the server accounts for it (information_schema.tables),
+ * and optionally compares it with an earlier snapshot.  Used to measure
+ * what the compact ciphertext formats save:
+ *
+ *   $ cryptdbsize -u root -p letmein -d mydb -s before.tsv
+ *   ... migrate with CRYPTDB_CIPHER_FORMAT=compact ...
+ *   $ cryptdbsize -u root -p letmein -d mydb -c before.tsv
+ *
+ * Anonymized tables are listed under their backend names; a migrated
+ * table gets a new one, so the totals per database are what to compare.
+ */
+
+#include <stdlib.h>
+#include <getopt.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <main/Connect.hh>
+
+struct TableSize {
+    uint64_t rows;
+    uint64_t data_bytes;
+    uint64_t index_bytes;
+
+    uint64_t total() const {return data_bytes + index_bytes;}
+};
+
+// (database, table) -> size
+typedef std::map<std::pair<std::string, std::string>, TableSize> SizeReport;
+
+static void __attribute__((noreturn))
+do_display_help(const char *arg)
+{
+    std::cout << "CryptDBSize" << std::endl;
+    std::cout << "Use: " << arg << " [OPTIONS]" << std::endl;
+    std::cout << "OPTIONS are:" << std::endl;
+    std::cout << "-h<host>: MySQL server host [localhost]" << std::endl;
+    std::cout << "-P<port>: MySQL server port [3306]" << std::endl;
+    std::cout << "-u<username>: MySQL server username" << std::endl;
+    std::cout << "-p<password>: MySQL server password" << std::endl;
+    std::cout << "-d<database>: only report this database (repeatable)" << std::endl;
+    std::cout << "-a: ANALYZE the tables first, for exact row counts" << std::endl;
+    std::cout << "-s <file>: save the report to file" << std::endl;
+    std::cout << "-c <file>: compare with a report saved by -s" << std::endl;
+    exit(0);
+}
+
+static uint64_t
+toUint(const char *const s)
+{
+    return s ? strtoull(s, NULL, 10) : 0;
+}
+
+static std::string
+quoted(const std::vector<std::string> &dbs)
+{
+    std::string out;
+    for (auto it : dbs) {
+        out += (out.empty() ? "'" : ", '") + it + "'";
+    }
+    return out;
+}
+
+static SizeReport
+measure(Connect *const conn, const std::vector<std::string> &dbs,
+        bool analyze)
+{
+    const std::string where =
+        dbs.empty()
+            ? " WHERE table_schema NOT IN ('mysql', 'information_schema',"
+              " 'performance_schema', 'remote_db')"
+            : " WHERE table_schema IN (" + quoted(dbs) + ")";
+
+    std::unique_ptr<DBResult> dbres;
+    if (analyze) {
+        if (!conn->execute("SELECT table_schema, table_name"
+                           " FROM information_schema.tables" + where,
+                           &dbres)) {
+            throw std::runtime_error("could not list tables: "
+                                     + conn->getError());
+        }
+        std::vector<std::string> tables;
+        while (const MYSQL_ROW row = mysql_fetch_row(dbres->n)) {
+            tables.push_back(std::string("`") + row[0] + "`.`" + row[1]
+                             + "`");
+        }
+        for (auto it : tables) {
+            conn->execute("ANALYZE TABLE " + it);
+        }
+    }
+
+    if (!conn->execute("SELECT table_schema, table_name, table_rows,"
+                       "       data_length, index_length"
+                       " FROM information_schema.tables" + where
+                       + " AND table_type = 'BASE TABLE'", &dbres)) {
+        throw std::runtime_error("could not read table sizes: "
+                                 + conn->getError());
+    }
+
+    SizeReport report;
+    while (const MYSQL_ROW row = mysql_fetch_row(dbres->n)) {
+        const TableSize size = {toUint(row[2]), toUint(row[3]),
+                                toUint(row[4])};
+        report[std::make_pair(row[0], row[1])] = size;
+    }
+    return report;
+}
+
+static void
+save(const SizeReport &report, const std::string &path)
+{
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("could not write " + path);
+    }
+    for (auto it : report) {
+        out << it.first.first << "\t" << it.first.second << "\t"
+            << it.second.rows << "\t" << it.second.data_bytes << "\t"
+            << it.second.index_bytes << std::endl;
+    }
+}
+
+static SizeReport
+load(const std::string &path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("could not read " + path);
+    }
+
+    SizeReport report;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string db, table;
+        TableSize size;
+        if (std::getline(fields, db, '\t') && std::getline(fields, table, '\t')
+            && fields >> size.rows >> size.data_bytes >> size.index_bytes) {
+            report[std::make_pair(db, table)] = size;
+        }
+    }
+    return report;
+}
+
+static std::string
+perRow(uint64_t bytes, uint64_t rows)
+{
+    return rows ? std::to_string(bytes / rows) : "-";
+}
+
+static void
+print(const SizeReport &report)
+{
+    std::cout << std::left << std::setw(20) << "database"
+              << std::setw(32) << "table" << std::right
+              << std::setw(12) << "rows" << std::setw(14) << "data"
+              << std::setw(14) << "index" << std::setw(12) << "bytes/row"
+              << std::endl;
+    for (auto it : report) {
+        const TableSize &s = it.second;
+        std::cout << std::left << std::setw(20) << it.first.first
+                  << std::setw(32) << it.first.second << std::right
+                  << std::setw(12) << s.rows << std::setw(14)
+                  << s.data_bytes << std::setw(14) << s.index_bytes
+                  << std::setw(12) << perRow(s.total(), s.rows)
+                  << std::endl;
+    }
+}
+
+static std::map<std::string, TableSize>
+perDatabase(const SizeReport &report)
+{
+    std::map<std::string, TableSize> totals;
+    for (auto it : report) {
+        TableSize &t = totals[it.first.first];
+        t.rows += it.second.rows;
+        t.data_bytes += it.second.data_bytes;
+        t.index_bytes += it.second.index_bytes;
+    }
+    return totals;
+}
+
+static void
+compare(const SizeReport &before, const SizeReport &after)
+{
+    const auto b = perDatabase(before);
+    const auto a = perDatabase(after);
+
+    std::cout << std::endl << std::left << std::setw(20) << "database"
+              << std::right << std::setw(16) << "bytes before"
+              << std::setw(16) << "bytes after" << std::setw(10) << "ratio"
+              << std::setw(14) << "row before" << std::setw(14)
+              << "row after" << std::endl;
+    for (auto it : a) {
+        const auto old = b.find(it.first);
+        if (b.end() == old) {
+            continue;
+        }
+        const TableSize &o = old->second, &n = it.second;
+        std::cout << std::left << std::setw(20) << it.first << std::right
+                  << std::setw(16) << o.total() << std::setw(16)
+                  << n.total() << std::setw(10) << std::fixed
+                  << std::setprecision(2)
+                  << (o.total() ? double(n.total()) / o.total() : 0.0)
+                  << std::setw(14) << perRow(o.total(), o.rows)
+                  << std::setw(14) << perRow(n.total(), n.rows)
+                  << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int c, optind = 0;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'H'},
+        {"host", required_argument, 0, 'h'},
+        {"port", required_argument, 0, 'P'},
+        {"user", required_argument, 0, 'u'},
+        {"password", required_argument, 0, 'p'},
+        {"database", required_argument, 0, 'd'},
+        {"analyze", no_argument, 0, 'a'},
+        {"save", required_argument, 0, 's'},
+        {"compare", required_argument, 0, 'c'},
+        {NULL, 0, 0, 0},
+    };
+
+    std::string host("localhost");
+    uint port = 3306;
+    std::string username("root");
+    std::string password("");
+    std::vector<std::string> dbs;
+    bool analyze = false;
+    std::string save_path, compare_path;
+
+    while (1) {
+        c = getopt_long(argc, argv, "Hh:P:u:p:d:as:c:", long_options,
+                        &optind);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'H':
+                do_display_help(argv[0]);
+            case 'h':
+                host = optarg;
+                break;
+            case 'P':
+                port = atoi(optarg);
+                break;
+            case 'u':
+                username = optarg;
+                break;
+            case 'p':
+                password = optarg;
+                break;
+            case 'd':
+                dbs.push_back(optarg);
+                break;
+            case 'a':
+                analyze = true;
+                break;
+            case 's':
+                save_path = optarg;
+                break;
+            case 'c':
+                compare_path = optarg;
+                break;
+            default:
+                do_display_help(argv[0]);
+        }
+    }
+
+    try {
+        Connect conn(host, username, password, port);
+        const SizeReport report = measure(&conn, dbs, analyze);
+        print(report);
+        if (!save_path.empty()) {
+            save(report, save_path);
+        }
+        if (!compare_path.empty()) {
+            compare(load(compare_path), report);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
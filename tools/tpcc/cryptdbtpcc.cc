@@ -0,0 +1,1092 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include <assert.h>
+#include <getopt.h>
+#include <stdlib.h>
+
+#include <crypto/arc4.hh>
+#include <main/error.hh>
+#include <main/macro_util.hh>
+#include <cryptdbtpcc.hh>
+
+static const unsigned int districts_per_warehouse = 10;
+// rows per INSERT while loading
+static const unsigned int load_batch = 100;
+static const std::string entry_date = "'2013-01-01 00:00:00'";
+
+static const char *const txn_names[] = {
+#define TPCC_TXN_NAME(name, weight) #name,
+    TPCC_TRANSACTIONS(TPCC_TXN_NAME)
+#undef TPCC_TXN_NAME
+};
+
+static const unsigned int txn_weights[] = {
+#define TPCC_TXN_WEIGHT(name, weight) weight,
+    TPCC_TRANSACTIONS(TPCC_TXN_WEIGHT)
+#undef TPCC_TXN_WEIGHT
+};
+
+static void __attribute__((noreturn))
+do_display_help(const char *arg)
+{
+    std::cout << "CryptDBTpcc" << std::endl;
+    std::cout << "Use: " << arg << " [OPTIONS]" << std::endl;
+    std::cout << "OPTIONS are:" << std::endl;
+    std::cout << "-u<username>: MySQL server username (root)" << std::endl;
+    std::cout << "-p<password>: MySQL server password (letmein)"
+              << std::endl;
+    std::cout << "-H <host>: MySQL server host (127.0.0.1)" << std::endl;
+    std::cout << "-P <port>: MySQL server port (3306)" << std::endl;
+    std::cout << "-e <dir>: embedded database directory"
+                 " (/var/lib/shadow-mysql)" << std::endl;
+    std::cout << "-s <file>: CREATE TABLEs of the schema"
+                 " (eval/tpcc/sqlTableCreates)" << std::endl;
+    std::cout << "-d <db>: database, dropped by the load (tpcc)"
+              << std::endl;
+    std::cout << "-w <warehouses>: warehouses (1)" << std::endl;
+    std::cout << "-I <items>: items (1000)" << std::endl;
+    std::cout << "-c <customers>: customers and orders per district (30)"
+              << std::endl;
+    std::cout << "-n: do not load, run against the database as it is"
+              << std::endl;
+    std::cout << "-t <terminals>: terminal threads (4)" << std::endl;
+    std::cout << "-T <seconds>: run time (60)" << std::endl;
+    std::cout << "-i <seconds>: report interval (5)" << std::endl;
+    std::cout << "-m <seconds>: StockLevel joins the mix after this long,"
+                 " 0 for from the start (0)" << std::endl;
+    exit(0);
+}
+
+static std::string
+luaString(lua_State *const L, int index)
+{
+    size_t length;
+    const char *const s = lua_tolstring(L, index, &length);
+    return s ? std::string(s, length) : std::string();
+}
+
+static void
+pushString(lua_State *const L, const std::string &s)
+{
+    lua_pushlstring(L, s.data(), s.length());
+}
+
+LuaClient::LuaClient(const std::string &name, const TpccOptions &options)
+    : name(name), L(luaL_newstate())
+{
+    TEST_TextMessageError(nullptr != this->L, "can not create a Lua state");
+    luaL_openlibs(this->L);
+    lua_cryptdb_init(this->L);
+    lua_settop(this->L, 0);
+
+    // the first connection starts the embedded server, which has to
+    // happen before the client library opens any connection
+    this->pushFunction("connect");
+    pushString(this->L, name);
+    pushString(this->L, options.ci.server);
+    lua_pushinteger(this->L, options.ci.port);
+    pushString(this->L, options.ci.user);
+    pushString(this->L, options.ci.passwd);
+    pushString(this->L, options.embed_dir);
+    this->call("connect", 6, 0);
+
+    this->backend =
+        std::unique_ptr<Connect>(new Connect(options.ci.server,
+                                             options.ci.user,
+                                             options.ci.passwd,
+                                             options.ci.port));
+    std::unique_ptr<DBResult> dbres;
+    TEST_TextMessageError(this->backend->execute("SELECT CONNECTION_ID()",
+                                                 &dbres),
+                          "can not get the backend connection id: "
+                          + this->backend->getError());
+    const MYSQL_ROW row = mysql_fetch_row(dbres->n);
+    TEST_TextMessageError(row && row[0], "no backend connection id");
+    this->thread_id = row[0];
+}
+
+LuaClient::~LuaClient()
+{
+    // CryptDB.disconnect() ends the thread's use of the client library
+    this->backend.reset();
+    this->pushFunction("disconnect");
+    pushString(this->L, this->name);
+    lua_pcall(this->L, 1, 0, 0);
+    lua_close(this->L);
+}
+
+void
+LuaClient::pushFunction(const std::string &function)
+{
+    lua_getfield(this->L, LUA_GLOBALSINDEX, "CryptDB");
+    lua_getfield(this->L, -1, function.c_str());
+    lua_remove(this->L, -2);
+}
+
+// the results start at index 1
+void
+LuaClient::call(const std::string &function, int args, int results)
+{
+    assert(args + 1 == lua_gettop(this->L));
+    if (0 != lua_pcall(this->L, args, results, 0)) {
+        const std::string message = luaString(this->L, -1);
+        lua_settop(this->L, 0);
+        FAIL_TextMessageError("CryptDB." + function + " failed: "
+                              + message);
+    }
+}
+
+// the fields, rows, affected rows and insert id that CryptDB.next() takes
+// after the query it asked for
+void
+LuaClient::pushResults(const DBResult *const dbres, bool rows)
+{
+    lua_newtable(this->L);
+    const int fields_index = lua_gettop(this->L);
+    lua_newtable(this->L);
+    const int rows_index = lua_gettop(this->L);
+    if (nullptr == dbres) {
+        lua_pushnil(this->L);
+        lua_pushnil(this->L);
+        return;
+    }
+
+    DBResult_native *const n = dbres->n;
+    if (rows && n) {
+        const unsigned int count = mysql_num_fields(n);
+        const MYSQL_FIELD *const fields = mysql_fetch_fields(n);
+        for (unsigned int i = 0; i < count; ++i) {
+            lua_createtable(this->L, 0, 2);
+            lua_pushstring(this->L, fields[i].name);
+            lua_setfield(this->L, -2, "name");
+            lua_pushinteger(this->L, fields[i].type);
+            lua_setfield(this->L, -2, "type");
+            lua_rawseti(this->L, fields_index, i + 1);
+        }
+
+        mysql_data_seek(n, 0);
+        int row_number = 0;
+        MYSQL_ROW row;
+        while ((row = mysql_fetch_row(n))) {
+            const unsigned long *const lengths = mysql_fetch_lengths(n);
+            lua_createtable(this->L, count, 0);
+            // a NULL is a hole in the row, as mysql-proxy leaves it
+            for (unsigned int j = 0; j < count; ++j) {
+                if (row[j]) {
+                    lua_pushlstring(this->L, row[j], lengths[j]);
+                    lua_rawseti(this->L, -2, j + 1);
+                }
+            }
+            lua_rawseti(this->L, rows_index, ++row_number);
+        }
+    }
+
+    lua_pushinteger(this->L, dbres->getAffectedRows());
+    lua_pushinteger(this->L, dbres->getInsertId());
+}
+
+static void
+readBackendResults(const DBResult &dbres, ClientResult *const out)
+{
+    out->affected_rows = dbres.getAffectedRows();
+    out->insert_id = dbres.getInsertId();
+    DBResult_native *const n = dbres.n;
+    if (nullptr == n) {
+        return;
+    }
+
+    const unsigned int count = mysql_num_fields(n);
+    const MYSQL_FIELD *const fields = mysql_fetch_fields(n);
+    for (unsigned int i = 0; i < count; ++i) {
+        out->names.push_back(fields[i].name);
+    }
+
+    mysql_data_seek(n, 0);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(n))) {
+        const unsigned long *const lengths = mysql_fetch_lengths(n);
+        std::vector<std::string> values;
+        for (unsigned int j = 0; j < count; ++j) {
+            values.push_back(row[j] ? std::string(row[j], lengths[j])
+                                    : std::string());
+        }
+        out->rows.push_back(std::move(values));
+    }
+}
+
+static void
+readLuaResults(lua_State *const L, int fields_index, int rows_index,
+               ClientResult *const out)
+{
+    const size_t field_count = lua_objlen(L, fields_index);
+    for (size_t i = 1; i <= field_count; ++i) {
+        lua_rawgeti(L, fields_index, i);
+        lua_getfield(L, -1, "name");
+        out->names.push_back(luaString(L, -1));
+        lua_pop(L, 2);
+    }
+
+    const size_t row_count = lua_objlen(L, rows_index);
+    for (size_t i = 1; i <= row_count; ++i) {
+        lua_rawgeti(L, rows_index, i);
+        std::vector<std::string> values;
+        for (size_t j = 1; j <= field_count; ++j) {
+            lua_rawgeti(L, -1, j);
+            values.push_back(luaString(L, -1));
+            lua_pop(L, 1);
+        }
+        out->rows.push_back(std::move(values));
+        lua_pop(L, 1);
+    }
+}
+
+// what wrapper.lua does for a query from the client
+bool
+LuaClient::query(const std::string &q, ClientResult *const out)
+{
+    *out = ClientResult();
+
+    this->pushFunction("rewrite");
+    pushString(this->L, this->name);
+    pushString(this->L, q);
+    pushString(this->L, this->thread_id);
+    this->call("rewrite", 3, 2);
+    const bool rewritten = lua_toboolean(this->L, 1);
+    if (false == rewritten) {
+        out->error = luaString(this->L, 2);
+        lua_settop(this->L, 0);
+        return false;
+    }
+    lua_settop(this->L, 0);
+
+    // the backend's answer to the last query the proxy asked for
+    std::unique_ptr<DBResult> dbres;
+    bool status = true;
+    bool interim = false;
+    while (true) {
+        this->pushFunction("next");
+        pushString(this->L, this->name);
+        this->pushResults(dbres.get(), interim);
+        lua_pushboolean(this->L, status);
+        this->call("next", 6, 5);
+
+        const std::string control = luaString(this->L, 1);
+        if ("again" == control) {
+            interim = lua_toboolean(this->L, 2);
+            const std::string next_query = luaString(this->L, 3);
+            lua_settop(this->L, 0);
+            status = this->backend->execute(next_query, &dbres);
+        } else if ("query-results" == control) {
+            const std::string next_query = luaString(this->L, 2);
+            lua_settop(this->L, 0);
+            if (false == this->backend->execute(next_query, &dbres)) {
+                out->error = this->backend->getError();
+                return false;
+            }
+            readBackendResults(*dbres, out);
+            return true;
+        } else if ("results" == control) {
+            out->affected_rows = lua_tointeger(this->L, 2);
+            out->insert_id = lua_tointeger(this->L, 3);
+            readLuaResults(this->L, 4, 5, out);
+            lua_settop(this->L, 0);
+            return true;
+        } else {
+            assert("error" == control);
+            out->error = luaString(this->L, 2);
+            lua_settop(this->L, 0);
+            return false;
+        }
+    }
+}
+
+ClientResult
+LuaClient::query(const std::string &q)
+{
+    ClientResult res;
+    TEST_TextMessageError(this->query(q, &res),
+                          "'" + q + "' failed: " + res.error);
+    return res;
+}
+
+void
+InsertBatch::add(const std::string &row)
+{
+    this->values += (this->values.empty() ? "" : ", ") + row;
+    if (++this->count >= load_batch) {
+        this->flush();
+    }
+}
+
+void
+InsertBatch::flush()
+{
+    if (0 == this->count) {
+        return;
+    }
+
+    this->c->query("INSERT INTO " + this->table + " VALUES "
+                   + this->values);
+    this->values.clear();
+    this->count = 0;
+}
+
+static int64_t
+randomNumber(PRNG *const r, int64_t low, int64_t high)
+{
+    assert(low <= high);
+    return low + r->rand<uint32_t>() % (high - low + 1);
+}
+
+// TPC-C's non-uniform random numbers, without the run-time constant
+static int64_t
+nonUniform(PRNG *const r, int64_t a, int64_t low, int64_t high)
+{
+    return ((randomNumber(r, 0, a) | randomNumber(r, low, high))
+            % (high - low + 1)) + low;
+}
+
+static std::string
+randomString(PRNG *const r, unsigned int low, unsigned int high)
+{
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz";
+    std::string out(randomNumber(r, low, high), ' ');
+    for (char &c : out) {
+        c = letters[randomNumber(r, 0, sizeof(letters) - 2)];
+    }
+    return out;
+}
+
+static std::string
+randomDigits(PRNG *const r, unsigned int length)
+{
+    std::string out(length, ' ');
+    for (char &c : out) {
+        c = '0' + randomNumber(r, 0, 9);
+    }
+    return out;
+}
+
+// TPC-C's customer last names: a syllable for each digit of @n
+static std::string
+lastName(unsigned int n)
+{
+    static const char *const syllables[] = {
+        "BAR", "OUGHT", "ABLE", "PRI", "PRES",
+        "ESE", "ANTI", "CALLY", "ATION", "EING",
+    };
+    return std::string(syllables[n / 100 % 10]) + syllables[n / 10 % 10]
+           + syllables[n % 10];
+}
+
+static std::string
+quote(const std::string &s)
+{
+    return "'" + s + "'";
+}
+
+static std::string
+row(const std::vector<std::string> &values)
+{
+    std::string out;
+    for (const std::string &value : values) {
+        out += (out.empty() ? "(" : ", ") + value;
+    }
+    return out + ")";
+}
+
+static std::string
+num(int64_t n)
+{
+    return std::to_string(n);
+}
+
+static int64_t
+number(const std::string &s)
+{
+    return strtoll(s.c_str(), NULL, 10);
+}
+
+static const std::vector<std::string> &
+firstRow(const ClientResult &res, const std::string &what)
+{
+    TEST_TextMessageError(false == res.rows.empty(), "no " + what);
+    return res.rows.front();
+}
+
+static void
+runSchema(LuaClient *const c, const std::string &path)
+{
+    std::ifstream file(path);
+    TEST_TextMessageError(file.is_open(), "can not open " + path);
+
+    std::string statement;
+    while (std::getline(file, statement, ';')) {
+        if (std::string::npos
+            != statement.find_first_not_of(" \t\r\n")) {
+            c->query(statement);
+        }
+    }
+}
+
+Tpcc::Tpcc(const TpccOptions &options)
+    : options(options), start(std::chrono::steady_clock::now()),
+      stopping(false)
+{
+    for (int i = 0; i < static_cast<int>(tpcc_txn::txn_count); ++i) {
+        this->committed[i] = 0;
+        this->failed[i] = 0;
+    }
+}
+
+void
+Tpcc::load()
+{
+    const std::string &db = this->options.db;
+    const unsigned int orders = this->options.customers;
+    // as in TPC-C the newest 30% of the orders are not delivered yet
+    const unsigned int delivered = orders * 7 / 10;
+
+    LuaClient c("tpcc-load", this->options);
+    streamrng<arc4> rand("cryptdbtpcc-load");
+    PRNG *const r = &rand;
+
+    c.query("DROP DATABASE IF EXISTS " + db);
+    c.query("CREATE DATABASE " + db);
+    c.query("USE " + db);
+    runSchema(&c, this->options.schema);
+
+    InsertBatch item(&c, "item");
+    for (unsigned int i_id = 1; i_id <= this->options.items; ++i_id) {
+        item.add(row({num(i_id), quote(randomString(r, 14, 24)),
+                      num(randomNumber(r, 100, 10000)),
+                      quote(randomString(r, 26, 50)),
+                      num(randomNumber(r, 1, 10000))}));
+    }
+    item.flush();
+
+    for (unsigned int w_id = 1; w_id <= this->options.warehouses;
+         ++w_id) {
+        c.query("INSERT INTO warehouse VALUES "
+                + row({num(w_id), num(30000000),
+                       num(randomNumber(r, 0, 2000)),
+                       quote(randomString(r, 6, 10)),
+                       quote(randomString(r, 10, 20)),
+                       quote(randomString(r, 10, 20)),
+                       quote(randomString(r, 10, 20)),
+                       quote(randomString(r, 2, 2)),
+                       quote(randomDigits(r, 9))}));
+
+        InsertBatch stock(&c, "stock");
+        for (unsigned int i_id = 1; i_id <= this->options.items; ++i_id) {
+            std::vector<std::string> values{
+                num(w_id), num(i_id), num(randomNumber(r, 10, 100)),
+                num(0), num(0), num(0), quote(randomString(r, 26, 50))};
+            for (unsigned int dist = 0; dist < 10; ++dist) {
+                values.push_back(quote(randomString(r, 24, 24)));
+            }
+            stock.add(row(values));
+        }
+        stock.flush();
+
+        for (unsigned int d_id = 1; d_id <= districts_per_warehouse;
+             ++d_id) {
+            c.query("INSERT INTO district VALUES "
+                    + row({num(w_id), num(d_id), num(3000000),
+                           num(randomNumber(r, 0, 2000)), num(orders + 1),
+                           quote(randomString(r, 6, 10)),
+                           quote(randomString(r, 10, 20)),
+                           quote(randomString(r, 10, 20)),
+                           quote(randomString(r, 10, 20)),
+                           quote(randomString(r, 2, 2)),
+                           quote(randomDigits(r, 9))}));
+
+            InsertBatch customer(&c, "customer");
+            InsertBatch history(&c, "history");
+            for (unsigned int c_id = 1; c_id <= this->options.customers;
+                 ++c_id) {
+                const unsigned int name =
+                    c_id <= 1000
+                        ? c_id - 1
+                        : static_cast<unsigned int>(nonUniform(r, 255, 0,
+                                                               999));
+                customer.add(row({num(w_id), num(d_id), num(c_id),
+                                  num(randomNumber(r, 0, 5000)),
+                                  quote(randomNumber(r, 0, 9) ? "GC"
+                                                              : "BC"),
+                                  quote(lastName(name)),
+                                  quote(randomString(r, 8, 16)),
+                                  num(5000000), num(0), num(1000), num(1),
+                                  num(0), quote(randomString(r, 10, 20)),
+                                  quote(randomString(r, 10, 20)),
+                                  quote(randomString(r, 10, 20)),
+                                  quote(randomString(r, 2, 2)),
+                                  quote(randomDigits(r, 9)),
+                                  quote(randomDigits(r, 16)), entry_date,
+                                  quote("OE"),
+                                  quote(randomString(r, 50, 100))}));
+                history.add(row({num(c_id), num(d_id), num(w_id),
+                                 num(d_id), num(w_id), entry_date,
+                                 num(1000),
+                                 quote(randomString(r, 12, 24))}));
+            }
+            customer.flush();
+            history.flush();
+
+            // customer n placed order n
+            InsertBatch oorder(&c, "oorder");
+            InsertBatch new_order(&c, "new_order");
+            InsertBatch order_line(&c, "order_line");
+            for (unsigned int o_id = 1; o_id <= orders; ++o_id) {
+                const bool done = o_id <= delivered;
+                const unsigned int ol_cnt = randomNumber(r, 5, 15);
+                oorder.add(row({num(w_id), num(d_id), num(o_id),
+                                num(o_id),
+                                done ? num(randomNumber(r, 1, 10))
+                                     : "NULL",
+                                num(ol_cnt), num(1), entry_date}));
+                if (false == done) {
+                    new_order.add(row({num(w_id), num(d_id), num(o_id)}));
+                }
+                for (unsigned int ol_number = 1; ol_number <= ol_cnt;
+                     ++ol_number) {
+                    order_line.add(row({num(w_id), num(d_id), num(o_id),
+                                        num(ol_number),
+                                        num(randomNumber(r, 1,
+                                                this->options.items)),
+                                        done ? entry_date : "NULL",
+                                        num(done ? 0
+                                                 : randomNumber(r, 1,
+                                                                999999)),
+                                        num(w_id), num(5),
+                                        quote(randomString(r, 24, 24))}));
+                }
+            }
+            oorder.flush();
+            new_order.flush();
+            order_line.flush();
+        }
+    }
+}
+
+double
+Tpcc::elapsed() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                         - this->start).count();
+}
+
+bool
+Tpcc::migrated() const
+{
+    return 0 == this->options.migrate_at
+           || this->elapsed() >= this->options.migrate_at;
+}
+
+tpcc_txn
+Tpcc::pick(PRNG *const r) const
+{
+    const int count = static_cast<int>(tpcc_txn::txn_count);
+    const int stock_level = static_cast<int>(tpcc_txn::stock_level);
+    const bool all = this->migrated();
+
+    unsigned int total = 0;
+    for (int i = 0; i < count; ++i) {
+        if (all || stock_level != i) {
+            total += txn_weights[i];
+        }
+    }
+
+    unsigned int x = randomNumber(r, 0, total - 1);
+    int i = 0;
+    for (; i < count - 1; ++i) {
+        if (false == all && stock_level == i) {
+            continue;
+        }
+        if (x < txn_weights[i]) {
+            break;
+        }
+        x -= txn_weights[i];
+    }
+    return static_cast<tpcc_txn>(i);
+}
+
+// TPC-C picks 60% of the customers of Payment and OrderStatus by last
+// name, then the middle one of those by first name
+static unsigned int
+pickCustomer(LuaClient *const c, PRNG *const r, unsigned int customers,
+             unsigned int w_id, unsigned int d_id)
+{
+    const unsigned int most = std::max(1u, customers);
+    if (randomNumber(r, 1, 100) > 60) {
+        return nonUniform(r, 1023, 1, most);
+    }
+
+    const std::string last =
+        lastName(nonUniform(r, 255, 0, std::min(999u, most - 1)));
+    ClientResult res =
+        c->query("SELECT c_id, c_first FROM customer WHERE c_w_id = "
+                 + num(w_id) + " AND c_d_id = " + num(d_id)
+                 + " AND c_last = " + quote(last));
+    firstRow(res, "customer named " + last);
+    std::sort(res.rows.begin(), res.rows.end(),
+              [] (const std::vector<std::string> &a,
+                  const std::vector<std::string> &b) {
+                  return a[1] < b[1];
+              });
+    return number(res.rows[(res.rows.size() - 1) / 2][0]);
+}
+
+void
+Tpcc::newOrder(LuaClient *const c, PRNG *const r, unsigned int w_id)
+{
+    const unsigned int d_id = randomNumber(r, 1, districts_per_warehouse);
+    const unsigned int c_id =
+        nonUniform(r, 1023, 1, std::max(1u, this->options.customers));
+    const unsigned int ol_cnt = randomNumber(r, 5, 15);
+    const std::string warehouse = num(w_id);
+    const std::string district = num(d_id);
+
+    firstRow(c->query("SELECT c_discount, c_last, c_credit FROM customer"
+                      " WHERE c_w_id = " + warehouse + " AND c_d_id = "
+                      + district + " AND c_id = " + num(c_id)),
+             "customer");
+    firstRow(c->query("SELECT w_tax FROM warehouse WHERE w_id = "
+                      + warehouse),
+             "warehouse");
+    const std::string o_id =
+        firstRow(c->query("SELECT d_next_o_id, d_tax FROM district"
+                          " WHERE d_w_id = " + warehouse
+                          + " AND d_id = " + district),
+                 "district")[0];
+    c->query("UPDATE district SET d_next_o_id = d_next_o_id + 1"
+             " WHERE d_w_id = " + warehouse + " AND d_id = " + district);
+    c->query("INSERT INTO oorder VALUES "
+             + row({warehouse, district, o_id, num(c_id), "NULL",
+                    num(ol_cnt), num(1), entry_date}));
+    c->query("INSERT INTO new_order VALUES "
+             + row({warehouse, district, o_id}));
+
+    std::string lines;
+    for (unsigned int ol_number = 1; ol_number <= ol_cnt; ++ol_number) {
+        const std::string i_id =
+            num(nonUniform(r, 8191, 1,
+                           std::max(1u, this->options.items)));
+        const int64_t quantity = randomNumber(r, 1, 10);
+        const int64_t price =
+            number(firstRow(c->query("SELECT i_price, i_name, i_data"
+                                     " FROM item WHERE i_id = " + i_id),
+                            "item")[0]);
+        const std::vector<std::string> stock =
+            firstRow(c->query("SELECT s_quantity, s_data, s_dist_"
+                              + std::string(d_id < 10 ? "0" : "")
+                              + district + " FROM stock WHERE s_i_id = "
+                              + i_id + " AND s_w_id = " + warehouse),
+                     "stock");
+        int64_t left = number(stock[0]) - quantity;
+        if (left < 10) {
+            left += 91;
+        }
+        c->query("UPDATE stock SET s_quantity = " + num(left)
+                 + ", s_ytd = s_ytd + " + num(quantity)
+                 + ", s_order_cnt = s_order_cnt + 1 WHERE s_i_id = "
+                 + i_id + " AND s_w_id = " + warehouse);
+        lines += (lines.empty() ? "" : ", ")
+                 + row({warehouse, district, o_id, num(ol_number), i_id,
+                        "NULL", num(quantity * price), warehouse,
+                        num(quantity), quote(stock[2])});
+    }
+    c->query("INSERT INTO order_line VALUES " + lines);
+}
+
+void
+Tpcc::payment(LuaClient *const c, PRNG *const r, unsigned int w_id)
+{
+    const unsigned int d_id = randomNumber(r, 1, districts_per_warehouse);
+    const std::string amount = num(randomNumber(r, 100, 500000));
+    const std::string warehouse = num(w_id);
+    const std::string district = num(d_id);
+    const std::string c_id =
+        num(pickCustomer(c, r, this->options.customers, w_id, d_id));
+
+    c->query("UPDATE warehouse SET w_ytd = w_ytd + " + amount
+             + " WHERE w_id = " + warehouse);
+    const std::string w_name =
+        firstRow(c->query("SELECT w_name, w_street_1, w_street_2, w_city,"
+                          " w_state, w_zip FROM warehouse WHERE w_id = "
+                          + warehouse),
+                 "warehouse")[0];
+    c->query("UPDATE district SET d_ytd = d_ytd + " + amount
+             + " WHERE d_w_id = " + warehouse + " AND d_id = " + district);
+    const std::string d_name =
+        firstRow(c->query("SELECT d_name, d_street_1, d_street_2, d_city,"
+                          " d_state, d_zip FROM district WHERE d_w_id = "
+                          + warehouse + " AND d_id = " + district),
+                 "district")[0];
+    // the new balance comes from the client, as in BenchmarkSQL
+    const int64_t balance =
+        number(firstRow(c->query("SELECT c_balance, c_first, c_middle,"
+                                 " c_last, c_credit FROM customer"
+                                 " WHERE c_w_id = " + warehouse
+                                 + " AND c_d_id = " + district
+                                 + " AND c_id = " + c_id),
+                        "customer")[0]);
+    c->query("UPDATE customer SET c_balance = "
+             + num(balance - number(amount))
+             + ", c_ytd_payment = c_ytd_payment + " + amount
+             + ", c_payment_cnt = c_payment_cnt + 1 WHERE c_w_id = "
+             + warehouse + " AND c_d_id = " + district + " AND c_id = "
+             + c_id);
+    c->query("INSERT INTO history VALUES "
+             + row({c_id, district, warehouse, district, warehouse,
+                    entry_date, amount, quote(w_name + "    " + d_name)}));
+}
+
+void
+Tpcc::orderStatus(LuaClient *const c, PRNG *const r, unsigned int w_id)
+{
+    const unsigned int d_id = randomNumber(r, 1, districts_per_warehouse);
+    const std::string warehouse = num(w_id);
+    const std::string district = num(d_id);
+    const std::string c_id =
+        num(pickCustomer(c, r, this->options.customers, w_id, d_id));
+
+    firstRow(c->query("SELECT c_balance, c_first, c_middle, c_last"
+                      " FROM customer WHERE c_w_id = " + warehouse
+                      + " AND c_d_id = " + district + " AND c_id = "
+                      + c_id),
+             "customer");
+    const ClientResult order =
+        c->query("SELECT o_id, o_carrier_id, o_entry_d FROM oorder"
+                 " WHERE o_w_id = " + warehouse + " AND o_d_id = "
+                 + district + " AND o_c_id = " + c_id
+                 + " ORDER BY o_id DESC LIMIT 1");
+    if (order.rows.empty()) {
+        return;
+    }
+    c->query("SELECT ol_i_id, ol_supply_w_id, ol_quantity, ol_amount,"
+             " ol_delivery_d FROM order_line WHERE ol_o_id = "
+             + order.rows[0][0] + " AND ol_d_id = " + district
+             + " AND ol_w_id = " + warehouse);
+}
+
+void
+Tpcc::delivery(LuaClient *const c, PRNG *const r, unsigned int w_id)
+{
+    const std::string carrier = num(randomNumber(r, 1, 10));
+    const std::string warehouse = num(w_id);
+    for (unsigned int d_id = 1; d_id <= districts_per_warehouse; ++d_id) {
+        const std::string district = num(d_id);
+        const ClientResult oldest =
+            c->query("SELECT no_o_id FROM new_order WHERE no_d_id = "
+                     + district + " AND no_w_id = " + warehouse
+                     + " ORDER BY no_o_id ASC LIMIT 1");
+        if (oldest.rows.empty()) {
+            continue;
+        }
+        const std::string o_id = oldest.rows[0][0];
+        const std::string order = " WHERE o_id = " + o_id
+                                  + " AND o_d_id = " + district
+                                  + " AND o_w_id = " + warehouse;
+        const std::string lines = " WHERE ol_o_id = " + o_id
+                                  + " AND ol_d_id = " + district
+                                  + " AND ol_w_id = " + warehouse;
+        // another terminal delivered it first
+        if (0 == c->query("DELETE FROM new_order WHERE no_o_id = " + o_id
+                          + " AND no_d_id = " + district
+                          + " AND no_w_id = " + warehouse).affected_rows) {
+            continue;
+        }
+        const std::string c_id =
+            firstRow(c->query("SELECT o_c_id FROM oorder" + order),
+                     "order")[0];
+        c->query("UPDATE oorder SET o_carrier_id = " + carrier + order);
+        c->query("UPDATE order_line SET ol_delivery_d = " + entry_date
+                 + lines);
+        const int64_t total =
+            number(firstRow(c->query("SELECT SUM(ol_amount)"
+                                     " FROM order_line" + lines),
+                            "order lines")[0]);
+        c->query("UPDATE customer SET c_balance = c_balance + "
+                 + num(total)
+                 + ", c_delivery_cnt = c_delivery_cnt + 1"
+                 " WHERE c_w_id = " + warehouse + " AND c_d_id = "
+                 + district + " AND c_id = " + c_id);
+    }
+}
+
+void
+Tpcc::stockLevel(LuaClient *const c, PRNG *const r, unsigned int w_id)
+{
+    const unsigned int d_id = randomNumber(r, 1, districts_per_warehouse);
+    const std::string threshold = num(randomNumber(r, 10, 20));
+    const std::string warehouse = num(w_id);
+    const int64_t next =
+        number(firstRow(c->query("SELECT d_next_o_id FROM district"
+                                 " WHERE d_w_id = " + warehouse
+                                 + " AND d_id = " + num(d_id)),
+                        "district")[0]);
+    // the range and the join are what need the OPE and JOIN onions
+    c->query("SELECT COUNT(DISTINCT s_i_id) FROM order_line, stock"
+             " WHERE ol_w_id = " + warehouse + " AND ol_d_id = "
+             + num(d_id) + " AND ol_o_id < " + num(next)
+             + " AND ol_o_id >= " + num(next - 20) + " AND s_w_id = "
+             + warehouse + " AND s_i_id = ol_i_id AND s_quantity < "
+             + threshold);
+}
+
+void
+Tpcc::terminal(unsigned int index)
+{
+    const unsigned int w_id = index % this->options.warehouses + 1;
+    streamrng<arc4> rand("cryptdbtpcc" + std::to_string(index));
+
+    std::unique_ptr<LuaClient> c;
+    try {
+        c = std::unique_ptr<LuaClient>(
+                new LuaClient("tpcc-" + std::to_string(index),
+                              this->options));
+        c->query("USE " + this->options.db);
+    } catch (const AbstractException &e) {
+        std::cerr << "terminal " << index << ": " << e.to_string()
+                  << std::endl;
+        return;
+    } catch (const std::runtime_error &e) {
+        std::cerr << "terminal " << index << ": " << e.what()
+                  << std::endl;
+        return;
+    }
+
+    bool reported = false;
+    while (false == this->stopping) {
+        const tpcc_txn txn = this->pick(&rand);
+        const int i = static_cast<int>(txn);
+        const uint64_t begin = latencyClock();
+        try {
+            switch (txn) {
+            case tpcc_txn::new_order:
+                this->newOrder(c.get(), &rand, w_id);
+                break;
+            case tpcc_txn::payment:
+                this->payment(c.get(), &rand, w_id);
+                break;
+            case tpcc_txn::order_status:
+                this->orderStatus(c.get(), &rand, w_id);
+                break;
+            case tpcc_txn::delivery:
+                this->delivery(c.get(), &rand, w_id);
+                break;
+            case tpcc_txn::stock_level:
+                this->stockLevel(c.get(), &rand, w_id);
+                break;
+            case tpcc_txn::txn_count:
+                assert(false);
+            }
+            this->latency[i].record(latencyClock() - begin);
+            this->committed[i] += 1;
+        } catch (const AbstractException &e) {
+            this->failed[i] += 1;
+            // the first failure only; the others show up in the counts
+            if (false == reported) {
+                std::cerr << "terminal " << index << ": " << txn_names[i]
+                          << ": " << e.to_string() << std::endl;
+                reported = true;
+            }
+        }
+    }
+}
+
+void
+Tpcc::run()
+{
+    const int count = static_cast<int>(tpcc_txn::txn_count);
+    const unsigned int interval = std::max(1u, this->options.interval);
+
+    this->start = std::chrono::steady_clock::now();
+    std::vector<std::thread> terminals;
+    for (unsigned int i = 0; i < this->options.terminals; ++i) {
+        terminals.push_back(std::thread(&Tpcc::terminal, this, i));
+    }
+
+    std::cout << "elapsed_s";
+    for (int i = 0; i < count; ++i) {
+        std::cout << "," << txn_names[i];
+    }
+    std::cout << ",failed,tps,tpmC" << std::endl;
+
+    std::vector<uint64_t> last(count, 0);
+    uint64_t last_failed = 0;
+    const int new_order = static_cast<int>(tpcc_txn::new_order);
+    bool announced = 0 == this->options.migrate_at;
+    for (unsigned int tick = 1; tick * interval <= this->options.seconds;
+         ++tick) {
+        std::this_thread::sleep_until(this->start
+                                      + std::chrono::seconds(tick
+                                                             * interval));
+        if (false == announced && this->migrated()) {
+            std::cerr << "stock_level joins the mix at "
+                      << static_cast<unsigned int>(this->elapsed()) << "s"
+                      << std::endl;
+            announced = true;
+        }
+
+        uint64_t total = 0;
+        uint64_t failures = 0;
+        const uint64_t new_orders =
+            this->committed[new_order] - last[new_order];
+        std::cout << tick * interval;
+        for (int i = 0; i < count; ++i) {
+            const uint64_t now = this->committed[i];
+            std::cout << "," << now - last[i];
+            total += now - last[i];
+            failures += this->failed[i];
+            last[i] = now;
+        }
+        std::cout << "," << failures - last_failed << std::fixed
+                  << std::setprecision(1) << ","
+                  << static_cast<double>(total) / interval << ","
+                  << 60.0 * new_orders / interval;
+        std::cout << std::endl;
+        last_failed = failures;
+    }
+
+    this->stopping = true;
+    for (std::thread &t : terminals) {
+        t.join();
+    }
+
+    std::cerr << "transaction,committed,failed,mean_ms,p50_ms,p99_ms,max_ms"
+              << std::endl;
+    for (int i = 0; i < count; ++i) {
+        const LatencyHistogram &h = this->latency[i];
+        const uint64_t n = std::max<uint64_t>(1, h.count());
+        std::cerr << txn_names[i] << "," << this->committed[i] << ","
+                  << this->failed[i] << std::fixed << std::setprecision(2)
+                  << "," << h.sum() / n / 1e6 << ","
+                  << h.percentile(0.5) / 1e6 << ","
+                  << h.percentile(0.99) / 1e6 << "," << h.max() / 1e6
+                  << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int c, optind = 0;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"password", required_argument, 0, 'p'},
+        {"user", required_argument, 0, 'u'},
+        {"host", required_argument, 0, 'H'},
+        {"port", required_argument, 0, 'P'},
+        {"embedded", required_argument, 0, 'e'},
+        {"schema", required_argument, 0, 's'},
+        {"database", required_argument, 0, 'd'},
+        {"warehouses", required_argument, 0, 'w'},
+        {"items", required_argument, 0, 'I'},
+        {"customers", required_argument, 0, 'c'},
+        {"noload", no_argument, 0, 'n'},
+        {"terminals", required_argument, 0, 't'},
+        {"seconds", required_argument, 0, 'T'},
+        {"interval", required_argument, 0, 'i'},
+        {"migrate-at", required_argument, 0, 'm'},
+        {NULL, 0, 0, 0},
+    };
+
+    std::string username("root");
+    std::string password("letmein");
+    std::string host("127.0.0.1");
+    uint port = 3306;
+    TpccOptions options{ConnectionInfo(), "/var/lib/shadow-mysql",
+                        "eval/tpcc/sqlTableCreates", "tpcc", 1, 4, 60, 5,
+                        0, 1000, 30, true};
+
+    while(1)
+    {
+        c = getopt_long(argc, argv, "hp:u:H:P:e:s:d:w:I:c:nt:T:i:m:",
+                        long_options, &optind);
+        if(c == -1)
+            break;
+
+        switch(c)
+        {
+            case 'h':
+                do_display_help(argv[0]);
+            case 'p':
+                password = optarg;
+                break;
+            case 'u':
+                username = optarg;
+                break;
+            case 'H':
+                host = optarg;
+                break;
+            case 'P':
+                port = atoi(optarg);
+                break;
+            case 'e':
+                options.embed_dir = optarg;
+                break;
+            case 's':
+                options.schema = optarg;
+                break;
+            case 'd':
+                options.db = optarg;
+                break;
+            case 'w':
+                options.warehouses = std::max(1, atoi(optarg));
+                break;
+            case 'I':
+                options.items = std::max(1, atoi(optarg));
+                break;
+            case 'c':
+                options.customers = std::max(1, atoi(optarg));
+                break;
+            case 'n':
+                options.load = false;
+                break;
+            case 't':
+                options.terminals = std::max(1, atoi(optarg));
+                break;
+            case 'T':
+                options.seconds = std::max(0, atoi(optarg));
+                break;
+            case 'i':
+                options.interval = std::max(1, atoi(optarg));
+                break;
+            case 'm':
+                options.migrate_at = std::max(0, atoi(optarg));
+                break;
+            case '?':
+                break;
+            default:
+                break;
+
+        }
+    }
+
+    options.ci = ConnectionInfo(host, username, password, port);
+    Tpcc tpcc(options);
+    if (options.load) {
+        try {
+            tpcc.load();
+        } catch (const AbstractException &e) {
+            std::cerr << "load failed: " << e.to_string() << std::endl;
+            return 1;
+        } catch (const std::runtime_error &e) {
+            std::cerr << "load failed: " << e.what() << std::endl;
+            return 1;
+        }
+        std::cerr << "loaded " << options.warehouses << " warehouses"
+                  << std::endl;
+    }
+
+    tpcc.run();
+    return 0;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+/*
+ * cryptdbtpcc.hh
+ *
+ *  A TPC-C like load generator that needs neither mysql-proxy nor the
+ *  BenchmarkSQL setup in eval/bench.  Every terminal thread owns a Lua
+ *  state with the CryptDB table of libexecute.so and a connection to the
+ *  backend MySQL, and runs its statements the way wrapper.lua does:
+ *  CryptDB.rewrite(), then CryptDB.next() until it has the results,
+ *  sending whatever the proxy asks for to the backend in between.
+ *
+ *  The tables are those of eval/tpcc/sqlTableCreates, loaded through the
+ *  proxy at a reduced scale.  The terminals run the five transactions in
+ *  the usual mix (as single statements under autocommit) for --seconds
+ *  and the committed transactions are reported every --interval.
+ *  --migrate-at keeps StockLevel, whose range and join need onions the
+ *  other transactions never peel, out of the mix until then, so the
+ *  onion adjustments happen in the middle of the run like the migration
+ *  of eval/bench/README.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <lua5.1/lua.hpp>
+
+#include <crypto/prng.hh>
+#include <main/Analysis.hh>
+#include <main/Connect.hh>
+#include <util/latency.hh>
+
+extern "C" int lua_cryptdb_init(lua_State *L);
+
+namespace {
+
+#define TPCC_TRANSACTIONS(m)                                    \
+    m(new_order, 45)                                            \
+    m(payment, 43)                                              \
+    m(order_status, 4)                                          \
+    m(delivery, 4)                                              \
+    m(stock_level, 4)
+
+enum class tpcc_txn {
+#define TPCC_TXN_ENUM(name, weight) name,
+    TPCC_TRANSACTIONS(TPCC_TXN_ENUM)
+#undef TPCC_TXN_ENUM
+    txn_count
+};
+
+struct TpccOptions {
+    ConnectionInfo ci;
+    std::string embed_dir;
+    std::string schema;
+    std::string db;
+    unsigned int warehouses;
+    unsigned int terminals;
+    unsigned int seconds;
+    unsigned int interval;
+    // StockLevel joins the mix after this many seconds
+    unsigned int migrate_at;
+    unsigned int items;
+    // customers and orders per district
+    unsigned int customers;
+    bool load;
+};
+
+// what the proxy returned to the client; NULLs are empty strings
+struct ClientResult {
+    ClientResult() : affected_rows(0), insert_id(0) {}
+
+    uint64_t affected_rows;
+    uint64_t insert_id;
+    std::vector<std::string> names;
+    std::vector<std::vector<std::string> > rows;
+    std::string error;
+};
+
+// a client of the proxy, driving it through the CryptDB Lua table; only
+// for the thread that created it
+class LuaClient {
+public:
+    LuaClient(const std::string &name, const TpccOptions &options);
+    ~LuaClient();
+
+    // false with @out->error set if the statement failed
+    bool query(const std::string &q, ClientResult *const out);
+    // throws if the statement failed
+    ClientResult query(const std::string &q);
+
+private:
+    LuaClient(const LuaClient &other);
+    LuaClient &operator=(const LuaClient &rhs);
+
+    void pushFunction(const std::string &function);
+    void call(const std::string &function, int args, int results);
+    void pushResults(const DBResult *const dbres, bool rows);
+
+    const std::string name;
+    lua_State *const L;
+    std::unique_ptr<Connect> backend;
+    // of the backend connection, for the default database
+    std::string thread_id;
+};
+
+// gathers the rows of the load into multi-row INSERTs
+class InsertBatch {
+public:
+    InsertBatch(LuaClient *const c, const std::string &table)
+        : c(c), table(table), count(0) {}
+
+    // @row is "(value, ...)"
+    void add(const std::string &row);
+    void flush();
+
+private:
+    LuaClient *const c;
+    const std::string table;
+    std::string values;
+    unsigned int count;
+};
+
+class Tpcc {
+public:
+    explicit Tpcc(const TpccOptions &options);
+
+    void load();
+    // the terminals for --seconds, reporting every --interval
+    void run();
+
+private:
+    Tpcc(const Tpcc &other);
+    Tpcc &operator=(const Tpcc &rhs);
+
+    void terminal(unsigned int index);
+    tpcc_txn pick(PRNG *const r) const;
+    bool migrated() const;
+    double elapsed() const;
+
+    void newOrder(LuaClient *const c, PRNG *const r,
+                  unsigned int w_id);
+    void payment(LuaClient *const c, PRNG *const r,
+                 unsigned int w_id);
+    void orderStatus(LuaClient *const c, PRNG *const r,
+                     unsigned int w_id);
+    void delivery(LuaClient *const c, PRNG *const r,
+                  unsigned int w_id);
+    void stockLevel(LuaClient *const c, PRNG *const r,
+                    unsigned int w_id);
+
+    const TpccOptions options;
+    std::chrono::steady_clock::time_point start;
+    std::atomic<bool> stopping;
+    std::atomic<uint64_t> committed[static_cast<int>(tpcc_txn::txn_count)];
+    std::atomic<uint64_t> failed[static_cast<int>(tpcc_txn::txn_count)];
+    LatencyHistogram latency[static_cast<int>(tpcc_txn::txn_count)];
+};
+
+}
@@ -11,6 +11,7 @@
 
 #include <crypto/BasicCrypto.hh>
 #include <crypto/blowfish.hh>
+#include <crypto/fpe.hh>
 #include <crypto/SWPSearch.hh>
 #include <crypto/paillier.hh>
 #include <util/params.hh>
@@ -30,6 +31,7 @@ typedef long long longlong;
 my_bool   cryptdb_decrypt_int_sem_init(UDF_INIT *const initid,
                                        UDF_ARGS *const args,
                                        char *const message);
+void      cryptdb_decrypt_int_sem_deinit(UDF_INIT *const initid);
 ulonglong cryptdb_decrypt_int_sem(UDF_INIT *const initid,
                                   UDF_ARGS *const args,
                                   char *const is_null, char *const error);
@@ -37,9 +39,26 @@ ulonglong cryptdb_decrypt_int_sem(UDF_INIT *const initid,
 my_bool   cryptdb_decrypt_int_det_init(UDF_INIT *const initid,
                                        UDF_ARGS *const args,
                                        char *const message);
+void      cryptdb_decrypt_int_det_deinit(UDF_INIT *const initid);
 ulonglong cryptdb_decrypt_int_det(UDF_INIT *const initid, UDF_ARGS *const args,
                                   char *const is_null, char *const error);
 
+my_bool   cryptdb_decrypt_int_fp_sem_init(UDF_INIT *const initid,
+                                          UDF_ARGS *const args,
+                                          char *const message);
+void      cryptdb_decrypt_int_fp_sem_deinit(UDF_INIT *const initid);
+ulonglong cryptdb_decrypt_int_fp_sem(UDF_INIT *const initid,
+                                     UDF_ARGS *const args,
+                                     char *const is_null, char *const error);
+
+my_bool   cryptdb_decrypt_int_fp_det_init(UDF_INIT *const initid,
+                                          UDF_ARGS *const args,
+                                          char *const message);
+void      cryptdb_decrypt_int_fp_det_deinit(UDF_INIT *const initid);
+ulonglong cryptdb_decrypt_int_fp_det(UDF_INIT *const initid,
+                                     UDF_ARGS *const args,
+                                     char *const is_null, char *const error);
+
 my_bool   cryptdb_decrypt_text_sem_init(UDF_INIT *const initid,
                                         UDF_ARGS *const args, char *const message);
 void      cryptdb_decrypt_text_sem_deinit(UDF_INIT *const initid);
@@ -55,6 +74,22 @@ char *    cryptdb_decrypt_text_det(UDF_INIT *const initid, UDF_ARGS *const args,
                                    char *const result, unsigned long *const length,
                                    char *const is_null, char *const error);
 
+my_bool   cryptdb_decrypt_text_ctr_init(UDF_INIT *const initid,
+                                        UDF_ARGS *const args,
+                                        char *const message);
+void      cryptdb_decrypt_text_ctr_deinit(UDF_INIT *const initid);
+char *    cryptdb_decrypt_text_ctr(UDF_INIT *const initid, UDF_ARGS *const args,
+                                   char *const result, unsigned long *const length,
+                                   char *const is_null, char *const error);
+
+my_bool   cryptdb_decrypt_text_lp_init(UDF_INIT *const initid,
+                                       UDF_ARGS *const args,
+                                       char *const message);
+void      cryptdb_decrypt_text_lp_deinit(UDF_INIT *const initid);
+char *    cryptdb_decrypt_text_lp(UDF_INIT *const initid, UDF_ARGS *const args,
+                                  char *const result, unsigned long *const length,
+                                  char *const is_null, char *const error);
+
 my_bool   cryptdb_searchSWP_init(UDF_INIT *const initid, UDF_ARGS *const args,
                                  char *const message);
 void      cryptdb_searchSWP_deinit(UDF_INIT *const initid);
@@ -156,6 +191,41 @@ getba(UDF_ARGS *const args, int i, uint64_t &len)
     return args->args[i];
 }
 
+/*
+ * BF_set_key costs about as much as 500 block encryptions, so the integer
+ * decryption UDFs keep the key schedule in initid->ptr for the whole
+ * statement and only rebuild it when the key argument changes.
+ */
+struct BlowfishCache {
+    std::string key;
+    std::unique_ptr<const blowfish> bf;
+};
+
+static const blowfish &
+getCachedBlowfish(UDF_INIT *const initid, UDF_ARGS *const args, int i)
+{
+    uint64_t keyLen;
+    char *const keyBytes = getba(args, i, keyLen);
+
+    BlowfishCache *const cache =
+        reinterpret_cast<BlowfishCache *>(initid->ptr);
+    assert(cache);
+    if (!cache->bf || cache->key.size() != keyLen
+        || memcmp(cache->key.data(), keyBytes, keyLen)) {
+        cache->key = std::string(keyBytes, keyLen);
+        cache->bf.reset(new blowfish(cache->key));
+    }
+
+    return *cache->bf;
+}
+
+static void
+deleteBlowfishCache(UDF_INIT *const initid)
+{
+    delete reinterpret_cast<BlowfishCache *>(initid->ptr);
+    initid->ptr = NULL;
+}
+
 my_bool
 cryptdb_decrypt_int_sem_init(UDF_INIT *const initid, UDF_ARGS *const args,
                              char *const message)
@@ -170,9 +240,16 @@ cryptdb_decrypt_int_sem_init(UDF_INIT *const initid, UDF_ARGS *const args,
     }
 
     initid->maybe_null = 1;
+    initid->ptr = reinterpret_cast<char *>(new BlowfishCache());
     return 0;
 }
 
+void
+cryptdb_decrypt_int_sem_deinit(UDF_INIT *const initid)
+{
+    deleteBlowfishCache(initid);
+}
+
 ulonglong
 cryptdb_decrypt_int_sem(UDF_INIT *const initid, UDF_ARGS *const args,
                         char *const is_null, char *const error)
@@ -184,15 +261,12 @@ cryptdb_decrypt_int_sem(UDF_INIT *const initid, UDF_ARGS *const args,
     } else {
         try {
             const uint64_t eValue = getui(args, 0);
-
-            uint64_t keyLen;
-            char *const keyBytes = getba(args, 1, keyLen);
-            const std::string key = std::string(keyBytes, keyLen);
-
+            const blowfish &bf = getCachedBlowfish(initid, args, 1);
             const uint64_t salt = getui(args, 2);
 
-            blowfish bf(key);
-            value = bf.decrypt(eValue) ^ salt;
+            uint64_t dec;
+            bf.decrypt_batch(&eValue, &dec, 1, &salt);
+            value = dec;
         } catch (const CryptoError &e) {
             std::cerr << e.msg << std::endl;
             value = 0;
@@ -220,9 +294,16 @@ cryptdb_decrypt_int_det_init(UDF_INIT *const initid, UDF_ARGS *const args,
     }
 
     initid->maybe_null = 1;
+    initid->ptr = reinterpret_cast<char *>(new BlowfishCache());
     return 0;
 }
 
+void
+cryptdb_decrypt_int_det_deinit(UDF_INIT *const initid)
+{
+    deleteBlowfishCache(initid);
+}
+
 ulonglong
 cryptdb_decrypt_int_det(UDF_INIT *const initid, UDF_ARGS *const args,
                         char *const is_null, char *const error)
@@ -234,13 +315,162 @@ cryptdb_decrypt_int_det(UDF_INIT *const initid, UDF_ARGS *const args,
     } else {
         try {
             const uint64_t eValue = getui(args, 0);
+            const blowfish &bf = getCachedBlowfish(initid, args, 1);
+            value = bf.decrypt(eValue);
+        } catch (const CryptoError &e) {
+            std::cerr << e.msg << std::endl;
+            value = 0;
+        }
+    }
 
-            uint64_t keyLen;
-            char *const keyBytes = getba(args, 1, keyLen);
-            const std::string key = std::string(keyBytes, keyLen);
+    return static_cast<ulonglong>(value.get());
+}
 
-            blowfish bf(key);
-            value = bf.decrypt(eValue);
+
+// same idea as BlowfishCache, for the format preserving layers
+struct FPECache {
+    std::string key;
+    uint64_t bits;
+    std::unique_ptr<const fpe_int> fpe;
+};
+
+static const fpe_int &
+getCachedFPE(UDF_INIT *const initid, UDF_ARGS *const args, int key_i,
+             int bits_i)
+{
+    uint64_t keyLen;
+    char *const keyBytes = getba(args, key_i, keyLen);
+    const uint64_t bits = getui(args, bits_i);
+
+    FPECache *const cache = reinterpret_cast<FPECache *>(initid->ptr);
+    assert(cache);
+    if (!cache->fpe || cache->bits != bits || cache->key.size() != keyLen
+        || memcmp(cache->key.data(), keyBytes, keyLen)) {
+        cache->key = std::string(keyBytes, keyLen);
+        cache->bits = bits;
+        cache->fpe.reset(new fpe_int(cache->key, bits));
+    }
+
+    return *cache->fpe;
+}
+
+static void
+deleteFPECache(UDF_INIT *const initid)
+{
+    delete reinterpret_cast<FPECache *>(initid->ptr);
+    initid->ptr = NULL;
+}
+
+// and for fpe_str, whose two AES key schedules and FFX setup cost more
+// than deciphering a short string; the result is handed back from here
+struct FPEStrCache {
+    std::string key;
+    std::unique_ptr<const fpe_str> fpe;
+    std::string value;
+};
+
+static const fpe_str &
+getCachedFPEStr(UDF_INIT *const initid, UDF_ARGS *const args, int key_i)
+{
+    uint64_t keyLen;
+    char *const keyBytes = getba(args, key_i, keyLen);
+
+    FPEStrCache *const cache = reinterpret_cast<FPEStrCache *>(initid->ptr);
+    assert(cache);
+    if (!cache->fpe || cache->key.size() != keyLen
+        || memcmp(cache->key.data(), keyBytes, keyLen)) {
+        cache->key = std::string(keyBytes, keyLen);
+        cache->fpe.reset(new fpe_str(cache->key));
+    }
+
+    return *cache->fpe;
+}
+
+my_bool
+cryptdb_decrypt_int_fp_sem_init(UDF_INIT *const initid, UDF_ARGS *const args,
+                                char *const message)
+{
+    if (args->arg_count != 4 ||
+        args->arg_type[0] != INT_RESULT ||
+        args->arg_type[1] != STRING_RESULT ||
+        args->arg_type[2] != INT_RESULT ||
+        args->arg_type[3] != INT_RESULT)
+    {
+        strcpy(message, "Usage: cryptdb_decrypt_int_fp_sem(int ciphertext, string key, int salt, int bits)");
+        return 1;
+    }
+
+    initid->maybe_null = 1;
+    initid->ptr = reinterpret_cast<char *>(new FPECache());
+    return 0;
+}
+
+void
+cryptdb_decrypt_int_fp_sem_deinit(UDF_INIT *const initid)
+{
+    deleteFPECache(initid);
+}
+
+ulonglong
+cryptdb_decrypt_int_fp_sem(UDF_INIT *const initid, UDF_ARGS *const args,
+                           char *const is_null, char *const error)
+{
+    AssignFirst<uint64_t> value;
+    if (NULL == args->args[0]) {
+        value = 0;
+        *is_null = 1;
+    } else {
+        try {
+            const uint64_t eValue = getui(args, 0);
+            const fpe_int &fpe = getCachedFPE(initid, args, 1, 3);
+            const uint64_t salt = getui(args, 2);
+            value = fpe.decrypt(eValue, salt);
+        } catch (const CryptoError &e) {
+            std::cerr << e.msg << std::endl;
+            value = 0;
+        }
+    }
+
+    return static_cast<ulonglong>(value.get());
+}
+
+my_bool
+cryptdb_decrypt_int_fp_det_init(UDF_INIT *const initid, UDF_ARGS *const args,
+                                char *const message)
+{
+    if (args->arg_count != 3 ||
+        args->arg_type[0] != INT_RESULT ||
+        args->arg_type[1] != STRING_RESULT ||
+        args->arg_type[2] != INT_RESULT)
+    {
+        strcpy(message, "Usage: cryptdb_decrypt_int_fp_det(int ciphertext, string key, int bits)");
+        return 1;
+    }
+
+    initid->maybe_null = 1;
+    initid->ptr = reinterpret_cast<char *>(new FPECache());
+    return 0;
+}
+
+void
+cryptdb_decrypt_int_fp_det_deinit(UDF_INIT *const initid)
+{
+    deleteFPECache(initid);
+}
+
+ulonglong
+cryptdb_decrypt_int_fp_det(UDF_INIT *const initid, UDF_ARGS *const args,
+                           char *const is_null, char *const error)
+{
+    AssignFirst<uint64_t> value;
+    if (NULL == args->args[0]) {
+        value = 0;
+        *is_null = 1;
+    } else {
+        try {
+            const uint64_t eValue = getui(args, 0);
+            const fpe_int &fpe = getCachedFPE(initid, args, 1, 2);
+            value = fpe.decrypt(eValue);
         } catch (const CryptoError &e) {
             std::cerr << e.msg << std::endl;
             value = 0;
@@ -384,6 +614,129 @@ cryptdb_decrypt_text_det(UDF_INIT *const initid, UDF_ARGS *const args,
     return initid->ptr;
 }
 
+/*
+ * The compact string layers.  RND_str_ctr hands the result back in
+ * initid->ptr, which is replaced (not leaked) on every row; DET_str_lp
+ * keeps it in its FPEStrCache.
+ */
+static char *
+textResult(UDF_INIT *const initid, const std::string &value,
+           unsigned long *const length)
+{
+    delete[] initid->ptr;
+    initid->ptr = new char[value.length()];
+    memcpy(initid->ptr, value.data(), value.length());
+    *length = value.length();
+    return initid->ptr;
+}
+
+my_bool
+cryptdb_decrypt_text_ctr_init(UDF_INIT *const initid, UDF_ARGS *const args,
+                              char *const message)
+{
+    if (args->arg_count != 3 ||
+        args->arg_type[0] != STRING_RESULT ||
+        args->arg_type[1] != STRING_RESULT ||
+        args->arg_type[2] != INT_RESULT)
+    {
+        strcpy(message, "Usage: cryptdb_decrypt_text_ctr(string ciphertext, string key, int salt)");
+        return 1;
+    }
+
+    initid->maybe_null = 1;
+    return 0;
+}
+
+void
+cryptdb_decrypt_text_ctr_deinit(UDF_INIT *const initid)
+{
+    delete[] initid->ptr;
+}
+
+char *
+cryptdb_decrypt_text_ctr(UDF_INIT *const initid, UDF_ARGS *const args,
+                         char *const result, unsigned long *const length,
+                         char *const is_null, char *const error)
+{
+    AssignFirst<std::string> value;
+    if (NULL == args->args[0]) {
+        value = "";
+        *is_null = 1;
+    } else {
+        try {
+            uint64_t eValueLen;
+            char *const eValueBytes = getba(args, 0, eValueLen);
+
+            uint64_t keyLen;
+            char *const keyBytes = getba(args, 1, keyLen);
+            const std::string key = std::string(keyBytes, keyLen);
+
+            const uint64_t salt = getui(args, 2);
+
+            const std::unique_ptr<AES_KEY> aesKey(get_AES_enc_key(key));
+            value =
+                decrypt_AES_CTR(std::string(eValueBytes, eValueLen),
+                                aesKey.get(),
+                                BytesFromInt(salt, SALT_LEN_BYTES));
+        } catch (const CryptoError &e) {
+            std::cerr << e.msg << std::endl;
+            value = "";
+        }
+    }
+
+    return textResult(initid, value.get(), length);
+}
+
+my_bool
+cryptdb_decrypt_text_lp_init(UDF_INIT *const initid, UDF_ARGS *const args,
+                             char *const message)
+{
+    if (args->arg_count != 2 ||
+        args->arg_type[0] != STRING_RESULT ||
+        args->arg_type[1] != STRING_RESULT)
+    {
+        strcpy(message, "Usage: cryptdb_decrypt_text_lp(string ciphertext, string key)");
+        return 1;
+    }
+
+    initid->maybe_null = 1;
+    initid->ptr = reinterpret_cast<char *>(new FPEStrCache());
+    return 0;
+}
+
+void
+cryptdb_decrypt_text_lp_deinit(UDF_INIT *const initid)
+{
+    delete reinterpret_cast<FPEStrCache *>(initid->ptr);
+    initid->ptr = NULL;
+}
+
+char *
+cryptdb_decrypt_text_lp(UDF_INIT *const initid, UDF_ARGS *const args,
+                        char *const result, unsigned long *const length,
+                        char *const is_null, char *const error)
+{
+    FPEStrCache *const cache = reinterpret_cast<FPEStrCache *>(initid->ptr);
+    cache->value.clear();
+    if (NULL == args->args[0]) {
+        *is_null = 1;
+    } else {
+        try {
+            uint64_t eValueLen;
+            char *const eValueBytes = getba(args, 0, eValueLen);
+
+            const fpe_str &fpe = getCachedFPEStr(initid, args, 1);
+            cache->value = fpe.decrypt(std::string(eValueBytes, eValueLen));
+        } catch (const CryptoError &e) {
+            std::cerr << e.msg << std::endl;
+            cache->value.clear();
+        }
+    }
+
+    *length = cache->value.length();
+    return cache->value.empty() ? result : &cache->value[0];
+}
+
 /*
  * given field of the form:   len1 word1 len2 word2 len3 word3 ...,
  * where each len is the length of the following "word",
@@ -528,8 +881,7 @@ cryptdb_agg(UDF_INIT *const initid, UDF_ARGS *const args, char *const result,
     return static_cast<char *>(as->rbuf);
 }
 
-// for update with increment
-// > UNUSED
+// for UPDATE t SET c = c + k on HOM counters, see HOM::sumUDF
 
 my_bool
 cryptdb_func_add_set_init(UDF_INIT *const initid, UDF_ARGS *const args,
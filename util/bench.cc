@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cmath>
+
+#include <util/bench.hh>
+#include <util/latency.hh>
+
+static const uint64_t max_iterations = 1000000000;
+
+// two-sided 95% quantiles of Student's t, by degrees of freedom
+static const double t95[] = {
+    0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+    2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+    2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+    2.042
+};
+
+BenchStats
+benchStats(std::vector<double> times)
+{
+    BenchStats out = BenchStats();
+    out.samples = times.size();
+    if (times.empty()) {
+        return out;
+    }
+
+    std::sort(times.begin(), times.end());
+    const size_t n = times.size();
+    out.median = n % 2 ? times[n / 2]
+                       : (times[n / 2 - 1] + times[n / 2]) / 2;
+    out.min = times.front();
+    out.max = times.back();
+
+    double sum = 0;
+    for (const double t : times) {
+        sum += t;
+    }
+    out.mean = sum / n;
+    if (n < 2) {
+        return out;
+    }
+
+    double squares = 0;
+    for (const double t : times) {
+        squares += (t - out.mean) * (t - out.mean);
+    }
+    out.stddev = std::sqrt(squares / (n - 1));
+    const size_t df = n - 1;
+    const double t = df < sizeof(t95) / sizeof(*t95) ? t95[df] : 1.960;
+    out.ci95 = t * out.stddev / std::sqrt(static_cast<double>(n));
+
+    return out;
+}
+
+BenchSuite::BenchSuite(const BenchConfig &config, std::ostream &out)
+    : config(config), out(out)
+{
+    this->out << "name,params,bytes,samples,iterations,median_ns,mean_ns,"
+                 "stddev_ns,min_ns,max_ns,ci95_ns,mb_per_sec"
+              << std::endl;
+}
+
+bool
+BenchSuite::wanted(const std::string &name, const std::string &params) const
+{
+    return (name + "/" + params).find(this->config.filter)
+        != std::string::npos;
+}
+
+uint64_t
+BenchSuite::calibrate(const Body &body) const
+{
+    const double target = this->config.target_msec * 1000000.0;
+    uint64_t iterations = 1;
+    while (true) {
+        const uint64_t start = latencyClock();
+        body(iterations);
+        const uint64_t elapsed = latencyClock() - start;
+        if (elapsed >= target / 10 || iterations >= max_iterations) {
+            const double per_op =
+                std::max(static_cast<double>(elapsed) / iterations, 1.0);
+            return std::min(std::max(static_cast<uint64_t>(target / per_op),
+                                     uint64_t(1)),
+                            max_iterations);
+        }
+        iterations *= 10;
+    }
+}
+
+void
+BenchSuite::run(const std::string &name, const std::string &params,
+                uint64_t bytes, const Body &body)
+{
+    if (false == this->wanted(name, params)) {
+        return;
+    }
+
+    const uint64_t iterations = this->calibrate(body);
+    std::vector<double> times;
+    for (unsigned int s = 0; s < this->config.samples; ++s) {
+        const uint64_t start = latencyClock();
+        body(iterations);
+        times.push_back(static_cast<double>(latencyClock() - start)
+                        / iterations);
+    }
+
+    BenchStats stats = benchStats(times);
+    stats.name = name;
+    stats.params = params;
+    stats.bytes = bytes;
+    stats.iterations = iterations;
+
+    // bytes per nanosecond is GB/s
+    const double mb_per_sec =
+        bytes && stats.median > 0 ? bytes * 1000.0 / stats.median : 0;
+    this->out << stats.name << "," << stats.params << "," << stats.bytes
+              << "," << stats.samples << "," << stats.iterations << ","
+              << stats.median << "," << stats.mean << "," << stats.stddev
+              << "," << stats.min << "," << stats.max << "," << stats.ci95
+              << "," << mb_per_sec << std::endl;
+    this->stats.push_back(stats);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+ * bench.hh
+ *
+ *  A harness for repeatable microbenchmarks.  A benchmark body runs its
+ *  operation a given number of times; the harness calibrates that number
+ *  so one sample takes about target_msec (the calibration runs double as
+ *  a warm-up), then takes the samples and reports nanoseconds per
+ *  operation: median, mean, standard deviation, min, max and the
+ *  half-width of the 95% confidence interval of the mean (Student's t).
+ *
+ *  Every benchmark is one CSV row under a fixed header, keyed by name and
+ *  parameters (neither may hold a comma), so the output of two commits
+ *  can be diffed or joined.
+ */
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+struct BenchConfig {
+    BenchConfig() : samples(15), target_msec(20) {}
+
+    unsigned int samples;
+    uint64_t target_msec;
+    // only benchmarks whose "name/params" contain it run
+    std::string filter;
+};
+
+struct BenchStats {
+    std::string name;
+    std::string params;
+    // the operation's input, for throughput; 0 if that means nothing
+    uint64_t bytes;
+    unsigned int samples;
+    uint64_t iterations;
+    // nanoseconds per operation
+    double median;
+    double mean;
+    double stddev;
+    double min;
+    double max;
+    double ci95;
+};
+
+// the mean, median, ... of per-operation @times
+BenchStats benchStats(std::vector<double> times);
+
+// keeps the compiler from dropping the computation of @value
+template<class T>
+inline void
+benchKeep(const T &value)
+{
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+class BenchSuite {
+public:
+    // a body runs the operation this many times
+    typedef std::function<void (uint64_t)> Body;
+
+    BenchSuite(const BenchConfig &config, std::ostream &out);
+
+    bool wanted(const std::string &name, const std::string &params) const;
+    // measures @body unless the filter leaves it out, and prints its row
+    void run(const std::string &name, const std::string &params,
+             uint64_t bytes, const Body &body);
+
+    const std::vector<BenchStats> &results() const {return stats;}
+
+private:
+    uint64_t calibrate(const Body &body) const;
+
+    const BenchConfig config;
+    std::ostream &out;
+    std::vector<BenchStats> stats;
+};
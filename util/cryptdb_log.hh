@@ -5,6 +5,16 @@
 #include <map>
 #include <string>
 
+/*
+ * LOG(g) << ... only formats its arguments, or evaluates them, when group
+ * g is enabled: the check is a branch on enable_mask.  Groups outside
+ * CRYPTDB_LOG_COMPILED (a mask of log_group bits, all of them unless the
+ * build says otherwise) are not compiled in at all.
+ */
+#ifndef CRYPTDB_LOG_COMPILED
+#define CRYPTDB_LOG_COMPILED (~0ULL)
+#endif
+
 #define LOG_GROUPS(m)       \
     m(warn)                 \
     m(debug)                \
@@ -74,10 +84,11 @@ class cryptdb_logger : public std::stringstream {
     static bool
     enabled(log_group g)
     {
-        return enable_mask & mask(g);
+        return (CRYPTDB_LOG_COMPILED & mask(g))
+               && __builtin_expect(!!(enable_mask & mask(g)), 0);
     }
 
-    static uint64_t
+    static constexpr uint64_t
     mask(log_group g)
     {
         return 1ULL << ((int) g);
@@ -108,6 +119,15 @@ class cryptdb_logger : public std::stringstream {
 
 };
 
-#define LOG(g) \
-    (cryptdb_logger(log_group::log_ ## g, __FILE__, __LINE__, __func__))
+// turns LOG(g) << ... into a void expression, so that it can sit in the
+// branch of a ?: that skips it
+class cryptdb_log_voidify {
+ public:
+    void operator&(const std::ostream &) {}
+};
+
+#define LOG(g)                                                          \
+    !cryptdb_logger::enabled(log_group::log_ ## g) ? (void) 0           \
+        : cryptdb_log_voidify() &                                       \
+          cryptdb_logger(log_group::log_ ## g, __FILE__, __LINE__, __func__)
 
@@ -0,0 +1,184 @@
+#include <time.h>
+#include <algorithm>
+#include <cmath>
+
+#include <util/latency.hh>
+#include <util/trace.hh>
+
+static const char *const stage_names[] = {
+#define __temp_m(n) #n,
+LATENCY_STAGES(__temp_m)
+#undef __temp_m
+};
+
+static const char *const kind_names[] = {
+#define __temp_m(n) #n,
+STATEMENT_KINDS(__temp_m)
+#undef __temp_m
+};
+
+static LatencyHistogram
+    histograms[static_cast<int>(statement_kind::kind_count)]
+              [static_cast<int>(latency_stage::stage_count)];
+
+static __thread statement_kind current_kind = statement_kind::kind_other;
+static __thread StageTotals *current_totals = NULL;
+
+unsigned int
+LatencyHistogram::bucketOf(uint64_t nsec)
+{
+    if (nsec < sub_buckets) {
+        return nsec;
+    }
+
+    const unsigned int msb = 63 - __builtin_clzll(nsec);
+    const unsigned int shift = msb - sub_bits;
+    return (shift + 1) * sub_buckets + ((nsec >> shift) - sub_buckets);
+}
+
+uint64_t
+LatencyHistogram::bucketTop(unsigned int bucket)
+{
+    if (bucket < sub_buckets) {
+        return bucket;
+    }
+
+    const unsigned int shift = bucket / sub_buckets - 1;
+    const uint64_t mantissa = bucket % sub_buckets + sub_buckets;
+    // the last bucket ends at 2^64 - 1
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void
+LatencyHistogram::record(uint64_t nsec)
+{
+    counts[bucketOf(nsec)].fetch_add(1, std::memory_order_relaxed);
+    samples.fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(nsec, std::memory_order_relaxed);
+
+    uint64_t seen = largest.load(std::memory_order_relaxed);
+    while (nsec > seen
+           && false == largest.compare_exchange_weak(seen, nsec,
+                                                     std::memory_order_relaxed)) {
+    }
+}
+
+void
+LatencyHistogram::reset()
+{
+    for (auto &it : counts) {
+        it.store(0);
+    }
+    samples.store(0);
+    total.store(0);
+    largest.store(0);
+}
+
+uint64_t
+LatencyHistogram::percentile(double fraction) const
+{
+    // the buckets may be a little ahead of the sample count while
+    // another thread records
+    const uint64_t want =
+        std::max(static_cast<uint64_t>(std::ceil(fraction * count())),
+                 uint64_t(1));
+    uint64_t seen = 0;
+    for (unsigned int b = 0; b < buckets; ++b) {
+        seen += counts[b].load(std::memory_order_relaxed);
+        if (seen >= want) {
+            return std::min(bucketTop(b), max());
+        }
+    }
+
+    return max();
+}
+
+uint64_t
+latencyClock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+const char *
+latencyStageName(latency_stage stage)
+{
+    return stage_names[static_cast<int>(stage)];
+}
+
+const char *
+statementKindName(statement_kind kind)
+{
+    return kind_names[static_cast<int>(kind)];
+}
+
+void
+setStatementKind(statement_kind kind)
+{
+    current_kind = kind;
+}
+
+statement_kind
+currentStatementKind()
+{
+    return current_kind;
+}
+
+void
+setStageTotals(StageTotals *totals)
+{
+    current_totals = totals;
+}
+
+void
+recordLatencyNsec(latency_stage stage, uint64_t nsec)
+{
+    histograms[static_cast<int>(current_kind)][static_cast<int>(stage)]
+        .record(nsec);
+    if (current_totals) {
+        current_totals->nsec[static_cast<int>(stage)] += nsec;
+    }
+}
+
+void
+recordLatency(latency_stage stage, uint64_t start)
+{
+    const uint64_t now = latencyClock();
+    recordLatencyNsec(stage, now > start ? now - start : 0);
+    traceSpan("stage", latencyStageName(stage), start, now);
+}
+
+std::vector<LatencySummary>
+latencySummaries()
+{
+    std::vector<LatencySummary> out;
+    for (int k = 0; k < static_cast<int>(statement_kind::kind_count); ++k) {
+        for (int s = 0; s < static_cast<int>(latency_stage::stage_count);
+             ++s) {
+            const LatencyHistogram &h = histograms[k][s];
+            const uint64_t count = h.count();
+            if (0 == count) {
+                continue;
+            }
+
+            out.push_back(LatencySummary{kind_names[k], stage_names[s],
+                                         count, h.sum() / count,
+                                         h.percentile(0.5),
+                                         h.percentile(0.9),
+                                         h.percentile(0.99), h.max()});
+        }
+    }
+
+    return out;
+}
+
+void
+resetLatencies()
+{
+    for (auto &kind : histograms) {
+        for (auto &h : kind) {
+            h.reset();
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+/*
+ * latency.hh
+ *
+ *  Always-on latency histograms for the stages of the query pipeline,
+ *  by statement kind.  A histogram keeps 8 buckets per power of two of
+ *  nanoseconds, so its percentiles are within 12.5% of the truth, and
+ *  recording a sample is a few relaxed atomic adds.
+ *
+ *  The kind of the statement a thread is working on is thread local:
+ *  the rewriter sets it once the query is parsed, and whoever picks the
+ *  query up again (the Lua wrapper's next()) restores it.
+ */
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#define LATENCY_STAGES(m)   \
+    m(parse)                \
+    m(gather)               \
+    m(rewrite)              \
+    m(print)                \
+    m(default_db)           \
+    m(schema)               \
+    m(backend)              \
+    m(unpack)               \
+    m(decrypt)              \
+    m(lua)
+
+#define STATEMENT_KINDS(m)  \
+    m(select)               \
+    m(insert)               \
+    m(update)               \
+    m(delete)               \
+    m(ddl)                  \
+    m(set)                  \
+    m(other)
+
+enum class latency_stage {
+#define __temp_m(n) stage_ ## n,
+LATENCY_STAGES(__temp_m)
+#undef __temp_m
+    stage_count
+};
+
+enum class statement_kind {
+#define __temp_m(n) kind_ ## n,
+STATEMENT_KINDS(__temp_m)
+#undef __temp_m
+    kind_count
+};
+
+class LatencyHistogram {
+public:
+    LatencyHistogram() {reset();}
+
+    void record(uint64_t nsec);
+    void reset();
+
+    uint64_t count() const {return samples.load();}
+    uint64_t sum() const {return total.load();}
+    uint64_t max() const {return largest.load();}
+    // the smallest bucket bound that @fraction of the samples are under
+    uint64_t percentile(double fraction) const;
+
+private:
+    LatencyHistogram(const LatencyHistogram &);
+    LatencyHistogram &operator=(const LatencyHistogram &);
+
+    static const unsigned int sub_bits = 3;
+    static const unsigned int sub_buckets = 1 << sub_bits;
+    static const unsigned int buckets = (64 - sub_bits + 1) * sub_buckets;
+
+    static unsigned int bucketOf(uint64_t nsec);
+    static uint64_t bucketTop(unsigned int bucket);
+
+    std::atomic<uint64_t> counts[buckets];
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> largest;
+};
+
+// what one query spent in each stage
+struct StageTotals {
+    uint64_t nsec[static_cast<int>(latency_stage::stage_count)];
+};
+
+struct LatencySummary {
+    std::string kind;
+    std::string stage;
+    uint64_t count;
+    // nanoseconds
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+};
+
+// monotonic nanoseconds
+uint64_t latencyClock();
+
+const char *latencyStageName(latency_stage stage);
+const char *statementKindName(statement_kind kind);
+
+void setStatementKind(statement_kind kind);
+statement_kind currentStatementKind();
+
+// the samples the thread records are also added to @totals, until it is
+// set to NULL
+void setStageTotals(StageTotals *totals);
+
+// the time since @start, under the current statement kind
+void recordLatency(latency_stage stage, uint64_t start);
+void recordLatencyNsec(latency_stage stage, uint64_t nsec);
+
+// the histograms with samples, by kind then stage
+std::vector<LatencySummary> latencySummaries();
+void resetLatencies();
+
+class LatencyScope {
+public:
+    explicit LatencyScope(latency_stage stage)
+        : stage(stage), start(latencyClock()) {}
+    ~LatencyScope() {recordLatency(stage, start);}
+
+private:
+    LatencyScope(const LatencyScope &);
+    LatencyScope &operator=(const LatencyScope &);
+
+    const latency_stage stage;
+    const uint64_t start;
+};
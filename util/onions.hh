@@ -47,6 +47,11 @@ static onionlayout NUM_ONION_LAYOUT = {
     {oAGG, std::vector<SECLEVEL>({SECLEVEL::HOM})}
 };
 
+// see FieldMeta::determineOnionLayout
+static onionlayout HOM_ONION_LAYOUT = {
+    {oAGG, std::vector<SECLEVEL>({SECLEVEL::HOM})}
+};
+
 static onionlayout BEST_EFFORT_NUM_ONION_LAYOUT = {
     {oDET, std::vector<SECLEVEL>({SECLEVEL::DETJOIN, SECLEVEL::DET,
                                   SECLEVEL::RND})},
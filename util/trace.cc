@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+
+#include <util/trace.hh>
+#include <util/latency.hh>
+
+struct TraceSlot {
+    // the index of the span in it plus one, 0 while it is written
+    std::atomic<uint64_t> seq;
+    std::atomic<const char *> category;
+    std::atomic<const char *> name;
+    std::atomic<uint64_t> start;
+    std::atomic<uint64_t> duration;
+    std::atomic<uint64_t> tid;
+    std::atomic<uint64_t> query;
+};
+
+static uint64_t
+envCount(const char *const name, uint64_t dflt)
+{
+    const char *const s = getenv(name);
+    return s ? strtoull(s, NULL, 10) : dflt;
+}
+
+static uint64_t
+traceCapacity()
+{
+    static const uint64_t spans =
+        std::max(envCount("CRYPTDB_TRACE_SPANS", 65536), uint64_t(1));
+    return spans;
+}
+
+static TraceSlot *
+traceRing()
+{
+    static TraceSlot *const ring = new TraceSlot[traceCapacity()]();
+    return ring;
+}
+
+static std::atomic<uint64_t> next_span(0);
+static std::atomic<uint64_t> next_query(0);
+static __thread uint64_t current_query = 0;
+static __thread uint64_t thread_id = 0;
+
+uint64_t
+traceSample()
+{
+    static const uint64_t sample = envCount("CRYPTDB_TRACE_SAMPLE", 0);
+    return sample;
+}
+
+uint64_t
+traceQueryBegin()
+{
+    if (0 == traceSample()) {
+        return 0;
+    }
+
+    const uint64_t n = next_query.fetch_add(1, std::memory_order_relaxed);
+    return 0 == n % traceSample() ? n + 1 : 0;
+}
+
+void
+setTraceQuery(uint64_t id)
+{
+    current_query = id;
+}
+
+uint64_t
+currentTraceQuery()
+{
+    return current_query;
+}
+
+void
+traceSpan(const char *category, const char *name, uint64_t start,
+          uint64_t end)
+{
+    if (0 == current_query) {
+        return;
+    }
+    if (0 == thread_id) {
+        thread_id = syscall(SYS_gettid);
+    }
+
+    const uint64_t index = next_span.fetch_add(1, std::memory_order_relaxed);
+    TraceSlot &slot = traceRing()[index % traceCapacity()];
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.category.store(category, std::memory_order_relaxed);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(end > start ? end - start : 0,
+                        std::memory_order_relaxed);
+    slot.tid.store(thread_id, std::memory_order_relaxed);
+    slot.query.store(current_query, std::memory_order_relaxed);
+    slot.seq.store(index + 1, std::memory_order_release);
+}
+
+static void
+jsonString(std::ostream &out, const char *s)
+{
+    out << '"';
+    for (; *s; ++s) {
+        if ('"' == *s || '\\' == *s) {
+            out << '\\';
+        }
+        out << *s;
+    }
+    out << '"';
+}
+
+std::string
+traceJSON()
+{
+    std::ostringstream out;
+    out << "{\"traceEvents\": [";
+
+    const uint64_t end = next_span.load(std::memory_order_acquire);
+    const uint64_t begin = end > traceCapacity() ? end - traceCapacity() : 0;
+    bool first = true;
+    for (uint64_t index = begin; index < end; ++index) {
+        TraceSlot &slot = traceRing()[index % traceCapacity()];
+        if (index + 1 != slot.seq.load(std::memory_order_acquire)) {
+            continue;
+        }
+        const char *const category =
+            slot.category.load(std::memory_order_relaxed);
+        const char *const name = slot.name.load(std::memory_order_relaxed);
+        const uint64_t start = slot.start.load(std::memory_order_relaxed);
+        const uint64_t duration =
+            slot.duration.load(std::memory_order_relaxed);
+        const uint64_t tid = slot.tid.load(std::memory_order_relaxed);
+        const uint64_t query = slot.query.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // overwritten while we read it
+        if (index + 1 != slot.seq.load(std::memory_order_relaxed)) {
+            continue;
+        }
+
+        out << (first ? "" : ",") << "\n {\"name\": ";
+        jsonString(out, name);
+        out << ", \"cat\": ";
+        jsonString(out, category);
+        out << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid
+            << ", \"ts\": " << start / 1000 << "." << start / 100 % 10
+            << start / 10 % 10 << start % 10
+            << ", \"dur\": " << duration / 1000 << "."
+            << duration / 100 % 10 << duration / 10 % 10 << duration % 10
+            << ", \"args\": {\"query\": " << query << "}}";
+        first = false;
+    }
+
+    out << "\n], \"displayTimeUnit\": \"ns\"}\n";
+    return out.str();
+}
+
+TraceScope::TraceScope(const char *category, const char *name)
+    : category(category), name(name),
+      start(current_query ? latencyClock() : 0)
+{
+}
+
+TraceScope::~TraceScope()
+{
+    if (this->start) {
+        traceSpan(this->category, this->name, this->start, latencyClock());
+    }
+}
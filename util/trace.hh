@@ -0,0 +1,51 @@
+#pragma once
+
+/*
+ * trace.hh
+ *
+ *  Opt-in tracing of sampled queries as Chrome trace (Perfetto) JSON.
+ *  With CRYPTDB_TRACE_SAMPLE=N one query in N is traced (0, the default,
+ *  turns tracing off; 100 traces 1%).  The spans of a traced query (its
+ *  rewrite(), every next(), executor steps, embedded and remote
+ *  executes, and the latency stages of util/latency.hh) go into a ring
+ *  of the last CRYPTDB_TRACE_SPANS (65536) spans that writers fill
+ *  without locks; traceJSON() dumps what the ring holds.
+ *
+ *  Like the statement kind, the traced query is thread local: the
+ *  wrapper starts it in rewrite() and restores it in next().
+ */
+
+#include <string>
+
+#include <stdint.h>
+
+// 0 unless tracing is on
+uint64_t traceSample();
+
+// the id of the query the thread starts, if it is sampled, else 0
+uint64_t traceQueryBegin();
+void setTraceQuery(uint64_t id);
+uint64_t currentTraceQuery();
+
+// @name and @category must outlive the process (string literals);
+// nothing is recorded unless the thread's query is traced
+void traceSpan(const char *category, const char *name, uint64_t start,
+               uint64_t end);
+
+// {"traceEvents": [...]} with the spans in the ring, oldest first
+std::string traceJSON();
+
+class TraceScope {
+public:
+    TraceScope(const char *category, const char *name);
+    ~TraceScope();
+
+private:
+    TraceScope(const TraceScope &);
+    TraceScope &operator=(const TraceScope &);
+
+    const char *const category;
+    const char *const name;
+    // 0 if the query is not traced
+    const uint64_t start;
+};